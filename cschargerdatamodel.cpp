@@ -1,3 +1,4 @@
+#include <QBrush>
 #include <cschargerdatamodel.h>
 
 #ifndef BIT
@@ -57,6 +58,7 @@ CSChargerDataModel::CSChargerDataModel(QObject* parent)
     m_rowData[0xEDE6] = {"Low-temp Charge Current", QPair<float, QVariant>(1, 0)};
     m_rowData[0xEDE7] = {"Tail Current", QPair<float, QVariant>(1, 0)};
     m_rowData[0xEDE9] = {"Output Voltage (V)", QPair<float, QVariant>(1, 0)};
+    m_rowData[0xEDEC] = {"Battery Temperature (K)", QPair<float, QVariant>(1, 0)};
     m_rowData[0xEDF0] = {"Maximum Current (A)", QPair<float, QVariant>(1, 0)};
     m_rowData[0xEDF1] = {"Charging Preset", QPair<float, QVariant>(1, 0)};
     m_rowData[0xEDF2] = {"Temperature Compensation", QPair<float, QVariant>(1, 0)};
@@ -127,6 +129,13 @@ QVariant CSChargerDataModel::data(const QModelIndex& index, int role) const
             return QVariant::fromValue(sv);
             break;
         }
+        /* restored from snapshot, not yet confirmed by device */
+        case Qt::ForegroundRole: {
+            if (m_stale.contains(regid)) {
+                return QBrush(Qt::gray);
+            }
+            break;
+        }
         case Qt::DisplayRole: {
             switch (index.column()) {
                 case 0: {
@@ -234,3 +243,13 @@ void CSChargerDataModel::updateRegister(quint16 regid, const QPair<float, QVaria
 {
     m_rowData[regid].second = p;
 }
+
+void CSChargerDataModel::setStale(quint16 regid, bool stale)
+{
+    if (stale) {
+        m_stale.insert(regid);
+    }
+    else {
+        m_stale.remove(regid);
+    }
+}
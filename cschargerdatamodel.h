@@ -1,5 +1,6 @@
 #pragma once
 #include <QAbstractTableModel>
+#include <QSet>
 
 class CSChargerDataModel: public QAbstractTableModel
 {
@@ -17,9 +18,11 @@ public:
     quint16 toRegId(const QModelIndex& index) const;
 
     void updateRegister(quint16 regid, const QPair<float, QVariant>& p);
+    void setStale(quint16 regid, bool stale);
     void beginUpdate();
     void endUpdate();
 
 private:
     QMap<quint16, QPair<QString, QPair<float, QVariant>>> m_rowData;
+    QSet<quint16> m_stale;
 };
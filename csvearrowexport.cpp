@@ -0,0 +1,388 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QFileInfo>
+#include <QSet>
+#include <csvearrowexport.h>
+#include <csvehistorysync.h>
+#include <csverecordreader.h>
+#include <csveregisterstore.h>
+#include <csveseriesindex.h>
+#include <limits>
+
+/* phase times, charges and voltages of a cycle record */
+static const int CYCLE_TIMES = 6;
+static const int CYCLE_CHARGES = 5;
+static const int CYCLE_VOLTAGES = 2;
+static const int CYCLE_RAWS = CYCLE_TIMES + CYCLE_CHARGES + CYCLE_VOLTAGES;
+/* 0.1 Ah, 0.01 V */
+static const double CHARGE_SCALE = 0.1;
+static const double VOLTAGE_SCALE = 0.01;
+
+/* column buffers of one record batch, reused */
+typedef struct {
+    QVector<qint64> m_times;
+    QByteArray m_devices;
+    QVector<qint32> m_offsets;
+    QVector<quint16> m_regids;
+    QVector<qint64> m_raws;
+    QVector<qint8> m_exponents;
+    QVector<double> m_values;
+} TRecordBatch;
+
+typedef struct {
+    QByteArray m_serials;
+    QVector<qint32> m_offsets;
+    QVector<quint32> m_cycles;
+    QVector<quint8> m_versions;
+    QVector<quint32> m_raws[CYCLE_RAWS];
+    QVector<quint8> m_typeReasons;
+    QVector<quint8> m_errors;
+} TCycleBatch;
+
+/* values = raws * 10^exponent, one factor per run of an exponent */
+static void scale(const qint64* raws, const qint8* exponents, double* values, int rows)
+{
+    int i = 0;
+    while (i < rows) {
+        const qint8 exponent = exponents[i];
+        int end = i + 1;
+        while (end < rows && exponents[end] == exponent) {
+            end++;
+        }
+
+        CSVeRegisterStore::TSlot unit = {};
+        unit.m_type = CSVeRegisterStore::TypeS32;
+        unit.m_exponent = exponent;
+        unit.m_raw = 1;
+        const double factor = CSVeRegisterStore::toDouble(unit);
+        for (int k = i; k < end; k++) {
+            values[k] = raws[k] * factor;
+        }
+        i = end;
+    }
+}
+
+/* column with the charger's "not available" value as null */
+static CSVeArrowWriter::TColumn nullable(const void* values, const quint32* raws, int rows, quint32 unknown, QByteArray* bits)
+{
+    bits->fill('\0', (rows + 7) / 8);
+    CSVeArrowWriter::TColumn column = CSVeArrowWriter::column(values);
+    for (int i = 0; i < rows; i++) {
+        if (raws[i] == unknown) {
+            column.m_nulls++;
+        }
+        else {
+            CSVeArrowWriter::setValid(bits, i, true);
+        }
+    }
+    column.m_validity = (const uchar*) bits->constData();
+    return column;
+}
+
+static bool writeRecords(CSVeArrowWriter* writer, TRecordBatch* batch)
+{
+    const int rows = batch->m_times.count();
+    if (rows == 0) {
+        return true;
+    }
+
+    batch->m_values.resize(rows);
+    scale(batch->m_raws.constData(), batch->m_exponents.constData(), batch->m_values.data(), rows);
+
+    const QVector<CSVeArrowWriter::TColumn> columns = {
+       CSVeArrowWriter::column(batch->m_times.constData()),
+       CSVeArrowWriter::column(batch->m_devices.constData(), batch->m_offsets.constData()),
+       CSVeArrowWriter::column(batch->m_regids.constData()),
+       CSVeArrowWriter::column(batch->m_raws.constData()),
+       CSVeArrowWriter::column(batch->m_values.constData()),
+    };
+    if (!writer->writeBatch(rows, columns)) {
+        return false;
+    }
+
+    batch->m_times.resize(0);
+    batch->m_devices.resize(0);
+    batch->m_offsets.resize(1);
+    batch->m_regids.resize(0);
+    batch->m_raws.resize(0);
+    batch->m_exponents.resize(0);
+    return true;
+}
+
+static bool writeCycles(CSVeArrowWriter* writer, TCycleBatch* batch)
+{
+    const int rows = batch->m_cycles.count();
+    if (rows == 0) {
+        return true;
+    }
+
+    QVector<CSVeArrowWriter::TColumn> columns = {
+       CSVeArrowWriter::column(batch->m_serials.constData(), batch->m_offsets.constData()),
+       CSVeArrowWriter::column(batch->m_cycles.constData()),
+       CSVeArrowWriter::column(batch->m_versions.constData()),
+    };
+
+    QByteArray bits[CYCLE_RAWS + 1];
+    QVector<double> scaled[CYCLE_CHARGES + CYCLE_VOLTAGES];
+    for (int k = 0; k < CYCLE_RAWS; k++) {
+        const quint32* raws = batch->m_raws[k].constData();
+        if (k < CYCLE_TIMES) {
+            columns << nullable(raws, raws, rows, 0xFFFFFFFF, &bits[k]);
+            continue;
+        }
+
+        const bool charge = (k < CYCLE_TIMES + CYCLE_CHARGES);
+        const double factor = (charge ? CHARGE_SCALE : VOLTAGE_SCALE);
+        QVector<double>& values = scaled[k - CYCLE_TIMES];
+        values.resize(rows);
+        double* v = values.data();
+        for (int i = 0; i < rows; i++) {
+            v[i] = raws[i] * factor;
+        }
+        columns << nullable(v, raws, rows, (charge ? 0xFFFFFFFF : 0xFFFF), &bits[k]);
+    }
+
+    QVector<quint32> errors(rows);
+    for (int i = 0; i < rows; i++) {
+        errors[i] = batch->m_errors.at(i);
+    }
+    columns << CSVeArrowWriter::column(batch->m_typeReasons.constData());
+    columns << nullable(batch->m_errors.constData(), errors.constData(), rows, 0xFF, &bits[CYCLE_RAWS]);
+
+    if (!writer->writeBatch(rows, columns)) {
+        return false;
+    }
+
+    batch->m_serials.resize(0);
+    batch->m_offsets.resize(1);
+    batch->m_cycles.resize(0);
+    batch->m_versions.resize(0);
+    for (int k = 0; k < CYCLE_RAWS; k++) {
+        batch->m_raws[k].resize(0);
+    }
+    batch->m_typeReasons.resize(0);
+    batch->m_errors.resize(0);
+    return true;
+}
+
+CSVeArrowExport::CSVeArrowExport()
+    : m_from(std::numeric_limits<qint64>::min())
+    , m_to(std::numeric_limits<qint64>::max())
+    , m_device()
+    , m_regids()
+    , m_batchRows(DEFAULT_BATCH_ROWS)
+    , m_stats()
+{
+}
+
+QList<CSVeArrowWriter::TField> CSVeArrowExport::recordFields()
+{
+    return {
+       {"time", CSVeArrowWriter::TypeTimestamp, false},
+       {"device", CSVeArrowWriter::TypeUtf8, false},
+       {"regid", CSVeArrowWriter::TypeUInt16, false},
+       {"raw", CSVeArrowWriter::TypeInt64, false},
+       {"value", CSVeArrowWriter::TypeFloat64, false},
+    };
+}
+
+QList<CSVeArrowWriter::TField> CSVeArrowExport::cycleFields()
+{
+    static const char* const TIMES[CYCLE_TIMES] = {
+       "start_time",
+       "bulk_time",
+       "absorption_time",
+       "recondition_time",
+       "float_time",
+       "storage_time",
+    };
+    static const char* const CHARGES[CYCLE_CHARGES] = {
+       "bulk_charge",
+       "absorption_charge",
+       "recondition_charge",
+       "float_charge",
+       "storage_charge",
+    };
+
+    QList<CSVeArrowWriter::TField> fields = {
+       {"serial", CSVeArrowWriter::TypeUtf8, false},
+       {"cycle", CSVeArrowWriter::TypeUInt32, false},
+       {"version", CSVeArrowWriter::TypeUInt8, false},
+    };
+    for (int k = 0; k < CYCLE_TIMES; k++) {
+        fields.append({TIMES[k], CSVeArrowWriter::TypeUInt32, true});
+    }
+    for (int k = 0; k < CYCLE_CHARGES; k++) {
+        fields.append({CHARGES[k], CSVeArrowWriter::TypeFloat64, true});
+    }
+    fields.append({"start_voltage", CSVeArrowWriter::TypeFloat64, true});
+    fields.append({"end_voltage", CSVeArrowWriter::TypeFloat64, true});
+    fields.append({"type_reason", CSVeArrowWriter::TypeUInt8, false});
+    fields.append({"error", CSVeArrowWriter::TypeUInt8, true});
+    return fields;
+}
+
+void CSVeArrowExport::setRange(qint64 from, qint64 to)
+{
+    m_from = from;
+    m_to = to;
+}
+
+void CSVeArrowExport::setDevice(const QString& device)
+{
+    m_device = device;
+}
+
+void CSVeArrowExport::setRegisters(const QList<quint16>& regids)
+{
+    m_regids = regids;
+}
+
+void CSVeArrowExport::setBatchRows(int rows)
+{
+    m_batchRows = qMax(1, rows);
+}
+
+bool CSVeArrowExport::exportRecords(const QString& directory, QIODevice* out)
+{
+    m_stats = {};
+
+    CSVeArrowWriter writer(out);
+    if (!writer.begin(recordFields())) {
+        return false;
+    }
+
+    TRecordBatch batch;
+    batch.m_times.reserve(m_batchRows);
+    batch.m_offsets.reserve(m_batchRows + 1);
+    batch.m_offsets.append(0);
+    batch.m_regids.reserve(m_batchRows);
+    batch.m_raws.reserve(m_batchRows);
+    batch.m_exponents.reserve(m_batchRows);
+
+    const QSet<quint16> regids(m_regids.constBegin(), m_regids.constEnd());
+
+    foreach (const QString& fileName, CSVeRecordReader::segments(directory)) {
+        m_stats.m_segments++;
+
+        /* a valid sidecar tells whether the segment can match */
+        CSVeSeriesIndex index;
+        if (index.load(CSVeSeriesIndex::indexName(fileName), QFileInfo(fileName).size()) && //
+            (index.count() == 0 || index.last() + index.wallBase() < m_from || index.first() + index.wallBase() >= m_to || //
+             (!m_device.isEmpty() && !index.devices().contains(m_device)))) {
+            m_stats.m_segmentsSkipped++;
+            continue;
+        }
+
+        CSVeRecordReader reader;
+        if (!reader.open(fileName)) {
+            continue;
+        }
+
+        /* device indexes are per segment */
+        QVector<QByteArray> names;
+        int device = -1;
+        CSVeRecordReader::TRecord r;
+        while (reader.next(&r)) {
+            if (names.count() != reader.devices().count()) {
+                names.resize(0);
+                foreach (const QString& id, reader.devices()) {
+                    names.append(id.toUtf8());
+                }
+                device = reader.devices().indexOf(m_device);
+            }
+
+            const qint64 time = r.m_time + reader.wallBase();
+            if (time < m_from || time >= m_to || r.m_device >= names.count() || //
+                (!m_device.isEmpty() && r.m_device != device) || (!regids.isEmpty() && !regids.contains(r.m_regid))) {
+                continue;
+            }
+
+            batch.m_times.append(time);
+            batch.m_devices.append(names.at(r.m_device));
+            batch.m_offsets.append(batch.m_devices.size());
+            batch.m_regids.append(r.m_regid);
+            batch.m_raws.append(r.m_raw);
+            batch.m_exponents.append(r.m_exponent);
+            m_stats.m_rows++;
+
+            if (batch.m_times.count() >= m_batchRows && !writeRecords(&writer, &batch)) {
+                return false;
+            }
+        }
+    }
+
+    const bool ok = writeRecords(&writer, &batch) && writer.finish();
+    m_stats.m_batches = writer.batchCount();
+    m_stats.m_bytes = writer.bytesWritten();
+    return ok;
+}
+
+bool CSVeArrowExport::exportCycles(const QStringList& serials, QIODevice* out)
+{
+    m_stats = {};
+
+    CSVeArrowWriter writer(out);
+    if (!writer.begin(cycleFields())) {
+        return false;
+    }
+
+    TCycleBatch batch;
+    batch.m_offsets.append(0);
+
+    foreach (const QString& serial, serials) {
+        quint32 sequence = 0;
+        CSVeHistorySync::TRecords records;
+        if (!CSVeHistorySync::load(serial, &sequence, &records)) {
+            continue;
+        }
+
+        const QByteArray id = serial.toUtf8();
+        foreach (const CSVeHistorySync::TCycleRecord& c, records) {
+            const quint32 raws[CYCLE_RAWS] = {
+               c.m_startTime,
+               c.m_bulkTime,
+               c.m_absTime,
+               c.m_reconTime,
+               c.m_floatTime,
+               c.m_storageTime,
+               c.m_bulkCharge,
+               c.m_absCharge,
+               c.m_reconCharge,
+               c.m_floatCharge,
+               c.m_storageCharge,
+               c.m_startVoltage,
+               c.m_endVoltage,
+            };
+
+            batch.m_serials.append(id);
+            batch.m_offsets.append(batch.m_serials.size());
+            batch.m_cycles.append(c.m_cycle);
+            batch.m_versions.append(c.m_version);
+            for (int k = 0; k < CYCLE_RAWS; k++) {
+                batch.m_raws[k].append(raws[k]);
+            }
+            batch.m_typeReasons.append(c.m_typeReason);
+            batch.m_errors.append(c.m_error);
+            m_stats.m_rows++;
+
+            if (batch.m_cycles.count() >= m_batchRows && !writeCycles(&writer, &batch)) {
+                return false;
+            }
+        }
+    }
+
+    const bool ok = writeCycles(&writer, &batch) && writer.finish();
+    m_stats.m_batches = writer.batchCount();
+    m_stats.m_bytes = writer.bytesWritten();
+    return ok;
+}
+
+const CSVeArrowExport::TStats& CSVeArrowExport::statistics() const
+{
+    return m_stats;
+}
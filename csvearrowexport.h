@@ -0,0 +1,89 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QIODevice>
+#include <QList>
+#include <QStringList>
+#include <csvearrowwriter.h>
+
+/**
+ * @brief Columnar export of recordings and charge cycle history
+ *
+ * Writes Arrow IPC streams (CSVeArrowWriter) for pandas, Polars
+ * and pyarrow:
+ *
+ *   records  time (timestamp ms UTC), device, regid, raw, value
+ *   cycles   serial, cycle, version, the six phase times in s,
+ *            the five phase charges in Ah, start and end voltage
+ *            in V, type_reason, error; the 0xFF.. "not available"
+ *            values of the charger are nulls
+ *
+ * Records are read segment by segment and written in batches of
+ * the batch row count, so memory stays the same for any range.
+ * Segments outside the time range are skipped by their index
+ * sidecar. Rows come in segment order and series by series within
+ * a compressed batch, not sorted by time.
+ *
+ * The scaled value column is computed per batch in one pass over
+ * the raw column, a constant factor per run of one exponent.
+ */
+class CSVeArrowExport
+{
+public:
+    static const int DEFAULT_BATCH_ROWS = 65536;
+
+    typedef struct {
+        quint64 m_rows;
+        quint32 m_batches;
+        quint64 m_bytes;
+        quint32 m_segments;
+        quint32 m_segmentsSkipped;
+    } TStats;
+
+    CSVeArrowExport();
+
+    static QList<CSVeArrowWriter::TField> recordFields();
+    static QList<CSVeArrowWriter::TField> cycleFields();
+
+    /**
+     * @brief setRange Records in time range
+     * @param from Wall clock ms, inclusive
+     * @param to Wall clock ms, exclusive
+     */
+    void setRange(qint64 from, qint64 to);
+    /* device id, empty = all */
+    void setDevice(const QString& device);
+    /* register ids, empty = all */
+    void setRegisters(const QList<quint16>& regids);
+    void setBatchRows(int rows);
+
+    /**
+     * @brief exportRecords Recorded register values of a recording
+     * @param directory Recording directory
+     * @param out Open for writing
+     * @return false on a write error
+     */
+    bool exportRecords(const QString& directory, QIODevice* out);
+    /**
+     * @brief exportCycles Cached cycle history (CSVeHistorySync) of
+     * chargers
+     * @param serials Device serial numbers
+     * @param out Open for writing
+     * @return false on a write error
+     */
+    bool exportCycles(const QStringList& serials, QIODevice* out);
+
+    const TStats& statistics() const;
+
+private:
+    qint64 m_from;
+    qint64 m_to;
+    QString m_device;
+    QList<quint16> m_regids;
+    int m_batchRows;
+    TStats m_stats;
+};
@@ -0,0 +1,419 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QtEndian>
+#include <csvearrowwriter.h>
+
+/* Message.fbs and Schema.fbs of the Arrow format */
+static const qint16 METADATA_V5 = 4;
+static const quint8 HEADER_SCHEMA = 1;
+static const quint8 HEADER_RECORD_BATCH = 3;
+static const quint8 TYPE_INT = 2;
+static const quint8 TYPE_FLOATING_POINT = 3;
+static const quint8 TYPE_UTF8 = 5;
+static const quint8 TYPE_TIMESTAMP = 10;
+static const qint16 PRECISION_DOUBLE = 2;
+static const qint16 UNIT_MILLISECOND = 1;
+static const quint32 CONTINUATION = 0xFFFFFFFF;
+/* FieldNode and Buffer structs: two i64 */
+static const int STRUCT_SIZE = 16;
+
+static const char PADDING[8] = {};
+
+static inline qint64 padded(qint64 size)
+{
+    return (size + 7) & ~7LL;
+}
+
+/**
+ * FlatBuffers encoder that writes parents before their children,
+ * every offset slot is linked once its target has been written.
+ */
+class CSVeFlatBuilder
+{
+public:
+    /* m_size 0 is an offset slot */
+    typedef struct {
+        int m_id;
+        int m_size;
+        qint64 m_value;
+    } TField;
+
+    CSVeFlatBuilder()
+        : m_data(4, '\0')
+    {
+    }
+
+    const QByteArray& data() const { return m_data; }
+
+    /* the root table offset at the start of the buffer */
+    void root(int table) { link(0, table); }
+
+    void link(int slot, int target) { qToLittleEndian<quint32>(target - slot, m_data.data() + slot); }
+
+    /**
+     * Vtable followed by the table, fields aligned to their size.
+     * slots gets the position of each offset slot by field id.
+     */
+    int table(const QVector<TField>& fields, QVector<int>* slots = nullptr)
+    {
+        int count = 0;
+        foreach (const TField& f, fields) {
+            count = qMax(count, f.m_id + 1);
+        }
+
+        pad(2);
+        const int vtable = m_data.size();
+        const int vsize = 4 + 2 * count;
+        m_data.append(QByteArray(vsize, '\0'));
+        pad(4);
+        const int table = m_data.size();
+        append<qint32>(table - vtable);
+
+        if (slots) {
+            slots->fill(-1, count);
+        }
+        foreach (const TField& f, fields) {
+            const int size = (f.m_size ? f.m_size : 4);
+            pad(size);
+            const int at = m_data.size();
+            switch (size) {
+                case 1: {
+                    append<quint8>((quint8) f.m_value);
+                    break;
+                }
+                case 2: {
+                    append<qint16>((qint16) f.m_value);
+                    break;
+                }
+                case 4: {
+                    append<qint32>((qint32) f.m_value);
+                    break;
+                }
+                default: {
+                    append<qint64>(f.m_value);
+                    break;
+                }
+            }
+            qToLittleEndian<quint16>(at - table, m_data.data() + vtable + 4 + 2 * f.m_id);
+            if (!f.m_size && slots) {
+                (*slots)[f.m_id] = at;
+            }
+        }
+
+        qToLittleEndian<quint16>(vsize, m_data.data() + vtable);
+        qToLittleEndian<quint16>(m_data.size() - table, m_data.data() + vtable + 2);
+        return table;
+    }
+
+    /* vector of count offset slots */
+    int offsets(int count, QVector<int>* slots = nullptr)
+    {
+        pad(4);
+        const int vector = m_data.size();
+        append<quint32>(count);
+        if (slots) {
+            slots->resize(count);
+            for (int i = 0; i < count; i++) {
+                (*slots)[i] = vector + 4 + 4 * i;
+            }
+        }
+        m_data.append(QByteArray(4 * count, '\0'));
+        return vector;
+    }
+
+    /* vector of structs, the elements 8 byte aligned */
+    int structs(const QByteArray& elements, int count)
+    {
+        pad(4);
+        if ((m_data.size() + 4) % 8) {
+            append<quint32>(0);
+        }
+        const int vector = m_data.size();
+        append<quint32>(count);
+        m_data.append(elements);
+        return vector;
+    }
+
+    int string(const QByteArray& text)
+    {
+        pad(4);
+        const int string = m_data.size();
+        append<quint32>(text.size());
+        m_data.append(text);
+        m_data.append('\0');
+        return string;
+    }
+
+private:
+    QByteArray m_data;
+
+private:
+    void pad(int alignment)
+    {
+        while (m_data.size() % alignment) {
+            m_data.append('\0');
+        }
+    }
+
+    template<typename T> void append(T value)
+    {
+        const int at = m_data.size();
+        m_data.resize(at + (int) sizeof(T));
+        qToLittleEndian<T>(value, m_data.data() + at);
+    }
+};
+
+/* Type union tag of a field */
+static quint8 typeId(CSVeArrowWriter::TType type)
+{
+    switch (type) {
+        case CSVeArrowWriter::TypeFloat64: {
+            return TYPE_FLOATING_POINT;
+        }
+        case CSVeArrowWriter::TypeTimestamp: {
+            return TYPE_TIMESTAMP;
+        }
+        case CSVeArrowWriter::TypeUtf8: {
+            return TYPE_UTF8;
+        }
+        default: {
+            return TYPE_INT;
+        }
+    }
+}
+
+/* Type union member of a field */
+static int typeTable(CSVeFlatBuilder* fb, CSVeArrowWriter::TType type)
+{
+    switch (type) {
+        case CSVeArrowWriter::TypeUInt8:
+        case CSVeArrowWriter::TypeUInt16:
+        case CSVeArrowWriter::TypeUInt32:
+        case CSVeArrowWriter::TypeInt64: {
+            return fb->table({
+               {0, 4, CSVeArrowWriter::width(type) * 8},
+               {1, 1, (type == CSVeArrowWriter::TypeInt64)},
+            });
+        }
+        case CSVeArrowWriter::TypeFloat64: {
+            return fb->table({{0, 2, PRECISION_DOUBLE}});
+        }
+        case CSVeArrowWriter::TypeTimestamp: {
+            QVector<int> slots;
+            const int table = fb->table({{0, 2, UNIT_MILLISECOND}, {1, 0, 0}}, &slots);
+            fb->link(slots.at(1), fb->string("UTC"));
+            return table;
+        }
+        default: {
+            return fb->table({});
+        }
+    }
+}
+
+CSVeArrowWriter::CSVeArrowWriter(QIODevice* device)
+    : m_device(device)
+    , m_fields()
+    , m_bytes(0)
+    , m_batches(0)
+{
+}
+
+int CSVeArrowWriter::width(TType type)
+{
+    switch (type) {
+        case TypeUInt8: {
+            return 1;
+        }
+        case TypeUInt16: {
+            return 2;
+        }
+        case TypeUInt32: {
+            return 4;
+        }
+        case TypeUtf8: {
+            return 0;
+        }
+        default: {
+            return 8;
+        }
+    }
+}
+
+CSVeArrowWriter::TColumn CSVeArrowWriter::column(const void* values, const qint32* offsets)
+{
+    return TColumn {values, offsets, nullptr, 0};
+}
+
+void CSVeArrowWriter::setValid(QByteArray* bitmap, qint64 row, bool valid)
+{
+    uchar* byte = (uchar*) bitmap->data() + row / 8;
+    if (valid) {
+        *byte |= (uchar) (1 << (row % 8));
+    }
+    else {
+        *byte &= (uchar) ~(1 << (row % 8));
+    }
+}
+
+bool CSVeArrowWriter::begin(const QList<TField>& fields)
+{
+    m_fields = fields;
+
+    CSVeFlatBuilder fb;
+    QVector<int> message;
+    fb.root(fb.table(
+       {
+          {0, 2, METADATA_V5},
+          {1, 1, HEADER_SCHEMA},
+          {2, 0, 0},
+          {3, 8, 0},
+       },
+       &message));
+
+    /* endianness Little, fields */
+    QVector<int> schema;
+    fb.link(message.at(2), fb.table({{0, 2, 0}, {1, 0, 0}}, &schema));
+
+    QVector<int> slots;
+    fb.link(schema.at(1), fb.offsets(fields.count(), &slots));
+    for (int i = 0; i < fields.count(); i++) {
+        const TField& field = fields.at(i);
+
+        /* name, nullable, type_type, type, children */
+        QVector<int> f;
+        fb.link(slots.at(i),
+                fb.table(
+                   {
+                      {0, 0, 0},
+                      {1, 1, field.m_nullable},
+                      {2, 1, typeId(field.m_type)},
+                      {3, 0, 0},
+                      {5, 0, 0},
+                   },
+                   &f));
+        fb.link(f.at(0), fb.string(field.m_name.toUtf8()));
+        fb.link(f.at(3), typeTable(&fb, field.m_type));
+        fb.link(f.at(5), fb.offsets(0));
+    }
+
+    return writeMessage(fb.data());
+}
+
+bool CSVeArrowWriter::writeBatch(qint64 rows, const QVector<TColumn>& columns)
+{
+    if (columns.count() != m_fields.count()) {
+        return false;
+    }
+
+    /* validity, then offsets and data or the values of each column */
+    QVector<const void*> buffers;
+    QVector<qint64> sizes;
+    QByteArray nodes;
+    for (int i = 0; i < columns.count(); i++) {
+        const TColumn& c = columns.at(i);
+        const TType type = m_fields.at(i).m_type;
+
+        QByteArray node(STRUCT_SIZE, '\0');
+        qToLittleEndian<qint64>(rows, node.data());
+        qToLittleEndian<qint64>(c.m_nulls, node.data() + 8);
+        nodes.append(node);
+
+        buffers << c.m_validity;
+        sizes << (c.m_nulls && c.m_validity ? (rows + 7) / 8 : 0);
+        if (type == TypeUtf8) {
+            buffers << c.m_offsets << c.m_values;
+            sizes << (rows + 1) * 4 << (rows ? c.m_offsets[rows] : 0);
+        }
+        else {
+            buffers << c.m_values;
+            sizes << rows * width(type);
+        }
+    }
+
+    QByteArray layout(buffers.count() * STRUCT_SIZE, '\0');
+    qint64 body = 0;
+    for (int i = 0; i < buffers.count(); i++) {
+        qToLittleEndian<qint64>(body, layout.data() + i * STRUCT_SIZE);
+        qToLittleEndian<qint64>(sizes.at(i), layout.data() + i * STRUCT_SIZE + 8);
+        body += padded(sizes.at(i));
+    }
+
+    CSVeFlatBuilder fb;
+    QVector<int> message;
+    fb.root(fb.table(
+       {
+          {0, 2, METADATA_V5},
+          {1, 1, HEADER_RECORD_BATCH},
+          {2, 0, 0},
+          {3, 8, body},
+       },
+       &message));
+
+    /* length, nodes, buffers */
+    QVector<int> batch;
+    fb.link(message.at(2),
+            fb.table(
+               {
+                  {0, 8, rows},
+                  {1, 0, 0},
+                  {2, 0, 0},
+               },
+               &batch));
+    fb.link(batch.at(1), fb.structs(nodes, columns.count()));
+    fb.link(batch.at(2), fb.structs(layout, buffers.count()));
+
+    if (!writeMessage(fb.data())) {
+        return false;
+    }
+    for (int i = 0; i < buffers.count(); i++) {
+        if (!writeBuffer(buffers.at(i), sizes.at(i))) {
+            return false;
+        }
+    }
+    m_batches++;
+    return true;
+}
+
+bool CSVeArrowWriter::finish()
+{
+    uchar eos[8];
+    qToLittleEndian<quint32>(CONTINUATION, eos);
+    qToLittleEndian<quint32>(0, eos + 4);
+    return writeBuffer(eos, sizeof(eos));
+}
+
+qint64 CSVeArrowWriter::bytesWritten() const
+{
+    return m_bytes;
+}
+
+quint32 CSVeArrowWriter::batchCount() const
+{
+    return m_batches;
+}
+
+/* continuation, size, metadata padded to 8 bytes */
+inline bool CSVeArrowWriter::writeMessage(const QByteArray& metadata)
+{
+    uchar prefix[8];
+    qToLittleEndian<quint32>(CONTINUATION, prefix);
+    qToLittleEndian<qint32>((qint32) padded(metadata.size()), prefix + 4);
+    return writeBuffer(prefix, sizeof(prefix)) && writeBuffer(metadata.constData(), metadata.size());
+}
+
+inline bool CSVeArrowWriter::writeBuffer(const void* data, qint64 size)
+{
+    if (size && m_device->write((const char*) data, size) != size) {
+        return false;
+    }
+    const qint64 pad = padded(size) - size;
+    if (pad && m_device->write(PADDING, pad) != pad) {
+        return false;
+    }
+    m_bytes += size + pad;
+    return true;
+}
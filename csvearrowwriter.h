@@ -0,0 +1,102 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief Apache Arrow IPC stream writer
+ *
+ * Writes the Arrow streaming format (".arrows", read by
+ * pyarrow.ipc.open_stream() and polars.read_ipc_stream()) without
+ * the Arrow library: a schema message, one record batch message
+ * per writeBatch() and the end of stream marker.
+ *
+ * Messages are the 0xFFFFFFFF continuation, the metadata size, a
+ * FlatBuffers encoded Message (metadata version V5) padded to 8
+ * bytes and the body. The FlatBuffers tables are laid out parent
+ * first, so every offset points forward as the format requires.
+ *
+ * Only the flat column types the exporters need are supported.
+ * Column data is taken as it is in memory, little endian hosts
+ * only, which all the targets are; each batch goes to the device
+ * when written, memory is bounded by the batch the caller fills.
+ */
+class CSVeArrowWriter
+{
+public:
+    typedef enum {
+        TypeUInt8 = 0,
+        TypeUInt16,
+        TypeUInt32,
+        TypeInt64,
+        TypeFloat64,
+        /* i64 ms since the epoch, UTC */
+        TypeTimestamp,
+        TypeUtf8,
+    } TType;
+
+    typedef struct {
+        QString m_name;
+        TType m_type;
+        bool m_nullable;
+    } TField;
+
+    /* column of a batch, caller owned memory */
+    typedef struct {
+        /* rows fixed width values, or the UTF-8 bytes */
+        const void* m_values;
+        /* TypeUtf8: rows + 1 byte offsets into m_values */
+        const qint32* m_offsets;
+        /* LSB first bit per row, nullptr if all valid */
+        const uchar* m_validity;
+        qint64 m_nulls;
+    } TColumn;
+
+    explicit CSVeArrowWriter(QIODevice* device);
+
+    /* bytes per value, 0 for TypeUtf8 */
+    static int width(TType type);
+    static TColumn column(const void* values, const qint32* offsets = nullptr);
+    /**
+     * @brief setValid Set a validity bit
+     * @param bitmap (rows + 7) / 8 bytes
+     */
+    static void setValid(QByteArray* bitmap, qint64 row, bool valid);
+
+    /**
+     * @brief begin Write the schema message
+     * @param fields
+     * @return false on a write error
+     */
+    bool begin(const QList<TField>& fields);
+    /**
+     * @brief writeBatch Write a record batch
+     * @param rows
+     * @param columns One per schema field
+     * @return false on a write error or a column count mismatch
+     */
+    bool writeBatch(qint64 rows, const QVector<TColumn>& columns);
+    /* end of stream marker */
+    bool finish();
+
+    qint64 bytesWritten() const;
+    quint32 batchCount() const;
+
+private:
+    QIODevice* m_device;
+    QList<TField> m_fields;
+    qint64 m_bytes;
+    quint32 m_batches;
+
+private:
+    inline bool writeMessage(const QByteArray& metadata);
+    inline bool writeBuffer(const void* data, qint64 size);
+};
@@ -0,0 +1,231 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <csvecapture.h>
+#include <csvedirect.h>
+
+CSVeCapture::CSVeCapture(QObject* parent)
+    : QObject(parent)
+    , m_lock()
+    , m_file()
+    , m_flushTimer(this)
+    , m_clock()
+    , m_lastTime(0)
+    , m_ports()
+    , m_portNames()
+    , m_buffer()
+    , m_failed(false)
+    , m_stats()
+{
+    m_flushTimer.setInterval(DEFAULT_FLUSH_INTERVAL);
+    connect(&m_flushTimer, &QTimer::timeout, this, &CSVeCapture::flush);
+}
+
+CSVeCapture::~CSVeCapture()
+{
+    close();
+}
+
+QByteArray CSVeCapture::header(qint64 wallBase, qint64 created)
+{
+    uchar header[HEADER_SIZE] = {};
+    qToLittleEndian<quint32>(MAGIC, header);
+    qToLittleEndian<quint16>(VERSION, header + 4);
+    qToLittleEndian<quint16>(HEADER_SIZE, header + 6);
+    qToLittleEndian<qint64>(wallBase, header + 8);
+    qToLittleEndian<qint64>(created, header + 16);
+    return QByteArray((const char*) header, HEADER_SIZE);
+}
+
+bool CSVeCapture::open(const QString& fileName)
+{
+    close();
+
+    QMutexLocker locker(&m_lock);
+
+    if (!QDir().mkpath(QFileInfo(fileName).absolutePath())) {
+        locker.unlock();
+        emit errorOccurred(tr("Unable to create %1").arg(QFileInfo(fileName).absolutePath()));
+        return false;
+    }
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        locker.unlock();
+        emit errorOccurred(tr("Unable to write %1").arg(fileName));
+        return false;
+    }
+
+    const qint64 created = CSVeParser::monotonicTime();
+    m_clock.start();
+    m_lastTime = 0;
+    m_failed = false;
+    m_stats = {};
+    m_buffer = header(QDateTime::currentMSecsSinceEpoch() - created, created);
+
+    /* ports added before open() */
+    for (int i = 0; i < m_portNames.count(); i++) {
+        const QByteArray name = m_portNames[i].toUtf8().left(255);
+        m_buffer += (char) TAG_PORT;
+        m_buffer += (char) i;
+        m_buffer += (char) name.size();
+        m_buffer += name;
+    }
+
+    locker.unlock();
+    m_flushTimer.start();
+    qDebug("[VE.CAP] capture %s", qPrintable(fileName));
+    return flush();
+}
+
+void CSVeCapture::close()
+{
+    if (!isOpen()) {
+        return;
+    }
+    m_flushTimer.stop();
+    flush();
+
+    QMutexLocker locker(&m_lock);
+    m_file.close();
+    m_buffer.clear();
+    qDebug("[VE.CAP] closed, %llu chunks, %llu bytes", //
+           (unsigned long long) m_stats.m_chunks,
+           (unsigned long long) m_stats.m_bytes);
+}
+
+bool CSVeCapture::isOpen() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_file.isOpen();
+}
+
+QString CSVeCapture::fileName() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_file.fileName();
+}
+
+void CSVeCapture::setFlushInterval(int msecs)
+{
+    m_flushTimer.setInterval(qMax(1, msecs));
+}
+
+int CSVeCapture::addPort(const QString& name)
+{
+    QMutexLocker locker(&m_lock);
+
+    QHash<QString, int>::const_iterator it = m_ports.constFind(name);
+    if (it != m_ports.constEnd()) {
+        return it.value();
+    }
+    if (m_portNames.count() >= MAX_PORTS) {
+        return -1;
+    }
+
+    const int index = m_portNames.count();
+    m_ports.insert(name, index);
+    m_portNames.append(name);
+
+    if (m_file.isOpen()) {
+        const QByteArray utf8 = name.toUtf8().left(255);
+        m_buffer += (char) TAG_PORT;
+        m_buffer += (char) index;
+        m_buffer += (char) utf8.size();
+        m_buffer += utf8;
+    }
+    return index;
+}
+
+void CSVeCapture::capture(int port, TDirection direction, const char* data, int size)
+{
+    if (port < 0 || port >= MAX_PORTS || size <= 0) {
+        return;
+    }
+
+    QMutexLocker locker(&m_lock);
+    if (!m_file.isOpen() || m_failed) {
+        return;
+    }
+
+    /* stamped under the lock, the times of all threads ascend */
+    const qint64 time = m_clock.nsecsElapsed() / 1000;
+    m_buffer += (char) ((direction << 7) | port);
+    appendVarint(&m_buffer, (quint64) qMax((qint64) 0, time - m_lastTime));
+    appendVarint(&m_buffer, (quint64) size);
+    m_buffer.append(data, size);
+    m_lastTime = qMax(m_lastTime, time);
+
+    m_stats.m_chunks++;
+    m_stats.m_payload += size;
+
+    if (m_buffer.size() >= MAX_BUFFER_SIZE && !writeBuffer()) {
+        m_failed = true;
+        /* reported in the thread of the capture */
+        QMetaObject::invokeMethod(this, &CSVeCapture::fail, Qt::QueuedConnection);
+    }
+}
+
+void CSVeCapture::capture(int port, TDirection direction, const QByteArray& data)
+{
+    capture(port, direction, data.constData(), data.size());
+}
+
+bool CSVeCapture::flush()
+{
+    QMutexLocker locker(&m_lock);
+    if (!m_file.isOpen() || m_failed) {
+        return false;
+    }
+    if (!writeBuffer() || !m_file.flush()) {
+        m_failed = true;
+        locker.unlock();
+        fail();
+        return false;
+    }
+    return true;
+}
+
+CSVeCapture::TStats CSVeCapture::statistics() const
+{
+    QMutexLocker locker(&m_lock);
+    return m_stats;
+}
+
+inline void CSVeCapture::appendVarint(QByteArray* buffer, quint64 value)
+{
+    while (value >= 0x80) {
+        buffer->append((char) (value | 0x80));
+        value >>= 7;
+    }
+    buffer->append((char) value);
+}
+
+/* called with the lock held */
+inline bool CSVeCapture::writeBuffer()
+{
+    if (m_buffer.isEmpty()) {
+        return true;
+    }
+    if (m_file.write(m_buffer) != m_buffer.size()) {
+        m_buffer.clear();
+        return false;
+    }
+    m_stats.m_bytes += m_buffer.size();
+    m_stats.m_flushes++;
+    m_buffer.clear();
+    return true;
+}
+
+inline void CSVeCapture::fail()
+{
+    qWarning("[VE.CAP] write error, capture stopped");
+    emit errorOccurred(tr("Capture write error"));
+}
@@ -0,0 +1,138 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+/**
+ * @brief Timestamped raw serial capture
+ *
+ * Logs every chunk of bytes read from or written to a serial port,
+ * as it was handed to or taken from the port, with the monotonic
+ * time of the read or write. A capture holds any number of ports
+ * (up to MAX_PORTS), each declared once before its first chunk.
+ *
+ * File layout, all little endian:
+ *
+ *   header  32 bytes  u32 magic "VCAP", u16 version, u16 header
+ *                     size, i64 wall clock ms at monotonic time 0,
+ *                     i64 monotonic ms at open (time 0 of the
+ *                     chunks), u64 reserved
+ *   port              u8 0xFF, u8 index, u8 size, UTF-8 name
+ *   chunk             u8 direction << 7 | port index, LEB128 us
+ *                     since the previous chunk, LEB128 size, bytes
+ *
+ * A chunk costs 3 to 4 bytes on top of its data. Chunks collect in
+ * memory and are written every flush interval or when the buffer
+ * is full; a crash loses at most the last interval and leaves a
+ * torn chunk at the end, which CSVeCaptureReader stops at.
+ *
+ * capture() may be called from any thread, the chunks of all
+ * threads are stamped and written in one order.
+ */
+class CSVeCapture: public QObject
+{
+    Q_OBJECT
+
+public:
+    static const quint32 MAGIC = 0x50414356; // VCAP
+    static const quint16 VERSION = 1;
+    static const int HEADER_SIZE = 32;
+    static const quint8 TAG_PORT = 0xFF;
+    static const int MAX_PORTS = 127;
+
+    static const int DEFAULT_FLUSH_INTERVAL = 1000;
+    static const int MAX_BUFFER_SIZE = 256 * 1024;
+
+    typedef enum {
+        /* bytes the port delivered */
+        DirRead = 0,
+        /* bytes handed to the port */
+        DirWrite = 1,
+    } TDirection;
+
+    typedef struct {
+        quint64 m_chunks;
+        quint64 m_payload;
+        quint64 m_bytes;
+        quint64 m_flushes;
+    } TStats;
+
+    explicit CSVeCapture(QObject* parent = nullptr);
+    ~CSVeCapture();
+
+    static QByteArray header(qint64 wallBase, qint64 created);
+
+    /**
+     * @brief open Start a new capture, an existing file is replaced
+     * @param fileName
+     * @return false if the file is not writable
+     */
+    bool open(const QString& fileName);
+    /**
+     * @brief close Flush and close the file
+     */
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+    void setFlushInterval(int msecs);
+
+    /**
+     * @brief addPort Index of a port in the chunks, declared on
+     * first use
+     * @param name Port name, e.g. "ttyS4"
+     * @return Index, -1 if MAX_PORTS are in use
+     */
+    int addPort(const QString& name);
+
+    /**
+     * @brief capture Append a chunk stamped now, ignored if the
+     * capture is not open
+     * @param port Index of addPort()
+     * @param direction
+     * @param data
+     * @param size
+     */
+    void capture(int port, TDirection direction, const char* data, int size);
+    void capture(int port, TDirection direction, const QByteArray& data);
+
+    /**
+     * @brief flush Write the collected chunks
+     * @return false on write error
+     */
+    bool flush();
+
+    TStats statistics() const;
+
+signals:
+    void errorOccurred(const QString& message);
+
+private:
+    mutable QMutex m_lock;
+    QFile m_file;
+    QTimer m_flushTimer;
+    /* time of the chunks, started at open() */
+    QElapsedTimer m_clock;
+    qint64 m_lastTime;
+    QHash<QString, int> m_ports;
+    QStringList m_portNames;
+    QByteArray m_buffer;
+    bool m_failed;
+    TStats m_stats;
+
+private:
+    inline static void appendVarint(QByteArray* buffer, quint64 value);
+    inline bool writeBuffer();
+    inline void fail();
+};
@@ -0,0 +1,294 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QFile>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <csvecapturedecoder.h>
+#include <cstring>
+#include <functional>
+
+/* the last field of a VE.Text block, "Checksum\t" + byte + "\r\n" */
+static const char CHECKSUM_LABEL[] = "Checksum\t";
+static const int CHECKSUM_LINE = sizeof(CHECKSUM_LABEL) - 1 + 3;
+
+typedef struct {
+    qint64 m_begin;
+    qint64 m_end;
+} TRange;
+
+static inline bool isLabelChar(uchar c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '#';
+}
+
+/* a mapped capture, closed with the file */
+static const uchar* mapCapture(QFile* file, qint64* size)
+{
+    if (!file->open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+    *size = file->size();
+    /* nothing to map, but a valid capture */
+    static const uchar EMPTY = 0;
+    return (*size ? file->map(0, *size) : &EMPTY);
+}
+
+CSVeCaptureDecoder::CSVeCaptureDecoder(QObject* parent)
+    : QObject(parent)
+    , m_chunkSize(DEFAULT_CHUNK_SIZE)
+    , m_window(0)
+    , m_offset(0)
+    , m_textStamp()
+    , m_stats()
+{
+}
+
+void CSVeCaptureDecoder::setChunkSize(int bytes)
+{
+    m_chunkSize = qMax(1024, bytes);
+}
+
+void CSVeCaptureDecoder::setWindow(int chunks)
+{
+    m_window = qMax(0, chunks);
+}
+
+qint64 CSVeCaptureDecoder::nextBoundary(const uchar* data, qint64 size, qint64 from)
+{
+    for (qint64 p = qMax(from, (qint64) 1); p < size; p++) {
+        const uchar* nl = (const uchar*) memchr(data + p - 1, '\n', size - p);
+        if (!nl) {
+            break;
+        }
+        p = nl - data + 1;
+        if (p >= size) {
+            break;
+        }
+        if (data[p] == ':') {
+            return p;
+        }
+        if (isLabelChar(data[p]) && p >= CHECKSUM_LINE && //
+            memcmp(data + p - CHECKSUM_LINE, CHECKSUM_LABEL, sizeof(CHECKSUM_LABEL) - 1) == 0) {
+            return p;
+        }
+    }
+    return size;
+}
+
+bool CSVeCaptureDecoder::decode(const QString& fileName)
+{
+    m_stats = {};
+
+    QFile file(fileName);
+    qint64 size = 0;
+    const uchar* data = mapCapture(&file, &size);
+    if (!data) {
+        return false;
+    }
+    m_stats.m_bytes = size;
+
+    /* the state at a boundary, what a parser has after a line end */
+    CSVeParser::TState boundary;
+    {
+        CSVeParser parser;
+        parser.handle('\n');
+        boundary = parser.state();
+    }
+
+    const int window = (m_window ? m_window : 2 * QThreadPool::globalInstance()->maxThreadCount());
+    const std::function<TChunk(const TRange&)> task = [data, &boundary](const TRange& range) {
+        /* the first chunk starts like a new parser */
+        return decodeChunk(data, range.m_begin, range.m_end, (range.m_begin ? &boundary : nullptr));
+    };
+
+    CSVeParser::TState carry = {};
+    qint64 pos = 0;
+    while (pos < size) {
+        QList<TRange> ranges;
+        while (ranges.count() < window && pos < size) {
+            const qint64 end = (size - pos > m_chunkSize ? nextBoundary(data, size, pos + m_chunkSize) : size);
+            ranges.append({pos, end});
+            pos = end;
+        }
+
+        /* results() keeps the chunk order */
+        QList<TChunk> chunks = QtConcurrent::mapped(ranges, task).results();
+        for (int i = 0; i < chunks.count(); i++) {
+            TChunk& chunk = chunks[i];
+            quint32 base = 0;
+            if (chunk.m_begin > 0) {
+                if (continues(carry, boundary, data[chunk.m_begin])) {
+                    base = carry.m_sequence;
+                }
+                else {
+                    chunk = decodeChunk(data, chunk.m_begin, chunk.m_end, &carry);
+                    m_stats.m_resumed++;
+                }
+            }
+            deliver(chunk, base);
+            carry = chunk.m_state;
+            rebase(&carry, base);
+            m_stats.m_chunks++;
+
+            /* the events of a chunk are not needed any more */
+            chunk.m_events = QVector<TEvent>();
+        }
+    }
+    return true;
+}
+
+bool CSVeCaptureDecoder::decodeSequential(const QString& fileName)
+{
+    m_stats = {};
+
+    QFile file(fileName);
+    qint64 size = 0;
+    const uchar* data = mapCapture(&file, &size);
+    if (!data) {
+        return false;
+    }
+    m_stats.m_bytes = size;
+    m_stats.m_chunks = (size ? 1 : 0);
+
+    CSVeParser parser;
+    connect(&parser, &CSVeParser::vedHexFrame, [this](const CSVeParser::TVeHexFrame& frame) {
+        m_stats.m_frames++;
+        emit vedHexFrame(frame);
+    });
+    connect(&parser, &CSVeParser::vedTextField, [this, &parser](const QString& field, const QByteArray& value) {
+        m_textStamp = parser.textStamp();
+        m_stats.m_fields++;
+        emit vedTextField(field, value);
+    });
+    connect(&parser, &CSVeParser::errorOccured, [this](const QByteArray& message) {
+        m_stats.m_errors++;
+        emit errorOccured(message);
+    });
+
+    for (m_offset = 0; m_offset < size; m_offset++) {
+        parser.handle((char) data[m_offset]);
+    }
+    return true;
+}
+
+qint64 CSVeCaptureDecoder::offset() const
+{
+    return m_offset;
+}
+
+const CSVeParser::TStamp& CSVeCaptureDecoder::textStamp() const
+{
+    return m_textStamp;
+}
+
+const CSVeCaptureDecoder::TStats& CSVeCaptureDecoder::statistics() const
+{
+    return m_stats;
+}
+
+/* runs on a pool thread, the parser lives only here */
+CSVeCaptureDecoder::TChunk CSVeCaptureDecoder::decodeChunk(const uchar* data, qint64 begin, qint64 end, const CSVeParser::TState* start)
+{
+    TChunk chunk = {begin, end, {}, {}};
+    qint64 at = begin;
+
+    CSVeParser parser;
+    if (start) {
+        parser.setState(*start);
+    }
+
+    QObject::connect(&parser, &CSVeParser::vedHexFrame, [&chunk, &at](const CSVeParser::TVeHexFrame& frame) {
+        chunk.m_events.append({
+           EventHexFrame,
+           at,
+           frame.stamp,
+           QString(),
+           frame.source,
+           frame.command,
+           frame.regid,
+           frame.flags,
+           QByteArray((const char*) frame.ve_in.data, qMin(frame.ve_in.size + 1, (int) CSVEDirect::FRAME_BUFF_SIZE)),
+           QByteArray((const char*) frame.ve_out.data, qMin((int) frame.ve_out.size, (int) CSVEDirect::FRAME_BUFF_SIZE)),
+        });
+    });
+    QObject::connect(&parser, &CSVeParser::vedTextField, [&chunk, &at, &parser](const QString& field, const QByteArray& value) {
+        chunk.m_events.append({EventTextField, at, parser.textStamp(), field, value, 0, 0, 0, QByteArray(), QByteArray()});
+    });
+    QObject::connect(&parser, &CSVeParser::errorOccured, [&chunk, &at](const QByteArray& message) {
+        chunk.m_events.append({EventError, at, {}, QString(), message, 0, 0, 0, QByteArray(), QByteArray()});
+    });
+
+    for (; at < end; at++) {
+        parser.handle((char) data[at]);
+    }
+    chunk.m_state = parser.state();
+    return chunk;
+}
+
+/* a chunk decoded from the boundary state is exact if the previous
+ * one ended in it; a ':' resets all but the text block */
+inline bool CSVeCaptureDecoder::continues(const CSVeParser::TState& end, const CSVeParser::TState& start, uchar first)
+{
+    if (end.m_textBlock != start.m_textBlock) {
+        return false;
+    }
+    if (first == ':') {
+        return true;
+    }
+    return (end.m_state == start.m_state && end.m_label == start.m_label && end.m_value == start.m_value);
+}
+
+/* sequence numbers of a chunk decoded from the boundary state start
+ * at 0, 0 is never a stamp of its own */
+inline void CSVeCaptureDecoder::rebase(CSVeParser::TState* state, quint32 base)
+{
+    state->m_sequence += base;
+    if (state->m_textStamp.m_sequence) {
+        state->m_textStamp.m_sequence += base;
+    }
+    if (state->m_hexStamp.m_sequence) {
+        state->m_hexStamp.m_sequence += base;
+    }
+}
+
+inline void CSVeCaptureDecoder::deliver(const TChunk& chunk, quint32 base)
+{
+    foreach (const TEvent& e, chunk.m_events) {
+        m_offset = e.m_offset;
+        CSVeParser::TStamp stamp = e.m_stamp;
+        stamp.m_sequence += base;
+
+        switch (e.m_kind) {
+            case EventHexFrame: {
+                CSVeParser::TVeHexFrame frame = {};
+                frame.command = e.m_command;
+                frame.regid = e.m_regid;
+                frame.flags = e.m_flags;
+                memcpy(frame.ve_in.data, e.m_in.constData(), e.m_in.size());
+                frame.ve_in.size = qMax(0, e.m_in.size() - 1);
+                memcpy(frame.ve_out.data, e.m_out.constData(), e.m_out.size());
+                frame.ve_out.size = e.m_out.size();
+                frame.source = e.m_value;
+                frame.stamp = stamp;
+                m_stats.m_frames++;
+                emit vedHexFrame(frame);
+                break;
+            }
+            case EventTextField: {
+                m_textStamp = stamp;
+                m_stats.m_fields++;
+                emit vedTextField(e.m_field, e.m_value);
+                break;
+            }
+            default: {
+                m_stats.m_errors++;
+                emit errorOccured(e.m_value);
+                break;
+            }
+        }
+    }
+}
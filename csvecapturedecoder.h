@@ -0,0 +1,134 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QObject>
+#include <QVector>
+#include <csvedirect.h>
+
+/**
+ * @brief Parallel offline decoder of raw serial captures
+ *
+ * Memory maps a capture of the bytes a charger sent and emits the
+ * signals a CSVeParser fed with them byte by byte would emit, in
+ * the same order, with the same stamp sequence numbers.
+ *
+ * The capture is cut into chunks of about the chunk size at a '\n'
+ * followed by ':' (a VE.HEX frame) or by the first label of a
+ * VE.Text block (the line before is the Checksum field). There the
+ * parser is in a known state, so the chunks of a window are
+ * decoded in parallel on the global thread pool, each by its own
+ * parser started in that state, and then delivered in order with
+ * their sequence numbers shifted behind the previous chunk.
+ *
+ * Whether the state was right is checked against the end state of
+ * the previous chunk; a chunk that started wrong (a frame in the
+ * middle of a text block, a damaged line) is decoded again from
+ * the real state. Memory is bounded by the decoded events of one
+ * window.
+ *
+ * The read time of the stamps is 0, a raw dump has no timing. The
+ * frame buffers of a delivered VE.HEX frame hold its bytes and the
+ * checksum, the rest is zero.
+ */
+class CSVeCaptureDecoder: public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
+
+    typedef struct {
+        quint64 m_bytes;
+        quint32 m_chunks;
+        /* chunks decoded again from the real parser state */
+        quint32 m_resumed;
+        quint64 m_frames;
+        quint64 m_fields;
+        quint64 m_errors;
+    } TStats;
+
+    explicit CSVeCaptureDecoder(QObject* parent = nullptr);
+
+    void setChunkSize(int bytes);
+    /* chunks decoded at a time, 0 = two per pool thread */
+    void setWindow(int chunks);
+
+    /**
+     * @brief nextBoundary Start of the next chunk
+     * @param data Capture
+     * @param size
+     * @param from Search start
+     * @return Offset of the ':' or label behind the '\n', size if
+     * there is none
+     */
+    static qint64 nextBoundary(const uchar* data, qint64 size, qint64 from);
+
+    /**
+     * @brief decode Decode a capture file in parallel
+     * @param fileName
+     * @return false if the file can't be mapped
+     */
+    bool decode(const QString& fileName);
+    /**
+     * @brief decodeSequential Decode with one parser byte by byte,
+     * the reference of decode()
+     */
+    bool decodeSequential(const QString& fileName);
+
+    /* capture offset of the byte that completed the current signal */
+    qint64 offset() const;
+    /* stamp of the VE.Text block of the last vedTextField() */
+    const CSVeParser::TStamp& textStamp() const;
+    const TStats& statistics() const;
+
+signals:
+    void vedHexFrame(const CSVeParser::TVeHexFrame& frame);
+    void vedTextField(const QString& field, const QByteArray& value);
+    void errorOccured(const QByteArray& message);
+
+private:
+    typedef enum {
+        EventHexFrame = 0,
+        EventTextField,
+        EventError,
+    } TEventKind;
+
+    typedef struct {
+        quint8 m_kind;
+        qint64 m_offset;
+        CSVeParser::TStamp m_stamp;
+        QString m_field;
+        /* field value, error message or VE.HEX source */
+        QByteArray m_value;
+        quint8 m_command;
+        quint16 m_regid;
+        quint8 m_flags;
+        /* used bytes of the frame buffers */
+        QByteArray m_in;
+        QByteArray m_out;
+    } TEvent;
+
+    typedef struct {
+        qint64 m_begin;
+        qint64 m_end;
+        QVector<TEvent> m_events;
+        /* parser state behind the last byte */
+        CSVeParser::TState m_state;
+    } TChunk;
+
+    int m_chunkSize;
+    int m_window;
+    qint64 m_offset;
+    CSVeParser::TStamp m_textStamp;
+    TStats m_stats;
+
+private:
+    static TChunk decodeChunk(const uchar* data, qint64 begin, qint64 end, const CSVeParser::TState* start);
+    static inline bool continues(const CSVeParser::TState& end, const CSVeParser::TState& start, uchar first);
+    static inline void rebase(CSVeParser::TState* state, quint32 base);
+    inline void deliver(const TChunk& chunk, quint32 base);
+};
@@ -0,0 +1,157 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QtEndian>
+#include <csvecapturereader.h>
+
+CSVeCaptureReader::CSVeCaptureReader()
+    : m_file()
+    , m_data(nullptr)
+    , m_size(0)
+    , m_headerSize(0)
+    , m_pos(0)
+    , m_time(0)
+    , m_wallBase(0)
+    , m_created(0)
+    , m_ports()
+{
+}
+
+CSVeCaptureReader::~CSVeCaptureReader()
+{
+    close();
+}
+
+bool CSVeCaptureReader::open(const QString& fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < CSVeCapture::HEADER_SIZE) {
+        close();
+        return false;
+    }
+    if (!(m_data = m_file.map(0, m_size))) {
+        close();
+        return false;
+    }
+
+    if (qFromLittleEndian<quint32>(m_data) != CSVeCapture::MAGIC || //
+        qFromLittleEndian<quint16>(m_data + 4) > CSVeCapture::VERSION) {
+        close();
+        return false;
+    }
+
+    m_headerSize = qMin((qint64) qFromLittleEndian<quint16>(m_data + 6), m_size);
+    m_wallBase = qFromLittleEndian<qint64>(m_data + 8);
+    m_created = qFromLittleEndian<qint64>(m_data + 16);
+
+    rewind();
+    return true;
+}
+
+void CSVeCaptureReader::close()
+{
+    if (m_data) {
+        m_file.unmap((uchar*) m_data);
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_headerSize = 0;
+    m_ports.clear();
+    rewind();
+}
+
+bool CSVeCaptureReader::isOpen() const
+{
+    return m_data != nullptr;
+}
+
+QString CSVeCaptureReader::fileName() const
+{
+    return m_file.fileName();
+}
+
+qint64 CSVeCaptureReader::wallBase() const
+{
+    return m_wallBase;
+}
+
+qint64 CSVeCaptureReader::created() const
+{
+    return m_created;
+}
+
+const QStringList& CSVeCaptureReader::ports() const
+{
+    return m_ports;
+}
+
+bool CSVeCaptureReader::next(TChunk* chunk)
+{
+    while (m_pos < m_size) {
+        const quint8 tag = m_data[m_pos++];
+
+        if (tag == CSVeCapture::TAG_PORT) {
+            if (m_pos + 2 > m_size || m_pos + 2 + m_data[m_pos + 1] > m_size) {
+                break;
+            }
+            const quint8 index = m_data[m_pos];
+            const quint8 length = m_data[m_pos + 1];
+            /* ports are declared in index order */
+            if (index > m_ports.count() || index >= CSVeCapture::MAX_PORTS) {
+                break;
+            }
+            if (index == m_ports.count()) {
+                m_ports.append(QString::fromUtf8((const char*) m_data + m_pos + 2, length));
+            }
+            m_pos += 2 + length;
+            continue;
+        }
+
+        quint64 delta = 0;
+        quint64 size = 0;
+        if (!readVarint(&delta) || !readVarint(&size) || size > (quint64) (m_size - m_pos) || (tag & 0x7F) >= m_ports.count()) {
+            break;
+        }
+
+        m_time += (qint64) delta;
+        *chunk = {(quint8) (tag & 0x7F), (quint8) (tag >> 7), m_time, (const char*) m_data + m_pos, (int) size};
+        m_pos += (qint64) size;
+        return true;
+    }
+
+    /* torn or damaged, nothing behind it is trusted */
+    m_pos = m_size;
+    return false;
+}
+
+void CSVeCaptureReader::rewind()
+{
+    m_pos = m_headerSize;
+    m_time = 0;
+    m_ports.clear();
+}
+
+inline bool CSVeCaptureReader::readVarint(quint64* value)
+{
+    quint64 v = 0;
+    for (int shift = 0; shift < 64 && m_pos < m_size; shift += 7) {
+        const uchar b = m_data[m_pos++];
+        v |= (quint64) (b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,76 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QFile>
+#include <QStringList>
+#include <csvecapture.h>
+
+/**
+ * @brief Memory mapped reader of a raw serial capture
+ *
+ * Maps the capture as it is at open() and walks its chunks in the
+ * order they were captured. Reading stops at the first incomplete
+ * or malformed record, which is what a crash leaves at the end of
+ * a capture being written.
+ */
+class CSVeCaptureReader
+{
+public:
+    /* chunk, data points into the mapping */
+    typedef struct {
+        quint8 m_port;
+        quint8 m_direction;
+        /* us since open of the capture */
+        qint64 m_time;
+        const char* m_data;
+        int m_size;
+    } TChunk;
+
+    CSVeCaptureReader();
+    ~CSVeCaptureReader();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+    /* wall clock ms = monotonic ms + wallBase() */
+    qint64 wallBase() const;
+    /* monotonic ms of chunk time 0 */
+    qint64 created() const;
+
+    /**
+     * @brief ports Port names by index, complete for all chunks
+     * returned so far
+     */
+    const QStringList& ports() const;
+
+    /**
+     * @brief next Read the next chunk
+     * @param chunk
+     * @return false at the end of the valid part
+     */
+    bool next(TChunk* chunk);
+    /**
+     * @brief rewind Back to the first chunk
+     */
+    void rewind();
+
+private:
+    QFile m_file;
+    const uchar* m_data;
+    qint64 m_size;
+    qint64 m_headerSize;
+    qint64 m_pos;
+    qint64 m_time;
+    qint64 m_wallBase;
+    qint64 m_created;
+    QStringList m_ports;
+
+private:
+    inline bool readVarint(quint64* value);
+};
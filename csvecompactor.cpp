@@ -0,0 +1,777 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QtEndian>
+#include <csvecompactor.h>
+#include <csvedirect.h>
+#include <csverecordreader.h>
+#include <csveseriescodec.h>
+#include <csveseriesindex.h>
+#include <cstdio>
+#include <limits>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#endif
+
+static const qint64 DAY = 24 * 60 * 60 * 1000LL;
+static const char* const TEMP_SUFFIX = ".compact";
+static const int ROLLUP_BATCH = CSVeRecorder::MAX_BATCH_SIZE / CSVeRollup::ENTRY_SIZE;
+/* records between two pace() calls */
+static const quint32 PACE_RECORDS = 16384;
+
+/* device, regid, level and bucket number of a rollup bucket */
+static inline quint64 bucketKey(quint16 device, quint16 regid, CSVeRollup::TLevel level, qint64 start)
+{
+    const quint64 bucket = (quint64) (start / CSVeRollup::span(level)) & 0x3FFFFFFF;
+    return ((quint64) device << 48) | ((quint64) regid << 32) | ((quint64) level << 30) | bucket;
+}
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+        return 0;
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* make renames and removals in a directory durable */
+static bool syncDirectory(const QString& directory)
+{
+    const int fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const int rc = ::fsync(fd);
+    ::close(fd);
+    return (rc == 0);
+}
+
+static bool syncFile(QFile* file)
+{
+    if (!file->flush()) {
+        return false;
+    }
+#if defined(Q_OS_LINUX)
+    return (::fdatasync(file->handle()) == 0);
+#else
+    return (::fsync(file->handle()) == 0);
+#endif
+}
+
+/**
+ * Writer of the rewritten segment: device table as devices appear,
+ * series encoders like the recorder, rollup entries buffered.
+ */
+class CSVeCompactWriter
+{
+public:
+    explicit CSVeCompactWriter(QFile* file)
+        : m_file(file)
+        , m_devices()
+        , m_names()
+        , m_newDevices()
+        , m_series()
+        , m_pending(0)
+        , m_encoded(0)
+        , m_windowStart(-1)
+        , m_rollups()
+        , m_bytes(0)
+    {
+    }
+
+    ~CSVeCompactWriter() { qDeleteAll(m_series); }
+
+    bool start(quint32 sequence, qint64 wallBase, qint64 created)
+    {
+        return write(CSVeRecorder::segmentHeader(sequence, wallBase, created));
+    }
+
+    quint16 device(const QString& id)
+    {
+        QHash<QString, quint16>::const_iterator it = m_devices.constFind(id);
+        if (it != m_devices.constEnd()) {
+            return it.value();
+        }
+        const quint16 index = (quint16) m_names.count();
+        m_devices.insert(id, index);
+        m_names.append(id);
+        m_newDevices.append(index);
+        return index;
+    }
+
+    bool record(quint16 device, quint16 regid, quint8 type, qint8 exponent, qint64 time, qint64 raw)
+    {
+        if (m_windowStart >= 0 && time - m_windowStart >= CSVeCompactor::BLOCK_WINDOW && !flushRecords()) {
+            return false;
+        }
+
+        const quint32 key = ((quint32) device << 16) | regid;
+        CSVeSeriesEncoder* encoder = m_series.value(key);
+        if (encoder && (encoder->type() != type || encoder->exponent() != exponent)) {
+            if (!flushRecords()) {
+                return false;
+            }
+            delete m_series.take(key);
+            encoder = nullptr;
+        }
+        if (!encoder) {
+            encoder = new CSVeSeriesEncoder(device, regid, type, exponent);
+            m_series.insert(key, encoder);
+        }
+
+        const int size = encoder->size();
+        encoder->append(time, raw);
+        m_encoded += encoder->size() - size;
+        m_pending++;
+        if (m_windowStart < 0) {
+            m_windowStart = time;
+        }
+        return (m_encoded < CSVeRecorder::MAX_BATCH_SIZE || flushRecords());
+    }
+
+    bool rollup(const CSVeRollup::TBucket& bucket)
+    {
+        m_rollups.append(bucket);
+        return (m_rollups.count() < ROLLUP_BATCH || flushRollups());
+    }
+
+    bool flushRecords()
+    {
+        if (m_pending == 0) {
+            return true;
+        }
+        if (!writeDevices()) {
+            return false;
+        }
+        const QByteArray payload = CSVeSeriesEncoder::encodeBatch(m_series.values());
+        if (!write(CSVeRecorder::batch(CSVeRecorder::KindRecords, CSVeRecorder::CodecGorilla, payload, m_pending))) {
+            return false;
+        }
+        foreach (CSVeSeriesEncoder* encoder, m_series) {
+            encoder->reset();
+        }
+        m_pending = 0;
+        m_encoded = 0;
+        m_windowStart = -1;
+        return true;
+    }
+
+    bool flushRollups()
+    {
+        if (m_rollups.isEmpty()) {
+            return true;
+        }
+        if (!writeDevices()) {
+            return false;
+        }
+        if (!write(CSVeRecorder::batch(CSVeRecorder::KindRollups, CSVeRecorder::CodecPlain, CSVeRollup::encode(m_rollups), m_rollups.count()))) {
+            return false;
+        }
+        m_rollups.resize(0);
+        return true;
+    }
+
+    qint64 bytes() const { return m_bytes; }
+
+private:
+    QFile* m_file;
+    QHash<QString, quint16> m_devices;
+    QStringList m_names;
+    QList<quint16> m_newDevices;
+    QHash<quint32, CSVeSeriesEncoder*> m_series;
+    quint32 m_pending;
+    int m_encoded;
+    qint64 m_windowStart;
+    QVector<CSVeRollup::TBucket> m_rollups;
+    qint64 m_bytes;
+
+private:
+    bool writeDevices()
+    {
+        if (m_newDevices.isEmpty()) {
+            return true;
+        }
+        const QList<quint16> devices = m_newDevices;
+        m_newDevices.clear();
+        return write(CSVeRecorder::batch(CSVeRecorder::KindDevices, CSVeRecorder::CodecPlain, CSVeRecorder::deviceTable(m_names, devices), devices.count()));
+    }
+
+    bool write(const QByteArray& data)
+    {
+        if (m_file->write(data) != data.size()) {
+            return false;
+        }
+        m_bytes += data.size();
+        return true;
+    }
+};
+
+CSVeCompactor::CSVeCompactor(QObject* parent)
+    : QObject(parent)
+    , m_retention()
+    , m_interval(DEFAULT_INTERVAL)
+    , m_targetSize(DEFAULT_TARGET_SIZE)
+    , m_cpuShare(DEFAULT_CPU_SHARE)
+    , m_byteRate(DEFAULT_BYTE_RATE)
+    , m_directory()
+    , m_thread(nullptr)
+    , m_stop(0)
+    , m_mutex()
+    , m_wake()
+    , m_wakeup(false)
+    , m_stats()
+    , m_paceStart(0)
+    , m_paceCpu(0)
+    , m_paceBytes(0)
+{
+    for (int cls = 0; cls < CSVeDirectAcDcCharger::ClassCount; cls++) {
+        m_retention[cls] = defaultRetention((CSVeDirectAcDcCharger::TRegisterClass) cls);
+    }
+}
+
+CSVeCompactor::~CSVeCompactor()
+{
+    stop();
+}
+
+CSVeCompactor::TRetention CSVeCompactor::defaultRetention(CSVeDirectAcDcCharger::TRegisterClass cls)
+{
+    switch (cls) {
+        /* raw V, I, T for fault analysis of the last two weeks */
+        case CSVeDirectAcDcCharger::ClassMeasurement: {
+            return {14 * DAY, {90 * DAY, 730 * DAY, 0}};
+        }
+        case CSVeDirectAcDcCharger::ClassState: {
+            return {90 * DAY, {90 * DAY, 730 * DAY, 0}};
+        }
+        /* settings change rarely, every change is kept */
+        default: {
+            return {0, {90 * DAY, 0, 0}};
+        }
+    }
+}
+
+QString CSVeCompactor::journalName(const QString& directory)
+{
+    return QDir(directory).filePath("compact.journal");
+}
+
+void CSVeCompactor::setRetention(CSVeDirectAcDcCharger::TRegisterClass cls, const TRetention& retention)
+{
+    if (cls >= 0 && cls < CSVeDirectAcDcCharger::ClassCount) {
+        m_retention[cls] = retention;
+    }
+}
+
+CSVeCompactor::TRetention CSVeCompactor::retention(CSVeDirectAcDcCharger::TRegisterClass cls) const
+{
+    return m_retention[qBound(0, (int) cls, CSVeDirectAcDcCharger::ClassCount - 1)];
+}
+
+void CSVeCompactor::setInterval(int msecs)
+{
+    m_interval = qMax(1000, msecs);
+}
+
+void CSVeCompactor::setTargetSize(qint64 bytes)
+{
+    m_targetSize = qMax((qint64) CSVeRecorder::MAX_BATCH_SIZE, bytes);
+}
+
+void CSVeCompactor::setBudget(int cpuShare, qint64 byteRate)
+{
+    m_cpuShare = qBound(1, cpuShare, 100);
+    m_byteRate = qMax(64 * 1024LL, byteRate);
+}
+
+void CSVeCompactor::start(const QString& directory)
+{
+    if (m_thread) {
+        return;
+    }
+
+    m_directory = directory;
+    m_stop.storeRelaxed(0);
+    m_thread = QThread::create([this]() {
+        run();
+    });
+    m_thread->setObjectName("ve-compactor");
+    m_thread->start(QThread::IdlePriority);
+}
+
+void CSVeCompactor::stop()
+{
+    if (!m_thread) {
+        return;
+    }
+
+    m_stop.storeRelaxed(1);
+    m_mutex.lock();
+    m_wake.wakeAll();
+    m_mutex.unlock();
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+bool CSVeCompactor::isRunning() const
+{
+    return (m_thread != nullptr);
+}
+
+void CSVeCompactor::compactNow()
+{
+    QMutexLocker lock(&m_mutex);
+    m_wakeup = true;
+    m_wake.wakeAll();
+}
+
+bool CSVeCompactor::compact(const QString& directory)
+{
+    if (!recover(directory)) {
+        return false;
+    }
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QList<TSegment> segments = inspect(directory, now);
+
+    /* runs of segments to rewrite or merge, up to the target size */
+    QList<QList<TSegment>> groups;
+    QList<TSegment> group;
+    qint64 size = 0;
+    bool needed = false;
+    foreach (const TSegment& segment, segments) {
+        const bool small = (segment.m_size < m_targetSize / 4);
+        if ((!small && !segment.m_needsRewrite) || (!group.isEmpty() && size + segment.m_size > m_targetSize)) {
+            if (needed || group.count() > 1) {
+                groups.append(group);
+            }
+            group.clear();
+            size = 0;
+            needed = false;
+        }
+        if (small || segment.m_needsRewrite) {
+            group.append(segment);
+            size += segment.m_size;
+            needed = needed || segment.m_needsRewrite;
+        }
+    }
+    if (needed || group.count() > 1) {
+        groups.append(group);
+    }
+
+    quint32 rewrites = 0;
+    quint64 bytesIn = 0;
+    quint64 bytesOut = 0;
+    bool failed = false;
+    foreach (const QList<TSegment>& inputs, groups) {
+        if (m_stop.loadRelaxed()) {
+            break;
+        }
+        const quint64 before = m_stats.m_bytesOut;
+        if (!rewrite(directory, inputs, now)) {
+            failed = true;
+            /* journaled, recover() finishes it on the next pass */
+            if (QFile::exists(journalName(directory))) {
+                break;
+            }
+            /* the inputs are unchanged, one bad run does not hold
+             * back the others */
+            qWarning("[VE.CMP] Skip run of %d segments from %s", inputs.count(), qPrintable(inputs.first().m_fileName));
+            continue;
+        }
+        /* stopped, the inputs are unchanged */
+        if (m_stats.m_bytesOut == before && m_stop.loadRelaxed()) {
+            break;
+        }
+        foreach (const TSegment& input, inputs) {
+            bytesIn += input.m_size;
+        }
+        bytesOut += m_stats.m_bytesOut - before;
+        rewrites++;
+    }
+
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stats.m_passes++;
+    }
+    if (rewrites) {
+        qInfo("[VE.CMP] Compacted %u runs, %llu -> %llu bytes", rewrites, (unsigned long long) bytesIn, (unsigned long long) bytesOut);
+        emit compacted(rewrites, bytesIn, bytesOut);
+    }
+    return !failed;
+}
+
+bool CSVeCompactor::recover(const QString& directory)
+{
+    const QDir dir(directory);
+    QFile journal(journalName(directory));
+    if (journal.open(QIODevice::ReadOnly)) {
+        const QList<QByteArray> lines = journal.readAll().split('\n');
+        journal.close();
+
+        QStringList inputs;
+        QString output;
+        foreach (const QByteArray& line, lines) {
+            if (line.startsWith("input ")) {
+                inputs << dir.filePath(QString::fromUtf8(line.mid(6)));
+            }
+            else if (line.startsWith("output ")) {
+                output = dir.filePath(QString::fromUtf8(line.mid(7)));
+            }
+        }
+
+        /* written by QSaveFile, complete or absent */
+        if (inputs.isEmpty() || output.isEmpty()) {
+            fail(tr("Invalid compaction journal: %1").arg(journal.fileName()));
+            journal.remove();
+            return syncDirectory(directory);
+        }
+        qWarning("[VE.CMP] Finish interrupted compaction of %s", qPrintable(inputs.first()));
+        if (!finish(directory, inputs, output)) {
+            return false;
+        }
+    }
+
+    /* unjournaled output of an interrupted rewrite */
+    foreach (const QString& name, dir.entryList({QStringLiteral("*.vrec") + TEMP_SUFFIX}, QDir::Files)) {
+        QFile::remove(dir.filePath(name));
+    }
+    return true;
+}
+
+CSVeCompactor::TStats CSVeCompactor::statistics() const
+{
+    QMutexLocker lock(const_cast<QMutex*>(&m_mutex));
+    return m_stats;
+}
+
+inline void CSVeCompactor::run()
+{
+#ifdef Q_OS_LINUX
+    /* IOPRIO_WHO_PROCESS of this thread, IOPRIO_CLASS_IDLE */
+    ::syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+
+    while (!m_stop.loadRelaxed()) {
+        compact(m_directory);
+
+        QMutexLocker lock(&m_mutex);
+        if (!m_wakeup && !m_stop.loadRelaxed()) {
+            m_wake.wait(&m_mutex, m_interval);
+        }
+        m_wakeup = false;
+    }
+}
+
+/* closed segments and whether retention or the codec asks for a rewrite */
+inline QList<CSVeCompactor::TSegment> CSVeCompactor::inspect(const QString& directory, qint64 now)
+{
+    QStringList files = CSVeRecordReader::segments(directory);
+    /* the newest one is the recorder's */
+    if (!files.isEmpty()) {
+        files.removeLast();
+    }
+
+    QList<TSegment> segments;
+    foreach (const QString& fileName, files) {
+        if (m_stop.loadRelaxed()) {
+            break;
+        }
+
+        TSegment segment = {fileName, QFileInfo(fileName).baseName().toUInt(), QFileInfo(fileName).size(), false};
+
+        CSVeSeriesIndex index;
+        const QString indexName = CSVeSeriesIndex::indexName(fileName);
+        if (!index.load(indexName, segment.m_size)) {
+            CSVeRecordReader reader;
+            if (!reader.open(fileName)) {
+                continue;
+            }
+            if (index.build(&reader)) {
+                index.save(indexName);
+            }
+            pace(segment.m_size);
+        }
+
+        foreach (const CSVeSeriesIndex::TEntry& e, index.entries()) {
+            const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(e.m_regid)].m_raw;
+            if (e.m_codec == CSVeRecorder::CodecPlain || (age && e.m_first + index.wallBase() < now - age)) {
+                segment.m_needsRewrite = true;
+                break;
+            }
+        }
+
+        const QHash<quint32, qint64>& starts = index.rollupStarts();
+        for (QHash<quint32, qint64>::const_iterator it = starts.constBegin(); it != starts.constEnd() && !segment.m_needsRewrite; ++it) {
+            const CSVeRollup::TLevel level = (CSVeRollup::TLevel) (it.key() >> 16);
+            if (level >= CSVeRollup::LevelCount) {
+                continue;
+            }
+            const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(it.key() & 0xFFFF)].m_rollup[level];
+            segment.m_needsRewrite = (age && it.value() + CSVeRollup::span(level) < now - age);
+        }
+
+        segments.append(segment);
+    }
+    return segments;
+}
+
+inline bool CSVeCompactor::rewrite(const QString& directory, const QList<TSegment>& inputs, qint64 now)
+{
+    m_paceStart = CSVeParser::monotonicTime();
+    m_paceCpu = threadCpuSeconds();
+    m_paceBytes = 0;
+
+    /* rollup buckets that exist for records past their raw age, in
+     * the inputs and the following segment, which gets the partials
+     * of buckets open when the last input was closed */
+    QStringList sources;
+    foreach (const TSegment& input, inputs) {
+        sources << input.m_fileName;
+    }
+    const QStringList all = CSVeRecordReader::segments(directory);
+    const int following = all.indexOf(inputs.last().m_fileName) + 1;
+    if (following > 0 && following < all.count()) {
+        sources << all.at(following);
+    }
+
+    QHash<QString, quint16> keyDevices;
+    QSet<quint64> existing;
+    foreach (const QString& fileName, sources) {
+        CSVeRecordReader reader;
+        if (!reader.open(fileName)) {
+            continue;
+        }
+        CSVeRollup::TBucket b;
+        while (reader.nextRollup(&b)) {
+            const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(b.m_regid)].m_raw;
+            if (!age || b.m_start >= now - age || b.m_level >= CSVeRollup::LevelCount || b.m_device >= reader.devices().count()) {
+                continue;
+            }
+            const QString& id = reader.devices().at(b.m_device);
+            if (!keyDevices.contains(id)) {
+                keyDevices.insert(id, (quint16) keyDevices.count());
+            }
+            existing.insert(bucketKey(keyDevices.value(id), b.m_regid, (CSVeRollup::TLevel) b.m_level, b.m_start));
+        }
+        if (!pace(reader.size())) {
+            return true;
+        }
+    }
+
+    const QString first = inputs.first().m_fileName;
+    const QString output = first + TEMP_SUFFIX;
+    QFile file(output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fail(tr("Unable to write %1: %2").arg(output, file.errorString()));
+        return false;
+    }
+
+    CSVeCompactWriter writer(&file);
+    qint64 outWallBase = 0;
+    quint64 dropped = 0;
+    quint64 rollupsDropped = 0;
+    /* rollups made from dropped records, devices by key index */
+    CSVeRollup made;
+    qint64 madeUntil = std::numeric_limits<qint64>::min();
+    bool ok = true;
+    bool aborted = false;
+
+    for (int i = 0; i < inputs.count() && ok && !aborted; i++) {
+        CSVeRecordReader reader;
+        if (!reader.open(inputs.at(i).m_fileName)) {
+            /* vanished or damaged header, it stays as it is */
+            fail(tr("Unable to read %1").arg(inputs.at(i).m_fileName));
+            ok = false;
+            break;
+        }
+        if (i == 0) {
+            outWallBase = reader.wallBase();
+            ok = writer.start(reader.sequence(), reader.wallBase(), reader.created());
+        }
+
+        /* monotonic ms of the segment to the ones of the output */
+        const qint64 shift = reader.wallBase() - outWallBase;
+        CSVeRecordReader::TRecord r;
+        quint32 n = 0;
+        while (ok && reader.next(&r)) {
+            if (r.m_device >= reader.devices().count()) {
+                continue;
+            }
+            const QString& id = reader.devices().at(r.m_device);
+            const qint64 wall = r.m_time + reader.wallBase();
+            const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(r.m_regid)].m_raw;
+
+            if (age && wall < now - age) {
+                if (!keyDevices.contains(id)) {
+                    keyDevices.insert(id, (quint16) keyDevices.count());
+                }
+                /* time weighted like the recorder, buckets that exist are
+                 * skipped when written */
+                made.add(keyDevices.value(id), r.m_regid, r.m_type, r.m_exponent, wall, r.m_raw);
+                madeUntil = qMax(madeUntil, wall);
+                dropped++;
+            }
+            else {
+                ok = writer.record(writer.device(id), r.m_regid, r.m_type, r.m_exponent, r.m_time + shift, r.m_raw);
+            }
+
+            if (++n % PACE_RECORDS == 0 && !pace(PACE_RECORDS * CSVeRecorder::RECORD_SIZE)) {
+                aborted = true;
+                break;
+            }
+        }
+        ok = ok && writer.flushRecords();
+
+        /* rollups pass through, partials stay partials */
+        reader.rewind();
+        CSVeRollup::TBucket b;
+        while (ok && !aborted && reader.nextRollup(&b)) {
+            if (b.m_device >= reader.devices().count() || b.m_level >= CSVeRollup::LevelCount) {
+                continue;
+            }
+            const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(b.m_regid)].m_rollup[b.m_level];
+            if (age && b.m_start + CSVeRollup::span((CSVeRollup::TLevel) b.m_level) < now - age) {
+                rollupsDropped++;
+                continue;
+            }
+            b.m_device = writer.device(reader.devices().at(b.m_device));
+            ok = writer.rollup(b);
+        }
+        aborted = aborted || !pace(reader.size());
+    }
+
+    quint64 rollupsMade = 0;
+    QHash<quint16, QString> names;
+    for (QHash<QString, quint16>::const_iterator it = keyDevices.constBegin(); it != keyDevices.constEnd(); ++it) {
+        names.insert(it.value(), it.key());
+    }
+    foreach (CSVeRollup::TBucket b, made.takeAll(madeUntil)) {
+        if (!ok) {
+            break;
+        }
+        if (existing.contains(bucketKey(b.m_device, b.m_regid, (CSVeRollup::TLevel) b.m_level, b.m_start))) {
+            continue;
+        }
+        const qint64 age = m_retention[CSVeDirectAcDcCharger::registerClass(b.m_regid)].m_rollup[b.m_level];
+        if (age && b.m_start + CSVeRollup::span((CSVeRollup::TLevel) b.m_level) < now - age) {
+            continue;
+        }
+        b.m_device = writer.device(names.value(b.m_device));
+        ok = writer.rollup(b);
+        rollupsMade++;
+    }
+    ok = ok && writer.flushRecords() && writer.flushRollups() && syncFile(&file);
+    file.close();
+
+    if (!ok || aborted) {
+        if (!ok) {
+            fail(tr("Unable to write %1: %2").arg(output, file.errorString()));
+        }
+        QFile::remove(output);
+        return ok;
+    }
+
+    /* from here the rewrite is finished by recover() after a crash */
+    QSaveFile journal(journalName(directory));
+    if (!journal.open(QIODevice::WriteOnly)) {
+        fail(tr("Unable to write %1: %2").arg(journal.fileName(), journal.errorString()));
+        QFile::remove(output);
+        return false;
+    }
+    foreach (const TSegment& input, inputs) {
+        journal.write("input " + QFileInfo(input.m_fileName).fileName().toUtf8() + '\n');
+    }
+    journal.write("output " + QFileInfo(output).fileName().toUtf8() + '\n');
+    if (!journal.commit() || !syncDirectory(directory)) {
+        fail(tr("Unable to write %1").arg(journal.fileName()));
+        QFile::remove(output);
+        return false;
+    }
+
+    QStringList names;
+    foreach (const TSegment& input, inputs) {
+        names << input.m_fileName;
+    }
+    if (!finish(directory, names, output)) {
+        return false;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    m_stats.m_rewrites++;
+    m_stats.m_segmentsIn += inputs.count();
+    m_stats.m_segmentsOut++;
+    foreach (const TSegment& input, inputs) {
+        m_stats.m_bytesIn += input.m_size;
+    }
+    m_stats.m_bytesOut += writer.bytes();
+    m_stats.m_recordsDropped += dropped;
+    m_stats.m_rollupsMade += rollupsMade;
+    m_stats.m_rollupsDropped += rollupsDropped;
+    return true;
+}
+
+/* the output replaces the first input, the others are removed */
+inline bool CSVeCompactor::finish(const QString& directory, const QStringList& inputs, const QString& output)
+{
+    if (QFile::exists(output)) {
+        if (::rename(QFile::encodeName(output).constData(), QFile::encodeName(inputs.first()).constData())) {
+            fail(tr("Unable to replace %1").arg(inputs.first()));
+            return false;
+        }
+    }
+    QFile::remove(CSVeSeriesIndex::indexName(inputs.first()));
+    for (int i = 1; i < inputs.count(); i++) {
+        QFile::remove(inputs.at(i));
+        QFile::remove(CSVeSeriesIndex::indexName(inputs.at(i)));
+    }
+    if (!syncDirectory(directory)) {
+        fail(tr("Unable to sync %1").arg(directory));
+        return false;
+    }
+
+    QFile::remove(journalName(directory));
+    syncDirectory(directory);
+    return true;
+}
+
+/* sleep until the work done so far fits the budget, false on stop() */
+inline bool CSVeCompactor::pace(qint64 bytes)
+{
+    m_paceBytes += bytes;
+
+    const double cpu = threadCpuSeconds() - m_paceCpu;
+    const qint64 budget = qMax((qint64) (cpu * 1000 * 100 / m_cpuShare), m_paceBytes * 1000 / m_byteRate);
+    qint64 wait = budget - (CSVeParser::monotonicTime() - m_paceStart);
+    while (wait > 0 && !m_stop.loadRelaxed()) {
+        const qint64 chunk = qMin(wait, (qint64) 100);
+        QThread::msleep(chunk);
+        wait -= chunk;
+
+        QMutexLocker lock(&m_mutex);
+        m_stats.m_throttleMs += chunk;
+    }
+    return !m_stop.loadRelaxed();
+}
+
+inline void CSVeCompactor::fail(const QString& message)
+{
+    qWarning("[VE.CMP] %s", qPrintable(message));
+    emit errorOccurred(message);
+}
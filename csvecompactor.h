@@ -0,0 +1,161 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QAtomicInt>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include <csvedirectacdccharger.h>
+#include <csverecorder.h>
+#include <csverollup.h>
+
+/**
+ * @brief Background retention and compaction of a recording
+ *
+ * A low priority thread wakes up every interval and rewrites the
+ * closed segments of the recording directory, never the newest one
+ * the recorder appends to:
+ *
+ *  - runs of small segments (a recorder restart starts a new one)
+ *    are merged up to the target size,
+ *  - records are rewritten into CodecGorilla blocks,
+ *  - records older than the raw age of their register class are
+ *    dropped once a minute rollup of their bucket exists; missing
+ *    rollups are made from the dropped records first,
+ *  - rollups older than the age of their level are dropped, the
+ *    others are copied as they are; partials of a bucket stay
+ *    partials, which keeps the memory of a pass bounded.
+ *
+ * The work is paced to a CPU share and a byte rate budget, the
+ * thread runs at idle priority (idle I/O class on Linux), so the
+ * serial ports and the recorder are never kept waiting.
+ *
+ * A rewrite is restartable after a power loss: the output goes to
+ * a temporary file and is synced, a journal naming inputs and
+ * output is synced, then the output replaces the first input and
+ * the other inputs are removed. open() and every pass first finish
+ * a journaled rewrite and delete unjournaled temporary files.
+ */
+class CSVeCompactor: public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DEFAULT_INTERVAL = 60 * 60 * 1000;
+    static const qint64 DEFAULT_TARGET_SIZE = CSVeRecorder::DEFAULT_SEGMENT_SIZE;
+    /* compressed block window of the rewritten segments */
+    static const int BLOCK_WINDOW = 60 * 60 * 1000;
+    static const int DEFAULT_CPU_SHARE = 10;
+    static const qint64 DEFAULT_BYTE_RATE = 2 * 1024 * 1024;
+
+    /* ages in ms, 0 = keep */
+    typedef struct {
+        qint64 m_raw;
+        qint64 m_rollup[CSVeRollup::LevelCount];
+    } TRetention;
+
+    typedef struct {
+        quint32 m_passes;
+        quint32 m_rewrites;
+        quint32 m_segmentsIn;
+        quint32 m_segmentsOut;
+        quint64 m_bytesIn;
+        quint64 m_bytesOut;
+        quint64 m_recordsDropped;
+        quint64 m_rollupsMade;
+        quint64 m_rollupsDropped;
+        /* time spent waiting for the budget */
+        qint64 m_throttleMs;
+    } TStats;
+
+    explicit CSVeCompactor(QObject* parent = nullptr);
+    ~CSVeCompactor();
+
+    static TRetention defaultRetention(CSVeDirectAcDcCharger::TRegisterClass cls);
+    static QString journalName(const QString& directory);
+
+    /* set before start() */
+    void setRetention(CSVeDirectAcDcCharger::TRegisterClass cls, const TRetention& retention);
+    TRetention retention(CSVeDirectAcDcCharger::TRegisterClass cls) const;
+    void setInterval(int msecs);
+    void setTargetSize(qint64 bytes);
+    /**
+     * @brief setBudget Pace of the rewrite
+     * @param cpuShare Percent of one core
+     * @param byteRate Bytes read and written per second
+     */
+    void setBudget(int cpuShare, qint64 byteRate);
+
+    /**
+     * @brief start Finish an interrupted rewrite and start the
+     * compaction thread
+     * @param directory Recording directory
+     */
+    void start(const QString& directory = CSVeRecorder::defaultDirectory());
+    /**
+     * @brief stop Abort the running pass at the next step, the
+     * inputs stay as they are
+     */
+    void stop();
+    bool isRunning() const;
+    /* wake the thread for a pass now */
+    void compactNow();
+
+    /**
+     * @brief compact One pass in the calling thread, a run that
+     * fails is skipped and the others are still compacted
+     * @param directory
+     * @return false on an I/O error
+     */
+    bool compact(const QString& directory);
+    /**
+     * @brief recover Finish or discard an interrupted rewrite
+     * @return false if a journaled rewrite can't be finished
+     */
+    bool recover(const QString& directory);
+
+    TStats statistics() const;
+
+signals:
+    void compacted(quint32 rewrites, quint64 bytesIn, quint64 bytesOut);
+    void errorOccurred(const QString& message);
+
+private:
+    typedef struct {
+        QString m_fileName;
+        quint32 m_sequence;
+        qint64 m_size;
+        bool m_needsRewrite;
+    } TSegment;
+
+    TRetention m_retention[CSVeDirectAcDcCharger::ClassCount];
+    int m_interval;
+    qint64 m_targetSize;
+    int m_cpuShare;
+    qint64 m_byteRate;
+    QString m_directory;
+    QThread* m_thread;
+    QAtomicInt m_stop;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_wakeup;
+    TStats m_stats;
+    /* pacing of the current rewrite */
+    qint64 m_paceStart;
+    double m_paceCpu;
+    qint64 m_paceBytes;
+
+private:
+    inline void run();
+    inline QList<TSegment> inspect(const QString& directory, qint64 now);
+    inline bool rewrite(const QString& directory, const QList<TSegment>& inputs, qint64 now);
+    inline bool finish(const QString& directory, const QStringList& inputs, const QString& output);
+    inline bool pace(qint64 bytes);
+    inline void fail(const QString& message);
+};
@@ -0,0 +1,255 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csvedevicemanager.h>
+
+CSVeDeviceManager::CSVeDeviceManager(QObject* parent)
+    : QObject(parent)
+    , m_devices()
+    , m_ids()
+    , m_samples()
+    , m_tick(this)
+    , m_clock()
+    , m_lastSample(0)
+    , m_lastReport(0)
+{
+    m_clock.start();
+    m_tick.setInterval(TICK_INTERVAL);
+    m_tick.setSingleShot(false);
+    connect(&m_tick, &QTimer::timeout, this, &CSVeDeviceManager::onTick);
+}
+
+CSVeDeviceManager::~CSVeDeviceManager()
+{
+    m_tick.stop();
+}
+
+CSVeDirectAcDcCharger* CSVeDeviceManager::addDevice(const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config)
+{
+    if (m_devices.contains(id)) {
+        return m_devices[id];
+    }
+
+    CSVeDirectAcDcCharger* charger = new CSVeDirectAcDcCharger(this);
+    charger->setSharedTick(true);
+    if (!config.m_portName.isEmpty()) {
+        charger->setConfigIn(config);
+    }
+
+    connect(charger, &CSVeDirectAcDcCharger::dataChanged, this, [this, id](uint regid, const QPair<float, QVariant>& value, const CSVeParser::TStamp& stamp) {
+        emit dataChanged(id, regid, value, stamp);
+    });
+    connect(charger, &CSVeDirectAcDcCharger::staleChanged, this, [this, id](uint regid, bool stale) {
+        emit staleChanged(id, regid, stale);
+    });
+    connect(charger, &CSVeDirectAcDcCharger::hexFrameReceived, this, [this, id](const CSVeParser::TVeHexFrame& frame) {
+        emit hexFrameReceived(id, frame);
+    });
+
+    m_devices.insert(id, charger);
+    m_ids.insert(charger, id);
+    m_samples.insert(id, {charger->load(), m_clock.elapsed(), 0, 0, 0});
+
+    if (!m_tick.isActive()) {
+        m_tick.start();
+    }
+
+    emit deviceAdded(id);
+    return charger;
+}
+
+void CSVeDeviceManager::removeDevice(const QString& id)
+{
+    CSVeDirectAcDcCharger* charger = m_devices.take(id);
+    if (!charger) {
+        return;
+    }
+
+    m_ids.remove(charger);
+    m_samples.remove(id);
+    disconnect(charger, nullptr, this, nullptr);
+    charger->stopVEDirect();
+    /* may be called from one of its signals */
+    charger->deleteLater();
+
+    if (m_devices.isEmpty()) {
+        m_tick.stop();
+    }
+
+    emit deviceRemoved(id);
+}
+
+CSVeDirectAcDcCharger* CSVeDeviceManager::device(const QString& id) const
+{
+    return m_devices.value(id, nullptr);
+}
+
+QString CSVeDeviceManager::deviceId(const QObject* charger) const
+{
+    return m_ids.value(charger);
+}
+
+QStringList CSVeDeviceManager::devices() const
+{
+    return m_devices.keys();
+}
+
+int CSVeDeviceManager::count() const
+{
+    return m_devices.count();
+}
+
+bool CSVeDeviceManager::start(const QString& id)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (!charger) {
+        return false;
+    }
+    if (!charger->startVEDirect()) {
+        qWarning("[VE.DEV] %s: unable to open %s", qPrintable(id), qPrintable(charger->configIn().m_portName));
+        return false;
+    }
+    return true;
+}
+
+void CSVeDeviceManager::stop(const QString& id)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (charger) {
+        charger->stopVEDirect();
+    }
+}
+
+int CSVeDeviceManager::startAll()
+{
+    int running = 0;
+    foreach (const QString& id, m_devices.keys()) {
+        running += (start(id) ? 1 : 0);
+    }
+    return running;
+}
+
+void CSVeDeviceManager::stopAll()
+{
+    foreach (const QString& id, m_devices.keys()) {
+        stop(id);
+    }
+}
+
+void CSVeDeviceManager::sendGetRegister(const QString& id, quint16 regid, CSVeScheduler::TPriority prio)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (charger) {
+        charger->sendGetRegister(regid, prio);
+    }
+}
+
+void CSVeDeviceManager::sendSetRegister(const QString& id, quint16 regid, quint8 value)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (charger) {
+        charger->sendSetRegister(regid, value);
+    }
+}
+
+void CSVeDeviceManager::sendSetRegister(const QString& id, quint16 regid, quint16 value)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (charger) {
+        charger->sendSetRegister(regid, value);
+    }
+}
+
+void CSVeDeviceManager::sendSetRegister(const QString& id, quint16 regid, quint32 value)
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (charger) {
+        charger->sendSetRegister(regid, value);
+    }
+}
+
+QPair<float, QVariant> CSVeDeviceManager::value(const QString& id, quint16 regid) const
+{
+    CSVeDirectAcDcCharger* charger = device(id);
+    if (!charger) {
+        return QPair<float, QVariant>(1, QVariant());
+    }
+    return charger->store().value(regid);
+}
+
+double CSVeDeviceManager::cpuLoad(const QString& id) const
+{
+    return m_samples.value(id).m_cpuLoad;
+}
+
+void CSVeDeviceManager::sample()
+{
+    const qint64 now = m_clock.elapsed();
+    QHash<QString, double> loads;
+
+    QMap<QString, CSVeDirectAcDcCharger*>::const_iterator it;
+    for (it = m_devices.constBegin(); it != m_devices.constEnd(); it++) {
+        TSample& sample = m_samples[it.key()];
+        const CSVeDirectAcDcCharger::TLoad& load = it.value()->load();
+        const qint64 ms = qMax(1LL, now - sample.m_time);
+
+        /* ns per ms of run time, 1e6 is one core */
+        sample.m_cpuLoad = (load.m_cpuNs - sample.m_load.m_cpuNs) / (ms * 1e6);
+        sample.m_bytesRate = (qint64) ((load.m_bytes - sample.m_load.m_bytes) * 1000 / ms);
+        sample.m_ticks = load.m_ticks - sample.m_load.m_ticks;
+        sample.m_load = load;
+        sample.m_time = now;
+
+        loads.insert(it.key(), sample.m_cpuLoad);
+    }
+
+    m_lastSample = now;
+    emit loadSampled(loads);
+}
+
+QStringList CSVeDeviceManager::report() const
+{
+    double total = 0;
+    QStringList lines;
+
+    QMap<QString, CSVeDirectAcDcCharger*>::const_iterator it;
+    for (it = m_devices.constBegin(); it != m_devices.constEnd(); it++) {
+        const TSample sample = m_samples.value(it.key());
+        lines << tr("%1 cpu=%2% us/s=%3 bytes/s=%4 ticks=%5")
+                    .arg(it.key())
+                    .arg(sample.m_cpuLoad * 100.0, 0, 'f', 3)
+                    .arg(sample.m_cpuLoad * 1e6, 0, 'f', 0)
+                    .arg(sample.m_bytesRate)
+                    .arg(sample.m_ticks);
+        total += sample.m_cpuLoad;
+    }
+
+    lines << tr("devices=%1 cpu=%2% per-device=%3%")
+                .arg(m_devices.count())
+                .arg(total * 100.0, 0, 'f', 3)
+                .arg(m_devices.isEmpty() ? 0.0 : total * 100.0 / m_devices.count(), 0, 'f', 3);
+    return lines;
+}
+
+/* one timer for all sessions, closed ports return immediately */
+void CSVeDeviceManager::onTick()
+{
+    foreach (CSVeDirectAcDcCharger* charger, m_devices) {
+        charger->tick();
+    }
+
+    const qint64 now = m_clock.elapsed();
+    if (now - m_lastSample >= SAMPLE_INTERVAL) {
+        sample();
+    }
+    if (now - m_lastReport >= REPORT_INTERVAL) {
+        m_lastReport = now;
+        foreach (const QString& line, report()) {
+            qDebug() << "[VE.DEV]" << line.toUtf8().constData();
+        }
+    }
+}
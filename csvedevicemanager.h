@@ -0,0 +1,125 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <csvedirectacdccharger.h>
+
+/**
+ * @brief Owner of any number of charger sessions
+ *
+ * Each device is a CSVeDirectAcDcCharger with its own port,
+ * parser, scheduler and register values, keyed by a device id
+ * (i.e. "van-1", "rack-03/2"). All sessions live in the event
+ * loop of the manager's thread; one shared tick drives the polls
+ * of all devices instead of a timer per device.
+ *
+ * Events of the devices are re-emitted with the device id, so
+ * consumers connect once for the whole fleet. CPU time spent on
+ * each device is accounted and reported per second of run time.
+ */
+class CSVeDeviceManager: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* shared poll tick, load sample and report interval in ms */
+    static const int TICK_INTERVAL = 250;
+    static const int SAMPLE_INTERVAL = 5000;
+    static const int REPORT_INTERVAL = 60000;
+
+    /**
+     * @brief CSVeDeviceManager
+     * @param parent
+     */
+    explicit CSVeDeviceManager(QObject* parent = nullptr);
+    ~CSVeDeviceManager();
+
+    /**
+     * @brief addDevice Create a charger session
+     * @param id Unique device id
+     * @param config Charger port, default port if empty name
+     * @return The session, existing one if id is known
+     */
+    CSVeDirectAcDcCharger* addDevice(const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config = CSVeDirectAcDcCharger::TVedConfig());
+    void removeDevice(const QString& id);
+    CSVeDirectAcDcCharger* device(const QString& id) const;
+    QString deviceId(const QObject* charger) const;
+    QStringList devices() const;
+    int count() const;
+
+    /**
+     * @brief start Open the port of a device
+     * @param id
+     * @return false if unknown or port can't be opened
+     */
+    bool start(const QString& id);
+    void stop(const QString& id);
+    /**
+     * @brief startAll Open the ports of all devices
+     * @return Number of devices running
+     */
+    int startAll();
+    void stopAll();
+
+    /* device keyed commands */
+    void sendGetRegister(const QString& id, quint16 regid, CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal);
+    void sendSetRegister(const QString& id, quint16 regid, quint8 value);
+    void sendSetRegister(const QString& id, quint16 regid, quint16 value);
+    void sendSetRegister(const QString& id, quint16 regid, quint32 value);
+    QPair<float, QVariant> value(const QString& id, quint16 regid) const;
+
+    /**
+     * @brief cpuLoad Share of one core used by a device in the
+     * last sample interval, 0..1
+     * @param id
+     * @return
+     */
+    double cpuLoad(const QString& id) const;
+    /**
+     * @brief sample Update the load of all devices, done by the
+     * tick every SAMPLE_INTERVAL
+     */
+    void sample();
+    QStringList report() const;
+
+signals:
+    void deviceAdded(const QString& id);
+    void deviceRemoved(const QString& id);
+    void dataChanged(const QString& id, uint regid, const QPair<float, QVariant>& value, const CSVeParser::TStamp& stamp);
+    void staleChanged(const QString& id, uint regid, bool stale);
+    void hexFrameReceived(const QString& id, const CSVeParser::TVeHexFrame& frame);
+    /**
+     * @brief loadSampled CPU share per device after each sample
+     * @param loads Device id to 0..1 of one core
+     */
+    void loadSampled(const QHash<QString, double>& loads);
+
+private slots:
+    void onTick();
+
+private:
+    typedef struct {
+        CSVeDirectAcDcCharger::TLoad m_load;
+        qint64 m_time;
+        double m_cpuLoad;
+        qint64 m_bytesRate;
+        quint32 m_ticks;
+    } TSample;
+
+    QMap<QString, CSVeDirectAcDcCharger*> m_devices;
+    QHash<const QObject*, QString> m_ids;
+    QHash<QString, TSample> m_samples;
+    QTimer m_tick;
+    QElapsedTimer m_clock;
+    qint64 m_lastSample;
+    qint64 m_lastReport;
+};
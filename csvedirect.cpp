@@ -6,6 +6,7 @@
  * SPDX-License-Identifier: MIT License
  **********************************************************************/
 #include <QDebug>
+#include <QElapsedTimer>
 #include <csvedirect.h>
 
 CSVEDirect::CSVEDirect(QObject* parent)
@@ -285,9 +286,51 @@ CSVeParser::CSVeParser(QObject* parent)
     , m_stateFunc(nullptr)
     , m_valueBuffer()
     , m_labelBuffer()
+    , m_readTime(0)
+    , m_sequence(0)
+    , m_textStamp()
+    , m_hexStamp()
+    , m_textBlock(false)
 {
 }
 
+void CSVeParser::setReadTime(qint64 time)
+{
+    m_readTime = time;
+}
+
+const CSVeParser::TStamp& CSVeParser::textStamp() const
+{
+    return m_textStamp;
+}
+
+qint64 CSVeParser::monotonicTime()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+CSVeParser::TState CSVeParser::state() const
+{
+    quint8 index = 0;
+    while (index < STATE_COUNT && stateFunc(index) != m_stateFunc) {
+        index++;
+    }
+    return TState {index, m_labelBuffer, m_valueBuffer, m_sequence, m_textStamp, m_hexStamp, m_textBlock};
+}
+
+void CSVeParser::setState(const TState& state)
+{
+    m_stateFunc = stateFunc(state.m_state);
+    m_labelBuffer = state.m_label;
+    m_valueBuffer = state.m_value;
+    m_sequence = state.m_sequence;
+    m_textStamp = state.m_textStamp;
+    m_hexStamp = state.m_hexStamp;
+    m_textBlock = state.m_textBlock;
+}
+
 void CSVeParser::setUnknownCmd(ved_t* ved, quint8 command)
 {
     setCommand(ved, VED_RESP_UNKNOWN);
@@ -328,6 +371,7 @@ void CSVeParser::handle(int c)
 {
     switch (c) {
         case ':': {
+            m_hexStamp = {m_readTime, ++m_sequence};
             m_stateFunc = &CSVeParser::vedRecordHex;
             m_valueBuffer = QByteArray();
             m_labelBuffer = "VE.HEX";
@@ -400,6 +444,12 @@ void CSVeParser::vedRecordName(char c)
         return;
     }
 
+    /* first label of a block */
+    if (!m_textBlock) {
+        m_textBlock = true;
+        m_textStamp = {m_readTime, ++m_sequence};
+    }
+
     m_labelBuffer.append(c);
 }
 
@@ -440,10 +490,30 @@ void CSVeParser::vedRecordComplete(char c)
     /* set data field and parse */
     emit vedTextField(field, m_valueBuffer);
 
+    /* last field of the block */
+    if (field == "CHECKSUM") {
+        m_textBlock = false;
+    }
+
     /* reset to start */
     vedRecordBegin(c);
 }
 
+/* state functions by TState::m_state, 0 = not started */
+inline CSVeParser::TStateFunc CSVeParser::stateFunc(quint8 index)
+{
+    static const TStateFunc STATES[STATE_COUNT] = {
+       nullptr,
+       &CSVeParser::vedRecordBegin,
+       &CSVeParser::vedRecordName,
+       &CSVeParser::vedRecordTabChar,
+       &CSVeParser::vedRecordValue,
+       &CSVeParser::vedRecordHex,
+       &CSVeParser::vedRecordComplete,
+    };
+    return (index < STATE_COUNT ? STATES[index] : nullptr);
+}
+
 inline void CSVeParser::vedErrorOccured(const QString& reason)
 {
     emit errorOccured("[VE.Direct] Error: " + reason.toUtf8());
@@ -520,5 +590,6 @@ inline void CSVeParser::parseHexFrame(const QByteArray& hex)
        .ve_in = ve_recv,
        .ve_out = ve_out,
        .source = hex,
+       .stamp = m_hexStamp,
     });
 }
@@ -203,6 +203,14 @@ class CSVeParser: public CSVEDirect
 public:
     explicit CSVeParser(QObject* parent = nullptr);
 
+    /* time of the read that delivered the first byte of a VE.Text
+     * block or VE.HEX frame (see monotonicTime()) and its sequence
+     * number; all fields of one text block share the stamp */
+    typedef struct {
+        qint64 m_time;
+        quint32 m_sequence;
+    } TStamp;
+
     typedef struct {
         quint8 command;
         quint16 regid;
@@ -210,8 +218,42 @@ public:
         CSVEDirect::ved_t ve_in;
         CSVEDirect::ved_t ve_out;
         QByteArray source;
+        TStamp stamp;
     } TVeHexFrame;
 
+    /* state between two handle() calls, the read time aside */
+    typedef struct {
+        quint8 m_state;
+        QByteArray m_label;
+        QByteArray m_value;
+        quint32 m_sequence;
+        TStamp m_textStamp;
+        TStamp m_hexStamp;
+        bool m_textBlock;
+    } TState;
+
+    /**
+     * @brief setReadTime Time of the bytes handled next, set by
+     * the reader once per read
+     * @param time Monotonic ms
+     */
+    void setReadTime(qint64 time);
+    /**
+     * @brief textStamp Stamp of the VE.Text block of the last
+     * vedTextField()
+     */
+    const TStamp& textStamp() const;
+    /**
+     * @brief monotonicTime Steady ms clock of the stamps, the same
+     * for all parsers and threads of the process
+     */
+    static qint64 monotonicTime();
+    /**
+     * @brief state Snapshot of the parser state, a parser set to it
+     * continues exactly like this one (see CSVeCaptureDecoder)
+     */
+    TState state() const;
+    void setState(const TState& state);
     void handle(int c);
     void setUnknownCmd(ved_t* ved, quint8 command);
     void setUnknownId(ved_t* ved, quint8 command, quint8 id);
@@ -226,12 +268,20 @@ signals:
 private:
     static const int VE_MAX_LABEL_LENGTH = 9;
     static const int VE_MAX_VALUE_LENGTH = 33;
+    static const quint8 STATE_COUNT = 7;
 
-    void (CSVeParser::*m_stateFunc)(char);
+    typedef void (CSVeParser::*TStateFunc)(char);
+    TStateFunc m_stateFunc;
 
     QByteArray m_valueBuffer;
     QByteArray m_labelBuffer;
 
+    qint64 m_readTime;
+    quint32 m_sequence;
+    TStamp m_textStamp;
+    TStamp m_hexStamp;
+    bool m_textBlock;
+
 private:
     /* state callback functions */
     void vedRecordBegin(char c);
@@ -242,7 +292,9 @@ private:
     void vedRecordComplete(char c);
 
 private:
+    inline static TStateFunc stateFunc(quint8 index);
     inline void vedErrorOccured(const QString& reason);
     inline void parseHexFrame(const QByteArray& hex);
 };
+Q_DECLARE_METATYPE(CSVeParser::TStamp)
 Q_DECLARE_METATYPE(CSVeParser::TVeHexFrame)
@@ -9,6 +9,7 @@
 #include <QThread>
 #include <QTimer>
 #include <csvedirectacdccharger.h>
+#include <csvehistorysync.h>
 
 Q_DECLARE_METATYPE(QSerialPort::SerialPortError)
 Q_DECLARE_METATYPE(QSerialPort::StopBits)
@@ -24,6 +25,17 @@ Q_DECLARE_METATYPE(QSerialPort::Parity)
 #define PORT_DEV_CHR "ttysVECHR"
 #define PORT_DEV_CGX "ttysVECGX"
 #endif
+
+/* poll scheduler tick and statistics report interval in ms */
+#define POLL_TICK_INTERVAL   250
+#define POLL_REPORT_INTERVAL 60000
+
+/* Cerbo GX requests answered from proxy cache, max. age in ms */
+#define PROXY_SETTINGS_TTL 10000
+
+/* warm start, max. wait for the 0xEC41 response in ms */
+#define WARM_START_TIMEOUT 3000
+
 CSVeDirectAcDcCharger::CSVeDirectAcDcCharger(QObject* parent)
     : QObject {parent}
     , m_portCharger(this)
@@ -31,9 +43,27 @@ CSVeDirectAcDcCharger::CSVeDirectAcDcCharger(QObject* parent)
     , m_portCerbo(this)
     , m_configCerbo()
     , m_parserCharger(this)
+    , m_store()
+    , m_stamp()
+    , m_history()
+    , m_stale()
+    , m_serial()
+    , m_snapshotChanged()
+    , m_warmStart(false)
+    , m_warmTimer(this)
     , m_stateData()
-    , m_queue()
+    , m_scheduler(this)
+    , m_discovery(&m_scheduler, this)
+    , m_pollTimer(this)
+    , m_sharedTick(false)
+    , m_lastReport(0)
+    , m_load()
+    , m_router(&m_portCharger, &m_portCerbo, this)
+    , m_cache(this)
+    , m_capture(nullptr)
+    , m_capturePort()
 {
+    setCapture(nullptr);
     setupDefaults();
     connectEvents();
 }
@@ -67,7 +97,7 @@ bool CSVeDirectAcDcCharger::startVEDirect()
     });
     connect(&m_portCerbo, &QSerialPort::readyRead, this, [this]() {
         /* Cerbo GX -> to -> CarIOS, Blue Smart Charger */
-        veHandleInput(&m_parserCerbo, &m_portCerbo, &m_portCharger);
+        veHandleInput(&m_parserCerbo, &m_portCerbo, CSVeFrameRouter::FromCerbo);
     });
 
     if (!openOutputPort()) {
@@ -98,7 +128,7 @@ bool CSVeDirectAcDcCharger::startVEDirect()
     });
     connect(&m_portCharger, &QSerialPort::readyRead, this, [this]() {
         /* Charger -> to -> CarIOS, Cerbo GX */
-        veHandleInput(&m_parserCharger, &m_portCharger, &m_portCerbo);
+        veHandleInput(&m_parserCharger, &m_portCharger, CSVeFrameRouter::FromCharger);
     });
 
     if (!openInputPort()) {
@@ -108,11 +138,29 @@ bool CSVeDirectAcDcCharger::startVEDirect()
         return false;
     }
 
+    if (m_capture) {
+        m_capturePort[CSVeFrameRouter::FromCharger] = m_capture->addPort(m_configCharger.m_portName);
+        m_capturePort[CSVeFrameRouter::FromCerbo] = m_capture->addPort(m_configCerbo.m_portName);
+        m_router.setCapture(m_capture, m_capturePort[CSVeFrameRouter::FromCharger], m_capturePort[CSVeFrameRouter::FromCerbo]);
+    }
+
+    m_scheduler.reset();
+    m_router.reset();
+    if (!m_sharedTick) {
+        m_pollTimer.start();
+    }
     return true;
 }
 
 void CSVeDirectAcDcCharger::stopVEDirect()
 {
+    m_pollTimer.stop();
+    m_warmTimer.stop();
+    m_warmStart = false;
+    veSaveSnapshot();
+    foreach (const QString& line, m_scheduler.report()) {
+        qDebug() << "[VE.CHR] POLL" << line.toUtf8().constData();
+    }
     disconnect(&m_portCharger);
     disconnect(&m_portCerbo);
     close();
@@ -128,13 +176,18 @@ void CSVeDirectAcDcCharger::setBatteryCharger()
     sendSetRegister(0x0206, (quint8) 0);
 }
 
-void CSVeDirectAcDcCharger::sendGetRegister(quint16 regid)
+void CSVeDirectAcDcCharger::sendGetRegister(quint16 regid, CSVeScheduler::TPriority prio)
 {
+    /* register not available on this unit */
+    if (!m_scheduler.isSupported(regid)) {
+        return;
+    }
+
     CSVEDirect::ved_t ved = {};
     CSVEDirect::setCommand(&ved, VED_CMD_GET);
     CSVEDirect::setId(&ved, regid);
     CSVEDirect::setFlags(&ved, 0);
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved, prio);
 }
 
 void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, const QString& value)
@@ -146,7 +199,7 @@ void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, const QString& value)
     for (int i = 0; i < value.length(); i++) {
         CSVEDirect::addU8(&ved, (quint8) value.at(i).cell());
     }
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved);
 }
 
 void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint8 value)
@@ -156,7 +209,7 @@ void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint8 value)
     CSVEDirect::setId(&ved, regid);
     CSVEDirect::setFlags(&ved, 0);
     CSVEDirect::setU8(&ved, value);
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved);
 }
 
 void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint16 value)
@@ -166,7 +219,7 @@ void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint16 value)
     CSVEDirect::setId(&ved, regid);
     CSVEDirect::setFlags(&ved, 0);
     CSVEDirect::setU16(&ved, value);
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved);
 }
 
 void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint32 value)
@@ -176,14 +229,107 @@ void CSVeDirectAcDcCharger::sendSetRegister(quint16 regid, quint32 value)
     CSVEDirect::setId(&ved, regid);
     CSVEDirect::setFlags(&ved, 0);
     CSVEDirect::setU32(&ved, value);
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved);
 }
 
 void CSVeDirectAcDcCharger::sendPing()
 {
     CSVEDirect::ved_t ved;
     CSVEDirect::setCommand(&ved, VED_CMD_PING);
-    m_queue.append(ved);
+    m_scheduler.enqueue(ved);
+}
+
+/* latest value wins, released as soon as the link is free */
+void CSVeDirectAcDcCharger::streamSetRegister(quint16 regid, quint8 value)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_SET);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, 0);
+    CSVEDirect::setU8(&ved, value);
+    m_scheduler.stream(ved);
+    veSendCommandQueue();
+}
+
+void CSVeDirectAcDcCharger::streamSetRegister(quint16 regid, quint16 value)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_SET);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, 0);
+    CSVEDirect::setU16(&ved, value);
+    m_scheduler.stream(ved);
+    veSendCommandQueue();
+}
+
+void CSVeDirectAcDcCharger::streamSetRegister(quint16 regid, quint32 value)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_SET);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, 0);
+    CSVEDirect::setU32(&ved, value);
+    m_scheduler.stream(ved);
+    veSendCommandQueue();
+}
+
+/* PSU mode output voltage (0xEDE9) in 0.01V */
+void CSVeDirectAcDcCharger::setOutputVoltage(double voltage)
+{
+    streamSetRegister(0xEDE9, (quint16) qRound(voltage * 100.0));
+}
+
+void CSVeDirectAcDcCharger::sendFrame(const CSVEDirect::ved_t& ved, CSVeScheduler::TPriority prio)
+{
+    m_scheduler.enqueue(ved, prio);
+    veSendCommandQueue();
+}
+
+void CSVeDirectAcDcCharger::setSharedTick(bool shared)
+{
+    m_sharedTick = shared;
+    if (m_sharedTick) {
+        m_pollTimer.stop();
+    }
+}
+
+void CSVeDirectAcDcCharger::tick()
+{
+    vePollRegisters();
+}
+
+const CSVeDirectAcDcCharger::TLoad& CSVeDirectAcDcCharger::load() const
+{
+    return m_load;
+}
+
+CSVeScheduler* CSVeDirectAcDcCharger::scheduler()
+{
+    return &m_scheduler;
+}
+
+CSVeFrameRouter* CSVeDirectAcDcCharger::router()
+{
+    return &m_router;
+}
+
+CSVeProxyCache* CSVeDirectAcDcCharger::proxyCache()
+{
+    return &m_cache;
+}
+
+void CSVeDirectAcDcCharger::setCapture(CSVeCapture* capture)
+{
+    /* ports are added to the capture on start */
+    m_capture = capture;
+    m_capturePort[CSVeFrameRouter::FromCharger] = -1;
+    m_capturePort[CSVeFrameRouter::FromCerbo] = -1;
+    m_router.setCapture(nullptr, -1, -1);
+}
+
+CSVeDiscovery* CSVeDirectAcDcCharger::discovery()
+{
+    return &m_discovery;
 }
 
 bool CSVeDirectAcDcCharger::open()
@@ -240,13 +386,92 @@ void CSVeDirectAcDcCharger::onVedEchoInbound(const char c)
         if (m_portCharger.isOpen()) {
             m_portCharger.write(&c, 1);
             m_portCharger.waitForBytesWritten();
+            if (m_capture) {
+                m_capture->capture(m_capturePort[CSVeFrameRouter::FromCharger], CSVeCapture::DirWrite, &c, 1);
+            }
+        }
+    }
+}
+
+const CSVeRegisterStore& CSVeDirectAcDcCharger::store() const
+{
+    return m_store;
+}
+
+void CSVeDirectAcDcCharger::setHistoryCapacity(TRegisterClass cls, int capacity)
+{
+    m_history[cls] = qMax(0, capacity);
+
+    foreach (const CSVeRegisterStore::TSlot& slot, m_store.view()) {
+        if (slot.m_type != CSVeRegisterStore::TypeNone && registerClass(slot.m_regid) == cls) {
+            m_store.setHistory(slot.m_regid, m_history[cls]);
+        }
+    }
+}
+
+int CSVeDirectAcDcCharger::historyCapacity(TRegisterClass cls) const
+{
+    return m_history[cls];
+}
+
+const CSVeSampleRing* CSVeDirectAcDcCharger::history(quint16 regid) const
+{
+    return m_store.history(regid);
+}
+
+bool CSVeDirectAcDcCharger::isStale(quint16 regid) const
+{
+    return m_stale.contains(regid);
+}
+
+void CSVeDirectAcDcCharger::readSettings()
+{
+    foreach (quint16 regid, settingsRegisters()) {
+        if (!m_scheduler.isQueued(VED_CMD_GET, regid)) {
+            sendGetRegister(regid);
         }
     }
 }
 
-const QMap<quint16, QPair<float, QVariant>>& CSVeDirectAcDcCharger::values() const
+const QList<quint16>& CSVeDirectAcDcCharger::settingsRegisters()
 {
-    return m_values;
+    /* built once by the first caller of any thread */
+    static const QList<quint16> regids = []() {
+        QList<quint16> list;
+        for (quint16 regid = 0xEDF0; regid <= 0xEDFF; regid++) {
+            list << regid;
+        }
+        for (quint16 regid = 0xEDE0; regid <= 0xEDE9; regid++) {
+            list << regid;
+        }
+        list << 0xED2E << 0xEE16 << 0xEE17 << 0xE001;
+        /* battery voltage, written before all others on restore */
+        list << 0xEDEA;
+        return list;
+    }();
+    return regids;
+}
+
+CSVeDirectAcDcCharger::TRegisterClass CSVeDirectAcDcCharger::registerClass(quint16 regid)
+{
+    switch (regid) {
+        /* V, I, T of VE.Text, link and channel readings */
+        case 0xED8C:
+        case 0xED8D:
+        case 0xED8F:
+        case 0xEDD5:
+        case 0xEDD7:
+        case 0xEDDB:
+        case 0xEDEC:
+        case 0x2002:
+        case 0x2003:
+        case 0x200A: {
+            return ClassMeasurement;
+        }
+        default: {
+            return (settingsRegisters().contains(regid) ? ClassSetting : ClassState);
+        }
+    }
 }
 
 inline void CSVeDirectAcDcCharger::setupDefaults()
@@ -268,10 +493,31 @@ inline void CSVeDirectAcDcCharger::setupDefaults()
     m_configCerbo.m_stopBits = QSerialPort::OneStop;
     m_configCerbo.m_parity = QSerialPort::NoParity;
     m_configCerbo.m_flow = QSerialPort::NoFlowControl;
+
+    /* cyclic register polls */
+    m_pollTimer.setInterval(POLL_TICK_INTERVAL);
+    m_pollTimer.setSingleShot(false);
+
+    /* no settings timestamp, read all settings */
+    m_warmTimer.setInterval(WARM_START_TIMEOUT);
+    m_warmTimer.setSingleShot(true);
+
+    /* settings change by SET only, which invalidates */
+    foreach (quint16 regid, settingsRegisters()) {
+        m_cache.setTtl(regid, PROXY_SETTINGS_TTL);
+    }
+    m_router.setCache(&m_cache);
 }
 
 inline void CSVeDirectAcDcCharger::connectEvents()
 {
+    connect(&m_warmTimer, &QTimer::timeout, this, [this]() {
+        veWarmStartFailed("no response");
+    });
+    connect(&m_pollTimer, &QTimer::timeout, this, [this]() {
+        vePollRegisters();
+    });
+
     /* ..................................................
      * Blue Smart Charger Protocol to CarIOS
      * .................................................. */
@@ -284,52 +530,12 @@ inline void CSVeDirectAcDcCharger::connectEvents()
         veChargerSetTextField(f, v);
     });
     connect(&m_parserCharger, &CSVeParser::vedHexFrame, this, [this](const CSVeParser::TVeHexFrame& frame) {
-        switch (frame.command) {
-            case VED_CMD_PING_RESPONSE: {
-                return;
-            }
-            /* setting value messages */
-            case VED_CMD_GET: {
-                if (veUpdateData(frame)) {
-                    return;
-                }
-                break;
-            }
-            /* update setting messages */
-            case VED_CMD_SET: {
-                if (veDoSetData(frame)) {
-                    return;
-                }
-                break;
-            }
-            /* broadcast value messages */
-            case VED_CMD_ASYNC: {
-                if (veUpdateData(frame)) {
-                    return;
-                }
-                break;
-            }
-        }
-        QStringList finfo;
-        if (frame.flags & VED_FLAG_NOT_SUPPORTED) {
-            finfo << "not supported";
-        }
-        if (frame.flags & VED_FLAG_PARAM_ERROR) {
-            finfo << "parameter error";
-        }
-        if (frame.flags & VED_FLAG_UNK_ID) {
-            finfo << "unknown register";
-        }
-        qWarning( //
-           "[VE.CHR] UN-HANDLED: cmd=%2d [%s] id=%5d (0x%04X) Flags=0x%02X [%s] Size=%d %s",
-           frame.command,
-           m_parserCharger.toCmdStr(frame.command).constData(),
-           frame.regid,
-           frame.regid,
-           frame.flags,
-           finfo.join(";").toUtf8().constData(),
-           frame.ve_in.size,
-           frame.source.constData());
+        m_scheduler.noteAnswer(frame.command, frame.regid);
+        m_cache.update(frame);
+        veChargerHexFrame(frame);
+        emit hexFrameReceived(frame);
+        /* response frees a pipeline slot */
+        veSendCommandQueue();
     });
 
     /* ..................................................
@@ -362,7 +568,7 @@ inline bool CSVeDirectAcDcCharger::openInputPort()
         return true;
     }
 
-    m_values = {};
+    m_store.clear();
 
     m_portCharger.setPortName(m_configCharger.m_portName);
     m_portCharger.setBaudRate(m_configCharger.m_baudRate);
@@ -377,6 +583,12 @@ inline bool CSVeDirectAcDcCharger::openInputPort()
 
     /* cleanup */
     m_portCharger.flush();
+    m_cache.clear();
+
+    /* warm start with the device seen last on this port */
+    m_serial.clear();
+    m_stale.clear();
+    veRestoreSnapshot(CSVeSnapshot::lastSerial(m_configCharger.m_portName));
     return true;
 }
 
@@ -419,36 +631,183 @@ inline void CSVeDirectAcDcCharger::restartPorts()
     });
 }
 
-inline void CSVeDirectAcDcCharger::setRegister(quint16 regid, float scale, const QVariant& value)
+inline void CSVeDirectAcDcCharger::setRegister(quint16 regid, CSVeRegisterStore::TType type, qint8 exponent, qint64 raw)
+{
+    if (!m_store.contains(regid)) {
+        applyHistory(regid);
+    }
+    registerUpdated(regid, m_store.setNumber(regid, type, exponent, raw, m_stamp.m_time));
+}
+
+inline void CSVeDirectAcDcCharger::setRegister(quint16 regid, CSVeRegisterStore::TType type, const QByteArray& bytes)
+{
+    registerUpdated(regid, m_store.setBytes(regid, type, bytes, m_stamp.m_time));
+}
+
+inline void CSVeDirectAcDcCharger::registerUpdated(quint16 regid, bool changed)
 {
-    if (!m_values.contains(regid) || !m_values[regid].second.isValid() || m_values[regid].second != value) {
-        qDebug(
-           "[VE.CHR] SAVE regid: 0x%04X scale: %f value: %s", //
-           regid,
-           scale,
-           value.toString().toLocal8Bit().constData());
+    if (m_stale.remove(regid)) {
+        emit staleChanged(regid, false);
+    }
+    if (regid == 0xEC41 && m_warmStart) {
+        veSettingsChanged(m_store.value(regid).second);
+    }
+    if (!changed) {
+        return;
+    }
+
+    const QPair<float, QVariant> value = m_store.value(regid);
+    qDebug(
+       "[VE.CHR] SAVE regid: 0x%04X scale: %f value: %s", //
+       regid,
+       value.first,
+       value.second.toString().toLocal8Bit().constData());
+
+    emit dataChanged(regid, value, m_stamp);
+}
 
-        m_values[regid] = QPair<float, QVariant>(scale, value);
+/* not decoded from the port */
+inline CSVeParser::TStamp CSVeDirectAcDcCharger::localStamp() const
+{
+    return {CSVeParser::monotonicTime(), 0};
+}
 
-        emit dataChanged(regid, m_values[regid]);
+/* once per register and port session, the store keeps it */
+inline void CSVeDirectAcDcCharger::applyHistory(quint16 regid)
+{
+    const int capacity = m_history[registerClass(regid)];
+    if (capacity > 0) {
+        m_store.setHistory(regid, capacity);
     }
 }
 
-inline void CSVeDirectAcDcCharger::veHandleInput(CSVeParser* parser, QSerialPort* input, QSerialPort* output)
+inline bool CSVeDirectAcDcCharger::veRestoreSnapshot(const QString& serial)
 {
-    char c;
-    do {
-        if (input->read(&c, 1) < 1) {
-            break;
+    CSVeSnapshot::TValues values;
+    if (serial.isEmpty() || !CSVeSnapshot::load(serial, &values)) {
+        return false;
+    }
+
+    m_serial = serial;
+
+    /* fill in last known values, fresh ones win */
+    const CSVeParser::TStamp stamp = localStamp();
+    CSVeSnapshot::TValues::const_iterator it;
+    for (it = values.constBegin(); it != values.constEnd(); it++) {
+        if (m_store.contains(it.key())) {
+            continue;
         }
+        applyHistory(it.key());
+        if (!m_store.setValue(it.key(), it.value().first, it.value().second, stamp.m_time)) {
+            continue;
+        }
+        m_stale.insert(it.key());
+        emit dataChanged(it.key(), it.value(), stamp);
+        emit staleChanged(it.key(), true);
+    }
+
+    qDebug("[VE.CHR] WARM START %s: %d registers restored", //
+           qPrintable(serial),
+           m_stale.count());
+
+    /* only read all settings if changed since snapshot */
+    m_snapshotChanged = (values.contains(0xEC41) ? values[0xEC41].second : QVariant());
+    m_warmStart = true;
+    if (!m_scheduler.isSupported(0xEC41)) {
+        veWarmStartFailed("not supported");
+        return true;
+    }
+    m_warmTimer.start();
+    sendGetRegister(0xEC41, CSVeScheduler::PrioHigh);
+    return true;
+}
+
+inline void CSVeDirectAcDcCharger::veSaveSnapshot()
+{
+    if (m_serial.isEmpty() || m_store.isEmpty()) {
+        return;
+    }
+    if (!CSVeSnapshot::save(m_serial, m_store.toValues())) {
+        qWarning("[VE.CHR] Unable to write snapshot: %s", qPrintable(CSVeSnapshot::fileName(m_serial)));
+    }
+}
+
+inline void CSVeDirectAcDcCharger::veSerialChanged(const QString& serial)
+{
+    /* restored values belong to another device */
+    foreach (quint16 regid, m_stale) {
+        m_store.remove(regid);
+        emit dataChanged(regid, QPair<float, QVariant>(1, QVariant()), localStamp());
+        emit staleChanged(regid, false);
+    }
+    m_stale.clear();
+    m_warmStart = false;
+    m_warmTimer.stop();
+
+    CSVeSnapshot::setLastSerial(m_configCharger.m_portName, serial);
 
-        parser->handle(c);
+    if (!veRestoreSnapshot(serial)) {
+        /* cold start, unknown device */
+        m_serial = serial;
+        readSettings();
+    }
+}
 
-        if (output->isOpen()) {
-            output->write(&c, 1);
-            output->flush();
+inline void CSVeDirectAcDcCharger::veSettingsChanged(const QVariant& timestamp)
+{
+    m_warmStart = false;
+    m_warmTimer.stop();
+
+    if (m_snapshotChanged.isValid() && m_snapshotChanged == timestamp) {
+        qDebug("[VE.CHR] WARM START settings unchanged, skip reading settings");
+        foreach (quint16 regid, settingsRegisters()) {
+            if (m_stale.remove(regid)) {
+                emit staleChanged(regid, false);
+            }
         }
-    } while (!input->atEnd());
+        return;
+    }
+
+    readSettings();
+}
+
+/* 0xEC41 not readable, the restored settings may be stale */
+inline void CSVeDirectAcDcCharger::veWarmStartFailed(const char* reason)
+{
+    if (!m_warmStart) {
+        return;
+    }
+    m_warmStart = false;
+    m_warmTimer.stop();
+
+    qWarning("[VE.CHR] WARM START settings timestamp %s, reading settings", reason);
+    readSettings();
+}
+
+/* forwarded as whole frames by the router, never byte by byte */
+inline void CSVeDirectAcDcCharger::veHandleInput(CSVeParser* parser, QSerialPort* input, CSVeFrameRouter::TDirection direction)
+{
+    QElapsedTimer cpu;
+    cpu.start();
+
+    /* closest to the UART we get, all bytes of this read share it */
+    parser->setReadTime(CSVeParser::monotonicTime());
+
+    /* the whole read at once, kept as one chunk by a capture */
+    const QByteArray data = input->readAll();
+    if (m_capture) {
+        m_capture->capture(m_capturePort[direction], CSVeCapture::DirRead, data);
+    }
+
+    const char* c = data.constData();
+    const char* end = c + data.size();
+    for (; c < end; c++) {
+        parser->handle(*c);
+        m_router.feed(direction, *c);
+    }
+    m_load.m_bytes += data.size();
+
+    m_load.m_cpuNs += cpu.nsecsElapsed();
 }
 
 inline void CSVeDirectAcDcCharger::veChargerSetTextField(const QString& field, const QByteArray& value)
@@ -457,71 +816,149 @@ inline void CSVeDirectAcDcCharger::veChargerSetTextField(const QString& field, c
         return;
     }
 
+    m_stamp = m_parserCharger.textStamp();
+
     // qDebug() << "[VE.CHR] RECV> " << field << "value:" << value;
 
     /* product id -> 0xA330 */
     if (field == "PID") {
-        setRegister(0x00001, value.count(), value);
+        setRegister(0x0001, CSVeRegisterStore::TypeBytes, value);
         m_stateData.m_counter++;
     }
     /* firmware release 24bit -> 0342FF */
     else if (field == "FWE") {
-        setRegister(0x00002, value.count(), value);
+        setRegister(0x0002, CSVeRegisterStore::TypeBytes, value);
         m_stateData.m_counter++;
     }
     /* serial number -> HQ2247PTFUR */
     else if (field == "SER#") {
-        setRegister(0x00003, value.count(), value);
+        setRegister(0x0003, CSVeRegisterStore::TypeBytes, value);
         m_stateData.m_counter++;
+        const QString serial = QString::fromLatin1(value).trimmed();
+        if (serial != m_serial) {
+            veSerialChanged(serial);
+        }
     }
-    /* voltage -> 12850mV -> 12.850V */
+    /* voltage -> 12850mV -> 12.850V, stored as 0xED8D sn16 0.01V */
     else if (field == "V") {
-        setRegister(0xED8D, 0.001f, value.toDouble());
+        setRegister(0xED8D, CSVeRegisterStore::TypeS16, -2, qRound64(value.toDouble() / 10));
         m_stateData.m_counter++;
     }
-    /* current 0.400A */
+    /* current 0.400A, stored as 0xED8F sn16 0.1A */
     else if (field == "I") {
-        setRegister(0xED8F, 0.001f, value.toDouble());
+        setRegister(0xED8F, CSVeRegisterStore::TypeS16, -1, qRound64(value.toDouble() / 100));
         m_stateData.m_counter++;
     }
-    /* time? */
+    /* battery temperature in °C, stored as 0xEDEC un16 0.01K */
     else if (field == "T") {
         if (value.toUInt() != 0) {
-            setRegister(0x2009, 0.01f, value.toUInt());
+            setRegister(0xEDEC, CSVeRegisterStore::TypeU16, -2, qRound64((value.toDouble() + 273.15) * 100));
         }
         m_stateData.m_counter++;
     }
-    /* error code */
+    /* error code, as the link error code 0x2009 */
     else if (field == "ERR") {
         if (value.toInt() != 0) {
-            setRegister(0x2009, 1, value.toInt());
+            setRegister(0x2009, CSVeRegisterStore::TypeU8, 0, value.toInt());
         }
         m_stateData.m_counter++;
     }
     /* work mode status */
     else if (field == "CS") {
         if (value.toInt() == 11) {
-            setRegister(0x0206, 1, 1);
+            setRegister(0x0206, CSVeRegisterStore::TypeU8, 0, 1);
         }
         else {
-            setRegister(0x0206, 1, 0);
+            setRegister(0x0206, CSVeRegisterStore::TypeU8, 0, 0);
         }
-        setRegister(0x0201, 1, value.toInt());
+        setRegister(0x0201, CSVeRegisterStore::TypeU8, 0, value.toInt());
         m_stateData.m_counter++;
     }
     /* should be the last one */
     else if (field == "HC#") {
-        setRegister(0x0004, value.count(), value);
+        setRegister(0x0004, CSVeRegisterStore::TypeBytes, value);
         m_stateData.m_counter++;
     }
 
+    /* capabilities of product and firmware */
+    if ((field == "PID" || field == "FWE") && m_store.contains(0x0001) && m_store.contains(0x0002)) {
+        m_discovery.start(m_store.text(0x0001), m_store.text(0x0002));
+    }
+
     if (m_stateData.m_counter >= 9) {
         m_stateData.m_counter = 0;
         veSendCommandQueue();
     }
 }
 
-inline void CSVeDirectAcDcCharger::veSendFrameTo(CSVEDirect::ved_t* ved, QSerialPort* port)
+inline void CSVeDirectAcDcCharger::veChargerHexFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    m_stamp = frame.stamp;
+
+    /* error or unknown id instead of the settings timestamp */
+    if (m_warmStart && frame.command == VED_CMD_GET && frame.regid == 0xEC41 && frame.flags) {
+        veWarmStartFailed((frame.flags & VED_FLAG_UNK_ID) ? "unknown" : "error");
+    }
+
+    /* probe response of the register discovery, no warnings */
+    if (m_discovery.handleFrame(frame)) {
+        if (!frame.flags) {
+            veUpdateData(frame);
+        }
+        return;
+    }
+
+    switch (frame.command) {
+        case VED_CMD_PING_RESPONSE: {
+            return;
+        }
+        /* setting value messages */
+        case VED_CMD_GET: {
+            m_scheduler.noteResponse(frame.regid);
+            if (veUpdateData(frame)) {
+                return;
+            }
+            break;
+        }
+        /* update setting messages */
+        case VED_CMD_SET: {
+            if (veDoSetData(frame)) {
+                return;
+            }
+            break;
+        }
+        /* broadcast value messages */
+        case VED_CMD_ASYNC: {
+            m_scheduler.noteBroadcast(frame.regid);
+            if (veUpdateData(frame)) {
+                return;
+            }
+            break;
+        }
+    }
+    QStringList finfo;
+    if (frame.flags & VED_FLAG_NOT_SUPPORTED) {
+        finfo << "not supported";
+    }
+    if (frame.flags & VED_FLAG_PARAM_ERROR) {
+        finfo << "parameter error";
+    }
+    if (frame.flags & VED_FLAG_UNK_ID) {
+        finfo << "unknown register";
+    }
+    qWarning( //
+       "[VE.CHR] UN-HANDLED: cmd=%2d [%s] id=%5d (0x%04X) Flags=0x%02X [%s] Size=%d %s",
+       frame.command,
+       m_parserCharger.toCmdStr(frame.command).constData(),
+       frame.regid,
+       frame.regid,
+       frame.flags,
+       finfo.join(";").toUtf8().constData(),
+       frame.ve_in.size,
+       frame.source.constData());
+}
+
+inline QByteArray CSVeDirectAcDcCharger::veEncodeFrame(CSVEDirect::ved_t* ved, QSerialPort* port)
 {
     quint16 regid;
     quint8 cmd, flags;
@@ -534,44 +971,100 @@ inline void CSVeDirectAcDcCharger::veSendFrameTo(CSVEDirect::ved_t* ved, QSerial
            ? CSVEDirect::getFlags(ved)
            : 0);
 
-    /* encode to VE.HEX frame and send */
-    if (CSVEDirect::enframe(ved)) {
-        QByteArray outbuf((char*) ved->data, ved->size);
-        QByteArray oport = port->portName().toLocal8Bit();
-        if (ved->size) {
-            qDebug( //
-               "[VE.%s] SEND> cmd=%d [%s] id=0x%04X Flags=0x%02X %s",
-               oport.constData(),
-               cmd,
-               m_parserCharger.toCmdStr(cmd).constData(),
-               regid,
-               flags,
-               outbuf.left(outbuf.length() - 1).constData());
-        }
-        port->flush();
-        port->write("\n" + outbuf);
-        port->waitForBytesWritten();
+    /* encode to VE.HEX frame */
+    if (!CSVEDirect::enframe(ved) || !ved->size) {
+        return QByteArray();
     }
+
+    QByteArray outbuf((char*) ved->data, ved->size);
+    QByteArray oport = port->portName().toLocal8Bit();
+    qDebug( //
+       "[VE.%s] SEND> cmd=%d [%s] id=0x%04X Flags=0x%02X %s",
+       oport.constData(),
+       cmd,
+       m_parserCharger.toCmdStr(cmd).constData(),
+       regid,
+       flags,
+       outbuf.left(outbuf.length() - 1).constData());
+
+    return "\n" + outbuf;
 }
 
 inline void CSVeDirectAcDcCharger::veSendToCerboGx(CSVEDirect::ved_t* ved)
 {
-    veSendFrameTo(ved, &m_portCerbo);
+    const QByteArray frame = veEncodeFrame(ved, &m_portCerbo);
+    if (!frame.isEmpty()) {
+        m_router.sendToCerbo(frame);
+    }
 }
 
-inline void CSVeDirectAcDcCharger::veSendToCharger(CSVEDirect::ved_t* ved)
+/* written at a frame boundary, arbitrated with Cerbo GX commands */
+inline void CSVeDirectAcDcCharger::veSendToCharger(CSVEDirect::ved_t* ved, CSVeScheduler::TPriority prio)
 {
-    veSendFrameTo(ved, &m_portCharger);
+    const QByteArray frame = veEncodeFrame(ved, &m_portCharger);
+    if (!frame.isEmpty()) {
+        m_router.submit(frame, prio);
+    }
 }
 
 inline void CSVeDirectAcDcCharger::veSendCommandQueue()
 {
-    if (m_queue.isEmpty()) {
+    if (!m_portCharger.isOpen()) {
+        return;
+    }
+
+    /* pipelined up to the scheduler window */
+    CSVEDirect::ved_t ved = {};
+    CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal;
+    while (m_scheduler.takeNext(&ved, &prio)) {
+        veSendToCharger(&ved, prio);
+    }
+}
+
+inline void CSVeDirectAcDcCharger::vePollRegisters()
+{
+    if (!m_portCharger.isOpen()) {
         return;
     }
 
-    CSVEDirect::ved_t ved = m_queue.takeFirst();
-    veSendToCharger(&ved);
+    QElapsedTimer cpu;
+    cpu.start();
+    m_load.m_ticks++;
+
+    /* broadcast fresh registers are skipped by the scheduler */
+    foreach (quint16 regid, m_scheduler.duePolls()) {
+        if (!m_scheduler.isQueued(VED_CMD_GET, regid)) {
+            sendGetRegister(regid);
+        }
+    }
+
+    /* background register discovery */
+    m_discovery.pump();
+
+    /* idle link, no VE.Text block to wait for */
+    if (m_scheduler.expireInflight() || !m_scheduler.inflightCount()) {
+        veSendCommandQueue();
+    }
+
+    const qint64 now = m_scheduler.elapsed();
+    if (now - m_lastReport >= POLL_REPORT_INTERVAL) {
+        m_lastReport = now;
+        veSaveSnapshot();
+        foreach (const QString& line, m_scheduler.report()) {
+            qDebug() << "[VE.CHR] POLL" << line.toUtf8().constData();
+        }
+        foreach (const QString& line, m_scheduler.streamReport()) {
+            qDebug() << "[VE.CHR] STREAM" << line.toUtf8().constData();
+        }
+        foreach (const QString& line, m_router.report()) {
+            qDebug() << "[VE.CHR] ROUTE" << line.toUtf8().constData();
+        }
+        foreach (const QString& line, m_cache.report()) {
+            qDebug() << "[VE.CHR] CACHE" << line.toUtf8().constData();
+        }
+    }
+
+    m_load.m_cpuNs += cpu.nsecsElapsed();
 }
 
 /* Cerbo GX to Blue Smart Charger */
@@ -597,6 +1090,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
     CSVEDirect::ved_t* ved_in = &hf.ve_in;
     double value = 0.0f;
     float scale = 1.0f;
+    /* wire type of the register, signed ones sign extended */
+    CSVeRegisterStore::TType type = CSVeRegisterStore::TypeNone;
 
     /* invalid frame, at least one byte data payload required */
     if (ved_in->size < 5) {
@@ -605,70 +1100,87 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
         return false;
     }
 
+    /* older cycle records, consumed by the history sync */
+    if (frame.regid > 0x1070 && frame.regid <= 0x1098) {
+        return true;
+    }
+
     switch (frame.regid) {
         /* VE_REG_GROUP_ID */
         case 0x0104: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* VE_REG_IDENTIFY or VE_REG_CAN_SELECT */
         case 0x010E: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* VE_REG_CHR_NUMBER_OUTPUTS */
         case 0xEDDE: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* VE_REG_CAPABILITIES1 */
         case 0x0140: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* VE_REG_CAPABILITIES4 */
         case 0x0143: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* VE_REG_AC_IN_1_CURRENT_LIMIT */
         case 0x0210: {
             value = CSVEDirect::getU16(ved_in);
-            scale = 1 / 100;
+            type = CSVeRegisterStore::TypeU16;
+            scale = 0.01f;
             break;
         }
         /* VE_REG_CHR_MIN_CURRENT */
         case 0xEDC8: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.1f;
             break;
         }
         /* VE_REG_LINK_NETWORK_STATUS */
         case 0x200F: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* VE_REG_LINK_CHARGE_CURRENT_LIMIT */
         case 0x2015: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.001f;
             break;
         }
         /* VE_REG_LINK_VSENSE */
         case 0x2002: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
         /* VE_REG_LINK_TSENSE */
         case 0x2003: {
-            value = CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.01f;
             break;
         }
         /* VE_REG_LINK_BATTERY_CURRENT */
         case 0x200A: {
-            value = CSVEDirect::getU32(ved_in);
+            value = (qint32) CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeS32;
             break;
         }
         /* VE_REG_DESCRIPTION1 */
@@ -681,7 +1193,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
                "[VE.CHR] SAVE regid: 0x%04X value: %s", //
                frame.regid,
                buffer.constData());
-            setRegister(frame.regid, scale, buffer);
+            setRegister(frame.regid, CSVeRegisterStore::TypeBytes, buffer);
             return true;
         }
         /* VE_REG_HISTORY_CYCLE_SEQUENCE_NUMBER
@@ -715,12 +1227,14 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x1099: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* The number of charge cycle history records.
          * un8 */
         case 0x106F: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* VE_REG_UPTIME un32
@@ -754,6 +1268,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x0201: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Device Function
@@ -762,6 +1277,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x0206: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Device off reason 2
@@ -787,6 +1303,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * :A0D200000001E */
         case 0x0207: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* Charger "link" network info (this reports the
@@ -794,6 +1311,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x200D: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             break;
         }
         /* Charger link  equalisation pending?
@@ -801,6 +1319,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2018: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Blue Power Charger - low current mode
@@ -808,6 +1327,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xE001: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Blue Power Charger - low current mode time left
@@ -816,6 +1336,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xE002: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* Date/time of last change of the "settings"
@@ -823,6 +1344,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEC41: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* Battery Re-bulk Offset Voltage & Level un16
@@ -835,6 +1357,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xED2E: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -844,7 +1367,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          *
          * output voltage - same is 0xEDD5 */
         case 0xED8D: {
-            value = CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.01f;
             break;
         }
@@ -855,6 +1379,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDD4: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Charger specific parameters - actual charge voltage
@@ -864,6 +1389,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * output voltage - same is 0xED8D */
         case 0xEDD5: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -875,7 +1401,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * value=3060 -> 30.6°C
          */
         case 0xEDDB: {
-            value = (float) CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.01f;
             break;
         }
@@ -886,6 +1413,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE0: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -895,6 +1423,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE1: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.1f;
             break;
         }
@@ -908,6 +1437,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE2: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -921,6 +1451,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE3: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -935,6 +1466,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE4: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Battery Equalisation Auto Stop
@@ -949,6 +1481,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE5: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Low-temp charge current
@@ -959,6 +1492,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE6: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.1f;
             break;
         }
@@ -972,6 +1506,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDE7: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.1f;
             break;
         }
@@ -987,6 +1522,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF0: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.1f;
             break;
         }
@@ -999,6 +1535,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF1: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Charger battery parameters - temperature compensation
@@ -1014,7 +1551,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * value=-1620 -> -16.20 mV/°C
          */
         case 0xEDF2: {
-            value = CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.01f;
             break;
         }
@@ -1028,6 +1566,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF4: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1045,6 +1584,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF5: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1062,6 +1602,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF6: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1079,6 +1620,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF7: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1092,6 +1634,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF8: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1104,6 +1647,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDF9: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1116,6 +1660,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFA: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1127,6 +1672,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFB: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1136,6 +1682,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFC: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             break;
         }
         /* Charger battery parameters - traction curve/auto
@@ -1150,6 +1697,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFD: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Charger battery parameters - adaptive mode un8
@@ -1164,6 +1712,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFE: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Charger battery parameters - battery safe mode (un8)
@@ -1175,12 +1724,14 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEDFF: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Battery Used VSense (un16) "[0.01V]"
          * 0xFFFF = Not Available */
         case 0xEE16: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1218,7 +1769,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
             offset += 4;
             values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
             offset += 4;
-            setRegister(frame.regid, scale, QVariant::fromValue(values));
+            setRegister(frame.regid, CSVeRegisterStore::TypeString, values.toUtf8());
             return true;
         }
         /* Table
@@ -1250,7 +1801,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
             offset += 4;
             values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
             offset += 4;
-            setRegister(frame.regid, scale, QVariant::fromValue(values));
+            setRegister(frame.regid, CSVeRegisterStore::TypeString, values.toUtf8());
             return true;
         }
         /* Table
@@ -1275,41 +1826,28 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * value of 0xFF/0xFFFF/0xFFFFFFFF (depending on the type)
          * indicates that a field is unknown/not available */
         case 0x1070: {
+            CSVeHistorySync::TCycleRecord r = {};
+            if (!CSVeHistorySync::decode(ved_in, &r)) {
+                return false;
+            }
             QString values;
-            uint offset = 0;
-            values.append(tr("%1 ").arg(CSVeParser::readU8(ved_in, &(offset))));
-            offset += 1;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU32(ved_in, &(offset))));
-            offset += 4;
-            values.append(tr("%1 ").arg(CSVeParser::readU16(ved_in, &(offset))));
-            offset += 2;
-            values.append(tr("%1 ").arg(CSVeParser::readU16(ved_in, &(offset))));
-            offset += 2;
-            values.append(tr("%1 ").arg(CSVeParser::readU8(ved_in, &(offset))));
-            offset += 1;
-            values.append(tr("%1 ").arg(CSVeParser::readU8(ved_in, &(offset))));
-            offset += 1;
-            setRegister(frame.regid, scale, QVariant::fromValue(values));
+            values.append(tr("%1 ").arg(r.m_version));
+            values.append(tr("%1 ").arg(r.m_startTime));
+            values.append(tr("%1 ").arg(r.m_bulkTime));
+            values.append(tr("%1 ").arg(r.m_absTime));
+            values.append(tr("%1 ").arg(r.m_reconTime));
+            values.append(tr("%1 ").arg(r.m_floatTime));
+            values.append(tr("%1 ").arg(r.m_storageTime));
+            values.append(tr("%1 ").arg(r.m_bulkCharge));
+            values.append(tr("%1 ").arg(r.m_absCharge));
+            values.append(tr("%1 ").arg(r.m_reconCharge));
+            values.append(tr("%1 ").arg(r.m_floatCharge));
+            values.append(tr("%1 ").arg(r.m_storageCharge));
+            values.append(tr("%1 ").arg(r.m_startVoltage));
+            values.append(tr("%1 ").arg(r.m_endVoltage));
+            values.append(tr("%1 ").arg(r.m_typeReason));
+            values.append(tr("%1 ").arg(r.m_error));
+            setRegister(frame.regid, CSVeRegisterStore::TypeString, values.toUtf8());
             return true;
         }
 
@@ -1330,6 +1868,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEC12: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             break;
         }
         /* The network key for BLE networking.
@@ -1346,6 +1885,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2001: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1355,6 +1895,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2007: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* Charger "link" solar absorption time
@@ -1363,6 +1904,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2008: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             break;
         }
         /* Charger "link" error code (@remark an external network master
@@ -1372,6 +1914,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2009: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Charger "link" absorption end time
@@ -1381,6 +1924,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2042: {
             value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             break;
         }
         /* Charger "link" device state (@remark share the
@@ -1390,6 +1934,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x200C: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* Unix timestamp ??
@@ -1399,6 +1944,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x2013: {
             value = CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeU32;
             break;
         }
         /* Charger "link" network mode un8:
@@ -1412,6 +1958,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0x200E: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* NumberOfInRangeDevices {un8 NumberOfInRangeDevices}
@@ -1423,6 +1970,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * :A30EC00012E */
         case 0xEC30: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* BLE networking devices in range list
@@ -1460,7 +2008,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
             offset += 1;
             values.append(CSVeParser::readU32(ved_in, &(offset)));
             offset += 4;
-            setRegister(frame.regid, scale, QVariant::fromValue(values));
+            setRegister(frame.regid, CSVeRegisterStore::TypeString, values.toUtf8());
             return true;
             break;
         }
@@ -1469,6 +2017,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * :A16EC000445 */
         case 0xEC16: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* BLE networking reception list
@@ -1501,6 +2050,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * :A15EC00004A */
         case 0xEC15: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         /* DC Channel 1 Current
@@ -1508,7 +2058,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * 0x7FFFFFFF = Not Available
          * value=450 -> 450mA -> 0.45A */
         case 0xED8C: {
-            value = (float) (CSVEDirect::getU32(ved_in));
+            value = (qint32) CSVEDirect::getU32(ved_in);
+            type = CSVeRegisterStore::TypeS32;
             scale = 0.001f;
             break;
         }
@@ -1516,7 +2067,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * sn16 current "[0.1A]" read-only
          * :A8FED000100CE */
         case 0xED8F: {
-            value = (float) CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.1f;
             break;
         }
@@ -1525,7 +2077,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * HEX protocol compat. data present in regular NMEA pgn
          */
         case 0xEDD7: {
-            value = (float) CSVEDirect::getU16(ved_in);
+            value = (qint16) CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeS16;
             scale = 0.1f;
             break;
         }
@@ -1541,7 +2094,8 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          * value=1280 -> 12.80V
          */
         case 0xEDE9: {
-            value = (float) CSVEDirect::getU16(ved_in);
+            value = CSVEDirect::getU16(ved_in);
+            type = CSVeRegisterStore::TypeU16;
             scale = 0.01f;
             break;
         }
@@ -1551,6 +2105,7 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
          */
         case 0xEE17: {
             value = CSVEDirect::getU8(ved_in);
+            type = CSVeRegisterStore::TypeU8;
             break;
         }
         default: {
@@ -1558,7 +2113,14 @@ inline bool CSVeDirectAcDcCharger::veUpdateData(const CSVeParser::TVeHexFrame& f
         }
     }
 
-    setRegister(frame.regid, scale, value);
+    /* not decoded, payload width only */
+    if (type == CSVeRegisterStore::TypeNone) {
+        const int width = ved_in->size - 4;
+        type = (width == 1   ? CSVeRegisterStore::TypeU8
+                : width == 2 ? CSVeRegisterStore::TypeU16
+                             : CSVeRegisterStore::TypeU32);
+    }
+    setRegister(frame.regid, type, CSVeRegisterStore::exponentOf(scale), (qint64) value);
 
     return true;
 }
@@ -5,11 +5,21 @@
  * SPDX-License-Identifier: MIT License
  **********************************************************************/
 #pragma once
+#include <QElapsedTimer>
 #include <QMap>
 #include <QObject>
 #include <QSerialPort>
+#include <QSet>
 #include <QSharedData>
+#include <QTimer>
+#include <csvecapture.h>
 #include <csvedirect.h>
+#include <csvediscovery.h>
+#include <csveframerouter.h>
+#include <csveproxycache.h>
+#include <csveregisterstore.h>
+#include <csvescheduler.h>
+#include <csvesnapshot.h>
 
 class CSVeDirectAcDcCharger: public QObject
 {
@@ -66,6 +76,21 @@ public:
         uint m_counter;
     } TStateData;
 
+    /* sample history capacity is set per class */
+    typedef enum {
+        ClassMeasurement = 0,
+        ClassState,
+        ClassSetting,
+        ClassCount,
+    } TRegisterClass;
+
+    /* time spent in input handling and polls, per charger */
+    typedef struct {
+        qint64 m_cpuNs;
+        quint64 m_bytes;
+        quint32 m_ticks;
+    } TLoad;
+
     explicit CSVeDirectAcDcCharger(QObject* parent = nullptr);
 
     ~CSVeDirectAcDcCharger();
@@ -75,23 +100,78 @@ public:
 
     void setPowerSupply();
     void setBatteryCharger();
-    void sendGetRegister(quint16 regid);
+    void sendGetRegister(quint16 regid, CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal);
     void sendSetRegister(quint16 regid, const QString& value);
     void sendSetRegister(quint16 regid, quint8 value);
     void sendSetRegister(quint16 regid, quint16 value);
     void sendSetRegister(quint16 regid, quint32 value);
     void sendPing();
+    void streamSetRegister(quint16 regid, quint8 value);
+    void streamSetRegister(quint16 regid, quint16 value);
+    void streamSetRegister(quint16 regid, quint32 value);
+    void setOutputVoltage(double voltage);
+    void sendFrame(const CSVEDirect::ved_t& ved, CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal);
+
+    /**
+     * @brief setSharedTick Polls are driven by tick() of a device
+     * manager instead of the own poll timer.
+     * @param shared
+     */
+    void setSharedTick(bool shared);
+    void tick();
+    const TLoad& load() const;
+
+    CSVeScheduler* scheduler();
+    CSVeDiscovery* discovery();
+    CSVeFrameRouter* router();
+    CSVeProxyCache* proxyCache();
+    /**
+     * @brief setCapture Log the raw bytes read from and written to
+     * both ports, from the next startVEDirect() on
+     * @param capture nullptr = off
+     */
+    void setCapture(CSVeCapture* capture);
 
     const TVedConfig& configOut() const;
     const TVedConfig& configIn() const;
 
-    const QMap<quint16, QPair<float, QVariant>>& values() const;
+    const CSVeRegisterStore& store() const;
+    /**
+     * @brief setHistoryCapacity Keep the last samples of all
+     * integer registers of a class, off by default.
+     * @param cls
+     * @param capacity Samples per register, 0 = off
+     */
+    void setHistoryCapacity(TRegisterClass cls, int capacity);
+    int historyCapacity(TRegisterClass cls) const;
+    /**
+     * @brief history Recent raw samples, scaled by the exponent of
+     * the register in store()
+     * @param regid
+     * @return nullptr if not kept
+     */
+    const CSVeSampleRing* history(quint16 regid) const;
+    bool isStale(quint16 regid) const;
+    void readSettings();
+
+    static const QList<quint16>& settingsRegisters();
+    static TRegisterClass registerClass(quint16 regid);
 
     void setConfigOut(const CSVeDirectAcDcCharger::TVedConfig& newConfigOut);
     void setConfigIn(const CSVeDirectAcDcCharger::TVedConfig& newConfigIn);
 
 signals:
-    void dataChanged(uint regid, const QPair<float, QVariant>&);
+    /**
+     * @brief dataChanged Register value changed
+     * @param regid
+     * @param value Scale / value pair, invalid value if removed
+     * @param stamp Read time and block sequence of the VE.Text
+     * block or VE.HEX frame that carried the value; sequence 0 for
+     * values restored from or removed with a snapshot
+     */
+    void dataChanged(uint regid, const QPair<float, QVariant>& value, const CSVeParser::TStamp& stamp);
+    void staleChanged(uint regid, bool stale);
+    void hexFrameReceived(const CSVeParser::TVeHexFrame& frame);
 
 protected:
     bool open();
@@ -111,10 +191,31 @@ private:
     CSVeParser m_parserCharger;
     CSVeParser m_parserCerbo;
 
-    QMap<quint16, QPair<float, QVariant>> m_values;
+    CSVeRegisterStore m_store;
+    /* stamp of the block or frame being decoded */
+    CSVeParser::TStamp m_stamp;
+    int m_history[ClassCount];
+
+    /* warm start */
+    QSet<quint16> m_stale;
+    QString m_serial;
+    QVariant m_snapshotChanged;
+    bool m_warmStart;
+    QTimer m_warmTimer;
 
     TStateData m_stateData;
-    QList<CSVEDirect::ved_t> m_queue;
+
+    CSVeScheduler m_scheduler;
+    CSVeDiscovery m_discovery;
+    QTimer m_pollTimer;
+    bool m_sharedTick;
+    qint64 m_lastReport;
+    TLoad m_load;
+    CSVeFrameRouter m_router;
+    CSVeProxyCache m_cache;
+    CSVeCapture* m_capture;
+    /* capture port index by the direction read from the port */
+    int m_capturePort[CSVeFrameRouter::Directions];
 
 private:
     inline void setupDefaults();
@@ -122,13 +223,24 @@ private:
     inline bool openInputPort();
     inline bool openOutputPort();
     inline void restartPorts();
-    inline void setRegister(quint16 regid, float scale, const QVariant& value);
-    inline void veHandleInput(CSVeParser* parser, QSerialPort* input, QSerialPort* output);
+    inline void setRegister(quint16 regid, CSVeRegisterStore::TType type, qint8 exponent, qint64 raw);
+    inline void setRegister(quint16 regid, CSVeRegisterStore::TType type, const QByteArray& bytes);
+    inline void registerUpdated(quint16 regid, bool changed);
+    inline void applyHistory(quint16 regid);
+    inline CSVeParser::TStamp localStamp() const;
+    inline bool veRestoreSnapshot(const QString& serial);
+    inline void veSaveSnapshot();
+    inline void veSerialChanged(const QString& serial);
+    inline void veSettingsChanged(const QVariant& timestamp);
+    inline void veWarmStartFailed(const char* reason);
+    inline void veHandleInput(CSVeParser* parser, QSerialPort* input, CSVeFrameRouter::TDirection direction);
     inline void veChargerSetTextField(const QString& field, const QByteArray& value);
     inline void veSendCommandQueue();
-    inline void veSendToCharger(CSVEDirect::ved_t* ve_out);
+    inline void vePollRegisters();
+    inline void veChargerHexFrame(const CSVeParser::TVeHexFrame& frame);
+    inline void veSendToCharger(CSVEDirect::ved_t* ve_out, CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal);
     inline void veSendToCerboGx(CSVEDirect::ved_t* ve_out);
-    inline void veSendFrameTo(CSVEDirect::ved_t* ved, QSerialPort* port);
+    inline QByteArray veEncodeFrame(CSVEDirect::ved_t* ved, QSerialPort* port);
     inline bool veDoSetData(const CSVeParser::TVeHexFrame& frame);
     inline bool veUpdateData(const CSVeParser::TVeHexFrame& frame);
 };
@@ -0,0 +1,350 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <csvediscovery.h>
+
+/* capability cache file header */
+static const quint32 CACHE_MAGIC = 0x56454350; // VECP
+static const quint16 CACHE_VERSION = 1;
+
+CSVeDiscovery::CSVeDiscovery(CSVeScheduler* scheduler, QObject* parent)
+    : QObject(parent)
+    , m_scheduler(scheduler)
+    , m_ranges()
+    , m_registers()
+    , m_pending()
+    , m_probes()
+    , m_pid()
+    , m_firmware()
+    , m_autoScan(true)
+    , m_scanning(false)
+    , m_total(0)
+{
+    /* register blocks known from Blue Smart / Phoenix chargers */
+    m_ranges << TRange(0x0100, 0x0150) //
+             << TRange(0x0200, 0x0210)
+             << TRange(0x1040, 0x1043)
+             << TRange(0x1060, 0x1070)
+             << TRange(0x1099, 0x1099)
+             << TRange(0x2000, 0x2042)
+             << TRange(0xE000, 0xE010)
+             << TRange(0xEC00, 0xEC41)
+             << TRange(0xED00, 0xEDFF)
+             << TRange(0xEE00, 0xEE20);
+}
+
+void CSVeDiscovery::setRanges(const QList<TRange>& ranges)
+{
+    m_ranges = ranges;
+}
+
+const QList<CSVeDiscovery::TRange>& CSVeDiscovery::ranges() const
+{
+    return m_ranges;
+}
+
+void CSVeDiscovery::setAutoScan(bool enabled)
+{
+    m_autoScan = enabled;
+}
+
+void CSVeDiscovery::start(const QString& pid, const QString& firmware)
+{
+    if (pid.isEmpty() || firmware.isEmpty()) {
+        return;
+    }
+    if (pid == m_pid && firmware == m_firmware) {
+        return;
+    }
+
+    stop();
+
+    m_pid = pid;
+    m_firmware = firmware;
+    m_registers.clear();
+
+    if (loadCache()) {
+        qDebug().noquote() << "[VE.CHR] DISCOVERY cache hit:" << cacheFile();
+        applyCapabilities();
+
+        /* probes that timed out are not cached, ask those again */
+        QList<quint16> missing;
+        foreach (quint16 regid, rangeRegisters()) {
+            if (!m_registers.contains(regid)) {
+                missing.append(regid);
+            }
+        }
+        if (missing.isEmpty() || !m_autoScan) {
+            emit scanFinished();
+            return;
+        }
+        scan(missing);
+        return;
+    }
+
+    if (m_autoScan) {
+        rescan();
+    }
+}
+
+void CSVeDiscovery::rescan()
+{
+    if (m_pid.isEmpty() || m_firmware.isEmpty()) {
+        return;
+    }
+
+    stop();
+    m_registers.clear();
+    scan(rangeRegisters());
+}
+
+void CSVeDiscovery::stop()
+{
+    m_pending.clear();
+    m_probes.clear();
+    m_scanning = false;
+}
+
+void CSVeDiscovery::pump()
+{
+    if (!m_scanning) {
+        return;
+    }
+
+    const qint64 now = m_scheduler->elapsed();
+
+    /* time out probes, restart the clock while still queued */
+    QList<quint16> probes = m_probes.keys();
+    foreach (quint16 regid, probes) {
+        QPair<qint64, int>& probe = m_probes[regid];
+        if (m_scheduler->isQueued(VED_CMD_GET, regid)) {
+            probe.first = now;
+            continue;
+        }
+        if (now - probe.first < SCAN_TIMEOUT) {
+            continue;
+        }
+        if (probe.second < SCAN_RETRIES) {
+            probe.first = now;
+            probe.second++;
+            m_pending.prepend(regid);
+        }
+        else {
+            record(regid, RegNoResponse, 0);
+        }
+    }
+
+    while (!m_pending.isEmpty() && m_scheduler->queuedCount(CSVeScheduler::PrioBackground) < SCAN_WINDOW) {
+        quint16 regid = m_pending.takeFirst();
+
+        CSVEDirect::ved_t ved = {};
+        CSVEDirect::setCommand(&ved, VED_CMD_GET);
+        CSVEDirect::setId(&ved, regid);
+        CSVEDirect::setFlags(&ved, 0);
+        m_scheduler->enqueue(ved, CSVeScheduler::PrioBackground);
+
+        if (!m_probes.contains(regid)) {
+            m_probes[regid] = QPair<qint64, int>(now, 0);
+        }
+    }
+
+    if (m_pending.isEmpty() && m_probes.isEmpty()) {
+        finish();
+    }
+}
+
+bool CSVeDiscovery::handleFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    if (frame.command != VED_CMD_GET && frame.command != VED_CMD_ASYNC) {
+        return false;
+    }
+
+    const bool probed = (frame.command == VED_CMD_GET && m_probes.contains(frame.regid));
+    if (!probed && !m_scanning) {
+        return false;
+    }
+
+    quint8 status = RegSupported;
+    if (frame.flags & VED_FLAG_UNK_ID) {
+        status = RegUnknownId;
+    }
+    else if (frame.flags & VED_FLAG_NOT_SUPPORTED) {
+        status = RegNotSupported;
+    }
+    else if (frame.flags & VED_FLAG_PARAM_ERROR) {
+        status = RegParamError;
+    }
+
+    /* payload without command, id and flags */
+    const quint8 size = (frame.ve_in.size > 4 ? frame.ve_in.size - 4 : 0);
+
+    /* foreign traffic during scan tells us about support too */
+    if (!probed) {
+        if (status == RegSupported && !m_registers.contains(frame.regid)) {
+            record(frame.regid, status, size);
+        }
+        return false;
+    }
+
+    record(frame.regid, status, size);
+    emit scanProgress(m_total - m_pending.count() - m_probes.count(), m_total);
+    return true;
+}
+
+bool CSVeDiscovery::isScanning() const
+{
+    return m_scanning;
+}
+
+bool CSVeDiscovery::isStarted() const
+{
+    return !m_pid.isEmpty();
+}
+
+const QMap<quint16, CSVeDiscovery::TRegInfo>& CSVeDiscovery::registers() const
+{
+    return m_registers;
+}
+
+QString CSVeDiscovery::cacheFile() const
+{
+    static const QRegularExpression invalid("[^A-Za-z0-9]");
+
+    QString pid = m_pid;
+    QString fwe = m_firmware;
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    return QDir(path).filePath(tr("capabilities/%1_%2.cap").arg(pid.remove(invalid), fwe.remove(invalid)));
+}
+
+inline QList<quint16> CSVeDiscovery::rangeRegisters() const
+{
+    QList<quint16> regids;
+    QSet<quint16> unique;
+    foreach (const TRange& range, m_ranges) {
+        for (uint regid = range.first; regid <= range.second; regid++) {
+            if (!unique.contains(regid)) {
+                unique.insert(regid);
+                regids.append(regid);
+            }
+        }
+    }
+    return regids;
+}
+
+inline void CSVeDiscovery::scan(const QList<quint16>& regids)
+{
+    m_pending = regids;
+    m_total = m_pending.count();
+    m_scanning = (m_total > 0);
+
+    qDebug("[VE.CHR] DISCOVERY scan %d registers", m_total);
+}
+
+inline void CSVeDiscovery::record(quint16 regid, quint8 status, quint8 size)
+{
+    m_probes.remove(regid);
+    m_registers[regid] = {regid, status, size};
+}
+
+inline void CSVeDiscovery::finish()
+{
+    m_scanning = false;
+
+    int supported = 0;
+    foreach (const TRegInfo& ri, m_registers) {
+        if (ri.m_status == RegSupported) {
+            supported++;
+        }
+    }
+    qDebug("[VE.CHR] DISCOVERY done: %d of %d registers supported", supported, m_registers.count());
+
+    if (!saveCache()) {
+        qWarning().noquote() << "[VE.CHR] DISCOVERY unable to write cache:" << cacheFile();
+    }
+
+    applyCapabilities();
+    emit scanFinished();
+}
+
+inline void CSVeDiscovery::applyCapabilities()
+{
+    QSet<quint16> unsupported;
+    foreach (const TRegInfo& ri, m_registers) {
+        if (ri.m_status == RegUnknownId || ri.m_status == RegNotSupported) {
+            unsupported.insert(ri.m_regid);
+        }
+    }
+    m_scheduler->setUnsupported(unsupported);
+}
+
+inline bool CSVeDiscovery::loadCache()
+{
+    QFile file(cacheFile());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    ds >> magic >> version >> count;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION) {
+        return false;
+    }
+
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        TRegInfo ri = {};
+        ds >> ri.m_regid >> ri.m_status >> ri.m_size;
+        /* a timeout is no capability, written by older versions */
+        if (ri.m_status != RegNoResponse) {
+            m_registers[ri.m_regid] = ri;
+        }
+    }
+
+    return (ds.status() == QDataStream::Ok);
+}
+
+inline bool CSVeDiscovery::saveCache() const
+{
+    const QString fileName = cacheFile();
+    if (!QDir().mkpath(QFileInfo(fileName).absolutePath())) {
+        return false;
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    /* a probe that timed out is asked again on the next start */
+    QList<TRegInfo> known;
+    foreach (const TRegInfo& ri, m_registers) {
+        if (ri.m_status != RegNoResponse) {
+            known.append(ri);
+        }
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+    ds << CACHE_MAGIC << CACHE_VERSION << (quint32) known.count();
+    foreach (const TRegInfo& ri, known) {
+        ds << ri.m_regid << ri.m_status << ri.m_size;
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,127 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QPair>
+#include <csvedirect.h>
+#include <csvescheduler.h>
+
+/**
+ * @brief Register-space discovery scanner
+ *
+ * Probes configurable register id ranges with background GET
+ * requests and records per register whether the device supports
+ * it and the payload size. Results are cached on disk keyed by
+ * product id (0x0001) and firmware release (0x0002), so a unit of
+ * a known product/firmware pair is not scanned again. Probes that
+ * timed out are not cached and are asked again on the next start.
+ */
+class CSVeDiscovery: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* background GETs queued at the same time */
+    static const int SCAN_WINDOW = 4;
+    /* response timeout of a probe in milliseconds */
+    static const qint64 SCAN_TIMEOUT = 2000;
+    /* probes without response are repeated once */
+    static const int SCAN_RETRIES = 1;
+
+    typedef enum {
+        RegNotScanned = 0,
+        RegSupported,
+        RegUnknownId,
+        RegNotSupported,
+        RegParamError,
+        RegNoResponse,
+    } TRegStatus;
+
+    typedef struct {
+        quint16 m_regid;
+        quint8 m_status;
+        quint8 m_size;
+    } TRegInfo;
+
+    typedef QPair<quint16, quint16> TRange;
+
+    /**
+     * @brief CSVeDiscovery
+     * @param scheduler Command queue of the device
+     * @param parent
+     */
+    explicit CSVeDiscovery(CSVeScheduler* scheduler, QObject* parent = nullptr);
+
+    /**
+     * @brief setRanges Register id ranges to scan (inclusive)
+     * @param ranges
+     */
+    void setRanges(const QList<TRange>& ranges);
+    const QList<TRange>& ranges() const;
+    /**
+     * @brief setAutoScan Scan automatically if no cache exists
+     * @param enabled
+     */
+    void setAutoScan(bool enabled);
+    /**
+     * @brief start Load capability cache of product and firmware
+     * and start background scan on cache miss.
+     * @param pid Product id (VE.Text PID)
+     * @param firmware Firmware release (VE.Text FWE)
+     */
+    void start(const QString& pid, const QString& firmware);
+    /**
+     * @brief rescan Drop cache and scan again
+     */
+    void rescan();
+    /**
+     * @brief stop Abort running scan
+     */
+    void stop();
+    /**
+     * @brief pump Queue next probes, called by device tick
+     */
+    void pump();
+    /**
+     * @brief handleFrame Record response of device
+     * @param frame
+     * @return true if frame was a probe response
+     */
+    bool handleFrame(const CSVeParser::TVeHexFrame& frame);
+
+    bool isScanning() const;
+    bool isStarted() const;
+    const QMap<quint16, TRegInfo>& registers() const;
+    QString cacheFile() const;
+
+signals:
+    void scanProgress(int done, int total);
+    void scanFinished();
+
+private:
+    CSVeScheduler* m_scheduler;
+    QList<TRange> m_ranges;
+    QMap<quint16, TRegInfo> m_registers;
+    QList<quint16> m_pending;
+    QMap<quint16, QPair<qint64, int>> m_probes;
+    QString m_pid;
+    QString m_firmware;
+    bool m_autoScan;
+    bool m_scanning;
+    int m_total;
+
+private:
+    inline QList<quint16> rangeRegisters() const;
+    inline void scan(const QList<quint16>& regids);
+    inline void record(quint16 regid, quint8 status, quint8 size);
+    inline void finish();
+    inline void applyCapabilities();
+    inline bool loadCache();
+    inline bool saveCache() const;
+};
@@ -0,0 +1,392 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csvefleetengine.h>
+
+typedef QPair<float, QVariant> TRegisterValue;
+typedef QHash<QString, double> TDeviceLoads;
+
+CSVeFleetEngine::CSVeFleetEngine(int shards, QObject* parent)
+    : QObject(parent)
+    , m_shards()
+    , m_devices()
+    , m_moving()
+    , m_moveSerial(0)
+    , m_rebalance(this)
+    , m_clock()
+    , m_setup()
+    , m_imbalance(DEFAULT_IMBALANCE)
+{
+    /* queued across the shard threads */
+    qRegisterMetaType<TRegisterValue>("QPair<float,QVariant>");
+    qRegisterMetaType<TDeviceLoads>("QHash<QString,double>");
+    qRegisterMetaType<CSVeParser::TStamp>("CSVeParser::TStamp");
+
+    const int count = (shards > 0 ? shards : qMax(1, QThread::idealThreadCount()));
+    for (int i = 0; i < count; i++) {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QStringLiteral("ve-shard-%1").arg(i));
+
+        /* created here, lives and dies in the shard thread */
+        CSVeDeviceManager* manager = new CSVeDeviceManager();
+        manager->moveToThread(thread);
+        connect(thread, &QThread::finished, manager, &QObject::deleteLater);
+
+        connect(manager, &CSVeDeviceManager::dataChanged, this, [this, i](const QString& id, uint regid, const TRegisterValue& value, const CSVeParser::TStamp& stamp) {
+            m_shards[i].m_stats.m_events++;
+            emit dataChanged(id, regid, value, stamp);
+        });
+        connect(manager, &CSVeDeviceManager::staleChanged, this, &CSVeFleetEngine::staleChanged);
+        connect(manager, &CSVeDeviceManager::loadSampled, this, [this, i](const TDeviceLoads& loads) {
+            onLoadSampled(i, loads);
+        });
+
+        m_shards.append({thread, manager, TDeviceLoads(), {}});
+        thread->start();
+    }
+
+    m_clock.start();
+    m_rebalance.setInterval(REBALANCE_INTERVAL);
+    connect(&m_rebalance, &QTimer::timeout, this, &CSVeFleetEngine::rebalance);
+    m_rebalance.start();
+}
+
+CSVeFleetEngine::~CSVeFleetEngine()
+{
+    m_rebalance.stop();
+
+    /* ports closed and snapshots saved by the owning thread */
+    foreach (const TShard& shard, m_shards) {
+        CSVeDeviceManager* manager = shard.m_manager;
+        QMetaObject::invokeMethod(
+           manager,
+           [manager]() {
+               manager->stopAll();
+           },
+           Qt::BlockingQueuedConnection);
+        shard.m_thread->quit();
+    }
+    foreach (const TShard& shard, m_shards) {
+        shard.m_thread->wait();
+    }
+}
+
+int CSVeFleetEngine::addDevice(const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config)
+{
+    if (m_devices.contains(id) || m_moving.contains(id)) {
+        return -1;
+    }
+
+    const int shard = leastLoaded();
+    m_devices.insert(id, {shard, config, m_clock.elapsed()});
+    m_shards[shard].m_stats.m_devices++;
+    attach(shard, id, config);
+    return shard;
+}
+
+void CSVeFleetEngine::removeDevice(const QString& id)
+{
+    if (!m_devices.contains(id)) {
+        return;
+    }
+
+    const TDevice device = m_devices.take(id);
+    m_shards[device.m_shard].m_stats.m_devices--;
+    m_shards[device.m_shard].m_loads.remove(id);
+    /* not on the target yet, moveFinished() removes it there */
+    if (!m_moving.contains(id)) {
+        detach(device.m_shard, id);
+    }
+}
+
+int CSVeFleetEngine::shardOf(const QString& id) const
+{
+    return (m_devices.contains(id) ? m_devices[id].m_shard : -1);
+}
+
+QStringList CSVeFleetEngine::devices() const
+{
+    return m_devices.keys();
+}
+
+int CSVeFleetEngine::shardCount() const
+{
+    return m_shards.count();
+}
+
+void CSVeFleetEngine::sendGetRegister(const QString& id, quint16 regid, CSVeScheduler::TPriority prio)
+{
+    const int shard = shardOf(id);
+    if (shard < 0) {
+        return;
+    }
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    QMetaObject::invokeMethod(manager, [manager, id, regid, prio]() {
+        manager->sendGetRegister(id, regid, prio);
+    });
+}
+
+void CSVeFleetEngine::sendSetRegister(const QString& id, quint16 regid, quint8 value)
+{
+    const int shard = shardOf(id);
+    if (shard < 0) {
+        return;
+    }
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    QMetaObject::invokeMethod(manager, [manager, id, regid, value]() {
+        manager->sendSetRegister(id, regid, value);
+    });
+}
+
+void CSVeFleetEngine::sendSetRegister(const QString& id, quint16 regid, quint16 value)
+{
+    const int shard = shardOf(id);
+    if (shard < 0) {
+        return;
+    }
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    QMetaObject::invokeMethod(manager, [manager, id, regid, value]() {
+        manager->sendSetRegister(id, regid, value);
+    });
+}
+
+void CSVeFleetEngine::sendSetRegister(const QString& id, quint16 regid, quint32 value)
+{
+    const int shard = shardOf(id);
+    if (shard < 0) {
+        return;
+    }
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    QMetaObject::invokeMethod(manager, [manager, id, regid, value]() {
+        manager->sendSetRegister(id, regid, value);
+    });
+}
+
+void CSVeFleetEngine::setSetup(const TSetup& setup)
+{
+    m_setup = setup;
+}
+
+void CSVeFleetEngine::setRebalancing(bool enabled)
+{
+    if (enabled) {
+        m_rebalance.start();
+    }
+    else {
+        m_rebalance.stop();
+    }
+}
+
+void CSVeFleetEngine::setImbalance(double factor)
+{
+    m_imbalance = qMax(1.0, factor);
+}
+
+const CSVeFleetEngine::TShardStats& CSVeFleetEngine::statistics(int shard) const
+{
+    return m_shards[shard].m_stats;
+}
+
+QStringList CSVeFleetEngine::report() const
+{
+    QStringList lines;
+    double total = 0;
+
+    for (int i = 0; i < m_shards.count(); i++) {
+        const TShardStats& st = m_shards[i].m_stats;
+        lines << tr("shard=%1 devices=%2 cpu=%3% max=%4% events=%5 in=%6 out=%7")
+                    .arg(i)
+                    .arg(st.m_devices)
+                    .arg(st.m_load * 100.0, 0, 'f', 2)
+                    .arg(st.m_maxLoad * 100.0, 0, 'f', 2)
+                    .arg(st.m_events)
+                    .arg(st.m_movedIn)
+                    .arg(st.m_movedOut);
+        total += st.m_load;
+    }
+    lines << tr("shards=%1 devices=%2 cpu=%3%").arg(m_shards.count()).arg(m_devices.count()).arg(total * 100.0, 0, 'f', 2);
+
+    return lines;
+}
+
+void CSVeFleetEngine::onLoadSampled(int shard, const QHash<QString, double>& loads)
+{
+    TShard& s = m_shards[shard];
+
+    /* devices moved away meanwhile are not ours anymore */
+    s.m_loads.clear();
+    s.m_stats.m_load = 0;
+    QHash<QString, double>::const_iterator it;
+    for (it = loads.constBegin(); it != loads.constEnd(); it++) {
+        if (shardOf(it.key()) != shard) {
+            continue;
+        }
+        s.m_loads.insert(it.key(), it.value());
+        s.m_stats.m_load += it.value();
+    }
+    s.m_stats.m_maxLoad = qMax(s.m_stats.m_maxLoad, s.m_stats.m_load);
+}
+
+/* one move per interval, the next sample shows the effect */
+void CSVeFleetEngine::rebalance()
+{
+    if (m_shards.count() < 2) {
+        return;
+    }
+
+    int hi = 0;
+    int lo = 0;
+    double total = 0;
+    for (int i = 0; i < m_shards.count(); i++) {
+        const double load = m_shards[i].m_stats.m_load;
+        total += load;
+        if (load > m_shards[hi].m_stats.m_load) {
+            hi = i;
+        }
+        if (load < m_shards[lo].m_stats.m_load) {
+            lo = i;
+        }
+    }
+
+    const double mean = total / m_shards.count();
+    const double high = m_shards[hi].m_stats.m_load;
+    if (hi == lo || high < MIN_LOAD || high <= mean * m_imbalance) {
+        return;
+    }
+
+    emit shardOverloaded(hi, high);
+
+    /* device closest to half the difference, smaller than all of it */
+    const double diff = high - m_shards[lo].m_stats.m_load;
+    const qint64 now = m_clock.elapsed();
+    QString best;
+    double bestDistance = diff;
+
+    QHash<QString, double>::const_iterator it;
+    for (it = m_shards[hi].m_loads.constBegin(); it != m_shards[hi].m_loads.constEnd(); it++) {
+        if (it.value() <= 0 || it.value() >= diff) {
+            continue;
+        }
+        if (now - m_devices[it.key()].m_lastMove < MOVE_COOLDOWN || m_moving.contains(it.key())) {
+            continue;
+        }
+        const double distance = qAbs(it.value() - diff / 2);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = it.key();
+        }
+    }
+
+    if (best.isEmpty()) {
+        return;
+    }
+
+    /* estimate until the next sample */
+    const double load = m_shards[hi].m_loads.take(best);
+    m_shards[hi].m_stats.m_load -= load;
+    m_shards[lo].m_loads.insert(best, load);
+    m_shards[lo].m_stats.m_load += load;
+
+    moveDevice(best, lo);
+}
+
+/* estimated load including devices not sampled yet */
+inline int CSVeFleetEngine::leastLoaded() const
+{
+    double total = 0;
+    int sampled = 0;
+    foreach (const TShard& shard, m_shards) {
+        total += shard.m_stats.m_load;
+        sampled += shard.m_loads.count();
+    }
+    const double perDevice = (sampled ? total / sampled : 0);
+
+    int best = 0;
+    double bestLoad = 0;
+    for (int i = 0; i < m_shards.count(); i++) {
+        const TShardStats& st = m_shards[i].m_stats;
+        const double load = st.m_load + (st.m_devices - m_shards[i].m_loads.count()) * perDevice;
+        if (i == 0 || load < bestLoad || (load == bestLoad && st.m_devices < m_shards[best].m_stats.m_devices)) {
+            best = i;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+inline void CSVeFleetEngine::attach(int shard, const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config)
+{
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    const TSetup setup = m_setup;
+
+    QMetaObject::invokeMethod(manager, [manager, id, config, setup]() {
+        CSVeDirectAcDcCharger* charger = manager->addDevice(id, config);
+        if (setup) {
+            setup(charger);
+        }
+        manager->start(id);
+    });
+}
+
+inline void CSVeFleetEngine::detach(int shard, const QString& id)
+{
+    CSVeDeviceManager* manager = m_shards[shard].m_manager;
+    QMetaObject::invokeMethod(manager, [manager, id]() {
+        manager->removeDevice(id);
+    });
+}
+
+/* the port is released by the old shard before the new one opens it */
+inline void CSVeFleetEngine::moveDevice(const QString& id, int to)
+{
+    TDevice& device = m_devices[id];
+    const int from = device.m_shard;
+
+    CSVeDeviceManager* source = m_shards[from].m_manager;
+    CSVeDeviceManager* target = m_shards[to].m_manager;
+    const CSVeDirectAcDcCharger::TVedConfig config = device.m_config;
+    const TSetup setup = m_setup;
+    const quint32 serial = ++m_moveSerial;
+    m_moving.insert(id, serial);
+
+    /* back to this thread when the device runs on the target */
+    QMetaObject::invokeMethod(source, [this, source, target, id, config, setup, serial, to]() {
+        source->removeDevice(id);
+        QMetaObject::invokeMethod(target, [this, target, id, config, setup, serial, to]() {
+            CSVeDirectAcDcCharger* charger = target->addDevice(id, config);
+            if (setup) {
+                setup(charger);
+            }
+            target->start(id);
+            QMetaObject::invokeMethod(this, [this, id, serial, to]() {
+                moveFinished(id, serial, to);
+            });
+        });
+    });
+
+    device.m_shard = to;
+    device.m_lastMove = m_clock.elapsed();
+    m_shards[from].m_stats.m_devices--;
+    m_shards[from].m_stats.m_movedOut++;
+    m_shards[to].m_stats.m_devices++;
+    m_shards[to].m_stats.m_movedIn++;
+
+    qDebug("[VE.FLEET] MOVE %s shard %d -> %d", qPrintable(id), from, to);
+    emit deviceMoved(id, from, to);
+}
+
+/* a device removed while it moved is stopped on the target now */
+inline void CSVeFleetEngine::moveFinished(const QString& id, quint32 serial, int shard)
+{
+    if (m_moving.value(id) != serial) {
+        return;
+    }
+    m_moving.remove(id);
+    if (!m_devices.contains(id)) {
+        detach(shard, id);
+    }
+}
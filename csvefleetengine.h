@@ -0,0 +1,141 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <csvedevicemanager.h>
+#include <functional>
+
+/**
+ * @brief Sharded multi-core charger engine
+ *
+ * Devices are spread over N worker threads (shards). Every shard
+ * runs its own event loop and its own device manager, so ports,
+ * parsers, schedulers and register values of a device are only
+ * ever touched by the thread of its shard. Nothing is shared
+ * between shards; commands and events cross threads as queued
+ * signals only, there are no locks on the data path.
+ *
+ * New devices go to the shard with the lowest load. The shards
+ * publish the CPU share of each device every sample interval; if
+ * one shard runs above the mean by more than the imbalance
+ * factor, the device that best evens out the two shards is moved
+ * to the least loaded shard (port closed and reopened there).
+ */
+class CSVeFleetEngine: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* rebalance check interval, min. time between moves of one device */
+    static const int REBALANCE_INTERVAL = 10000;
+    static const int MOVE_COOLDOWN = 60000;
+    /* shards below this share of one core are never overloaded */
+    static constexpr double MIN_LOAD = 0.05;
+    static constexpr double DEFAULT_IMBALANCE = 1.5;
+
+    /* device setup, runs in the shard thread */
+    typedef std::function<void(CSVeDirectAcDcCharger*)> TSetup;
+
+    typedef struct {
+        int m_devices;
+        /* 0..1 of one core, last sample */
+        double m_load;
+        double m_maxLoad;
+        quint32 m_movedIn;
+        quint32 m_movedOut;
+        quint64 m_events;
+    } TShardStats;
+
+    /**
+     * @brief CSVeFleetEngine
+     * @param shards Worker threads, 0 = one per core
+     * @param parent
+     */
+    explicit CSVeFleetEngine(int shards = 0, QObject* parent = nullptr);
+    ~CSVeFleetEngine();
+
+    /**
+     * @brief addDevice Create and start a device on the least
+     * loaded shard
+     * @param id
+     * @param config
+     * @return Shard index, -1 if id is known or its move has
+     * not finished yet
+     */
+    int addDevice(const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config);
+    void removeDevice(const QString& id);
+    int shardOf(const QString& id) const;
+    QStringList devices() const;
+    int shardCount() const;
+
+    /* device keyed commands, queued to the shard */
+    void sendGetRegister(const QString& id, quint16 regid, CSVeScheduler::TPriority prio = CSVeScheduler::PrioNormal);
+    void sendSetRegister(const QString& id, quint16 regid, quint8 value);
+    void sendSetRegister(const QString& id, quint16 regid, quint16 value);
+    void sendSetRegister(const QString& id, quint16 regid, quint32 value);
+
+    /**
+     * @brief setSetup Called for each device after it was created
+     * on its shard (poll registers, defaults). Runs in the shard
+     * thread, concurrently for different shards.
+     * @param setup
+     */
+    void setSetup(const TSetup& setup);
+    void setRebalancing(bool enabled);
+    void setImbalance(double factor);
+
+    const TShardStats& statistics(int shard) const;
+    QStringList report() const;
+
+signals:
+    /* stamps of all shards share one clock and can be correlated */
+    void dataChanged(const QString& id, uint regid, const QPair<float, QVariant>& value, const CSVeParser::TStamp& stamp);
+    void staleChanged(const QString& id, uint regid, bool stale);
+    void deviceMoved(const QString& id, int from, int to);
+    void shardOverloaded(int shard, double load);
+
+private slots:
+    void onLoadSampled(int shard, const QHash<QString, double>& loads);
+    void rebalance();
+
+private:
+    typedef struct {
+        QThread* m_thread;
+        CSVeDeviceManager* m_manager;
+        QHash<QString, double> m_loads;
+        TShardStats m_stats;
+    } TShard;
+
+    typedef struct {
+        int m_shard;
+        CSVeDirectAcDcCharger::TVedConfig m_config;
+        qint64 m_lastMove;
+    } TDevice;
+
+    QList<TShard> m_shards;
+    QHash<QString, TDevice> m_devices;
+    /* moves in flight by device id, also of removed devices */
+    QHash<QString, quint32> m_moving;
+    quint32 m_moveSerial;
+    QTimer m_rebalance;
+    QElapsedTimer m_clock;
+    TSetup m_setup;
+    double m_imbalance;
+
+private:
+    inline int leastLoaded() const;
+    inline void attach(int shard, const QString& id, const CSVeDirectAcDcCharger::TVedConfig& config);
+    inline void detach(int shard, const QString& id);
+    inline void moveDevice(const QString& id, int to);
+    inline void moveFinished(const QString& id, quint32 serial, int shard);
+};
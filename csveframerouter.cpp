@@ -0,0 +1,392 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csvecapture.h>
+#include <csvedirect.h>
+#include <csveframerouter.h>
+
+/* weight of the newest frame in the moving average */
+static const double EMA_WEIGHT = 0.05;
+
+CSVeFrameRouter::CSVeFrameRouter(QSerialPort* charger, QSerialPort* cerbo, QObject* parent)
+    : QObject(parent)
+    , m_charger(charger)
+    , m_cerbo(cerbo)
+    , m_cache(nullptr)
+    , m_capture(nullptr)
+    , m_capturePort()
+    , m_clock()
+    , m_rx()
+    , m_stats()
+    , m_toCerbo()
+    , m_requests()
+    , m_collisions(0)
+    , m_deferred(0)
+{
+    m_clock.start();
+    reset();
+}
+
+void CSVeFrameRouter::feed(TDirection direction, char c)
+{
+    TReceiver& rx = m_rx[direction];
+
+    if (rx.m_buffer.isEmpty()) {
+        rx.m_begin = m_clock.nsecsElapsed();
+    }
+
+    /* VE.Text block checksum, any byte value */
+    if (rx.m_checksum) {
+        rx.m_buffer.append(c);
+        rx.m_checksum = false;
+        complete(direction);
+        return;
+    }
+
+    /* VE.HEX frame start, flush partial text line first */
+    if (c == ':' && !rx.m_hex) {
+        if (!rx.m_buffer.isEmpty()) {
+            complete(direction);
+            rx.m_begin = m_clock.nsecsElapsed();
+        }
+        rx.m_hex = true;
+    }
+
+    rx.m_buffer.append(c);
+
+    if (!rx.m_hex && rx.m_buffer.endsWith("Checksum\t")) {
+        rx.m_checksum = true;
+        return;
+    }
+    if (c == '\n') {
+        complete(direction);
+    }
+}
+
+void CSVeFrameRouter::submit(const QByteArray& frame, CSVeScheduler::TPriority prio, QObject* owner)
+{
+    if (prio < CSVeScheduler::PrioBackground || prio >= CSVeScheduler::PrioLevels) {
+        prio = CSVeScheduler::PrioNormal;
+    }
+
+    if (owner) {
+        quint8 command = 0;
+        quint16 regid = 0;
+        if (!parseHeader(frame, &command, &regid)) {
+            return;
+        }
+        /* clients share the cache with the Cerbo GX */
+        QByteArray cached;
+        if (m_cache && m_cache->lookup(command, regid, &cached) && !cached.isEmpty()) {
+            emit response(owner, cached);
+            return;
+        }
+        m_requests.append({command, regid, m_clock.nsecsElapsed(), owner});
+    }
+
+    /* the old byte pass-through would have split this frame */
+    if (m_rx[FromCerbo].m_hex && !m_rx[FromCerbo].m_buffer.isEmpty()) {
+        m_deferred++;
+    }
+
+    m_toCharger[prio].append(localUnit(frame));
+    pumpCharger();
+}
+
+void CSVeFrameRouter::removeOwner(QObject* owner)
+{
+    for (int i = m_requests.count() - 1; i >= 0; i--) {
+        if (m_requests.at(i).m_owner == owner) {
+            m_requests.removeAt(i);
+        }
+    }
+}
+
+void CSVeFrameRouter::sendToCerbo(const QByteArray& frame)
+{
+    m_toCerbo.append(localUnit(frame));
+    pumpCerbo();
+}
+
+void CSVeFrameRouter::setCache(CSVeProxyCache* cache)
+{
+    m_cache = cache;
+}
+
+void CSVeFrameRouter::setCapture(CSVeCapture* capture, int charger, int cerbo)
+{
+    m_capture = capture;
+    m_capturePort[FromCharger] = charger;
+    m_capturePort[FromCerbo] = cerbo;
+}
+
+void CSVeFrameRouter::reset()
+{
+    for (int i = 0; i < Directions; i++) {
+        m_rx[i] = {};
+    }
+    for (int prio = CSVeScheduler::PrioBackground; prio < CSVeScheduler::PrioLevels; prio++) {
+        m_toCharger[prio].clear();
+    }
+    m_toCerbo.clear();
+    m_requests.clear();
+
+    /* next unit as soon as the previous one left the port */
+    connect(m_charger, &QSerialPort::bytesWritten, this, &CSVeFrameRouter::onChargerWritten, Qt::UniqueConnection);
+    connect(m_cerbo, &QSerialPort::bytesWritten, this, &CSVeFrameRouter::onCerboWritten, Qt::UniqueConnection);
+}
+
+const CSVeFrameRouter::TStats& CSVeFrameRouter::statistics(TDirection direction) const
+{
+    return m_stats[direction];
+}
+
+quint32 CSVeFrameRouter::collisions() const
+{
+    return m_collisions;
+}
+
+quint32 CSVeFrameRouter::deferred() const
+{
+    return m_deferred;
+}
+
+QStringList CSVeFrameRouter::report() const
+{
+    static const char* names[Directions] = {"charger>cerbo", "cerbo>charger"};
+    QStringList lines;
+
+    for (int i = 0; i < Directions; i++) {
+        const TStats& st = m_stats[i];
+        lines << tr("%1 frames=%2 dropped=%3 latency=%4us avg=%5us max=%6us reassembly=%7us")
+                    .arg(names[i])
+                    .arg(st.m_frames)
+                    .arg(st.m_dropped)
+                    .arg(st.m_lastLatency)
+                    .arg(st.m_avgLatency, 0, 'f', 0)
+                    .arg(st.m_maxLatency)
+                    .arg(st.m_avgReassembly, 0, 'f', 0);
+    }
+    lines << tr("collisions=%1 deferred=%2").arg(m_collisions).arg(m_deferred);
+
+    return lines;
+}
+
+void CSVeFrameRouter::onChargerWritten(qint64)
+{
+    pumpCharger();
+}
+
+void CSVeFrameRouter::onCerboWritten(qint64)
+{
+    pumpCerbo();
+}
+
+bool CSVeFrameRouter::parseHeader(const QByteArray& frame, quint8* command, quint16* regid)
+{
+    const int i = frame.indexOf(':');
+    if (i < 0 || frame.length() < i + 2) {
+        return false;
+    }
+
+    bool ok = false;
+    (*command) = (quint8) frame.mid(i + 1, 1).toUShort(&ok, 16);
+    if (!ok) {
+        return false;
+    }
+
+    (*regid) = 0;
+    if (frame.length() >= i + 6) {
+        const quint16 lo = frame.mid(i + 2, 2).toUShort(&ok, 16);
+        const quint16 hi = frame.mid(i + 4, 2).toUShort(&ok, 16);
+        (*regid) = (quint16) ((hi << 8) | lo);
+    }
+
+    return true;
+}
+
+inline void CSVeFrameRouter::complete(TDirection direction)
+{
+    TReceiver& rx = m_rx[direction];
+
+    TUnit unit = {rx.m_buffer, rx.m_begin, m_clock.nsecsElapsed(), rx.m_hex};
+    rx.m_buffer.clear();
+    rx.m_hex = false;
+    rx.m_checksum = false;
+
+    switch (direction) {
+        case FromCerbo: {
+            /* the Cerbo GX talks VE.HEX only */
+            quint8 command = 0;
+            quint16 regid = 0;
+            if (!unit.m_hex || !parseHeader(unit.m_data, &command, &regid)) {
+                m_stats[direction].m_dropped++;
+                return;
+            }
+            /* answered from cache, no charger link time */
+            QByteArray response;
+            if (m_cache && m_cache->lookup(command, regid, &response) && !response.isEmpty()) {
+                unit.m_data = response;
+                m_toCerbo.append(unit);
+                pumpCerbo();
+                return;
+            }
+            m_requests.append({command, regid, unit.m_complete, m_cerbo});
+            emit cerboFrame(unit.m_data);
+            m_toCharger[CSVeScheduler::PrioHigh].append(unit);
+            pumpCharger();
+            break;
+        }
+        case FromCharger: {
+            bool all = false;
+            QObject* owner = recipient(unit, &all);
+            if (all) {
+                emit broadcast(unit.m_data);
+            }
+            else if (owner && owner != m_cerbo) {
+                emit response(owner, unit.m_data);
+                return;
+            }
+            if (!m_cerbo->isOpen()) {
+                return;
+            }
+            if (!all && !owner) {
+                m_stats[direction].m_dropped++;
+                return;
+            }
+            m_toCerbo.append(unit);
+            pumpCerbo();
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+/* VE.Text and ASYNC to everyone, responses to the oldest matching request */
+inline QObject* CSVeFrameRouter::recipient(const TUnit& unit, bool* broadcast)
+{
+    (*broadcast) = false;
+
+    if (!unit.m_hex) {
+        (*broadcast) = true;
+        return nullptr;
+    }
+
+    quint8 command = 0;
+    quint16 regid = 0;
+    if (!parseHeader(unit.m_data, &command, &regid)) {
+        return nullptr;
+    }
+    if (command == VED_RESP_ERROR) {
+        m_collisions++;
+    }
+    if (command == VED_CMD_ASYNC) {
+        (*broadcast) = true;
+        return nullptr;
+    }
+
+    /* forget requests without response */
+    const qint64 timeout = CSVeScheduler::RESPONSE_TIMEOUT * 1000000LL;
+    while (!m_requests.isEmpty() && (unit.m_complete - m_requests.first().m_sent) > timeout) {
+        m_requests.removeFirst();
+    }
+
+    for (int i = 0; i < m_requests.count(); i++) {
+        const TRequest& rq = m_requests.at(i);
+        bool match = false;
+        switch (command) {
+            case VED_RESP_GET:
+            case VED_RESP_SET: {
+                match = (rq.m_command == command && rq.m_regid == regid);
+                break;
+            }
+            case VED_RESP_PING: {
+                match = (rq.m_command == VED_CMD_PING);
+                break;
+            }
+            /* no id, oldest request */
+            default: {
+                match = true;
+                break;
+            }
+        }
+        if (match) {
+            return m_requests.takeAt(i).m_owner;
+        }
+    }
+
+    return nullptr;
+}
+
+inline void CSVeFrameRouter::pumpCharger()
+{
+    if (!m_charger->isOpen() || m_charger->bytesToWrite() > 0) {
+        return;
+    }
+
+    for (int prio = CSVeScheduler::PrioLevels - 1; prio >= CSVeScheduler::PrioBackground; prio--) {
+        if (m_toCharger[prio].isEmpty()) {
+            continue;
+        }
+        const TUnit unit = m_toCharger[prio].takeFirst();
+        m_charger->write(unit.m_data);
+        if (m_capture) {
+            m_capture->capture(m_capturePort[FromCharger], CSVeCapture::DirWrite, unit.m_data);
+        }
+        written(FromCerbo, unit);
+        return;
+    }
+}
+
+inline void CSVeFrameRouter::pumpCerbo()
+{
+    if (!m_cerbo->isOpen()) {
+        m_toCerbo.clear();
+        return;
+    }
+    if (m_cerbo->bytesToWrite() > 0 || m_toCerbo.isEmpty()) {
+        return;
+    }
+
+    const TUnit unit = m_toCerbo.takeFirst();
+    m_cerbo->write(unit.m_data);
+    if (m_capture) {
+        m_capture->capture(m_capturePort[FromCerbo], CSVeCapture::DirWrite, unit.m_data);
+    }
+    written(FromCharger, unit);
+}
+
+/* added latency of proxied units, local ones have no origin time */
+inline void CSVeFrameRouter::written(TDirection direction, const TUnit& unit)
+{
+    if (unit.m_begin < 0) {
+        return;
+    }
+
+    TStats& st = m_stats[direction];
+    const qint64 latency = (m_clock.nsecsElapsed() - unit.m_complete) / 1000;
+    const double reassembly = (unit.m_complete - unit.m_begin) / 1000.0;
+
+    if (st.m_frames == 0) {
+        st.m_avgLatency = latency;
+        st.m_avgReassembly = reassembly;
+    }
+    else {
+        st.m_avgLatency += EMA_WEIGHT * (latency - st.m_avgLatency);
+        st.m_avgReassembly += EMA_WEIGHT * (reassembly - st.m_avgReassembly);
+    }
+    st.m_frames++;
+    st.m_lastLatency = latency;
+    st.m_maxLatency = qMax(st.m_maxLatency, latency);
+}
+
+inline CSVeFrameRouter::TUnit CSVeFrameRouter::localUnit(const QByteArray& frame) const
+{
+    return {frame, -1, -1, true};
+}
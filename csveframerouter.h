@@ -0,0 +1,197 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QSerialPort>
+#include <QStringList>
+#include <csveproxycache.h>
+#include <csvescheduler.h>
+
+class CSVeCapture;
+
+/**
+ * @brief Frame aware proxy between Cerbo GX and charger
+ *
+ * Bytes received on either port are reassembled into whole
+ * units (VE.Text lines, VE.HEX frames) before they are
+ * forwarded. Writes to a port happen only at unit boundaries:
+ * the next unit is released when the previous one left the
+ * port buffer. Cerbo GX commands and local commands share the
+ * charger line through a priority arbiter.
+ *
+ * Charger responses are routed back to whoever asked: responses
+ * to Cerbo GX requests are forwarded, responses to client
+ * commands are signaled to the client, responses to local
+ * commands are not routed. VE.Text and ASYNC frames always go
+ * to the Cerbo GX and to all clients.
+ */
+class CSVeFrameRouter: public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef enum {
+        FromCharger = 0,
+        FromCerbo,
+        Directions,
+    } TDirection;
+
+    typedef struct {
+        QByteArray m_data;
+        /* first and last byte received, ns */
+        qint64 m_begin;
+        qint64 m_complete;
+        bool m_hex;
+    } TUnit;
+
+    typedef struct {
+        quint8 m_command;
+        quint16 m_regid;
+        qint64 m_sent;
+        /* who gets the response, Cerbo GX port or a client */
+        QObject* m_owner;
+    } TRequest;
+
+    typedef struct {
+        quint32 m_frames;
+        quint32 m_dropped;
+        /* time a complete unit waited in the router, us */
+        qint64 m_lastLatency;
+        qint64 m_maxLatency;
+        double m_avgLatency;
+        /* reassembly time first to last byte, us */
+        double m_avgReassembly;
+    } TStats;
+
+    /**
+     * @brief CSVeFrameRouter
+     * @param charger Charger port
+     * @param cerbo Cerbo GX port
+     * @param parent
+     */
+    explicit CSVeFrameRouter(QSerialPort* charger, QSerialPort* cerbo, QObject* parent = nullptr);
+
+    /**
+     * @brief feed Received byte of one direction
+     * @param direction
+     * @param c
+     */
+    void feed(TDirection direction, char c);
+    /**
+     * @brief submit Local frame to the charger
+     * @param frame Encoded VE.HEX frame
+     * @param prio Scheduler priority of the command
+     * @param owner Client waiting for the response, nullptr if
+     * the response is handled by the local parser only
+     */
+    void submit(const QByteArray& frame, CSVeScheduler::TPriority prio, QObject* owner = nullptr);
+    /**
+     * @brief removeOwner Forget pending requests of a client
+     * @param owner
+     */
+    void removeOwner(QObject* owner);
+    /**
+     * @brief sendToCerbo Local frame to the Cerbo GX
+     * @param frame Encoded VE.HEX frame
+     */
+    void sendToCerbo(const QByteArray& frame);
+    /**
+     * @brief setCache Answer Cerbo GX requests from this cache,
+     * forward misses only.
+     * @param cache
+     */
+    void setCache(CSVeProxyCache* cache);
+    /**
+     * @brief setCapture Log the written units of both ports
+     * @param capture nullptr = off
+     * @param charger Capture port index of the charger port
+     * @param cerbo Capture port index of the Cerbo GX port
+     */
+    void setCapture(CSVeCapture* capture, int charger, int cerbo);
+    /**
+     * @brief reset Drop partial units, queues and requests,
+     * (re)connect the port write notifications.
+     */
+    void reset();
+
+    const TStats& statistics(TDirection direction) const;
+    /**
+     * @brief collisions Framing errors reported by the charger
+     * (":4AAAA"), a sign of interleaved writes.
+     * @return
+     */
+    quint32 collisions() const;
+    /**
+     * @brief deferred Local frames held back because a Cerbo GX
+     * frame was being received at the same time.
+     * @return
+     */
+    quint32 deferred() const;
+    QStringList report() const;
+
+    /**
+     * @brief parseHeader Command and register id of an encoded
+     * VE.HEX frame (":<cmd><id lo><id hi>...")
+     * @param frame
+     * @param command
+     * @param regid
+     * @return false if not a VE.HEX frame
+     */
+    static bool parseHeader(const QByteArray& frame, quint8* command, quint16* regid);
+
+signals:
+    void cerboFrame(const QByteArray& frame);
+    /**
+     * @brief broadcast VE.Text line or ASYNC frame of the charger
+     * @param unit Complete unit, shared buffer
+     */
+    void broadcast(const QByteArray& unit);
+    /**
+     * @brief response Charger response to a client command
+     * @param owner Client of the request
+     * @param frame Encoded VE.HEX frame
+     */
+    void response(QObject* owner, const QByteArray& frame);
+
+private slots:
+    void onChargerWritten(qint64 bytes);
+    void onCerboWritten(qint64 bytes);
+
+private:
+    typedef struct {
+        QByteArray m_buffer;
+        qint64 m_begin;
+        bool m_hex;
+        bool m_checksum;
+    } TReceiver;
+
+    QSerialPort* m_charger;
+    QSerialPort* m_cerbo;
+    CSVeProxyCache* m_cache;
+    CSVeCapture* m_capture;
+    /* capture port index by the direction read from the port */
+    int m_capturePort[Directions];
+    QElapsedTimer m_clock;
+    TReceiver m_rx[Directions];
+    TStats m_stats[Directions];
+    QList<TUnit> m_toCharger[CSVeScheduler::PrioLevels];
+    QList<TUnit> m_toCerbo;
+    QList<TRequest> m_requests;
+    quint32 m_collisions;
+    quint32 m_deferred;
+
+private:
+    inline void complete(TDirection direction);
+    inline QObject* recipient(const TUnit& unit, bool* broadcast);
+    inline void pumpCharger();
+    inline void pumpCerbo();
+    inline void written(TDirection direction, const TUnit& unit);
+    inline TUnit localUnit(const QByteArray& frame) const;
+};
@@ -0,0 +1,323 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <csvedirectacdccharger.h>
+#include <csvehistorysync.h>
+
+/* history cache file header */
+static const quint32 HISTORY_MAGIC = 0x56454859; // VEHY
+static const quint16 HISTORY_VERSION = 1;
+
+/* version, 11 x un32, 2 x un16, 2 x un8 */
+static const quint16 CYCLE_RECORD_SIZE = 51;
+
+CSVeHistorySync::CSVeHistorySync(CSVeDirectAcDcCharger* charger, QObject* parent)
+    : QObject(parent)
+    , m_charger(charger)
+    , m_serial()
+    , m_sequence(0)
+    , m_records()
+    , m_cacheValid(false)
+    , m_busy(false)
+    , m_newSequence(0)
+    , m_pending()
+    , m_downloaded(0)
+    , m_timer(this)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(PROGRESS_TIMEOUT);
+
+    connect(&m_timer, &QTimer::timeout, this, [this]() {
+        qWarning("[VE.CHR] HISTORY timeout, %d cycle records missing", m_pending.count());
+        finish(false);
+    });
+    connect(m_charger, &CSVeDirectAcDcCharger::dataChanged, this, &CSVeHistorySync::onDataChanged);
+    connect(m_charger, &CSVeDirectAcDcCharger::hexFrameReceived, this, &CSVeHistorySync::onHexFrame);
+}
+
+void CSVeHistorySync::sync()
+{
+    m_charger->sendGetRegister(0x1099);
+}
+
+bool CSVeHistorySync::isBusy() const
+{
+    return m_busy;
+}
+
+quint32 CSVeHistorySync::sequence() const
+{
+    return m_sequence;
+}
+
+const CSVeHistorySync::TRecords& CSVeHistorySync::records() const
+{
+    return m_records;
+}
+
+const QString& CSVeHistorySync::serial() const
+{
+    return m_serial;
+}
+
+void CSVeHistorySync::onDataChanged(uint regid, const QPair<float, QVariant>& value)
+{
+    /* other device connected */
+    if (regid == 0x0003 && value.second.isValid()) {
+        loadDevice(value.second.toString().trimmed());
+    }
+}
+
+void CSVeHistorySync::onHexFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    if (frame.command != VED_CMD_GET && frame.command != VED_CMD_ASYNC) {
+        return;
+    }
+    if (frame.flags && !m_pending.contains(frame.regid)) {
+        return;
+    }
+
+    CSVEDirect::ved_t ved = frame.ve_in;
+
+    switch (frame.regid) {
+        /* history sequence number, changes with a new cycle */
+        case 0x1099: {
+            if (m_busy || ved.size < 8) {
+                return;
+            }
+            if (m_serial.isEmpty()) {
+                loadDevice(m_charger->store().text(0x0003).trimmed());
+                if (m_serial.isEmpty()) {
+                    return;
+                }
+            }
+
+            const quint32 sequence = CSVEDirect::getU32(&ved);
+            if (m_cacheValid && sequence == m_sequence) {
+                return;
+            }
+
+            qDebug("[VE.CHR] HISTORY sequence %u -> %u", m_sequence, sequence);
+
+            m_busy = true;
+            m_newSequence = sequence;
+            m_downloaded = 0;
+            m_pending.clear();
+            m_timer.start();
+            m_charger->sendGetRegister(0x106F);
+            return;
+        }
+        /* number of cycle records */
+        case 0x106F: {
+            if (m_busy && m_pending.isEmpty() && ved.size >= 5) {
+                startDownload(m_newSequence, CSVEDirect::getU8(&ved));
+            }
+            return;
+        }
+    }
+
+    if (!m_pending.contains(frame.regid)) {
+        return;
+    }
+
+    m_pending.remove(frame.regid);
+    m_timer.start();
+
+    TCycleRecord record = {};
+    if (!frame.flags && decode(&ved, &record)) {
+        record.m_cycle = m_newSequence - (frame.regid - FIRST_CYCLE_REG);
+        m_records[record.m_cycle] = record;
+        m_downloaded++;
+    }
+
+    if (m_pending.isEmpty()) {
+        finish(true);
+    }
+}
+
+inline void CSVeHistorySync::startDownload(quint32 sequence, int count)
+{
+    if (count > MAX_CYCLES) {
+        count = MAX_CYCLES;
+    }
+
+    /* records before the last synced active cycle are final */
+    int fetch = count;
+    if (m_cacheValid && sequence >= m_sequence && (sequence - m_sequence) < (quint32) count) {
+        fetch = (sequence - m_sequence) + 1;
+    }
+    /* history cleared or unknown */
+    else if (!m_cacheValid || sequence < m_sequence) {
+        m_records.clear();
+    }
+
+    qDebug("[VE.CHR] HISTORY download %d of %d cycle records", fetch, count);
+
+    for (int i = 0; i < fetch; i++) {
+        quint16 regid = FIRST_CYCLE_REG + i;
+        m_pending.insert(regid);
+        m_charger->sendGetRegister(regid);
+    }
+
+    if (m_pending.isEmpty()) {
+        finish(true);
+    }
+}
+
+inline void CSVeHistorySync::finish(bool complete)
+{
+    m_timer.stop();
+    m_pending.clear();
+    m_busy = false;
+
+    /* incomplete: keep old sequence, missing ones next time */
+    if (complete) {
+        m_sequence = m_newSequence;
+        m_cacheValid = true;
+    }
+
+    if (!save(m_serial, m_sequence, m_records)) {
+        qWarning("[VE.CHR] HISTORY unable to write: %s", qPrintable(fileName(m_serial)));
+    }
+
+    emit historyUpdated(m_downloaded);
+}
+
+inline void CSVeHistorySync::loadDevice(const QString& serial)
+{
+    if (serial.isEmpty() || serial == m_serial || m_busy) {
+        return;
+    }
+
+    m_serial = serial;
+    m_sequence = 0;
+    m_records.clear();
+    m_cacheValid = load(m_serial, &m_sequence, &m_records);
+
+    qDebug("[VE.CHR] HISTORY %s: %d cycle records cached", //
+           qPrintable(m_serial),
+           m_records.count());
+}
+
+bool CSVeHistorySync::decode(const CSVEDirect::ved_t* ved, TCycleRecord* record)
+{
+    if (ved->size < 4 + CYCLE_RECORD_SIZE) {
+        return false;
+    }
+
+    CSVEDirect::ved_t* in = const_cast<CSVEDirect::ved_t*>(ved);
+    uint offset = 4;
+
+    record->m_version = CSVEDirect::readU8(in, &offset);
+    offset += 1;
+    quint32* u32[] = {
+       &record->m_startTime,
+       &record->m_bulkTime,
+       &record->m_absTime,
+       &record->m_reconTime,
+       &record->m_floatTime,
+       &record->m_storageTime,
+       &record->m_bulkCharge,
+       &record->m_absCharge,
+       &record->m_reconCharge,
+       &record->m_floatCharge,
+       &record->m_storageCharge,
+    };
+    for (uint i = 0; i < sizeof(u32) / sizeof(quint32*); i++) {
+        (*u32[i]) = CSVEDirect::readU32(in, &offset);
+        offset += 4;
+    }
+    record->m_startVoltage = CSVEDirect::readU16(in, &offset);
+    offset += 2;
+    record->m_endVoltage = CSVEDirect::readU16(in, &offset);
+    offset += 2;
+    record->m_typeReason = CSVEDirect::readU8(in, &offset);
+    offset += 1;
+    record->m_error = CSVEDirect::readU8(in, &offset);
+    return true;
+}
+
+QString CSVeHistorySync::fileName(const QString& serial)
+{
+    static const QRegularExpression invalid("[^A-Za-z0-9]");
+
+    QString name = serial;
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    return QDir(path).filePath("history/" + name.remove(invalid) + ".hist");
+}
+
+bool CSVeHistorySync::load(const QString& serial, quint32* sequence, TRecords* records)
+{
+    QFile file(fileName(serial));
+    if (serial.isEmpty() || !file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    ds >> magic >> version;
+    if (magic != HISTORY_MAGIC || version != HISTORY_VERSION) {
+        return false;
+    }
+
+    ds >> (*sequence) >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        TCycleRecord r = {};
+        ds >> r.m_cycle >> r.m_version;
+        ds >> r.m_startTime >> r.m_bulkTime >> r.m_absTime >> r.m_reconTime;
+        ds >> r.m_floatTime >> r.m_storageTime;
+        ds >> r.m_bulkCharge >> r.m_absCharge >> r.m_reconCharge;
+        ds >> r.m_floatCharge >> r.m_storageCharge;
+        ds >> r.m_startVoltage >> r.m_endVoltage >> r.m_typeReason >> r.m_error;
+        (*records)[r.m_cycle] = r;
+    }
+
+    return (ds.status() == QDataStream::Ok);
+}
+
+bool CSVeHistorySync::save(const QString& serial, quint32 sequence, const TRecords& records)
+{
+    if (serial.isEmpty()) {
+        return false;
+    }
+
+    const QString name = fileName(serial);
+    if (!QDir().mkpath(QFileInfo(name).absolutePath())) {
+        return false;
+    }
+
+    QSaveFile file(name);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+    ds << HISTORY_MAGIC << HISTORY_VERSION << sequence << (quint32) records.count();
+
+    foreach (const TCycleRecord& r, records) {
+        ds << r.m_cycle << r.m_version;
+        ds << r.m_startTime << r.m_bulkTime << r.m_absTime << r.m_reconTime;
+        ds << r.m_floatTime << r.m_storageTime;
+        ds << r.m_bulkCharge << r.m_absCharge << r.m_reconCharge;
+        ds << r.m_floatCharge << r.m_storageCharge;
+        ds << r.m_startVoltage << r.m_endVoltage << r.m_typeReason << r.m_error;
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,112 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QMap>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QTimer>
+#include <QVariant>
+#include <csvedirect.h>
+
+class CSVeDirectAcDcCharger;
+
+/**
+ * @brief Incremental charge cycle history download
+ *
+ * Watches the history sequence number (0x1099) and downloads
+ * only the cycle records (0x1070 onward) that changed since the
+ * last sync. Cycle 0 is the active cycle, cycle n the n-th cycle
+ * before. Decoded records are cached per device serial number and
+ * keyed by absolute cycle number (sequence - n), so a reconnect
+ * never downloads the whole history again.
+ */
+class CSVeHistorySync: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* VE_REG_HISTORY_CYCLE00 .. VE_REG_HISTORY_CYCLE40 */
+    static const quint16 FIRST_CYCLE_REG = 0x1070;
+    static const int MAX_CYCLES = 41;
+    /* no progress timeout in milliseconds */
+    static const int PROGRESS_TIMEOUT = 5000;
+
+    typedef struct {
+        quint32 m_cycle;
+        quint8 m_version;
+        quint32 m_startTime;
+        quint32 m_bulkTime;
+        quint32 m_absTime;
+        quint32 m_reconTime;
+        quint32 m_floatTime;
+        quint32 m_storageTime;
+        quint32 m_bulkCharge;
+        quint32 m_absCharge;
+        quint32 m_reconCharge;
+        quint32 m_floatCharge;
+        quint32 m_storageCharge;
+        quint16 m_startVoltage;
+        quint16 m_endVoltage;
+        quint8 m_typeReason;
+        quint8 m_error;
+    } TCycleRecord;
+
+    typedef QMap<quint32, TCycleRecord> TRecords;
+
+    /**
+     * @brief CSVeHistorySync
+     * @param charger
+     * @param parent
+     */
+    explicit CSVeHistorySync(CSVeDirectAcDcCharger* charger, QObject* parent = nullptr);
+
+    /**
+     * @brief sync Request sequence number, download on change
+     */
+    void sync();
+    bool isBusy() const;
+    quint32 sequence() const;
+    const TRecords& records() const;
+    const QString& serial() const;
+
+    /**
+     * @brief decode History cycle record frame
+     * @param ved Received VE.HEX frame
+     * @param record
+     * @return false if frame too short
+     */
+    static bool decode(const CSVEDirect::ved_t* ved, TCycleRecord* record);
+    static QString fileName(const QString& serial);
+    static bool load(const QString& serial, quint32* sequence, TRecords* records);
+    static bool save(const QString& serial, quint32 sequence, const TRecords& records);
+
+signals:
+    void historyUpdated(int downloaded);
+
+private slots:
+    void onDataChanged(uint regid, const QPair<float, QVariant>& value);
+    void onHexFrame(const CSVeParser::TVeHexFrame& frame);
+
+private:
+    CSVeDirectAcDcCharger* m_charger;
+    QString m_serial;
+    quint32 m_sequence;
+    TRecords m_records;
+    bool m_cacheValid;
+    /* pending download */
+    bool m_busy;
+    quint32 m_newSequence;
+    QSet<quint16> m_pending;
+    int m_downloaded;
+    QTimer m_timer;
+
+private:
+    inline void startDownload(quint32 sequence, int count);
+    inline void finish(bool complete);
+    inline void loadDevice(const QString& serial);
+};
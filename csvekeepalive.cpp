@@ -0,0 +1,292 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <csvedirectacdccharger.h>
+#include <csvekeepalive.h>
+
+CSVeKeepalive::CSVeKeepalive(QObject* parent)
+    : QObject(parent)
+    , m_clock()
+    , m_timer(this)
+    , m_orders()
+    , m_chargers()
+    , m_margin(DEFAULT_MARGIN)
+    , m_lastReport(0)
+    , m_missed(0)
+{
+    m_clock.start();
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &CSVeKeepalive::onTimeout);
+}
+
+void CSVeKeepalive::setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, const QByteArray& payload)
+{
+    const TKey key(charger, regid);
+
+    if (!m_orders.contains(key)) {
+        TOrder order = {};
+        order.m_charger = charger;
+        order.m_regid = regid;
+        order.m_lastSent = -1;
+        order.m_lastAcked = -1;
+        order.m_minSlack = LLONG_MAX;
+        m_orders[key] = order;
+        attach(charger);
+    }
+
+    TOrder& order = m_orders[key];
+    order.m_payload = payload;
+    order.m_pending = false;
+    sendOrder(order);
+    rearm();
+}
+
+void CSVeKeepalive::setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, quint8 value)
+{
+    setOrder(charger, regid, QByteArray(1, (char) value));
+}
+
+void CSVeKeepalive::setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, quint16 value)
+{
+    QByteArray payload;
+    payload.append((char) (value & 0xff));
+    payload.append((char) ((value >> 8) & 0xff));
+    setOrder(charger, regid, payload);
+}
+
+void CSVeKeepalive::removeOrder(CSVeDirectAcDcCharger* charger, quint16 regid)
+{
+    m_orders.remove(TKey(charger, regid));
+    rearm();
+}
+
+void CSVeKeepalive::removeCharger(QObject* charger)
+{
+    QHash<TKey, TOrder>::iterator it = m_orders.begin();
+    while (it != m_orders.end()) {
+        if (it.key().first == charger) {
+            it = m_orders.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+
+    foreach (const QMetaObject::Connection& c, m_chargers.take(charger)) {
+        disconnect(c);
+    }
+
+    rearm();
+}
+
+bool CSVeKeepalive::hasOrder(CSVeDirectAcDcCharger* charger, quint16 regid) const
+{
+    return m_orders.contains(TKey(charger, regid));
+}
+
+void CSVeKeepalive::setMargin(qint64 margin)
+{
+    m_margin = qBound((qint64) RETRY_INTERVAL, margin, LINK_TIMEOUT - RETRY_INTERVAL);
+    rearm();
+}
+
+qint64 CSVeKeepalive::margin() const
+{
+    return m_margin;
+}
+
+QList<CSVeKeepalive::TOrder> CSVeKeepalive::statistics() const
+{
+    return m_orders.values();
+}
+
+QStringList CSVeKeepalive::report() const
+{
+    QStringList lines;
+
+    foreach (const TOrder& o, m_orders) {
+        lines << tr("%1 0x%2 refresh=%3 ack=%4 reject=%5 missed=%6 min-slack=%7ms max-latency=%8ms")
+                    .arg(o.m_charger->configIn().m_portName)
+                    .arg(o.m_regid, 4, 16, QChar('0'))
+                    .arg(o.m_refreshes)
+                    .arg(o.m_acks)
+                    .arg(o.m_rejects)
+                    .arg(o.m_misses)
+                    .arg(o.m_minSlack == LLONG_MAX ? -1 : o.m_minSlack)
+                    .arg(o.m_maxLatency);
+    }
+
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
+
+quint32 CSVeKeepalive::missedDeadlines() const
+{
+    return m_missed;
+}
+
+void CSVeKeepalive::onTimeout()
+{
+    const qint64 now = m_clock.elapsed();
+
+    QHash<TKey, TOrder>::iterator it;
+    for (it = m_orders.begin(); it != m_orders.end(); it++) {
+        TOrder& order = it.value();
+
+        /* the device timeout counts at the latest from our send */
+        if (order.m_lastAcked >= 0 && !order.m_missed) {
+            const qint64 late = now - (order.m_lastAcked + LINK_TIMEOUT);
+            if (late >= 0) {
+                order.m_missed = true;
+                order.m_misses++;
+                m_missed++;
+                qWarning("[VE.KAL] %s 0x%04X deadline missed by %lld ms", //
+                         qPrintable(order.m_charger->configIn().m_portName),
+                         order.m_regid,
+                         late);
+                emit deadlineMissed(order.m_charger, order.m_regid, late);
+            }
+        }
+
+        if (nextDue(order) <= now) {
+            sendOrder(order);
+        }
+    }
+
+    if ((now - m_lastReport) >= REPORT_INTERVAL && !m_orders.isEmpty()) {
+        m_lastReport = now;
+        foreach (const QString& line, report()) {
+            qDebug("[VE.KAL] %s", qPrintable(line));
+        }
+    }
+
+    rearm();
+}
+
+inline void CSVeKeepalive::attach(CSVeDirectAcDcCharger* charger)
+{
+    if (m_chargers.contains(charger)) {
+        return;
+    }
+
+    QList<QMetaObject::Connection> connections;
+    connections << connect(charger, &CSVeDirectAcDcCharger::hexFrameReceived, this, [this, charger](const CSVeParser::TVeHexFrame& frame) {
+        onHexFrame(charger, frame);
+    });
+    connections << connect(charger, &QObject::destroyed, this, &CSVeKeepalive::removeCharger);
+    m_chargers[charger] = connections;
+}
+
+inline void CSVeKeepalive::onHexFrame(CSVeDirectAcDcCharger* charger, const CSVeParser::TVeHexFrame& frame)
+{
+    if (frame.command != VED_CMD_SET) {
+        return;
+    }
+
+    const TKey key(charger, frame.regid);
+    if (!m_orders.contains(key)) {
+        return;
+    }
+
+    TOrder& order = m_orders[key];
+    if (!order.m_pending || !isAnswer(order, frame)) {
+        return;
+    }
+
+    order.m_pending = false;
+
+    if (frame.flags) {
+        order.m_rejects++;
+        qWarning("[VE.KAL] %s 0x%04X rejected flags=0x%02X", //
+                 qPrintable(charger->configIn().m_portName),
+                 frame.regid,
+                 frame.flags);
+        emit orderRejected(charger, frame.regid, frame.flags);
+        rearm();
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    if (order.m_lastAcked >= 0) {
+        order.m_minSlack = qMin(order.m_minSlack, order.m_lastAcked + LINK_TIMEOUT - now);
+    }
+    order.m_maxLatency = qMax(order.m_maxLatency, now - order.m_lastSent);
+    order.m_lastAcked = order.m_lastSent;
+    order.m_missed = false;
+    order.m_acks++;
+
+    rearm();
+}
+
+/* the response echoes the value written, the answer to a SET of
+ * another value (another writer, an older order) is not the ack */
+inline bool CSVeKeepalive::isAnswer(const TOrder& order, const CSVeParser::TVeHexFrame& frame) const
+{
+    const CSVEDirect::ved_t* ved = &frame.ve_in;
+    const int size = (ved->size > 4 ? ved->size - 4 : 0);
+    if (size == 0) {
+        /* a rejection may come without the value */
+        return (frame.flags != 0);
+    }
+    return (size == order.m_payload.count() && memcmp(ved->data + 4, order.m_payload.constData(), size) == 0);
+}
+
+inline void CSVeKeepalive::sendOrder(TOrder& order)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_SET);
+    CSVEDirect::setId(&ved, order.m_regid);
+    CSVEDirect::setFlags(&ved, 0);
+    for (int i = 0; i < order.m_payload.count(); i++) {
+        CSVEDirect::addU8(&ved, (quint8) order.m_payload.at(i));
+    }
+
+    /* previous refresh still waiting in the queue */
+    if (order.m_pending && order.m_charger->scheduler()->isQueued(VED_CMD_SET, order.m_regid)) {
+        order.m_lastSent = m_clock.elapsed();
+        return;
+    }
+
+    order.m_lastSent = m_clock.elapsed();
+    order.m_pending = true;
+    order.m_refreshes++;
+    order.m_charger->sendFrame(ved, CSVeScheduler::PrioUrgent);
+}
+
+/* refresh margin ahead of the deadline, retry unacknowledged */
+inline qint64 CSVeKeepalive::nextDue(const TOrder& order) const
+{
+    if (order.m_pending || order.m_lastAcked < 0) {
+        return order.m_lastSent + RETRY_INTERVAL;
+    }
+    return order.m_lastAcked + LINK_TIMEOUT - m_margin;
+}
+
+inline void CSVeKeepalive::rearm()
+{
+    if (m_orders.isEmpty()) {
+        m_timer.stop();
+        return;
+    }
+
+    const qint64 now = m_clock.elapsed();
+    qint64 due = LLONG_MAX;
+
+    foreach (const TOrder& order, m_orders) {
+        due = qMin(due, nextDue(order));
+        /* wake up on the deadline to raise the alarm */
+        if (order.m_lastAcked >= 0 && !order.m_missed) {
+            due = qMin(due, order.m_lastAcked + LINK_TIMEOUT);
+        }
+    }
+
+    m_timer.start((int) qMax((qint64) 0, due - now));
+}
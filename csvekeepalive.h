@@ -0,0 +1,138 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <csvedirect.h>
+
+class CSVeDirectAcDcCharger;
+
+/**
+ * @brief Deadline keepalive of remote controlled link registers
+ *
+ * The charger falls back to its own settings if the link
+ * registers (0x2015, 0x200E, 0x2009, 0x200C) are not written
+ * again within 60 seconds. A standing order holds the value of
+ * such a register and rewrites it before the deadline minus a
+ * safety margin, as urgent command ahead of any polling.
+ *
+ * One instance serves any number of chargers with a single
+ * timer, armed to the earliest refresh of all orders.
+ */
+class CSVeKeepalive: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* device side link register timeout in milliseconds */
+    static const qint64 LINK_TIMEOUT = 60000;
+    /* default refresh ahead of the deadline in milliseconds */
+    static const qint64 DEFAULT_MARGIN = 15000;
+    /* resend interval of an unacknowledged refresh in milliseconds */
+    static const qint64 RETRY_INTERVAL = 1000;
+    /* metrics log interval in milliseconds */
+    static const qint64 REPORT_INTERVAL = 60000;
+
+    typedef struct {
+        CSVeDirectAcDcCharger* m_charger;
+        quint16 m_regid;
+        QByteArray m_payload;
+        /* send time of the last write and the acknowledged one */
+        qint64 m_lastSent;
+        qint64 m_lastAcked;
+        bool m_pending;
+        bool m_missed;
+        quint32 m_refreshes;
+        quint32 m_acks;
+        quint32 m_rejects;
+        quint32 m_misses;
+        /* shortest time left to the deadline on acknowledge */
+        qint64 m_minSlack;
+        qint64 m_maxLatency;
+    } TOrder;
+
+    /**
+     * @brief CSVeKeepalive
+     * @param parent
+     */
+    explicit CSVeKeepalive(QObject* parent = nullptr);
+
+    /**
+     * @brief setOrder Hold register value, written now and
+     * refreshed until removed. Replaces the value of an
+     * existing order.
+     * @param charger
+     * @param regid
+     * @param payload Raw little endian register value
+     */
+    void setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, const QByteArray& payload);
+    void setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, quint8 value);
+    void setOrder(CSVeDirectAcDcCharger* charger, quint16 regid, quint16 value);
+    /**
+     * @brief removeOrder Stop refresh, the charger falls back
+     * after its link timeout.
+     * @param charger
+     * @param regid
+     */
+    void removeOrder(CSVeDirectAcDcCharger* charger, quint16 regid);
+    /**
+     * @brief removeCharger Drop all orders of a charger
+     * @param charger
+     */
+    void removeCharger(QObject* charger);
+    bool hasOrder(CSVeDirectAcDcCharger* charger, quint16 regid) const;
+
+    /**
+     * @brief setMargin Refresh this many ms before the deadline
+     * @param margin
+     */
+    void setMargin(qint64 margin);
+    qint64 margin() const;
+
+    /**
+     * @brief statistics
+     * @return Per order refresh and deadline metrics
+     */
+    QList<TOrder> statistics() const;
+    /**
+     * @brief report Human readable deadline metrics per order
+     * @return
+     */
+    QStringList report() const;
+    quint32 missedDeadlines() const;
+
+signals:
+    void deadlineMissed(CSVeDirectAcDcCharger* charger, quint16 regid, qint64 late);
+    void orderRejected(CSVeDirectAcDcCharger* charger, quint16 regid, quint8 flags);
+
+private slots:
+    void onTimeout();
+
+private:
+    typedef QPair<CSVeDirectAcDcCharger*, quint16> TKey;
+
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+    QHash<TKey, TOrder> m_orders;
+    QHash<QObject*, QList<QMetaObject::Connection>> m_chargers;
+    qint64 m_margin;
+    qint64 m_lastReport;
+    quint32 m_missed;
+
+private:
+    inline void attach(CSVeDirectAcDcCharger* charger);
+    inline void onHexFrame(CSVeDirectAcDcCharger* charger, const CSVeParser::TVeHexFrame& frame);
+    inline bool isAnswer(const TOrder& order, const CSVeParser::TVeHexFrame& frame) const;
+    inline void sendOrder(TOrder& order);
+    inline qint64 nextDue(const TOrder& order) const;
+    inline void rearm();
+};
@@ -0,0 +1,228 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <csvemuxserver.h>
+
+CSVeMuxServer::CSVeMuxServer(CSVeDirectAcDcCharger* charger, QObject* parent)
+    : QObject(parent)
+    , m_charger(charger)
+    , m_tcp(this)
+    , m_local(this)
+    , m_clients()
+    , m_prio(CSVeScheduler::PrioNormal)
+    , m_stats()
+{
+    connect(&m_tcp, &QTcpServer::newConnection, this, &CSVeMuxServer::onTcpConnection);
+    connect(&m_local, &QLocalServer::newConnection, this, &CSVeMuxServer::onLocalConnection);
+    connect(m_charger->router(), &CSVeFrameRouter::broadcast, this, &CSVeMuxServer::onBroadcast);
+    connect(m_charger->router(), &CSVeFrameRouter::response, this, &CSVeMuxServer::onResponse);
+}
+
+CSVeMuxServer::~CSVeMuxServer()
+{
+    close();
+}
+
+bool CSVeMuxServer::listen(const QHostAddress& address, quint16 port)
+{
+    if (m_tcp.isListening()) {
+        return true;
+    }
+    m_tcp.setMaxPendingConnections(MAX_CLIENTS);
+    if (!m_tcp.listen(address, port)) {
+        qWarning("[VE.MUX] TCP %s:%d: %s", qPrintable(address.toString()), port, qPrintable(m_tcp.errorString()));
+        return false;
+    }
+    return true;
+}
+
+bool CSVeMuxServer::listenLocal(const QString& name)
+{
+    if (m_local.isListening()) {
+        return true;
+    }
+    /* stale socket file of a crashed instance */
+    QLocalServer::removeServer(name);
+    m_local.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_local.listen(name)) {
+        qWarning("[VE.MUX] Socket %s: %s", qPrintable(name), qPrintable(m_local.errorString()));
+        return false;
+    }
+    return true;
+}
+
+void CSVeMuxServer::close()
+{
+    m_tcp.close();
+    m_local.close();
+
+    foreach (QObject* socket, m_clients.keys()) {
+        removeClient(socket);
+    }
+}
+
+void CSVeMuxServer::setPriority(CSVeScheduler::TPriority prio)
+{
+    m_prio = prio;
+}
+
+int CSVeMuxServer::clientCount() const
+{
+    return m_clients.count();
+}
+
+const CSVeMuxServer::TStats& CSVeMuxServer::statistics() const
+{
+    return m_stats;
+}
+
+QStringList CSVeMuxServer::report() const
+{
+    QStringList lines;
+    lines << tr("clients=%1 accepted=%2 rejected=%3 broadcasts=%4 commands=%5 responses=%6 invalid=%7 skipped=%8")
+                .arg(m_clients.count())
+                .arg(m_stats.m_accepted)
+                .arg(m_stats.m_rejected)
+                .arg(m_stats.m_broadcasts)
+                .arg(m_stats.m_commands)
+                .arg(m_stats.m_responses)
+                .arg(m_stats.m_invalid)
+                .arg(m_stats.m_skipped);
+    return lines;
+}
+
+void CSVeMuxServer::onTcpConnection()
+{
+    while (m_tcp.hasPendingConnections()) {
+        QTcpSocket* socket = m_tcp.nextPendingConnection();
+        /* frames are small, don't wait for more */
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            removeClient(socket);
+        });
+        addClient(socket);
+    }
+}
+
+void CSVeMuxServer::onLocalConnection()
+{
+    while (m_local.hasPendingConnections()) {
+        QLocalSocket* socket = m_local.nextPendingConnection();
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            removeClient(socket);
+        });
+        addClient(socket);
+    }
+}
+
+void CSVeMuxServer::onBroadcast(const QByteArray& unit)
+{
+    if (m_clients.isEmpty()) {
+        return;
+    }
+
+    m_stats.m_broadcasts++;
+
+    QHash<QObject*, TClient>::iterator it;
+    for (it = m_clients.begin(); it != m_clients.end(); it++) {
+        writeClient(it.value(), unit);
+    }
+}
+
+void CSVeMuxServer::onResponse(QObject* owner, const QByteArray& frame)
+{
+    if (!m_clients.contains(owner)) {
+        return;
+    }
+
+    m_stats.m_responses++;
+    writeClient(m_clients[owner], frame);
+}
+
+inline void CSVeMuxServer::addClient(QIODevice* socket)
+{
+    if (m_clients.count() >= MAX_CLIENTS) {
+        m_stats.m_rejected++;
+        socket->close();
+        socket->deleteLater();
+        return;
+    }
+
+    m_clients.insert(socket, {socket, QByteArray(), 0, 0});
+    m_stats.m_accepted++;
+
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() {
+        readClient(socket);
+    });
+
+    emit clientCountChanged(m_clients.count());
+}
+
+inline void CSVeMuxServer::removeClient(QObject* socket)
+{
+    if (!m_clients.contains(socket)) {
+        return;
+    }
+
+    /* a late response has nobody to go to */
+    m_charger->router()->removeOwner(socket);
+
+    const TClient client = m_clients.take(socket);
+    disconnect(client.m_socket, nullptr, this, nullptr);
+    client.m_socket->close();
+    client.m_socket->deleteLater();
+
+    emit clientCountChanged(m_clients.count());
+}
+
+/* one VE.HEX frame per line, anything else is dropped */
+inline void CSVeMuxServer::readClient(QIODevice* socket)
+{
+    if (!m_clients.contains(socket)) {
+        return;
+    }
+
+    TClient& client = m_clients[socket];
+    client.m_rx.append(socket->readAll());
+
+    int eol;
+    while ((eol = client.m_rx.indexOf('\n')) >= 0) {
+        QByteArray line = client.m_rx.left(eol).trimmed();
+        client.m_rx.remove(0, eol + 1);
+
+        quint8 command = 0;
+        quint16 regid = 0;
+        if (!line.startsWith(':') || !CSVeFrameRouter::parseHeader(line, &command, &regid)) {
+            if (!line.isEmpty()) {
+                m_stats.m_invalid++;
+            }
+            continue;
+        }
+
+        client.m_commands++;
+        m_stats.m_commands++;
+        m_charger->router()->submit("\n" + line + "\n", m_prio, socket);
+    }
+
+    if (client.m_rx.length() > MAX_LINE) {
+        m_stats.m_invalid++;
+        client.m_rx.clear();
+    }
+}
+
+/* write the shared buffer, no per client copy */
+inline void CSVeMuxServer::writeClient(TClient& client, const QByteArray& data)
+{
+    if (client.m_socket->bytesToWrite() > MAX_BACKLOG) {
+        client.m_skipped++;
+        m_stats.m_skipped++;
+        return;
+    }
+    client.m_socket->write(data);
+}
@@ -0,0 +1,122 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QObject>
+#include <QStringList>
+#include <QTcpServer>
+#include <csvedirectacdccharger.h>
+
+/**
+ * @brief VE.Direct multiplexer for local tools
+ *
+ * Only one process can own the charger port. The server owns it
+ * through the charger instance and exposes the VE.Direct stream
+ * to any number of clients over TCP and a Unix domain socket.
+ *
+ * VE.Text lines and ASYNC frames go to every client. The same
+ * QByteArray is written to all sockets, the socket write buffers
+ * share it instead of copying per client. A client that does not
+ * read misses whole units, never parts of one.
+ *
+ * Clients send VE.HEX frames, one per line (":7F0ED0071\n").
+ * The commands are serialized with the local and Cerbo GX
+ * traffic by the frame router, the response goes back to the
+ * client that asked.
+ */
+class CSVeMuxServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    static const quint16 DEFAULT_PORT = 2101;
+    static const int MAX_CLIENTS = 32;
+    /* client line length, longer input is garbage */
+    static const int MAX_LINE = 1024;
+    /* unread bytes of a client before units are skipped */
+    static const qint64 MAX_BACKLOG = 65536;
+
+    typedef struct {
+        quint32 m_accepted;
+        quint32 m_rejected;
+        quint32 m_broadcasts;
+        quint32 m_commands;
+        quint32 m_responses;
+        quint32 m_invalid;
+        /* units not written to slow clients */
+        quint32 m_skipped;
+    } TStats;
+
+    /**
+     * @brief CSVeMuxServer
+     * @param charger Charger owning the port
+     * @param parent
+     */
+    explicit CSVeMuxServer(CSVeDirectAcDcCharger* charger, QObject* parent = nullptr);
+    ~CSVeMuxServer();
+
+    /**
+     * @brief listen Accept TCP clients
+     * @param address Default local host only
+     * @param port
+     * @return false if the address is in use
+     */
+    bool listen(const QHostAddress& address = QHostAddress::LocalHost, quint16 port = DEFAULT_PORT);
+    /**
+     * @brief listenLocal Accept Unix domain socket clients
+     * @param name Socket name or path
+     * @return
+     */
+    bool listenLocal(const QString& name = QStringLiteral("vedirect"));
+    /**
+     * @brief close Stop listening and disconnect all clients
+     */
+    void close();
+
+    /**
+     * @brief setPriority Scheduler priority of client commands
+     * @param prio
+     */
+    void setPriority(CSVeScheduler::TPriority prio);
+
+    int clientCount() const;
+    const TStats& statistics() const;
+    QStringList report() const;
+
+signals:
+    void clientCountChanged(int count);
+
+private slots:
+    void onTcpConnection();
+    void onLocalConnection();
+    void onBroadcast(const QByteArray& unit);
+    void onResponse(QObject* owner, const QByteArray& frame);
+
+private:
+    typedef struct {
+        QIODevice* m_socket;
+        QByteArray m_rx;
+        quint32 m_commands;
+        quint32 m_skipped;
+    } TClient;
+
+    CSVeDirectAcDcCharger* m_charger;
+    QTcpServer m_tcp;
+    QLocalServer m_local;
+    QHash<QObject*, TClient> m_clients;
+    CSVeScheduler::TPriority m_prio;
+    TStats m_stats;
+
+private:
+    inline void addClient(QIODevice* socket);
+    inline void removeClient(QObject* socket);
+    inline void readClient(QIODevice* socket);
+    inline void writeClient(TClient& client, const QByteArray& data);
+};
@@ -0,0 +1,253 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csvedirectacdccharger.h>
+#include <csvenetworkmaster.h>
+
+/* weight of the newest round in the moving average */
+static const double EMA_WEIGHT = 0.2;
+
+CSVeNetworkMaster::CSVeNetworkMaster(QObject* parent)
+    : QObject(parent)
+    , m_clock()
+    , m_timer(this)
+    , m_slaves()
+    , m_voltage(0)
+    , m_state(0)
+    , m_valid(false)
+    , m_stateStart(0)
+    , m_roundStart(-1)
+    , m_maxSkewLimit(DEFAULT_MAX_SKEW)
+    , m_stats()
+{
+    m_clock.start();
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &CSVeNetworkMaster::broadcast);
+}
+
+void CSVeNetworkMaster::addCharger(CSVeDirectAcDcCharger* charger)
+{
+    if (indexOf(charger) >= 0) {
+        return;
+    }
+
+    TSlave slave = {};
+    slave.m_charger = charger;
+    slave.m_status = -1;
+    slave.m_offset = -1;
+
+    slave.m_connections << connect(charger->scheduler(), &CSVeScheduler::streamAcknowledged, this, [this, charger](quint16 regid, qint64) {
+        onAcknowledged(charger, regid);
+    });
+    slave.m_connections << connect(charger, &CSVeDirectAcDcCharger::dataChanged, this, [this, charger](uint regid, const QPair<float, QVariant>& value) {
+        const int i = indexOf(charger);
+        if (regid != 0x200F || i < 0) {
+            return;
+        }
+        m_slaves[i].m_status = value.second.toInt();
+        emit networkStatusChanged(charger, m_slaves[i].m_status);
+    });
+    slave.m_connections << connect(charger, &QObject::destroyed, this, &CSVeNetworkMaster::removeCharger);
+
+    charger->scheduler()->addPollRegister(0x200F, STATUS_POLL_INTERVAL);
+    m_slaves.append(slave);
+}
+
+void CSVeNetworkMaster::removeCharger(QObject* charger)
+{
+    const int i = indexOf(charger);
+    if (i < 0) {
+        return;
+    }
+
+    foreach (const QMetaObject::Connection& c, m_slaves[i].m_connections) {
+        disconnect(c);
+    }
+    m_slaves.removeAt(i);
+}
+
+int CSVeNetworkMaster::chargerCount() const
+{
+    return m_slaves.count();
+}
+
+void CSVeNetworkMaster::setVoltage(double voltage)
+{
+    m_voltage = (quint16) qRound(voltage * 100.0);
+    m_valid = true;
+    if (isActive()) {
+        broadcast();
+    }
+}
+
+void CSVeNetworkMaster::setDeviceState(quint8 state)
+{
+    if (state != m_state) {
+        m_stateStart = m_clock.elapsed();
+    }
+    m_state = state;
+    if (isActive()) {
+        broadcast();
+    }
+}
+
+void CSVeNetworkMaster::setMaxSkew(qint64 skew)
+{
+    m_maxSkewLimit = skew;
+}
+
+qint64 CSVeNetworkMaster::maxSkew() const
+{
+    return m_maxSkewLimit;
+}
+
+void CSVeNetworkMaster::start(int interval)
+{
+    m_stateStart = m_clock.elapsed();
+    m_timer.start(interval);
+    broadcast();
+}
+
+void CSVeNetworkMaster::stop()
+{
+    m_timer.stop();
+    closeRound();
+}
+
+bool CSVeNetworkMaster::isActive() const
+{
+    return m_timer.isActive();
+}
+
+const CSVeNetworkMaster::TSkewStats& CSVeNetworkMaster::skewStatistics() const
+{
+    return m_stats;
+}
+
+QStringList CSVeNetworkMaster::report() const
+{
+    QStringList lines;
+
+    lines << tr("rounds=%1 complete=%2 exceeded=%3 skew=%4ms avg=%5ms max=%6ms")
+                .arg(m_stats.m_rounds)
+                .arg(m_stats.m_complete)
+                .arg(m_stats.m_exceeded)
+                .arg(m_stats.m_lastSkew)
+                .arg(m_stats.m_avgSkew, 0, 'f', 1)
+                .arg(m_stats.m_maxSkew);
+
+    foreach (const TSlave& s, m_slaves) {
+        lines << tr("%1 status=0x%2 acks=%3 missed=%4")
+                    .arg(s.m_charger->configIn().m_portName)
+                    .arg(s.m_status, 2, 16, QChar('0'))
+                    .arg(s.m_acks)
+                    .arg(s.m_missed);
+    }
+
+    return lines;
+}
+
+/* one round: all ports written in the same pass */
+void CSVeNetworkMaster::broadcast()
+{
+    if (!m_valid || m_slaves.isEmpty()) {
+        return;
+    }
+
+    closeRound();
+
+    m_roundStart = m_clock.elapsed();
+    const quint32 elapsed = (quint32) (m_roundStart - m_stateStart);
+
+    for (int i = 0; i < m_slaves.count(); i++) {
+        TSlave& s = m_slaves[i];
+        s.m_offset = -1;
+        s.m_charger->streamSetRegister(0x2001, m_voltage);
+        s.m_charger->streamSetRegister(0x200C, m_state);
+        s.m_charger->streamSetRegister(0x2007, elapsed);
+    }
+}
+
+inline int CSVeNetworkMaster::indexOf(QObject* charger) const
+{
+    for (int i = 0; i < m_slaves.count(); i++) {
+        if (m_slaves[i].m_charger == charger) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* the voltage set-point acknowledge times the round */
+inline void CSVeNetworkMaster::onAcknowledged(CSVeDirectAcDcCharger* charger, quint16 regid)
+{
+    const int i = indexOf(charger);
+    if (regid != 0x2001 || i < 0 || m_roundStart < 0 || m_slaves[i].m_offset >= 0) {
+        return;
+    }
+
+    m_slaves[i].m_offset = m_clock.elapsed() - m_roundStart;
+    m_slaves[i].m_acks++;
+
+    foreach (const TSlave& s, m_slaves) {
+        if (s.m_offset < 0) {
+            return;
+        }
+    }
+
+    closeRound();
+}
+
+inline void CSVeNetworkMaster::closeRound()
+{
+    if (m_roundStart < 0) {
+        return;
+    }
+
+    qint64 first = -1;
+    qint64 last = -1;
+    bool complete = true;
+
+    for (int i = 0; i < m_slaves.count(); i++) {
+        TSlave& s = m_slaves[i];
+        if (s.m_offset < 0) {
+            s.m_missed++;
+            complete = false;
+            continue;
+        }
+        if (first < 0 || s.m_offset < first) {
+            first = s.m_offset;
+        }
+        if (s.m_offset > last) {
+            last = s.m_offset;
+        }
+    }
+
+    m_roundStart = -1;
+    m_stats.m_rounds++;
+
+    if (!complete || first < 0) {
+        return;
+    }
+
+    const qint64 skew = last - first;
+    if (m_stats.m_complete == 0) {
+        m_stats.m_avgSkew = skew;
+    }
+    else {
+        m_stats.m_avgSkew += EMA_WEIGHT * (skew - m_stats.m_avgSkew);
+    }
+    m_stats.m_complete++;
+    m_stats.m_lastSkew = skew;
+    m_stats.m_maxSkew = qMax(m_stats.m_maxSkew, skew);
+
+    if (skew > m_maxSkewLimit) {
+        m_stats.m_exceeded++;
+        qWarning("[VE.NET] round skew %lld ms exceeds %lld ms", skew, m_maxSkewLimit);
+        emit skewExceeded(skew);
+    }
+}
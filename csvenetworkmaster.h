@@ -0,0 +1,114 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QElapsedTimer>
+#include <QList>
+#include <QMetaObject>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+class CSVeDirectAcDcCharger;
+
+/**
+ * @brief Network master for chargers on one battery bank
+ *
+ * Acts like the master of a VE.Smart network: the link voltage
+ * set-point (0x2001), the shared device state (0x200C) and the
+ * state elapsed time (0x2007) are written to all chargers in one
+ * round, every round released on all ports within the same event
+ * loop pass. The arrival skew of a round is measured from the
+ * write acknowledges. The link network status (0x200F) of every
+ * charger is monitored.
+ */
+class CSVeNetworkMaster: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* set-point broadcast interval in milliseconds */
+    static const int BROADCAST_INTERVAL = 1000;
+    /* link network status poll interval in milliseconds */
+    static const qint64 STATUS_POLL_INTERVAL = 2000;
+    /* default max. acknowledge skew of a round in milliseconds */
+    static const qint64 DEFAULT_MAX_SKEW = 100;
+
+    typedef struct {
+        CSVeDirectAcDcCharger* m_charger;
+        /* 0x200F, -1 = unknown */
+        int m_status;
+        /* acknowledge offset to round start, -1 = pending */
+        qint64 m_offset;
+        quint32 m_acks;
+        quint32 m_missed;
+        QList<QMetaObject::Connection> m_connections;
+    } TSlave;
+
+    typedef struct {
+        quint32 m_rounds;
+        quint32 m_complete;
+        quint32 m_exceeded;
+        qint64 m_lastSkew;
+        qint64 m_maxSkew;
+        double m_avgSkew;
+    } TSkewStats;
+
+    /**
+     * @brief CSVeNetworkMaster
+     * @param parent
+     */
+    explicit CSVeNetworkMaster(QObject* parent = nullptr);
+
+    void addCharger(CSVeDirectAcDcCharger* charger);
+    void removeCharger(QObject* charger);
+    int chargerCount() const;
+
+    /**
+     * @brief setVoltage Link voltage set-point
+     * @param voltage in V
+     */
+    void setVoltage(double voltage);
+    /**
+     * @brief setDeviceState Shared device state, restarts the
+     * state elapsed time.
+     * @param state VE_REG_DEVICE_STATE
+     */
+    void setDeviceState(quint8 state);
+    void setMaxSkew(qint64 skew);
+    qint64 maxSkew() const;
+
+    void start(int interval = BROADCAST_INTERVAL);
+    void stop();
+    bool isActive() const;
+
+    const TSkewStats& skewStatistics() const;
+    QStringList report() const;
+
+signals:
+    void skewExceeded(qint64 skew);
+    void networkStatusChanged(CSVeDirectAcDcCharger* charger, int status);
+
+private slots:
+    void broadcast();
+
+private:
+    QElapsedTimer m_clock;
+    QTimer m_timer;
+    QList<TSlave> m_slaves;
+    quint16 m_voltage;
+    quint8 m_state;
+    bool m_valid;
+    qint64 m_stateStart;
+    qint64 m_roundStart;
+    qint64 m_maxSkewLimit;
+    TSkewStats m_stats;
+
+private:
+    inline int indexOf(QObject* charger) const;
+    inline void onAcknowledged(CSVeDirectAcDcCharger* charger, quint16 regid);
+    inline void closeRound();
+};
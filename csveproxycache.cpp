@@ -0,0 +1,177 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csveproxycache.h>
+
+/* application version changes with a firmware update only */
+static const qint64 PING_TTL = 60000;
+
+CSVeProxyCache::CSVeProxyCache(QObject* parent)
+    : QObject(parent)
+    , m_clock()
+    , m_registers()
+    , m_ping()
+    , m_ttl()
+    , m_defaultTtl(DEFAULT_TTL)
+    , m_stats()
+{
+    m_clock.start();
+    m_ping.m_time = -1;
+}
+
+void CSVeProxyCache::update(const CSVeParser::TVeHexFrame& frame)
+{
+    const CSVEDirect::ved_t* ved = &frame.ve_in;
+    if (ved->size < 1) {
+        return;
+    }
+
+    const QByteArray body((const char*) ved->data + 1, ved->size - 1);
+
+    switch (frame.command) {
+        case VED_CMD_GET:
+        case VED_CMD_ASYNC: {
+            if (frame.flags || ved->size < 5) {
+                return;
+            }
+            TEntry& entry = m_registers[frame.regid];
+            entry.m_body = body;
+            entry.m_time = m_clock.elapsed();
+            /* answered as GET, ASYNC has no other response format */
+            entry.m_body[2] = 0;
+            break;
+        }
+        case VED_CMD_SET: {
+            invalidate(frame.regid);
+            break;
+        }
+        case VED_CMD_PING_RESPONSE: {
+            m_ping.m_body = body;
+            m_ping.m_time = m_clock.elapsed();
+            break;
+        }
+    }
+}
+
+bool CSVeProxyCache::lookup(quint8 command, quint16 regid, QByteArray* response)
+{
+    switch (command) {
+        case VED_CMD_GET: {
+            if (!m_registers.contains(regid) || !isFresh(m_registers[regid], ttl(regid))) {
+                break;
+            }
+            const QByteArray frame = encode(VED_RESP_GET, m_registers[regid].m_body);
+            if (frame.isEmpty()) {
+                break;
+            }
+            m_stats.m_hits++;
+            (*response) = frame;
+            return true;
+        }
+        case VED_CMD_PING: {
+            if (!isFresh(m_ping, PING_TTL)) {
+                break;
+            }
+            const QByteArray frame = encode(VED_RESP_PING, m_ping.m_body);
+            if (frame.isEmpty()) {
+                break;
+            }
+            m_stats.m_hits++;
+            (*response) = frame;
+            return true;
+        }
+        /* the device changes, cached value is wrong */
+        case VED_CMD_SET: {
+            invalidate(regid);
+            break;
+        }
+    }
+
+    m_stats.m_misses++;
+    return false;
+}
+
+void CSVeProxyCache::invalidate(quint16 regid)
+{
+    if (m_registers.remove(regid)) {
+        m_stats.m_invalidated++;
+    }
+}
+
+void CSVeProxyCache::clear()
+{
+    m_registers.clear();
+    m_ping.m_body.clear();
+    m_ping.m_time = -1;
+}
+
+void CSVeProxyCache::setTtl(quint16 regid, qint64 ttl)
+{
+    m_ttl[regid] = ttl;
+}
+
+qint64 CSVeProxyCache::ttl(quint16 regid) const
+{
+    return m_ttl.value(regid, m_defaultTtl);
+}
+
+void CSVeProxyCache::setDefaultTtl(qint64 ttl)
+{
+    m_defaultTtl = ttl;
+}
+
+const CSVeProxyCache::TStats& CSVeProxyCache::statistics() const
+{
+    return m_stats;
+}
+
+QStringList CSVeProxyCache::report() const
+{
+    const quint32 requests = m_stats.m_hits + m_stats.m_misses;
+    const double savings = (requests ? (100.0 * m_stats.m_hits) / requests : 0.0);
+
+    return QStringList() << tr("registers=%1 hits=%2 misses=%3 expired=%4 invalidated=%5 savings=%6%")
+                               .arg(m_registers.count())
+                               .arg(m_stats.m_hits)
+                               .arg(m_stats.m_misses)
+                               .arg(m_stats.m_expired)
+                               .arg(m_stats.m_invalidated)
+                               .arg(savings, 0, 'f', 0);
+}
+
+inline bool CSVeProxyCache::isFresh(const TEntry& entry, qint64 ttl)
+{
+    if (entry.m_time < 0 || ttl <= 0) {
+        return false;
+    }
+    if ((m_clock.elapsed() - entry.m_time) > ttl) {
+        m_stats.m_expired++;
+        return false;
+    }
+    return true;
+}
+
+inline QByteArray CSVeProxyCache::encode(quint8 command, const QByteArray& body) const
+{
+    /* enframe() writes ':', the command nibble, two hex digits per
+     * byte, checksum, '\n' and '\0' into FRAME_BUFF_SIZE */
+    static const int MAX_BODY = (CSVEDirect::FRAME_BUFF_SIZE - 4) / 2 - 1;
+    if (body.count() > MAX_BODY) {
+        return QByteArray();
+    }
+
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, command);
+    /* PING response has no id and flags, raw copy */
+    for (int i = 0; i < body.count(); i++) {
+        ved.data[ved.size++] = (quint8) body.at(i);
+    }
+    if (!CSVEDirect::enframe(&ved)) {
+        return QByteArray();
+    }
+    return "\n" + QByteArray((const char*) ved.data, ved.size);
+}
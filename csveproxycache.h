@@ -0,0 +1,91 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <csvedirect.h>
+
+/**
+ * @brief Read-through cache of charger responses
+ *
+ * Keeps the raw payload of every GET response, ASYNC broadcast
+ * and PING response received from the charger. GET and PING
+ * requests of the Cerbo GX are answered from the cache if the
+ * entry is younger than the time to live of the register, only
+ * misses cost charger link time. A SET request invalidates the
+ * register.
+ */
+class CSVeProxyCache: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* default time to live in milliseconds */
+    static const qint64 DEFAULT_TTL = 1000;
+
+    typedef struct {
+        quint32 m_hits;
+        quint32 m_misses;
+        quint32 m_expired;
+        quint32 m_invalidated;
+    } TStats;
+
+    /**
+     * @brief CSVeProxyCache
+     * @param parent
+     */
+    explicit CSVeProxyCache(QObject* parent = nullptr);
+
+    /**
+     * @brief update Learn from a charger frame
+     * @param frame
+     */
+    void update(const CSVeParser::TVeHexFrame& frame);
+    /**
+     * @brief lookup Encoded response to a Cerbo GX request
+     * @param command Request command
+     * @param regid
+     * @param response Encoded VE.HEX frame on hit
+     * @return false on miss, forward the request
+     */
+    bool lookup(quint8 command, quint16 regid, QByteArray* response);
+    void invalidate(quint16 regid);
+    void clear();
+
+    /**
+     * @brief setTtl Max. age of a cached register value
+     * @param regid
+     * @param ttl in ms, 0 = never from cache
+     */
+    void setTtl(quint16 regid, qint64 ttl);
+    qint64 ttl(quint16 regid) const;
+    void setDefaultTtl(qint64 ttl);
+
+    const TStats& statistics() const;
+    QStringList report() const;
+
+private:
+    typedef struct {
+        /* frame without command byte and checksum */
+        QByteArray m_body;
+        qint64 m_time;
+    } TEntry;
+
+    QElapsedTimer m_clock;
+    QHash<quint16, TEntry> m_registers;
+    TEntry m_ping;
+    QHash<quint16, qint64> m_ttl;
+    qint64 m_defaultTtl;
+    TStats m_stats;
+
+private:
+    inline bool isFresh(const TEntry& entry, qint64 ttl);
+    inline QByteArray encode(quint8 command, const QByteArray& body) const;
+};
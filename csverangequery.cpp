@@ -0,0 +1,287 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QFileInfo>
+#include <QMap>
+#include <QtConcurrent>
+#include <QtEndian>
+#include <QtNumeric>
+#include <algorithm>
+#include <csverangequery.h>
+#include <csverecordreader.h>
+#include <csveseriescodec.h>
+#include <functional>
+
+CSVeRangeQuery::CSVeRangeQuery(const QString& directory)
+    : m_directory(directory)
+    , m_segments()
+{
+}
+
+CSVeRangeQuery::~CSVeRangeQuery()
+{
+    close();
+}
+
+CSVeRangeQuery::TQuery CSVeRangeQuery::query(const QString& device, quint16 regid, qint64 from, qint64 to)
+{
+    return TQuery {device, regid, from, to, -qInf(), qInf()};
+}
+
+bool CSVeRangeQuery::open(bool save)
+{
+    close();
+
+    foreach (const QString& fileName, CSVeRecordReader::segments(m_directory)) {
+        TSegment* segment = new TSegment {fileName, CSVeSeriesIndex()};
+        const QString indexName = CSVeSeriesIndex::indexName(fileName);
+
+        /* a stale index belongs to a segment that has grown */
+        if (!segment->m_index.load(indexName, QFileInfo(fileName).size())) {
+            CSVeRecordReader reader;
+            if (!reader.open(fileName)) {
+                delete segment;
+                continue;
+            }
+            if (segment->m_index.build(&reader) && save && !segment->m_index.save(indexName)) {
+                qWarning("[VE.QRY] Unable to write index %s", qPrintable(indexName));
+            }
+        }
+        m_segments.append(segment);
+    }
+    return !m_segments.isEmpty();
+}
+
+void CSVeRangeQuery::close()
+{
+    qDeleteAll(m_segments);
+    m_segments.clear();
+}
+
+int CSVeRangeQuery::segmentCount() const
+{
+    return m_segments.count();
+}
+
+QString CSVeRangeQuery::directory() const
+{
+    return m_directory;
+}
+
+qint64 CSVeRangeQuery::first() const
+{
+    qint64 first = 0;
+    bool any = false;
+    foreach (const TSegment* segment, m_segments) {
+        if (segment->m_index.count()) {
+            const qint64 time = segment->m_index.first() + segment->m_index.wallBase();
+            first = (any ? qMin(first, time) : time);
+            any = true;
+        }
+    }
+    return first;
+}
+
+qint64 CSVeRangeQuery::last() const
+{
+    qint64 last = 0;
+    bool any = false;
+    foreach (const TSegment* segment, m_segments) {
+        if (segment->m_index.count()) {
+            const qint64 time = segment->m_index.last() + segment->m_index.wallBase();
+            last = (any ? qMax(last, time) : time);
+            any = true;
+        }
+    }
+    return last;
+}
+
+QList<CSVeRangeQuery::TSeries> CSVeRangeQuery::run(const TQuery& query, TStats* stats) const
+{
+    QList<TPartial> partials;
+    foreach (const TSegment* segment, m_segments) {
+        partials.append(scan(segment, query));
+    }
+    return merge(partials, stats);
+}
+
+QList<CSVeRangeQuery::TSeries> CSVeRangeQuery::runParallel(const TQuery& query, TStats* stats) const
+{
+    const std::function<TPartial(const TSegment*)> task = [&query](const TSegment* segment) {
+        return scan(segment, query);
+    };
+    /* results() keeps the segment order */
+    return merge(QtConcurrent::mapped(m_segments, task).results(), stats);
+}
+
+CSVeRangeQuery::TPartial CSVeRangeQuery::scan(const TSegment* segment, const TQuery& query)
+{
+    TPartial partial = {{}, {}};
+    partial.m_stats.m_segments = 1;
+
+    /* index times are monotonic ms of the segment */
+    const CSVeSeriesIndex& index = segment->m_index;
+    const qint64 from = query.m_from - index.wallBase();
+    const qint64 to = query.m_to - index.wallBase();
+    if (index.count() == 0 || to <= index.first() || from > index.last()) {
+        partial.m_stats.m_segmentsSkipped = 1;
+        return partial;
+    }
+
+    QList<quint16> devices;
+    if (query.m_device.isEmpty()) {
+        for (int i = 0; i < index.devices().count(); i++) {
+            devices.append((quint16) i);
+        }
+    }
+    else if (index.devices().contains(query.m_device)) {
+        devices.append((quint16) index.devices().indexOf(query.m_device));
+    }
+
+    CSVeRecordReader reader;
+    QVector<CSVeSeriesIndex::TEntry> entries;
+    CSVeSeriesCodec::TBatch blocks;
+    qint64 parsed = -1;
+    QVector<qint64> times;
+    QVector<qint64> raws;
+
+    foreach (quint16 device, devices) {
+        entries.resize(0);
+        if (!index.find(device, query.m_regid, from, to, &entries)) {
+            continue;
+        }
+        if (!reader.isOpen() && !reader.open(segment->m_fileName)) {
+            return partial;
+        }
+
+        TSeries series = {index.devices().at(device), query.m_regid, {}, {}};
+
+        foreach (const CSVeSeriesIndex::TEntry& e, entries) {
+            partial.m_stats.m_blocks++;
+
+            /* predicate pushdown, the block can't match */
+            CSVeRegisterStore::TSlot unit = {};
+            unit.m_type = e.m_type;
+            unit.m_exponent = e.m_exponent;
+            unit.m_raw = 1;
+            const double scale = CSVeRegisterStore::toDouble(unit);
+            if (e.m_max * scale < query.m_min || e.m_min * scale > query.m_max) {
+                partial.m_stats.m_blocksPruned++;
+                continue;
+            }
+
+            /* the index was built from intact batches */
+            const uchar* header = reader.data() + e.m_offset;
+            if (e.m_offset + CSVeRecorder::BATCH_HEADER_SIZE > reader.size()) {
+                continue;
+            }
+            const quint32 size = qFromLittleEndian<quint32>(header + 8);
+            const quint32 count = qFromLittleEndian<quint32>(header + 12);
+            const uchar* payload = header + CSVeRecorder::BATCH_HEADER_SIZE;
+            if (e.m_offset + CSVeRecorder::BATCH_HEADER_SIZE + size > reader.size()) {
+                continue;
+            }
+
+            int n = 0;
+            if (e.m_codec == CSVeRecorder::CodecGorilla) {
+                if (parsed != e.m_offset) {
+                    parsed = (CSVeSeriesCodec::parse(payload, size, &blocks) ? e.m_offset : -1);
+                }
+                if (parsed < 0 || (int) e.m_block >= blocks.m_blocks.count()) {
+                    continue;
+                }
+                const CSVeSeriesCodec::TBlockInfo& info = blocks.m_blocks.at(e.m_block);
+                times.resize(info.m_count);
+                raws.resize(info.m_count);
+                n = CSVeSeriesCodec::decode(info, blocks.m_data.at(e.m_block), times.data(), raws.data());
+            }
+            else if (e.m_codec == CSVeRecorder::CodecPlain && (quint64) count * CSVeRecorder::RECORD_SIZE == size) {
+                times.resize(e.m_count);
+                raws.resize(e.m_count);
+                /* the run starts at m_block, its records up to
+                 * m_count are the only ones of this type */
+                CSVeRecordReader::TRecord r;
+                for (quint32 i = e.m_block; i < count && n < (int) e.m_count; i++) {
+                    CSVeRecordReader::decode(payload + i * CSVeRecorder::RECORD_SIZE, &r);
+                    if (r.m_device == device && r.m_regid == query.m_regid && //
+                        r.m_type == e.m_type && r.m_exponent == e.m_exponent) {
+                        times[n] = r.m_time;
+                        raws[n] = r.m_raw;
+                        n++;
+                    }
+                }
+            }
+            partial.m_stats.m_samplesDecoded += n;
+
+            for (int i = 0; i < n; i++) {
+                const double value = raws.at(i) * scale;
+                if (times.at(i) >= from && times.at(i) < to && value >= query.m_min && value <= query.m_max) {
+                    series.m_times.append(times.at(i) + index.wallBase());
+                    series.m_values.append(value);
+                }
+            }
+        }
+
+        if (!series.m_times.isEmpty()) {
+            partial.m_series.append(series);
+        }
+    }
+    return partial;
+}
+
+QList<CSVeRangeQuery::TSeries> CSVeRangeQuery::merge(const QList<TPartial>& partials, TStats* stats)
+{
+    TStats total = {};
+    QMap<QString, TSeries> merged;
+
+    foreach (const TPartial& partial, partials) {
+        total.m_segments += partial.m_stats.m_segments;
+        total.m_segmentsSkipped += partial.m_stats.m_segmentsSkipped;
+        total.m_blocks += partial.m_stats.m_blocks;
+        total.m_blocksPruned += partial.m_stats.m_blocksPruned;
+        total.m_samplesDecoded += partial.m_stats.m_samplesDecoded;
+
+        foreach (const TSeries& series, partial.m_series) {
+            QMap<QString, TSeries>::iterator it = merged.find(series.m_device);
+            if (it == merged.end()) {
+                merged.insert(series.m_device, series);
+            }
+            else {
+                it->m_times.append(series.m_times);
+                it->m_values.append(series.m_values);
+            }
+        }
+    }
+
+    QList<TSeries> result;
+    foreach (TSeries series, merged) {
+        /* late data and overlapping blocks */
+        if (!std::is_sorted(series.m_times.constBegin(), series.m_times.constEnd())) {
+            QVector<int> order(series.m_times.count());
+            for (int i = 0; i < order.count(); i++) {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&series](int a, int b) {
+                return series.m_times.at(a) < series.m_times.at(b);
+            });
+            QVector<qint64> times(order.count());
+            QVector<double> values(order.count());
+            for (int i = 0; i < order.count(); i++) {
+                times[i] = series.m_times.at(order.at(i));
+                values[i] = series.m_values.at(order.at(i));
+            }
+            series.m_times = times;
+            series.m_values = values;
+        }
+        total.m_samples += series.m_times.count();
+        result.append(series);
+    }
+
+    if (stats) {
+        *stats = total;
+    }
+    return result;
+}
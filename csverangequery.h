@@ -0,0 +1,105 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QList>
+#include <QString>
+#include <QVector>
+#include <csveseriesindex.h>
+
+/**
+ * @brief Range queries over a recording directory
+ *
+ * open() loads the sparse index of every segment (CSVeSeriesIndex),
+ * building and saving it where it is missing or stale. A query
+ * selects the blocks of a device register that overlap its time
+ * range through the index, skips the blocks whose min/max cannot
+ * match the value predicate and decodes only the remaining ones,
+ * straight from the memory mapped segment.
+ *
+ * run() scans the segments in the calling thread, runParallel()
+ * one segment per task on the global thread pool, which is what a
+ * fleet-wide query (empty device) spreads over the cores. Both
+ * return the same result.
+ */
+class CSVeRangeQuery
+{
+public:
+    typedef struct {
+        /* device id, empty = all devices */
+        QString m_device;
+        quint16 m_regid;
+        /* wall clock ms, from inclusive, to exclusive */
+        qint64 m_from;
+        qint64 m_to;
+        /* value predicate, inclusive scaled values */
+        double m_min;
+        double m_max;
+    } TQuery;
+
+    typedef struct {
+        QString m_device;
+        quint16 m_regid;
+        /* wall clock ms, ascending */
+        QVector<qint64> m_times;
+        QVector<double> m_values;
+    } TSeries;
+
+    typedef struct {
+        int m_segments;
+        /* segments out of the time range, not mapped */
+        int m_segmentsSkipped;
+        /* index entries in the time range */
+        quint64 m_blocks;
+        /* of these, skipped by min/max */
+        quint64 m_blocksPruned;
+        quint64 m_samplesDecoded;
+        quint64 m_samples;
+    } TStats;
+
+    explicit CSVeRangeQuery(const QString& directory);
+    ~CSVeRangeQuery();
+
+    /**
+     * @brief query Query of a register, any value
+     */
+    static TQuery query(const QString& device, quint16 regid, qint64 from, qint64 to);
+
+    /**
+     * @brief open Load or build the segment indexes
+     * @param save Write missing or stale indexes next to the segments
+     * @return false if the directory has no readable segment
+     */
+    bool open(bool save = true);
+    void close();
+    int segmentCount() const;
+    QString directory() const;
+    /* wall clock ms of the first and last indexed sample */
+    qint64 first() const;
+    qint64 last() const;
+
+    QList<TSeries> run(const TQuery& query, TStats* stats = nullptr) const;
+    QList<TSeries> runParallel(const TQuery& query, TStats* stats = nullptr) const;
+
+private:
+    typedef struct {
+        QString m_fileName;
+        CSVeSeriesIndex m_index;
+    } TSegment;
+
+    /* result of one segment */
+    typedef struct {
+        QList<TSeries> m_series;
+        TStats m_stats;
+    } TPartial;
+
+    QString m_directory;
+    QList<TSegment*> m_segments;
+
+private:
+    static TPartial scan(const TSegment* segment, const TQuery& query);
+    static QList<TSeries> merge(const QList<TPartial>& partials, TStats* stats);
+};
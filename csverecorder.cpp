@@ -0,0 +1,694 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QtEndian>
+#include <csvedevicemanager.h>
+#include <csvedirect.h>
+#include <csverecorder.h>
+#include <csverecordreader.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* make a new file in a directory durable */
+static bool syncDirectory(const QString& directory)
+{
+    const int fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const int rc = ::fsync(fd);
+    ::close(fd);
+    return (rc == 0);
+}
+
+CSVeRecorder::CSVeRecorder(QObject* parent)
+    : QObject(parent)
+    , m_directory()
+    , m_devices()
+    , m_commitTimer(this)
+    , m_connections()
+    , m_mutex()
+    , m_wake()
+    , m_queue()
+    , m_queuedDevices()
+    , m_nextCodec(CodecPlain)
+    , m_commit(false)
+    , m_stop(false)
+    , m_failed(false)
+    , m_published()
+    , m_thread(nullptr)
+    , m_file()
+    , m_sequence(0)
+    , m_segmentSize(DEFAULT_SEGMENT_SIZE)
+    , m_size(0)
+    , m_synced(0)
+    , m_deviceNames()
+    , m_newDevices()
+    , m_buffer()
+    , m_pending(0)
+    , m_codec(CodecPlain)
+    , m_blockWindow(DEFAULT_BLOCK_WINDOW)
+    , m_windowStart(-1)
+    , m_series()
+    , m_encoded(0)
+    , m_rollup()
+    , m_wallBase(QDateTime::currentMSecsSinceEpoch() - CSVeParser::monotonicTime())
+    , m_stats()
+{
+    m_commitTimer.setInterval(DEFAULT_COMMIT_INTERVAL);
+    connect(&m_commitTimer, &QTimer::timeout, this, &CSVeRecorder::commit);
+}
+
+CSVeRecorder::~CSVeRecorder()
+{
+    close();
+    qDeleteAll(m_series);
+}
+
+QString CSVeRecorder::defaultDirectory()
+{
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    return QDir(path).filePath("recordings");
+}
+
+QString CSVeRecorder::segmentName(quint32 sequence)
+{
+    return QStringLiteral("%1.vrec").arg(sequence, 8, 10, QChar('0'));
+}
+
+quint32 CSVeRecorder::crc32(const char* data, int size, quint32 crc)
+{
+    static const struct TTable {
+        quint32 m_entries[256];
+        TTable()
+        {
+            for (quint32 i = 0; i < 256; i++) {
+                quint32 c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1);
+                }
+                m_entries[i] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (int i = 0; i < size; i++) {
+        crc = table.m_entries[(crc ^ (quint8) data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+QByteArray CSVeRecorder::segmentHeader(quint32 sequence, qint64 wallBase, qint64 created)
+{
+    uchar header[SEGMENT_HEADER_SIZE] = {};
+    qToLittleEndian<quint32>(SEGMENT_MAGIC, header);
+    qToLittleEndian<quint16>(SEGMENT_VERSION, header + 4);
+    qToLittleEndian<quint16>(SEGMENT_HEADER_SIZE, header + 6);
+    qToLittleEndian<quint32>(sequence, header + 8);
+    qToLittleEndian<qint64>(wallBase, header + 16);
+    qToLittleEndian<qint64>(created, header + 24);
+    return QByteArray((const char*) header, SEGMENT_HEADER_SIZE);
+}
+
+QByteArray CSVeRecorder::batch(TBatchKind kind, TCodec codec, const QByteArray& payload, quint32 count)
+{
+    uchar header[BATCH_HEADER_SIZE] = {};
+    qToLittleEndian<quint32>(BATCH_MAGIC, header);
+    header[4] = (uchar) kind;
+    header[5] = (uchar) codec;
+    qToLittleEndian<quint32>(payload.size(), header + 8);
+    qToLittleEndian<quint32>(count, header + 12);
+    qToLittleEndian<quint32>(crc32(payload.constData(), payload.size()), header + 16);
+
+    QByteArray batch;
+    batch.reserve(BATCH_HEADER_SIZE + payload.size());
+    batch.append((const char*) header, BATCH_HEADER_SIZE);
+    batch.append(payload);
+    return batch;
+}
+
+QByteArray CSVeRecorder::deviceTable(const QStringList& names, const QList<quint16>& devices)
+{
+    QByteArray table;
+    foreach (quint16 index, devices) {
+        const QByteArray name = names.at(index).toUtf8();
+        uchar head[4];
+        qToLittleEndian<quint16>(index, head);
+        qToLittleEndian<quint16>(name.size(), head + 2);
+        table.append((const char*) head, sizeof(head));
+        table.append(name);
+    }
+    return table;
+}
+
+bool CSVeRecorder::open(const QString& directory)
+{
+    close();
+
+    if (!QDir().mkpath(directory)) {
+        fail(tr("Unable to create directory: %1").arg(directory));
+        return false;
+    }
+    m_directory = directory;
+
+    /* continue numbering, repair what the last run left */
+    const QStringList segments = CSVeRecordReader::segments(directory);
+    m_sequence = 0;
+    if (!segments.isEmpty()) {
+        m_sequence = QFileInfo(segments.last()).baseName().toUInt();
+        recover(segments.last());
+    }
+
+    if (!startSegment()) {
+        return false;
+    }
+
+    m_stop = false;
+    m_commit = false;
+    m_failed = false;
+    m_thread = QThread::create([this]() {
+        run();
+    });
+    m_thread->setObjectName("ve-recorder");
+    m_thread->start();
+
+    if (m_commitTimer.interval() > 0) {
+        m_commitTimer.start();
+    }
+    return true;
+}
+
+void CSVeRecorder::close()
+{
+    m_commitTimer.stop();
+    if (!m_thread) {
+        return;
+    }
+
+    /* the thread writes what is queued before it ends */
+    m_mutex.lock();
+    m_stop = true;
+    m_wake.wakeAll();
+    m_mutex.unlock();
+
+    m_thread->wait();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+bool CSVeRecorder::isOpen() const
+{
+    return (m_thread != nullptr);
+}
+
+QString CSVeRecorder::directory() const
+{
+    return m_directory;
+}
+
+void CSVeRecorder::setCommitInterval(int msecs)
+{
+    m_commitTimer.setInterval(qMax(0, msecs));
+    if (msecs <= 0) {
+        m_commitTimer.stop();
+    }
+    else if (m_thread) {
+        m_commitTimer.start();
+    }
+}
+
+void CSVeRecorder::setSegmentSize(qint64 bytes)
+{
+    m_segmentSize = qMax((qint64) MAX_BATCH_SIZE, bytes);
+}
+
+void CSVeRecorder::setCodec(TCodec codec)
+{
+    QMutexLocker lock(&m_mutex);
+    m_nextCodec = codec;
+    /* the writer thread switches with the next queue it takes */
+    if (!m_thread) {
+        m_codec = codec;
+    }
+}
+
+CSVeRecorder::TCodec CSVeRecorder::codec() const
+{
+    QMutexLocker lock(const_cast<QMutex*>(&m_mutex));
+    return m_nextCodec;
+}
+
+void CSVeRecorder::setBlockWindow(int msecs)
+{
+    m_blockWindow = qMax(0, msecs);
+}
+
+void CSVeRecorder::attach(CSVeDeviceManager* manager)
+{
+    if (m_connections.contains(manager)) {
+        return;
+    }
+
+    /* the slot holds type, exponent and raw value of the change */
+    m_connections.insert(
+       manager,
+       connect(manager, &CSVeDeviceManager::dataChanged, this, [this, manager](const QString& id, uint regid, const QPair<float, QVariant>&, const CSVeParser::TStamp& stamp) {
+           /* local and restored values were not read from the device */
+           if (stamp.m_sequence == 0) {
+               return;
+           }
+           const CSVeDirectAcDcCharger* charger = manager->device(id);
+           const CSVeRegisterStore::TSlot* slot = (charger ? charger->store().find(regid) : nullptr);
+           if (slot) {
+               record(id, *slot);
+           }
+       }));
+}
+
+void CSVeRecorder::detach(CSVeDeviceManager* manager)
+{
+    if (m_connections.contains(manager)) {
+        disconnect(m_connections.take(manager));
+    }
+}
+
+void CSVeRecorder::record(const QString& device, const CSVeRegisterStore::TSlot& slot)
+{
+    record(deviceIndex(device), slot);
+}
+
+void CSVeRecorder::record(quint16 device, const CSVeRegisterStore::TSlot& slot)
+{
+    switch (slot.m_type) {
+        case CSVeRegisterStore::TypeNone:
+        case CSVeRegisterStore::TypeString:
+        case CSVeRegisterStore::TypeBytes:
+        case CSVeRegisterStore::TypeStruct: {
+            return;
+        }
+    }
+    if (!m_thread) {
+        return;
+    }
+
+    TRecord record = {slot.m_time, device, slot.m_regid, slot.m_type, slot.m_exponent, slot.m_raw};
+    QMutexLocker lock(&m_mutex);
+    m_queue.append(record);
+    /* encode a full batch without waiting for the commit */
+    if (m_queue.count() * RECORD_SIZE >= MAX_BATCH_SIZE) {
+        m_wake.wakeAll();
+    }
+}
+
+quint16 CSVeRecorder::deviceIndex(const QString& device)
+{
+    QHash<QString, quint16>::const_iterator it = m_devices.constFind(device);
+    if (it != m_devices.constEnd()) {
+        return it.value();
+    }
+
+    const quint16 index = (quint16) m_devices.count();
+    m_devices.insert(device, index);
+    /* the writer thread adds it before the records of the queue */
+    QMutexLocker lock(&m_mutex);
+    if (m_thread) {
+        m_queuedDevices.append(device);
+    }
+    else {
+        m_deviceNames.append(device);
+        m_newDevices.append(index);
+    }
+    return index;
+}
+
+bool CSVeRecorder::commit()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_thread) {
+        return false;
+    }
+    m_commit = true;
+    m_wake.wakeAll();
+    return !m_failed;
+}
+
+CSVeRecorder::TStats CSVeRecorder::statistics() const
+{
+    QMutexLocker lock(const_cast<QMutex*>(&m_mutex));
+    return m_published;
+}
+
+QStringList CSVeRecorder::report() const
+{
+    const TStats st = statistics();
+    const double amplification = (st.m_payload ? (double) st.m_bytes / st.m_payload : 0);
+
+    QStringList lines;
+    lines << tr("records=%1 batches=%2 commits=%3 segments=%4 rollups=%5 late=%6") //
+                .arg(st.m_records)
+                .arg(st.m_batches)
+                .arg(st.m_commits)
+                .arg(st.m_segments)
+                .arg(st.m_rollups)
+                .arg(st.m_late);
+    lines << tr("plain=%1 written=%2 amplification=%3 sync avg=%4ms max=%5ms")
+                .arg(st.m_payload)
+                .arg(st.m_bytes)
+                .arg(amplification, 0, 'f', 3)
+                .arg((st.m_commits ? st.m_syncNs / 1e6 / st.m_commits : 0), 0, 'f', 3)
+                .arg(st.m_maxSyncNs / 1e6, 0, 'f', 3);
+    return lines;
+}
+
+inline void CSVeRecorder::run()
+{
+    QVector<TRecord> records;
+    QStringList devices;
+    bool stop = false;
+    while (!stop) {
+        bool commit = false;
+        TCodec codec;
+        {
+            QMutexLocker lock(&m_mutex);
+            if (m_queue.isEmpty() && !m_commit && !m_stop) {
+                m_wake.wait(&m_mutex);
+            }
+            /* the port thread appends to the emptied vector */
+            records.swap(m_queue);
+            devices.swap(m_queuedDevices);
+            codec = m_nextCodec;
+            commit = m_commit;
+            m_commit = false;
+            stop = m_stop;
+        }
+
+        foreach (const QString& device, devices) {
+            m_newDevices.append((quint16) m_deviceNames.count());
+            m_deviceNames.append(device);
+        }
+        devices.clear();
+        /* nothing pending of the other layout */
+        if (codec != m_codec) {
+            writePending(true);
+            m_codec = codec;
+        }
+        foreach (const TRecord& record, records) {
+            append(record);
+        }
+        records.resize(0);
+
+        if (commit && !stop) {
+            flush();
+        }
+    }
+
+    if (m_file.isOpen()) {
+        writePending(true);
+        /* the next run adds the rest of the open buckets */
+        writeRollups(m_rollup.takeAll(CSVeParser::monotonicTime() + m_wallBase));
+        flush();
+        finishSegment();
+    }
+}
+
+inline void CSVeRecorder::append(const TRecord& record)
+{
+    if (!m_file.isOpen()) {
+        return;
+    }
+    m_rollup.add(record.m_device, record.m_regid, record.m_type, record.m_exponent, record.m_time + m_wallBase, record.m_raw);
+    if (m_codec == CodecGorilla) {
+        encode(record);
+        return;
+    }
+
+    const int offset = m_buffer.size();
+    m_buffer.resize(offset + RECORD_SIZE);
+    uchar* p = (uchar*) m_buffer.data() + offset;
+    qToLittleEndian<qint64>(record.m_time, p);
+    qToLittleEndian<quint16>(record.m_device, p + 8);
+    qToLittleEndian<quint16>(record.m_regid, p + 10);
+    p[12] = record.m_type;
+    p[13] = (uchar) record.m_exponent;
+    qToLittleEndian<quint32>((quint32) record.m_raw, p + 14);
+    m_pending++;
+
+    if (m_buffer.size() >= MAX_BATCH_SIZE) {
+        writePending(true);
+    }
+}
+
+/* group commit: write pending records and closed rollups, sync */
+inline bool CSVeRecorder::flush()
+{
+    if (!m_file.isOpen()) {
+        return false;
+    }
+
+    /* compressed blocks stay open for the block window */
+    const bool seal = (m_codec == CodecPlain || (m_windowStart >= 0 && CSVeParser::monotonicTime() - m_windowStart >= m_blockWindow));
+    if (!writePending(seal) || !writeRollups(m_rollup.takeClosed(CSVeParser::monotonicTime() + m_wallBase)) || !sync()) {
+        publish();
+        return false;
+    }
+
+    m_stats.m_commits++;
+    publish();
+    emit committed(m_stats.m_records);
+    return true;
+}
+
+inline void CSVeRecorder::publish()
+{
+    m_stats.m_late = m_rollup.lateCount();
+    QMutexLocker lock(&m_mutex);
+    m_published = m_stats;
+}
+
+inline bool CSVeRecorder::startSegment()
+{
+    m_sequence++;
+    m_file.setFileName(QDir(m_directory).filePath(segmentName(m_sequence)));
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        fail(tr("Unable to create segment: %1").arg(m_file.fileName()));
+        return false;
+    }
+
+    const qint64 monotonic = CSVeParser::monotonicTime();
+    m_wallBase = QDateTime::currentMSecsSinceEpoch() - monotonic;
+    if (m_file.write(segmentHeader(m_sequence, m_wallBase, monotonic)) != SEGMENT_HEADER_SIZE) {
+        fail(tr("Unable to write segment: %1").arg(m_file.fileName()));
+        m_file.close();
+        return false;
+    }
+    /* the segment survives a crash even if no commit follows */
+    if (!syncDirectory(m_directory)) {
+        fail(tr("Unable to sync %1").arg(m_directory));
+        m_file.close();
+        return false;
+    }
+    m_size = SEGMENT_HEADER_SIZE;
+    m_stats.m_bytes += SEGMENT_HEADER_SIZE;
+    m_stats.m_segments++;
+
+    /* self contained, every segment knows all devices */
+    m_newDevices.clear();
+    QList<quint16> all;
+    for (int i = 0; i < m_deviceNames.count(); i++) {
+        all.append((quint16) i);
+    }
+    if (!all.isEmpty()) {
+        return writeBatch(KindDevices, CodecPlain, deviceTable(m_deviceNames, all), all.count());
+    }
+    return true;
+}
+
+inline void CSVeRecorder::finishSegment()
+{
+    sync();
+    m_file.close();
+    m_size = 0;
+}
+
+inline bool CSVeRecorder::writeBatch(TBatchKind kind, TCodec codec, const QByteArray& payload, quint32 count)
+{
+    /* header and payload in one write, a torn batch fails its CRC */
+    const QByteArray batch = CSVeRecorder::batch(kind, codec, payload, count);
+    if (m_file.write(batch) != batch.size()) {
+        fail(tr("Unable to write segment: %1").arg(m_file.fileName()));
+        return false;
+    }
+
+    m_size += batch.size();
+    m_stats.m_bytes += batch.size();
+    m_stats.m_batches++;
+    return true;
+}
+
+inline bool CSVeRecorder::writePending(bool seal)
+{
+    QByteArray payload;
+    if (seal && m_pending > 0) {
+        payload = (m_codec == CodecGorilla ? CSVeSeriesEncoder::encodeBatch(m_series.values()) : m_buffer);
+    }
+    if (payload.isEmpty() && m_newDevices.isEmpty()) {
+        return true;
+    }
+
+    if (m_size + BATCH_HEADER_SIZE + payload.size() > m_segmentSize) {
+        finishSegment();
+        if (!startSegment()) {
+            return false;
+        }
+    }
+
+    /* devices of the records first */
+    if (!m_newDevices.isEmpty()) {
+        const QList<quint16> devices = m_newDevices;
+        m_newDevices.clear();
+        if (!writeBatch(KindDevices, CodecPlain, deviceTable(m_deviceNames, devices), devices.count())) {
+            return false;
+        }
+    }
+    if (payload.isEmpty()) {
+        return true;
+    }
+
+    if (!writeBatch(KindRecords, m_codec, payload, m_pending)) {
+        return false;
+    }
+    m_stats.m_records += m_pending;
+    m_stats.m_payload += (quint64) m_pending * RECORD_SIZE;
+
+    /* keep the capacity, the next batch doesn't allocate */
+    m_buffer.resize(0);
+    foreach (CSVeSeriesEncoder* encoder, m_series) {
+        encoder->reset();
+    }
+    m_pending = 0;
+    m_encoded = 0;
+    m_windowStart = -1;
+    return true;
+}
+
+/* one streaming encoder per series, a new block on type change
+ * and when the sample is past the block window */
+inline void CSVeRecorder::encode(const TRecord& record)
+{
+    if (m_windowStart >= 0 && record.m_time - m_windowStart >= m_blockWindow) {
+        writePending(true);
+    }
+
+    const quint32 key = ((quint32) record.m_device << 16) | record.m_regid;
+    CSVeSeriesEncoder* encoder = m_series.value(key);
+    if (encoder && (encoder->type() != record.m_type || encoder->exponent() != record.m_exponent)) {
+        writePending(true);
+        delete m_series.take(key);
+        encoder = nullptr;
+    }
+    if (!encoder) {
+        encoder = new CSVeSeriesEncoder(record.m_device, record.m_regid, record.m_type, record.m_exponent);
+        m_series.insert(key, encoder);
+    }
+
+    const int size = encoder->size();
+    encoder->append(record.m_time, record.m_raw);
+    m_encoded += encoder->size() - size;
+    m_pending++;
+
+    if (m_windowStart < 0) {
+        m_windowStart = record.m_time;
+    }
+    if (m_encoded >= MAX_BATCH_SIZE) {
+        writePending(true);
+    }
+}
+
+inline bool CSVeRecorder::writeRollups(const QVector<CSVeRollup::TBucket>& buckets)
+{
+    if (buckets.isEmpty()) {
+        return true;
+    }
+
+    const QByteArray payload = CSVeRollup::encode(buckets);
+    if (m_size + BATCH_HEADER_SIZE + payload.size() > m_segmentSize) {
+        finishSegment();
+        if (!startSegment()) {
+            return false;
+        }
+    }
+    if (!writeBatch(KindRollups, CodecPlain, payload, buckets.count())) {
+        return false;
+    }
+    m_stats.m_rollups += buckets.count();
+    return true;
+}
+
+inline bool CSVeRecorder::sync()
+{
+    if (!m_file.isOpen()) {
+        return false;
+    }
+    /* nothing written since the last sync */
+    if (m_synced == m_stats.m_bytes) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+#if defined(Q_OS_MACOS)
+    const int rc = ::fcntl(m_file.handle(), F_FULLFSYNC);
+#elif defined(Q_OS_LINUX)
+    const int rc = ::fdatasync(m_file.handle());
+#else
+    const int rc = ::fsync(m_file.handle());
+#endif
+    const qint64 ns = timer.nsecsElapsed();
+
+    m_stats.m_syncNs += ns;
+    m_stats.m_maxSyncNs = qMax(m_stats.m_maxSyncNs, ns);
+
+    if (rc != 0) {
+        fail(tr("Unable to sync segment: %1").arg(m_file.fileName()));
+        return false;
+    }
+    m_synced = m_stats.m_bytes;
+    return true;
+}
+
+/* cut a torn tail, so appending tools see a clean end */
+inline void CSVeRecorder::recover(const QString& fileName)
+{
+    CSVeRecordReader reader;
+    if (!reader.open(fileName)) {
+        return;
+    }
+    if (reader.scan()) {
+        return;
+    }
+
+    const qint64 valid = reader.validSize();
+    reader.close();
+
+    qWarning("[VE.REC] Truncate torn segment %s at %lld", qPrintable(fileName), (long long) valid);
+    QFile file(fileName);
+    file.resize(valid);
+}
+
+inline void CSVeRecorder::fail(const QString& message)
+{
+    qWarning("[VE.REC] %s", qPrintable(message));
+    m_mutex.lock();
+    m_failed = true;
+    m_mutex.unlock();
+    emit errorOccurred(message);
+}
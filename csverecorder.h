@@ -0,0 +1,267 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+#include <csveregisterstore.h>
+#include <csverollup.h>
+#include <csveseriescodec.h>
+
+class CSVeDeviceManager;
+
+/**
+ * @brief Append-only register time-series recorder
+ *
+ * Every numeric register change of the attached devices is
+ * appended as a fixed size binary record to segment files
+ * "00000001.vrec", "00000002.vrec", ... in the recording
+ * directory. A new segment is started on open() and when a
+ * segment reaches the segment size.
+ *
+ * Segment layout, all little endian:
+ *
+ *   header  32 bytes  u32 magic "VREC", u16 version, u16 header
+ *                     size, u32 segment number, u32 reserved,
+ *                     i64 wall clock ms at monotonic time 0,
+ *                     i64 monotonic ms at creation
+ *   batch   20 bytes  u32 magic "VREB", u8 kind, u8 codec,
+ *                     u16 reserved, u32 payload size, u32 entry
+ *                     count, u32 CRC-32 of the payload
+ *           payload   KindDevices: u16 index, u16 size, UTF-8 id
+ *                     KindRecords: records of RECORD_SIZE, or
+ *                     blocks of CSVeSeriesCodec (CodecGorilla)
+ *                     KindRollups: CSVeRollup entries
+ *   record  18 bytes  i64 monotonic ms (stamp of the value),
+ *                     u16 device index, u16 register id, u8 type,
+ *                     i8 exponent, 32 bit raw value
+ *
+ * Records collect in memory and are written as one batch; a
+ * group commit writes the pending batch and syncs the file once
+ * for all of them, every commit interval. A crash loses at most
+ * the last interval; a torn batch at the end of a segment fails
+ * its CRC and is cut off by the reader and on the next open().
+ *
+ * With CodecGorilla the records of a batch are stored as one
+ * compressed block per device and register (see CSVeSeriesCodec).
+ * Samples are encoded as they arrive and the blocks are written
+ * when the block window has passed, by the commit or the first
+ * sample time behind the window, which trades the commit
+ * interval for the block window as the maximum loss on a crash.
+ *
+ * The 1 min, 1 h and 1 day rollups of every series (CSVeRollup)
+ * are maintained as records arrive and written with the commit
+ * after their bucket has ended, late data as extra partials, the
+ * open buckets at close(). CSVeRollup::query() answers long ranges
+ * from them.
+ *
+ * record() only queues the record on the calling (port) thread.
+ * The rollups, the encoding, the writes and the sync run on a
+ * writer thread started by open(); commit() wakes it for a group
+ * commit. committed() and errorOccurred() are emitted from the
+ * writer thread.
+ *
+ * Each segment starts with the full device table and can be read
+ * on its own, see CSVeRecordReader.
+ */
+class CSVeRecorder: public QObject
+{
+    Q_OBJECT
+
+public:
+    static const quint32 SEGMENT_MAGIC = 0x43455256; // VREC
+    static const quint16 SEGMENT_VERSION = 1;
+    static const int SEGMENT_HEADER_SIZE = 32;
+    static const quint32 BATCH_MAGIC = 0x42455256; // VREB
+    static const int BATCH_HEADER_SIZE = 20;
+    static const int RECORD_SIZE = 18;
+
+    /* group commit interval in ms, 0 = commit() only */
+    static const int DEFAULT_COMMIT_INTERVAL = 1000;
+    static const qint64 DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+    /* pending records written early, synced with the next commit */
+    static const int MAX_BATCH_SIZE = 256 * 1024;
+    /* time covered by the compressed blocks of a batch */
+    static const int DEFAULT_BLOCK_WINDOW = 60000;
+
+    typedef enum {
+        KindDevices = 1,
+        KindRecords = 2,
+        KindRollups = 3,
+    } TBatchKind;
+
+    typedef enum {
+        CodecPlain = 0,
+        CodecGorilla = 1,
+    } TCodec;
+
+    typedef struct {
+        qint64 m_time;
+        quint16 m_device;
+        quint16 m_regid;
+        quint8 m_type;
+        qint8 m_exponent;
+        qint64 m_raw;
+    } TRecord;
+
+    typedef struct {
+        quint64 m_records;
+        quint64 m_batches;
+        quint64 m_commits;
+        quint32 m_segments;
+        /* records as plain bytes, all bytes written to segment files */
+        quint64 m_payload;
+        quint64 m_bytes;
+        qint64 m_syncNs;
+        qint64 m_maxSyncNs;
+        quint64 m_rollups;
+        /* samples older than the open rollup bucket */
+        quint64 m_late;
+    } TStats;
+
+    explicit CSVeRecorder(QObject* parent = nullptr);
+    ~CSVeRecorder();
+
+    static QString defaultDirectory();
+    static QString segmentName(quint32 sequence);
+    /**
+     * @brief crc32 CRC-32 (IEEE 802.3) of the batch payloads
+     */
+    static quint32 crc32(const char* data, int size, quint32 crc = 0);
+    static QByteArray segmentHeader(quint32 sequence, qint64 wallBase, qint64 created);
+    /* header and payload of a batch */
+    static QByteArray batch(TBatchKind kind, TCodec codec, const QByteArray& payload, quint32 count);
+    /* KindDevices payload of devices, indexes into names */
+    static QByteArray deviceTable(const QStringList& names, const QList<quint16>& devices);
+
+    /**
+     * @brief open Start recording into directory, cuts a torn
+     * tail off the last segment, starts a new one and the writer
+     * thread.
+     * @param directory
+     * @return false if the directory or segment is not writable
+     */
+    bool open(const QString& directory = defaultDirectory());
+    /**
+     * @brief close Write all queued records, commit, close the
+     * segment and stop the writer thread
+     */
+    void close();
+    bool isOpen() const;
+    QString directory() const;
+
+    void setCommitInterval(int msecs);
+    /* set before open() */
+    void setSegmentSize(qint64 bytes);
+    /* the records pending in the other codec are written first */
+    void setCodec(TCodec codec);
+    TCodec codec() const;
+    /**
+     * @brief setBlockWindow Compressed blocks are written after
+     * this time, CodecGorilla only, set before open()
+     * @param msecs
+     */
+    void setBlockWindow(int msecs);
+
+    /**
+     * @brief attach Record all register changes of the devices of
+     * a manager living in the same thread
+     * @param manager
+     */
+    void attach(CSVeDeviceManager* manager);
+    void detach(CSVeDeviceManager* manager);
+
+    /**
+     * @brief record Queue a register value for the writer thread,
+     * not numeric types are ignored.
+     * @param device Device id
+     * @param slot Register slot, its time is the record time
+     */
+    void record(const QString& device, const CSVeRegisterStore::TSlot& slot);
+    void record(quint16 device, const CSVeRegisterStore::TSlot& slot);
+    /**
+     * @brief deviceIndex Index of a device in the records,
+     * assigned on first use, same thread as record()
+     */
+    quint16 deviceIndex(const QString& device);
+
+    /**
+     * @brief commit Wake the writer thread to write the queued
+     * records and sync the segment
+     * @return false if not open or the last commit failed
+     */
+    bool commit();
+
+    /* as of the last commit */
+    TStats statistics() const;
+    QStringList report() const;
+
+signals:
+    void committed(quint64 records);
+    void errorOccurred(const QString& message);
+
+private:
+    QString m_directory;
+    /* port thread */
+    QHash<QString, quint16> m_devices;
+    QTimer m_commitTimer;
+    QHash<CSVeDeviceManager*, QMetaObject::Connection> m_connections;
+    /* queue of the port thread, guarded by m_mutex */
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QVector<TRecord> m_queue;
+    QStringList m_queuedDevices;
+    TCodec m_nextCodec;
+    bool m_commit;
+    bool m_stop;
+    bool m_failed;
+    TStats m_published;
+    QThread* m_thread;
+
+    /* writer thread, or the caller while it is not running */
+    QFile m_file;
+    quint32 m_sequence;
+    qint64 m_segmentSize;
+    qint64 m_size;
+    /* m_stats.m_bytes at the last sync */
+    quint64 m_synced;
+    QStringList m_deviceNames;
+    QList<quint16> m_newDevices;
+    QByteArray m_buffer;
+    quint32 m_pending;
+    TCodec m_codec;
+    int m_blockWindow;
+    qint64 m_windowStart;
+    /* series encoders by device << 16 | regid */
+    QHash<quint32, CSVeSeriesEncoder*> m_series;
+    int m_encoded;
+    CSVeRollup m_rollup;
+    /* wall clock ms at monotonic time 0 */
+    qint64 m_wallBase;
+    TStats m_stats;
+
+private:
+    inline void run();
+    inline void append(const TRecord& record);
+    inline bool flush();
+    inline void publish();
+    inline bool startSegment();
+    inline void finishSegment();
+    inline bool writeBatch(TBatchKind kind, TCodec codec, const QByteArray& payload, quint32 count);
+    inline bool writePending(bool seal);
+    inline void encode(const TRecord& record);
+    inline bool writeRollups(const QVector<CSVeRollup::TBucket>& buckets);
+    inline bool sync();
+    inline void recover(const QString& fileName);
+    inline void fail(const QString& message);
+};
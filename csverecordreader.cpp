@@ -0,0 +1,378 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDir>
+#include <QtEndian>
+#include <csverecordreader.h>
+
+CSVeRecordReader::CSVeRecordReader()
+    : m_file()
+    , m_data(nullptr)
+    , m_size(0)
+    , m_sequence(0)
+    , m_wallBase(0)
+    , m_created(0)
+    , m_devices()
+    , m_offset(0)
+    , m_records(nullptr)
+    , m_left(0)
+    , m_decoded()
+    , m_rollups(nullptr)
+    , m_rollupsLeft(0)
+    , m_count(0)
+    , m_valid(0)
+    , m_torn(false)
+{
+}
+
+CSVeRecordReader::~CSVeRecordReader()
+{
+    close();
+}
+
+QStringList CSVeRecordReader::segments(const QString& directory)
+{
+    const QDir dir(directory);
+    QStringList files;
+    /* fixed width numbers, name order is segment order */
+    foreach (const QString& name, dir.entryList({"*.vrec"}, QDir::Files, QDir::Name)) {
+        files << dir.filePath(name);
+    }
+    return files;
+}
+
+bool CSVeRecordReader::open(const QString& fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < CSVeRecorder::SEGMENT_HEADER_SIZE) {
+        close();
+        return false;
+    }
+    if (!(m_data = m_file.map(0, m_size))) {
+        close();
+        return false;
+    }
+
+    if (qFromLittleEndian<quint32>(m_data) != CSVeRecorder::SEGMENT_MAGIC || //
+        qFromLittleEndian<quint16>(m_data + 4) > CSVeRecorder::SEGMENT_VERSION) {
+        close();
+        return false;
+    }
+
+    const quint16 headerSize = qFromLittleEndian<quint16>(m_data + 6);
+    m_sequence = qFromLittleEndian<quint32>(m_data + 8);
+    m_wallBase = qFromLittleEndian<qint64>(m_data + 16);
+    m_created = qFromLittleEndian<qint64>(m_data + 24);
+    m_valid = qMin((qint64) headerSize, m_size);
+
+    rewind();
+    return true;
+}
+
+void CSVeRecordReader::close()
+{
+    if (m_data) {
+        m_file.unmap((uchar*) m_data);
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_size = 0;
+    m_devices.clear();
+    m_records = nullptr;
+    m_left = 0;
+    m_rollups = nullptr;
+    m_rollupsLeft = 0;
+    m_count = 0;
+    m_valid = 0;
+    m_torn = false;
+}
+
+bool CSVeRecordReader::isOpen() const
+{
+    return (m_data != nullptr);
+}
+
+QString CSVeRecordReader::fileName() const
+{
+    return m_file.fileName();
+}
+
+quint32 CSVeRecordReader::sequence() const
+{
+    return m_sequence;
+}
+
+qint64 CSVeRecordReader::wallBase() const
+{
+    return m_wallBase;
+}
+
+qint64 CSVeRecordReader::created() const
+{
+    return m_created;
+}
+
+const QStringList& CSVeRecordReader::devices() const
+{
+    return m_devices;
+}
+
+bool CSVeRecordReader::next(TRecord* record)
+{
+    while (m_left == 0) {
+        if (!nextBatch(CSVeRecorder::KindRecords)) {
+            return false;
+        }
+    }
+
+    if (m_records) {
+        decode(m_records, record);
+        m_records += CSVeRecorder::RECORD_SIZE;
+    }
+    else {
+        *record = m_decoded.at(m_decoded.count() - m_left);
+    }
+    m_left--;
+    return true;
+}
+
+bool CSVeRecordReader::nextRollup(CSVeRollup::TBucket* bucket)
+{
+    while (m_rollupsLeft == 0) {
+        if (!nextBatch(CSVeRecorder::KindRollups)) {
+            return false;
+        }
+    }
+
+    CSVeRollup::readEntry(m_rollups, bucket);
+    m_rollups += CSVeRollup::ENTRY_SIZE;
+    m_rollupsLeft--;
+    return true;
+}
+
+bool CSVeRecordReader::readBatch(TBatch* batch, quint8 kind)
+{
+    if (!m_data || m_offset >= m_size) {
+        return false;
+    }
+
+    const uchar* header = m_data + m_offset;
+    const qint64 left = m_size - m_offset;
+    if (left < CSVeRecorder::BATCH_HEADER_SIZE || qFromLittleEndian<quint32>(header) != CSVeRecorder::BATCH_MAGIC) {
+        m_torn = true;
+        return false;
+    }
+
+    const quint32 size = qFromLittleEndian<quint32>(header + 8);
+    const quint32 crc = qFromLittleEndian<quint32>(header + 16);
+    const uchar* payload = header + CSVeRecorder::BATCH_HEADER_SIZE;
+    if (size > left - CSVeRecorder::BATCH_HEADER_SIZE) {
+        m_torn = true;
+        return false;
+    }
+    /* a rollup pass does not pay for the records */
+    const bool verify = (kind == 0 || header[4] == kind || header[4] == CSVeRecorder::KindDevices);
+    if (verify && CSVeRecorder::crc32((const char*) payload, size) != crc) {
+        m_torn = true;
+        return false;
+    }
+
+    batch->m_offset = m_offset;
+    batch->m_kind = header[4];
+    batch->m_codec = header[5];
+    batch->m_count = qFromLittleEndian<quint32>(header + 12);
+    batch->m_payload = payload;
+    batch->m_size = size;
+
+    m_offset += CSVeRecorder::BATCH_HEADER_SIZE + size;
+    if (verify) {
+        m_valid = qMax(m_valid, m_offset);
+    }
+    if (batch->m_kind == CSVeRecorder::KindDevices) {
+        readDevices(payload, size);
+    }
+    return true;
+}
+
+void CSVeRecordReader::seek(qint64 offset)
+{
+    m_offset = offset;
+    m_records = nullptr;
+    m_left = 0;
+    m_rollups = nullptr;
+    m_rollupsLeft = 0;
+}
+
+const uchar* CSVeRecordReader::data() const
+{
+    return m_data;
+}
+
+qint64 CSVeRecordReader::size() const
+{
+    return m_size;
+}
+
+void CSVeRecordReader::rewind()
+{
+    m_offset = (m_data ? qFromLittleEndian<quint16>(m_data + 6) : 0);
+    m_records = nullptr;
+    m_left = 0;
+    m_rollups = nullptr;
+    m_rollupsLeft = 0;
+    m_count = 0;
+    m_torn = false;
+}
+
+bool CSVeRecordReader::scan()
+{
+    rewind();
+    while (nextBatch(0)) {
+    }
+
+    const bool intact = !m_torn;
+    const quint64 count = m_count;
+    rewind();
+    m_count = count;
+    m_torn = !intact;
+    return intact;
+}
+
+quint64 CSVeRecordReader::recordCount() const
+{
+    return m_count;
+}
+
+qint64 CSVeRecordReader::validSize() const
+{
+    return m_valid;
+}
+
+bool CSVeRecordReader::isTorn() const
+{
+    return m_torn;
+}
+
+void CSVeRecordReader::decode(const uchar* p, TRecord* record)
+{
+    record->m_time = qFromLittleEndian<qint64>(p);
+    record->m_device = qFromLittleEndian<quint16>(p + 8);
+    record->m_regid = qFromLittleEndian<quint16>(p + 10);
+    record->m_type = p[12];
+    record->m_exponent = (qint8) p[13];
+
+    /* 32 bit on disk, signed types sign extended */
+    const quint32 raw = qFromLittleEndian<quint32>(p + 14);
+    switch (record->m_type) {
+        case CSVeRegisterStore::TypeS16:
+        case CSVeRegisterStore::TypeS32:
+        case CSVeRegisterStore::TypeInt: {
+            record->m_raw = (qint32) raw;
+            break;
+        }
+        default: {
+            record->m_raw = raw;
+            break;
+        }
+    }
+}
+
+/* enter the next intact batch, only batches of kind are decoded,
+ * false at the end or a torn tail */
+inline bool CSVeRecordReader::nextBatch(quint8 kind)
+{
+    m_records = nullptr;
+    m_left = 0;
+    m_rollups = nullptr;
+    m_rollupsLeft = 0;
+
+    TBatch batch;
+    if (!readBatch(&batch, kind)) {
+        return false;
+    }
+
+    if (batch.m_kind == CSVeRecorder::KindRollups) {
+        if (kind == CSVeRecorder::KindRollups && (quint64) batch.m_count * CSVeRollup::ENTRY_SIZE == batch.m_size) {
+            m_rollups = batch.m_payload;
+            m_rollupsLeft = batch.m_count;
+        }
+        return true;
+    }
+    if (batch.m_kind != CSVeRecorder::KindRecords) {
+        return true;
+    }
+
+    m_count += batch.m_count;
+    if (kind != CSVeRecorder::KindRecords) {
+        return true;
+    }
+
+    /* batches of unknown codecs are skipped */
+    if (batch.m_codec == CSVeRecorder::CodecPlain && (quint64) batch.m_count * CSVeRecorder::RECORD_SIZE == batch.m_size) {
+        m_records = batch.m_payload;
+        m_left = batch.m_count;
+    }
+    else if (batch.m_codec == CSVeRecorder::CodecGorilla && decodeSeries(batch.m_payload, batch.m_size)) {
+        m_left = m_decoded.count();
+    }
+    return true;
+}
+
+inline bool CSVeRecordReader::decodeSeries(const uchar* payload, quint32 size)
+{
+    CSVeSeriesCodec::TBatch batch;
+    if (!CSVeSeriesCodec::parse(payload, size, &batch)) {
+        return false;
+    }
+
+    m_decoded.resize(0);
+    QVector<qint64> times;
+    QVector<qint64> raws;
+    for (int i = 0; i < batch.m_blocks.count(); i++) {
+        const CSVeSeriesCodec::TBlockInfo& info = batch.m_blocks.at(i);
+        times.resize(info.m_count);
+        raws.resize(info.m_count);
+        const int n = CSVeSeriesCodec::decode(info, batch.m_data.at(i), times.data(), raws.data());
+
+        const int offset = m_decoded.count();
+        m_decoded.resize(offset + n);
+        TRecord* r = m_decoded.data() + offset;
+        for (int k = 0; k < n; k++, r++) {
+            r->m_time = times.at(k);
+            r->m_device = info.m_device;
+            r->m_regid = info.m_regid;
+            r->m_type = info.m_type;
+            r->m_exponent = info.m_exponent;
+            r->m_raw = raws.at(k);
+        }
+    }
+    return true;
+}
+
+inline void CSVeRecordReader::readDevices(const uchar* p, quint32 size)
+{
+    const uchar* end = p + size;
+    while (end - p >= 4) {
+        const quint16 index = qFromLittleEndian<quint16>(p);
+        const quint16 length = qFromLittleEndian<quint16>(p + 2);
+        p += 4;
+        if (end - p < length) {
+            return;
+        }
+        while (m_devices.count() <= index) {
+            m_devices.append(QString());
+        }
+        m_devices[index] = QString::fromUtf8((const char*) p, length);
+        p += length;
+    }
+}
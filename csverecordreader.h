@@ -0,0 +1,141 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QFile>
+#include <QStringList>
+#include <csverecorder.h>
+#include <csverollup.h>
+
+/**
+ * @brief Memory mapped reader of a recorder segment
+ *
+ * Maps the segment as it is at open() and walks its batches. The
+ * CRC of a batch is checked when the batch is entered; reading
+ * stops at the first incomplete or damaged batch, which is what a
+ * crash leaves at the end of the segment being written.
+ *
+ * Records of compressed batches are decoded when the batch is
+ * entered and come series by series, not in time order.
+ *
+ * next() and nextRollup() each walk all batch headers and skip the
+ * other kind by its size, without reading or checking its payload;
+ * a pass reads either records or rollups.
+ */
+class CSVeRecordReader
+{
+public:
+    typedef CSVeRecorder::TRecord TRecord;
+
+    /* intact batch, payload points into the mapping */
+    typedef struct {
+        qint64 m_offset;
+        quint8 m_kind;
+        quint8 m_codec;
+        quint32 m_count;
+        const uchar* m_payload;
+        quint32 m_size;
+    } TBatch;
+
+    CSVeRecordReader();
+    ~CSVeRecordReader();
+
+    /**
+     * @brief segments Segment files of a recording directory
+     * @param directory
+     * @return File paths, oldest first
+     */
+    static QStringList segments(const QString& directory);
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+    quint32 sequence() const;
+    /* wall clock ms = monotonic ms + wallBase() */
+    qint64 wallBase() const;
+    qint64 created() const;
+
+    /**
+     * @brief devices Device ids by index, complete for all records
+     * returned so far
+     */
+    const QStringList& devices() const;
+
+    /**
+     * @brief next Read the next record
+     * @param record
+     * @return false at the end of the valid part
+     */
+    bool next(TRecord* record);
+    /**
+     * @brief nextRollup Read the next rollup partial, record batches
+     * are skipped without decoding
+     * @param bucket
+     * @return false at the end of the valid part
+     */
+    bool nextRollup(CSVeRollup::TBucket* bucket);
+    void rewind();
+
+    /**
+     * @brief readBatch Check and return the batch at the read
+     * position and move behind it; device tables are applied
+     * @param batch
+     * @param kind The payload CRC is checked for batches of this
+     * kind and device tables only, the others are skipped by size;
+     * 0 = all
+     * @return false at the end or a torn tail
+     */
+    bool readBatch(TBatch* batch, quint8 kind = 0);
+    /**
+     * @brief seek Move the read position to a batch offset taken
+     * from readBatch(), the current batch is dropped
+     */
+    void seek(qint64 offset);
+    /* the mapped segment */
+    const uchar* data() const;
+    qint64 size() const;
+
+    /**
+     * @brief scan Walk all batches without decoding the records,
+     * then rewind. Fills devices(), recordCount() and validSize().
+     * @return false if the segment has a torn or damaged tail
+     */
+    bool scan();
+    quint64 recordCount() const;
+    /* end of the last intact batch seen */
+    qint64 validSize() const;
+    bool isTorn() const;
+
+    static void decode(const uchar* p, TRecord* record);
+
+private:
+    QFile m_file;
+    const uchar* m_data;
+    qint64 m_size;
+    quint32 m_sequence;
+    qint64 m_wallBase;
+    qint64 m_created;
+    QStringList m_devices;
+    /* next batch header */
+    qint64 m_offset;
+    /* records of the current batch */
+    const uchar* m_records;
+    quint32 m_left;
+    QVector<TRecord> m_decoded;
+    /* rollup entries of the current batch */
+    const uchar* m_rollups;
+    quint32 m_rollupsLeft;
+    quint64 m_count;
+    qint64 m_valid;
+    bool m_torn;
+
+private:
+    inline bool nextBatch(quint8 kind);
+    inline void readDevices(const uchar* p, quint32 size);
+    inline bool decodeSeries(const uchar* payload, quint32 size);
+};
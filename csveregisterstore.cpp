@@ -0,0 +1,323 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QAtomicInt>
+#include <QMutex>
+#include <QtMath>
+#include <csveregisterstore.h>
+
+/* register id -> slot + 1, 0 = not assigned; written once under lock */
+static QAtomicInt s_index[0x10000];
+static QMutex s_indexLock;
+static int s_slots = 0;
+
+static const double POW10[] = {
+   1e-9, 1e-8, 1e-7, 1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, //
+   1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+};
+
+CSVeRegisterStore::CSVeRegisterStore()
+    : m_slots()
+    , m_rings()
+    , m_count(0)
+    , m_version(0)
+{
+}
+
+int CSVeRegisterStore::slotOf(quint16 regid)
+{
+    return s_index[regid].loadAcquire() - 1;
+}
+
+bool CSVeRegisterStore::setNumber(quint16 regid, TType type, qint8 exponent, qint64 raw, qint64 time)
+{
+    const int index = prepare(regid);
+    TSlot* slot = &m_slots[index];
+    slot->m_time = time;
+
+    if (index < m_rings.size() && m_rings.at(index).capacity() > 0) {
+        /* samples of another unit are meaningless */
+        if (slot->m_type != type || slot->m_exponent != exponent) {
+            m_rings[index].clear();
+        }
+        m_rings[index].append(time, raw);
+    }
+
+    if (slot->m_type == type && slot->m_exponent == exponent && slot->m_raw == raw) {
+        return false;
+    }
+    if (slot->m_type == TypeNone) {
+        m_count++;
+    }
+
+    slot->m_regid = regid;
+    slot->m_type = type;
+    slot->m_exponent = exponent;
+    slot->m_raw = raw;
+    slot->m_bytes.clear();
+    slot->m_version = ++m_version;
+    return true;
+}
+
+bool CSVeRegisterStore::setBytes(quint16 regid, TType type, const QByteArray& bytes, qint64 time)
+{
+    TSlot* slot = &m_slots[prepare(regid)];
+    slot->m_time = time;
+
+    if (slot->m_type == type && slot->m_bytes == bytes) {
+        return false;
+    }
+    if (slot->m_type == TypeNone) {
+        m_count++;
+    }
+
+    slot->m_regid = regid;
+    slot->m_type = type;
+    slot->m_exponent = 0;
+    slot->m_raw = 0;
+    slot->m_bytes = bytes;
+    slot->m_version = ++m_version;
+    return true;
+}
+
+bool CSVeRegisterStore::setValue(quint16 regid, float scale, const QVariant& value, qint64 time)
+{
+    switch (value.type()) {
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong: {
+            return setNumber(regid, TypeInt, exponentOf(scale), value.toLongLong(), time);
+        }
+        case QVariant::Double: {
+            const qint64 raw = qRound64(value.toDouble());
+            return setNumber(regid, (raw < 0 ? TypeS32 : TypeU32), exponentOf(scale), raw, time);
+        }
+        case QVariant::String: {
+            return setBytes(regid, TypeString, value.toString().toUtf8(), time);
+        }
+        case QVariant::ByteArray: {
+            return setBytes(regid, TypeBytes, value.toByteArray(), time);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+bool CSVeRegisterStore::remove(quint16 regid)
+{
+    const int slot = slotOf(regid);
+    if (slot < 0 || slot >= m_slots.size() || m_slots.at(slot).m_type == TypeNone) {
+        return false;
+    }
+
+    m_slots[slot] = TSlot();
+    if (slot < m_rings.size()) {
+        m_rings[slot].clear();
+    }
+    m_count--;
+    m_version++;
+    return true;
+}
+
+void CSVeRegisterStore::clear()
+{
+    m_slots = TView();
+    for (int i = 0; i < m_rings.size(); i++) {
+        m_rings[i].clear();
+    }
+    m_count = 0;
+    m_version++;
+}
+
+void CSVeRegisterStore::setHistory(quint16 regid, int capacity)
+{
+    const int index = prepare(regid);
+    if (index >= m_rings.size()) {
+        if (capacity <= 0) {
+            return;
+        }
+        m_rings.resize(index + 1);
+    }
+    if (m_rings.at(index).capacity() != capacity) {
+        m_rings[index].setCapacity(capacity);
+    }
+}
+
+const CSVeSampleRing* CSVeRegisterStore::history(quint16 regid) const
+{
+    const int slot = slotOf(regid);
+    if (slot < 0 || slot >= m_rings.size() || m_rings.at(slot).capacity() == 0) {
+        return nullptr;
+    }
+    return m_rings.constData() + slot;
+}
+
+bool CSVeRegisterStore::contains(quint16 regid) const
+{
+    return (find(regid) != nullptr);
+}
+
+const CSVeRegisterStore::TSlot* CSVeRegisterStore::find(quint16 regid) const
+{
+    const int slot = slotOf(regid);
+    if (slot < 0 || slot >= m_slots.size()) {
+        return nullptr;
+    }
+
+    const TSlot* p = m_slots.constData() + slot;
+    return (p->m_type == TypeNone ? nullptr : p);
+}
+
+double CSVeRegisterStore::number(quint16 regid, double fallback) const
+{
+    const TSlot* slot = find(regid);
+    return (slot ? toDouble(*slot) : fallback);
+}
+
+QByteArray CSVeRegisterStore::bytes(quint16 regid) const
+{
+    const TSlot* slot = find(regid);
+    return (slot ? slot->m_bytes : QByteArray());
+}
+
+QString CSVeRegisterStore::text(quint16 regid) const
+{
+    const TSlot* slot = find(regid);
+    if (!slot) {
+        return QString();
+    }
+
+    switch (slot->m_type) {
+        case TypeString: {
+            return QString::fromUtf8(slot->m_bytes);
+        }
+        case TypeBytes:
+        case TypeStruct: {
+            return QString::fromLatin1(slot->m_bytes);
+        }
+        default: {
+            return QString::number(toDouble(*slot));
+        }
+    }
+}
+
+QPair<float, QVariant> CSVeRegisterStore::value(quint16 regid) const
+{
+    const TSlot* slot = find(regid);
+    return (slot ? toPair(*slot) : QPair<float, QVariant>(1, QVariant()));
+}
+
+int CSVeRegisterStore::count() const
+{
+    return m_count;
+}
+
+bool CSVeRegisterStore::isEmpty() const
+{
+    return (m_count == 0);
+}
+
+quint32 CSVeRegisterStore::version() const
+{
+    return m_version;
+}
+
+CSVeRegisterStore::TView CSVeRegisterStore::view() const
+{
+    return m_slots;
+}
+
+CSVeSnapshot::TValues CSVeRegisterStore::toValues() const
+{
+    CSVeSnapshot::TValues values;
+    foreach (const TSlot& slot, m_slots) {
+        if (slot.m_type != TypeNone) {
+            values.insert(slot.m_regid, toPair(slot));
+        }
+    }
+    return values;
+}
+
+double CSVeRegisterStore::toDouble(const TSlot& slot)
+{
+    switch (slot.m_type) {
+        case TypeNone:
+        case TypeString:
+        case TypeBytes:
+        case TypeStruct: {
+            return 0;
+        }
+        default: {
+            return slot.m_raw * POW10[qBound(-9, (int) slot.m_exponent, 9) + 9];
+        }
+    }
+}
+
+/* wire types are doubles, VE.Text integers ints, as the UI model expects */
+QPair<float, QVariant> CSVeRegisterStore::toPair(const TSlot& slot)
+{
+    const float scale = (float) POW10[qBound(-9, (int) slot.m_exponent, 9) + 9];
+
+    switch (slot.m_type) {
+        case TypeU8:
+        case TypeU16:
+        case TypeU32:
+        case TypeS16:
+        case TypeS32: {
+            return QPair<float, QVariant>(scale, QVariant((double) slot.m_raw));
+        }
+        case TypeInt: {
+            return QPair<float, QVariant>(scale, QVariant((int) slot.m_raw));
+        }
+        case TypeString: {
+            return QPair<float, QVariant>(1, QVariant(QString::fromUtf8(slot.m_bytes)));
+        }
+        case TypeBytes:
+        case TypeStruct: {
+            return QPair<float, QVariant>(1, QVariant(slot.m_bytes));
+        }
+        default: {
+            return QPair<float, QVariant>(1, QVariant());
+        }
+    }
+}
+
+qint8 CSVeRegisterStore::exponentOf(float scale)
+{
+    if (scale <= 0) {
+        return 0;
+    }
+    return (qint8) qBound(-9, qRound(std::log10(scale)), 9);
+}
+
+int CSVeRegisterStore::allocSlot(quint16 regid)
+{
+    QMutexLocker lock(&s_indexLock);
+
+    /* another store was faster */
+    const int slot = s_index[regid].loadAcquire() - 1;
+    if (slot >= 0) {
+        return slot;
+    }
+
+    s_index[regid].storeRelease(++s_slots);
+    return s_slots - 1;
+}
+
+/* first value of a register grows the vector, nothing else allocates */
+inline int CSVeRegisterStore::prepare(quint16 regid)
+{
+    int slot = slotOf(regid);
+    if (slot < 0) {
+        slot = allocSlot(regid);
+    }
+    if (slot >= m_slots.size()) {
+        m_slots.resize(slot + 1);
+    }
+    return slot;
+}
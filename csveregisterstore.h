@@ -0,0 +1,159 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QPair>
+#include <QVariant>
+#include <QVector>
+#include <csvesamplering.h>
+#include <csvesnapshot.h>
+
+/**
+ * @brief Dense typed register values of one device
+ *
+ * Every register id gets a compact slot number on first use,
+ * shared by all stores of the process, so the values of a device
+ * are a plain vector indexed by slot. A slot keeps the raw
+ * integer as received with its wire type and a decimal exponent
+ * (physical value = raw * 10^exponent), or the bytes of a string
+ * or record, plus update time and version.
+ *
+ * Lookup and change detection are O(1) and don't allocate; only
+ * the first value of a register never seen before grows the
+ * vector. view() returns the slots without copying: the vector
+ * is implicitly shared and only detached when the store changes
+ * while a view is held.
+ *
+ * Integer registers can keep a ring of their recent raw samples
+ * (setHistory), filled on every update, changed or not.
+ */
+class CSVeRegisterStore
+{
+public:
+    typedef enum {
+        TypeNone = 0,
+        /* VE.HEX wire types */
+        TypeU8,
+        TypeU16,
+        TypeU32,
+        TypeS16,
+        TypeS32,
+        /* VE.Text integer field */
+        TypeInt,
+        TypeString,
+        TypeBytes,
+        /* raw record payload, decoded by the consumer */
+        TypeStruct,
+    } TType;
+
+    typedef struct {
+        quint16 m_regid;
+        quint8 m_type;
+        qint8 m_exponent;
+        /* store version of the last change */
+        quint32 m_version;
+        qint64 m_raw;
+        /* monotonic ms of the last update, changed or not */
+        qint64 m_time;
+        QByteArray m_bytes;
+    } TSlot;
+
+    typedef QVector<TSlot> TView;
+
+    CSVeRegisterStore();
+
+    /**
+     * @brief slotOf Process wide slot number of a register
+     * @param regid
+     * @return -1 if no store has seen the register yet
+     */
+    static int slotOf(quint16 regid);
+
+    /**
+     * @brief setNumber Update integer register
+     * @param regid
+     * @param type Wire type
+     * @param exponent Decimal exponent, -2 = 0.01 units
+     * @param raw
+     * @param time Monotonic ms
+     * @return true if value, type or exponent changed
+     */
+    bool setNumber(quint16 regid, TType type, qint8 exponent, qint64 raw, qint64 time);
+    /**
+     * @brief setBytes Update string, bytes or record register
+     * @return true if changed
+     */
+    bool setBytes(quint16 regid, TType type, const QByteArray& bytes, qint64 time);
+    /**
+     * @brief setValue Update from a scale / variant pair of a
+     * snapshot, not for the data path.
+     * @return true if changed
+     */
+    bool setValue(quint16 regid, float scale, const QVariant& value, qint64 time);
+    bool remove(quint16 regid);
+    /**
+     * @brief clear Remove all values and samples, history
+     * capacities are kept
+     */
+    void clear();
+
+    /**
+     * @brief setHistory Keep the last samples of a register
+     * @param regid
+     * @param capacity 0 = none, drops the samples
+     */
+    void setHistory(quint16 regid, int capacity);
+    /**
+     * @brief history Recent samples of a register
+     * @param regid
+     * @return nullptr if no history is kept
+     */
+    const CSVeSampleRing* history(quint16 regid) const;
+
+    bool contains(quint16 regid) const;
+    /**
+     * @brief find Slot of a register
+     * @param regid
+     * @return nullptr if not set, valid until the next change
+     */
+    const TSlot* find(quint16 regid) const;
+    double number(quint16 regid, double fallback = 0) const;
+    QByteArray bytes(quint16 regid) const;
+    QString text(quint16 regid) const;
+    /**
+     * @brief value Scale / variant pair as used by the UI model
+     * @param regid
+     * @return invalid variant if not set
+     */
+    QPair<float, QVariant> value(quint16 regid) const;
+
+    int count() const;
+    bool isEmpty() const;
+    quint32 version() const;
+
+    /**
+     * @brief view All slots, empty ones with TypeNone
+     * @return Shared vector, no copy
+     */
+    TView view() const;
+    CSVeSnapshot::TValues toValues() const;
+
+    static double toDouble(const TSlot& slot);
+    static QPair<float, QVariant> toPair(const TSlot& slot);
+    static qint8 exponentOf(float scale);
+
+private:
+    TView m_slots;
+    /* by slot, capacity 0 = no history */
+    QVector<CSVeSampleRing> m_rings;
+    int m_count;
+    quint32 m_version;
+
+private:
+    static int allocSlot(quint16 regid);
+    inline int prepare(quint16 regid);
+};
@@ -0,0 +1,428 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QFileInfo>
+#include <QMap>
+#include <QtEndian>
+#include <csverecorder.h>
+#include <csverecordreader.h>
+#include <csveregisterstore.h>
+#include <csverollup.h>
+#include <csveseriescodec.h>
+#include <csveseriesindex.h>
+
+static const qint64 SPANS[CSVeRollup::LevelCount] = {
+   60 * 1000LL,
+   60 * 60 * 1000LL,
+   24 * 60 * 60 * 1000LL,
+};
+
+CSVeRollup::CSVeRollup()
+    : m_series()
+    , m_closed()
+    , m_late()
+    , m_lateCount(0)
+{
+}
+
+qint64 CSVeRollup::span(TLevel level)
+{
+    return SPANS[qBound(0, (int) level, LevelCount - 1)];
+}
+
+qint64 CSVeRollup::bucketStart(TLevel level, qint64 time)
+{
+    const qint64 length = span(level);
+    /* floor, also before the epoch */
+    return (time >= 0 ? time - time % length : time - ((time % length) + length) % length);
+}
+
+CSVeRollup::TLevel CSVeRollup::levelFor(qint64 range, int maxBuckets)
+{
+    for (int level = LevelMinute; level < LevelDay; level++) {
+        if (range / SPANS[level] <= maxBuckets) {
+            return (TLevel) level;
+        }
+    }
+    return LevelDay;
+}
+
+void CSVeRollup::merge(TBucket* into, const TBucket& from)
+{
+    if (from.m_count == 0) {
+        return;
+    }
+    if (into->m_count == 0 || into->m_type != from.m_type || into->m_exponent != from.m_exponent) {
+        if (into->m_count == 0 || from.m_lastTime > into->m_lastTime) {
+            *into = from;
+        }
+        return;
+    }
+
+    into->m_count += from.m_count;
+    into->m_min = qMin(into->m_min, from.m_min);
+    into->m_max = qMax(into->m_max, from.m_max);
+    into->m_sum += from.m_sum;
+    into->m_held += from.m_held;
+    if (from.m_lastTime >= into->m_lastTime) {
+        into->m_last = from.m_last;
+        into->m_lastTime = from.m_lastTime;
+    }
+}
+
+double CSVeRollup::scaled(const TBucket& bucket, qint64 raw)
+{
+    CSVeRegisterStore::TSlot slot = {};
+    slot.m_type = bucket.m_type;
+    slot.m_exponent = bucket.m_exponent;
+    slot.m_raw = raw;
+    return CSVeRegisterStore::toDouble(slot);
+}
+
+double CSVeRollup::average(const TBucket& bucket)
+{
+    if (bucket.m_count == 0) {
+        return 0;
+    }
+    if (bucket.m_held <= 0) {
+        return scaled(bucket, bucket.m_last);
+    }
+    return scaled(bucket, 1) * bucket.m_sum / bucket.m_held;
+}
+
+void CSVeRollup::writeEntry(const TBucket& bucket, uchar* p)
+{
+    qToLittleEndian<quint16>(bucket.m_device, p);
+    qToLittleEndian<quint16>(bucket.m_regid, p + 2);
+    p[4] = bucket.m_level;
+    p[5] = bucket.m_type;
+    p[6] = (uchar) bucket.m_exponent;
+    p[7] = 0;
+    qToLittleEndian<qint64>(bucket.m_start, p + 8);
+    qToLittleEndian<quint32>(bucket.m_count, p + 16);
+    qToLittleEndian<quint32>((quint32) bucket.m_min, p + 20);
+    qToLittleEndian<quint32>((quint32) bucket.m_max, p + 24);
+    qToLittleEndian<quint32>((quint32) bucket.m_last, p + 28);
+    qToLittleEndian<qint64>(bucket.m_sum, p + 32);
+    qToLittleEndian<qint64>(bucket.m_lastTime, p + 40);
+    qToLittleEndian<qint64>(bucket.m_held, p + 48);
+}
+
+void CSVeRollup::readEntry(const uchar* p, TBucket* bucket)
+{
+    bucket->m_device = qFromLittleEndian<quint16>(p);
+    bucket->m_regid = qFromLittleEndian<quint16>(p + 2);
+    bucket->m_level = p[4];
+    bucket->m_type = p[5];
+    bucket->m_exponent = (qint8) p[6];
+    bucket->m_start = qFromLittleEndian<qint64>(p + 8);
+    bucket->m_count = qFromLittleEndian<quint32>(p + 16);
+    bucket->m_min = CSVeSeriesCodec::extend(bucket->m_type, qFromLittleEndian<quint32>(p + 20));
+    bucket->m_max = CSVeSeriesCodec::extend(bucket->m_type, qFromLittleEndian<quint32>(p + 24));
+    bucket->m_last = CSVeSeriesCodec::extend(bucket->m_type, qFromLittleEndian<quint32>(p + 28));
+    bucket->m_sum = qFromLittleEndian<qint64>(p + 32);
+    bucket->m_lastTime = qFromLittleEndian<qint64>(p + 40);
+    bucket->m_held = qFromLittleEndian<qint64>(p + 48);
+}
+
+QByteArray CSVeRollup::encode(const QVector<TBucket>& buckets)
+{
+    QByteArray payload(buckets.count() * ENTRY_SIZE, '\0');
+    uchar* p = (uchar*) payload.data();
+    foreach (const TBucket& bucket, buckets) {
+        writeEntry(bucket, p);
+        p += ENTRY_SIZE;
+    }
+    return payload;
+}
+
+QVector<CSVeRollup::TBucket> CSVeRollup::query(const QString& directory, const QString& device, quint16 regid, TLevel level, qint64 from, qint64 to)
+{
+    QMap<qint64, TBucket> buckets;
+    /* newest bucket before from, carried into the range */
+    TBucket before = {};
+    /* end of the recording */
+    qint64 end = from;
+
+    foreach (const QString& segment, CSVeRecordReader::segments(directory)) {
+        CSVeRecordReader reader;
+        if (!reader.open(segment)) {
+            continue;
+        }
+
+        CSVeSeriesIndex index;
+        const QString indexName = CSVeSeriesIndex::indexName(segment);
+        if (!index.load(indexName, QFileInfo(segment).size())) {
+            if (index.build(&reader) && !index.save(indexName)) {
+                qWarning("[VE.QRY] Unable to write index %s", qPrintable(indexName));
+            }
+        }
+        if (index.count()) {
+            end = qMax(end, index.last() + index.wallBase());
+        }
+
+        /* device indexes are per segment */
+        const int dev = index.devices().indexOf(device);
+        if (dev < 0) {
+            continue;
+        }
+        QVector<CSVeSeriesIndex::TRollupEntry> entries;
+        index.findRollups(dev, regid, level, from, to, &entries);
+        CSVeSeriesIndex::TRollupEntry last;
+        if (index.lastRollup(dev, regid, level, from, &last)) {
+            bool found = false;
+            foreach (const CSVeSeriesIndex::TRollupEntry& e, entries) {
+                found = found || e.m_offset == last.m_offset;
+            }
+            if (!found) {
+                entries.append(last);
+            }
+        }
+
+        foreach (const CSVeSeriesIndex::TRollupEntry& e, entries) {
+            /* the index was built from intact batches */
+            if (e.m_offset + CSVeRecorder::BATCH_HEADER_SIZE > reader.size()) {
+                continue;
+            }
+            const uchar* header = reader.data() + e.m_offset;
+            const quint32 size = qFromLittleEndian<quint32>(header + 8);
+            const quint32 count = qFromLittleEndian<quint32>(header + 12);
+            const uchar* payload = header + CSVeRecorder::BATCH_HEADER_SIZE;
+            if (e.m_offset + CSVeRecorder::BATCH_HEADER_SIZE + size > reader.size() || (quint64) count * ENTRY_SIZE != size) {
+                continue;
+            }
+
+            TBucket bucket;
+            for (quint32 i = 0; i < count; i++) {
+                readEntry(payload + i * ENTRY_SIZE, &bucket);
+                if (bucket.m_device != dev || bucket.m_regid != regid || bucket.m_level != level || bucket.m_start >= to) {
+                    continue;
+                }
+                if (bucket.m_start < from) {
+                    if (before.m_count == 0 || bucket.m_start > before.m_start) {
+                        before = bucket;
+                    }
+                    else if (bucket.m_start == before.m_start) {
+                        merge(&before, bucket);
+                    }
+                    continue;
+                }
+                QMap<qint64, TBucket>::iterator it = buckets.find(bucket.m_start);
+                if (it == buckets.end()) {
+                    buckets.insert(bucket.m_start, bucket);
+                }
+                else {
+                    merge(&it.value(), bucket);
+                }
+            }
+        }
+    }
+
+    /* only buckets with samples are written, the last value holds
+     * through the empty ones */
+    const qint64 length = span(level);
+    const qint64 stop = qMin(to, end);
+    QVector<TBucket> result;
+    result.reserve(buckets.count());
+    TBucket last = before;
+    qint64 time = bucketStart(level, from);
+    for (QMap<qint64, TBucket>::const_iterator it = buckets.constBegin();; ++it) {
+        const qint64 next = (it == buckets.constEnd() ? stop : qMin(it.key(), stop));
+        for (; last.m_count && time < next; time += length) {
+            TBucket carried = last;
+            carried.m_start = time;
+            carried.m_count = 1;
+            carried.m_min = last.m_last;
+            carried.m_max = last.m_last;
+            carried.m_held = qMin(length, end - time);
+            carried.m_sum = last.m_last * carried.m_held;
+            carried.m_lastTime = time + carried.m_held;
+            result.append(carried);
+        }
+        if (it == buckets.constEnd()) {
+            break;
+        }
+        result.append(it.value());
+        last = it.value();
+        time = it.key() + length;
+    }
+    return result;
+}
+
+void CSVeRollup::add(quint16 device, quint16 regid, quint8 type, qint8 exponent, qint64 time, qint64 raw)
+{
+    const quint32 key = ((quint32) device << 16) | regid;
+    QHash<quint32, TSeries>::iterator it = m_series.find(key);
+    if (it == m_series.end()) {
+        /* value initialized, all buckets empty */
+        it = m_series.insert(key, TSeries());
+    }
+
+    for (int level = 0; level < LevelCount; level++) {
+        TBucket* open = &it->m_open[level];
+        const qint64 begin = bucketStart((TLevel) level, time);
+
+        bool* carry = &it->m_carry[level];
+        if ((open->m_count && begin < open->m_start) || (*carry && begin < open->m_start + SPANS[level])) {
+            /* late: a partial of the bucket it belongs to */
+            const QPair<quint32, qint64> lateKey(key, begin + level);
+            QHash<QPair<quint32, qint64>, TBucket>::iterator late = m_late.find(lateKey);
+            if (late == m_late.end()) {
+                TBucket partial = *open;
+                partial.m_level = level;
+                partial.m_type = type;
+                partial.m_exponent = exponent;
+                partial.m_start = begin;
+                start(&partial, time, raw);
+                m_late.insert(lateKey, partial);
+            }
+            else {
+                update(&late.value(), time, raw);
+            }
+            if (level == LevelMinute) {
+                m_lateCount++;
+            }
+            continue;
+        }
+
+        roll(open, carry, time);
+        if (open->m_count && (open->m_type != type || open->m_exponent != exponent)) {
+            hold(open, time);
+            m_closed.append(*open);
+            open->m_count = 0;
+        }
+        if (open->m_count == 0) {
+            /* the value of the last closed bucket holds from begin */
+            const bool carried = (*carry && open->m_type == type && open->m_exponent == exponent && time > begin);
+            const qint64 held = open->m_last;
+            open->m_device = device;
+            open->m_regid = regid;
+            open->m_level = level;
+            open->m_type = type;
+            open->m_exponent = exponent;
+            open->m_start = begin;
+            if (carried) {
+                start(open, begin, held);
+                update(open, time, raw);
+            }
+            else {
+                start(open, time, raw);
+            }
+            *carry = false;
+        }
+        else {
+            update(open, time, raw);
+        }
+    }
+}
+
+QVector<CSVeRollup::TBucket> CSVeRollup::takeClosed(qint64 time)
+{
+    for (QHash<quint32, TSeries>::iterator it = m_series.begin(); it != m_series.end(); ++it) {
+        for (int level = 0; level < LevelCount; level++) {
+            roll(&it->m_open[level], &it->m_carry[level], time);
+        }
+    }
+
+    QVector<TBucket> closed = m_closed;
+    foreach (const TBucket& bucket, m_late) {
+        closed.append(bucket);
+    }
+    m_closed.resize(0);
+    m_late.clear();
+    return closed;
+}
+
+QVector<CSVeRollup::TBucket> CSVeRollup::takeAll(qint64 time)
+{
+    for (QHash<quint32, TSeries>::iterator it = m_series.begin(); it != m_series.end(); ++it) {
+        for (int level = 0; level < LevelCount; level++) {
+            TBucket* open = &it->m_open[level];
+            roll(open, &it->m_carry[level], time);
+            if (open->m_count) {
+                hold(open, time);
+                m_closed.append(*open);
+                open->m_count = 0;
+            }
+            it->m_carry[level] = false;
+        }
+    }
+    return takeClosed(time);
+}
+
+bool CSVeRollup::hasClosed() const
+{
+    return (!m_closed.isEmpty() || !m_late.isEmpty());
+}
+
+const CSVeRollup::TBucket* CSVeRollup::current(quint16 device, quint16 regid, TLevel level) const
+{
+    QHash<quint32, TSeries>::const_iterator it = m_series.constFind(((quint32) device << 16) | regid);
+    if (it == m_series.constEnd() || level < LevelMinute || level >= LevelCount || it->m_open[level].m_count == 0) {
+        return nullptr;
+    }
+    return &it->m_open[level];
+}
+
+quint64 CSVeRollup::lateCount() const
+{
+    return m_lateCount;
+}
+
+void CSVeRollup::clear()
+{
+    m_series.clear();
+    m_closed.clear();
+    m_late.clear();
+    m_lateCount = 0;
+}
+
+inline void CSVeRollup::start(TBucket* bucket, qint64 time, qint64 raw)
+{
+    bucket->m_count = 1;
+    bucket->m_min = raw;
+    bucket->m_max = raw;
+    bucket->m_last = raw;
+    bucket->m_sum = 0;
+    bucket->m_lastTime = time;
+    bucket->m_held = 0;
+}
+
+inline void CSVeRollup::update(TBucket* bucket, qint64 time, qint64 raw)
+{
+    bucket->m_count++;
+    bucket->m_min = qMin(bucket->m_min, raw);
+    bucket->m_max = qMax(bucket->m_max, raw);
+    /* out of order samples are counted, not weighted */
+    if (time >= bucket->m_lastTime) {
+        hold(bucket, time);
+        bucket->m_last = raw;
+    }
+}
+
+/* the last value holds up to time */
+inline void CSVeRollup::hold(TBucket* bucket, qint64 time)
+{
+    if (time <= bucket->m_lastTime) {
+        return;
+    }
+    bucket->m_sum += bucket->m_last * (time - bucket->m_lastTime);
+    bucket->m_held += time - bucket->m_lastTime;
+    bucket->m_lastTime = time;
+}
+
+/* close the open bucket with its value held to the end if time is
+ * past it, the next sample carries the value in */
+inline void CSVeRollup::roll(TBucket* open, bool* carry, qint64 time)
+{
+    const qint64 end = open->m_start + SPANS[open->m_level];
+    if (open->m_count && end <= time) {
+        hold(open, end);
+        m_closed.append(*open);
+        open->m_count = 0;
+        *carry = true;
+    }
+}
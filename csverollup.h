@@ -0,0 +1,164 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief Incremental min/max/avg/last rollups of register series
+ *
+ * Every sample updates the open 1 minute, 1 hour and 1 day bucket
+ * of its device register. A bucket is closed when a sample of the
+ * next bucket arrives or its time has passed (takeClosed()), and
+ * then persisted as one ENTRY_SIZE entry by the recorder.
+ *
+ * Samples are value changes, a value holds until the next one. The
+ * average is weighted by the time a value was held. Only buckets
+ * with samples are written; the value of a closed bucket is carried
+ * into the next sampled bucket from its start, and query() carries
+ * it through the empty buckets in between.
+ *
+ * Buckets are partial aggregates: count, min, max, the raw values
+ * times the ms they were held and those ms, and the newest value.
+ * Partials of the same bucket merge exactly, so a sample older
+ * than the open bucket of its level (late data) only produces a
+ * partial of the bucket it falls into, and buckets left open at close() are completed by the partial
+ * of the next run. Readers merge all partials of a bucket.
+ *
+ * Bucket start times are wall clock ms, aligned to UTC.
+ */
+class CSVeRollup
+{
+public:
+    typedef enum {
+        LevelMinute = 0,
+        LevelHour,
+        LevelDay,
+        LevelCount,
+    } TLevel;
+
+    /* little endian on disk: u16 device, u16 regid, u8 level,
+     * u8 type, i8 exponent, u8 reserved, i64 start, u32 count,
+     * i32 min, i32 max, i32 last, i64 sum, i64 last time,
+     * i64 held */
+    static const int ENTRY_SIZE = 56;
+
+    typedef struct {
+        quint16 m_device;
+        quint16 m_regid;
+        quint8 m_level;
+        quint8 m_type;
+        qint8 m_exponent;
+        qint64 m_start;
+        /* samples, with the value carried in */
+        quint32 m_count;
+        qint64 m_min;
+        qint64 m_max;
+        qint64 m_last;
+        /* raw values times ms held */
+        qint64 m_sum;
+        /* time of the last value, or up to which it was held */
+        qint64 m_lastTime;
+        /* ms covered by the values */
+        qint64 m_held;
+    } TBucket;
+
+    CSVeRollup();
+
+    /* bucket length in ms */
+    static qint64 span(TLevel level);
+    static qint64 bucketStart(TLevel level, qint64 time);
+    /**
+     * @brief levelFor Finest level with at most maxBuckets buckets
+     * in range, the day level if none
+     * @param range ms
+     * @param maxBuckets
+     */
+    static TLevel levelFor(qint64 range, int maxBuckets);
+
+    /**
+     * @brief merge Add partial from to into, same bucket. A partial
+     * with another type or exponent replaces into if it is newer.
+     */
+    static void merge(TBucket* into, const TBucket& from);
+    static double scaled(const TBucket& bucket, qint64 raw);
+    /* time weighted, the last value if nothing was held */
+    static double average(const TBucket& bucket);
+
+    static void writeEntry(const TBucket& bucket, uchar* p);
+    static void readEntry(const uchar* p, TBucket* bucket);
+    static QByteArray encode(const QVector<TBucket>& buckets);
+
+    /**
+     * @brief query Merged buckets of a device register from the
+     * rollup batches of a recording, found through the segment
+     * indexes. Raw records are not read. Empty buckets up to the
+     * end of the recording get the last value before them.
+     * @param directory Recording directory
+     * @param device Device id
+     * @param regid
+     * @param level
+     * @param from Wall clock ms, inclusive
+     * @param to Wall clock ms, exclusive
+     * @return Buckets ordered by start
+     */
+    static QVector<TBucket> query(const QString& directory, const QString& device, quint16 regid, TLevel level, qint64 from, qint64 to);
+
+    /**
+     * @brief add Update the buckets of a sample
+     * @param device Device index
+     * @param regid
+     * @param type Register type, signed types are sign extended
+     * @param exponent
+     * @param time Wall clock ms
+     * @param raw
+     */
+    void add(quint16 device, quint16 regid, quint8 type, qint8 exponent, qint64 time, qint64 raw);
+
+    /**
+     * @brief takeClosed Close the buckets ended before time and
+     * return all closed buckets and late partials
+     * @param time Wall clock ms
+     */
+    QVector<TBucket> takeClosed(qint64 time);
+    /**
+     * @brief takeAll Closed and open buckets, the open ones held
+     * up to time and reset
+     * @param time Wall clock ms
+     */
+    QVector<TBucket> takeAll(qint64 time);
+    bool hasClosed() const;
+
+    /* open bucket of a series, nullptr if none */
+    const TBucket* current(quint16 device, quint16 regid, TLevel level) const;
+    /* samples older than the open bucket of a level */
+    quint64 lateCount() const;
+    void clear();
+
+private:
+    typedef struct {
+        TBucket m_open[LevelCount];
+        /* closed with its value held, the next sample carries it */
+        bool m_carry[LevelCount];
+    } TSeries;
+
+    /* series by device << 16 | regid */
+    QHash<quint32, TSeries> m_series;
+    QVector<TBucket> m_closed;
+    /* late partials by series and start + level */
+    QHash<QPair<quint32, qint64>, TBucket> m_late;
+    quint64 m_lateCount;
+
+private:
+    inline static void start(TBucket* bucket, qint64 time, qint64 raw);
+    inline static void update(TBucket* bucket, qint64 time, qint64 raw);
+    inline static void hold(TBucket* bucket, qint64 time);
+    inline void roll(TBucket* open, bool* carry, qint64 time);
+};
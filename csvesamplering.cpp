@@ -0,0 +1,149 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <csvesamplering.h>
+#include <string.h>
+
+CSVeSampleRing::CSVeSampleRing(int capacity)
+    : m_times()
+    , m_raws()
+    , m_head(0)
+    , m_count(0)
+{
+    setCapacity(capacity);
+}
+
+void CSVeSampleRing::setCapacity(int capacity)
+{
+    capacity = qMax(0, capacity);
+    m_times.fill(0, capacity);
+    m_raws.fill(0, capacity);
+    m_times.squeeze();
+    m_raws.squeeze();
+    m_head = 0;
+    m_count = 0;
+}
+
+int CSVeSampleRing::capacity() const
+{
+    return m_times.size();
+}
+
+int CSVeSampleRing::count() const
+{
+    return m_count;
+}
+
+bool CSVeSampleRing::isEmpty() const
+{
+    return (m_count == 0);
+}
+
+void CSVeSampleRing::clear()
+{
+    m_head = 0;
+    m_count = 0;
+}
+
+void CSVeSampleRing::append(qint64 time, qint64 raw)
+{
+    const int capacity = m_times.size();
+    if (capacity == 0) {
+        return;
+    }
+
+    m_times[m_head] = time;
+    m_raws[m_head] = raw;
+    m_head = (m_head + 1 == capacity ? 0 : m_head + 1);
+    if (m_count < capacity) {
+        m_count++;
+    }
+}
+
+qint64 CSVeSampleRing::timeAt(int i) const
+{
+    return m_times.at(physical(i));
+}
+
+qint64 CSVeSampleRing::rawAt(int i) const
+{
+    return m_raws.at(physical(i));
+}
+
+qint64 CSVeSampleRing::lastTime() const
+{
+    return (m_count ? timeAt(m_count - 1) : 0);
+}
+
+qint64 CSVeSampleRing::lastRaw() const
+{
+    return (m_count ? rawAt(m_count - 1) : 0);
+}
+
+int CSVeSampleRing::last(int n, QVector<qint64>* times, QVector<qint64>* raws) const
+{
+    return copy(m_count - qBound(0, n, m_count), times, raws);
+}
+
+int CSVeSampleRing::since(qint64 time, QVector<qint64>* times, QVector<qint64>* raws) const
+{
+    return copy(indexOf(time), times, raws);
+}
+
+int CSVeSampleRing::indexOf(qint64 time) const
+{
+    int lo = 0;
+    int hi = m_count;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (timeAt(mid) < time) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+inline int CSVeSampleRing::physical(int i) const
+{
+    const int capacity = m_times.size();
+    int p = m_head - m_count + i;
+    if (p < 0) {
+        p += capacity;
+    }
+    return (p >= capacity ? p - capacity : p);
+}
+
+/* at most two blocks, the tail of the array and its start */
+inline int CSVeSampleRing::copy(int from, QVector<qint64>* times, QVector<qint64>* raws) const
+{
+    const int n = m_count - from;
+    if (times) {
+        times->resize(n);
+    }
+    if (raws) {
+        raws->resize(n);
+    }
+    if (n <= 0) {
+        return 0;
+    }
+
+    const int start = physical(from);
+    const int first = qMin(n, m_times.size() - start);
+    const size_t size = sizeof(qint64);
+
+    if (times) {
+        memcpy(times->data(), m_times.constData() + start, first * size);
+        memcpy(times->data() + first, m_times.constData(), (n - first) * size);
+    }
+    if (raws) {
+        memcpy(raws->data(), m_raws.constData() + start, first * size);
+        memcpy(raws->data() + first, m_raws.constData(), (n - first) * size);
+    }
+    return n;
+}
@@ -0,0 +1,76 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QVector>
+
+/**
+ * @brief Fixed size ring of timestamped raw register samples
+ *
+ * Times and raw values are kept in two separate arrays, so a scan
+ * over the time column (since()) only touches timestamps and the
+ * values of a query are copied out as contiguous blocks. Memory is
+ * allocated once by setCapacity(), append() never allocates and
+ * overwrites the oldest sample when full.
+ *
+ * Times are monotonic ms and must not decrease, raw values are
+ * scaled by the exponent of the register (see CSVeRegisterStore).
+ */
+class CSVeSampleRing
+{
+public:
+    explicit CSVeSampleRing(int capacity = 0);
+
+    /**
+     * @brief setCapacity Resize, drops all samples
+     * @param capacity 0 = no history
+     */
+    void setCapacity(int capacity);
+    int capacity() const;
+    int count() const;
+    bool isEmpty() const;
+    void clear();
+
+    void append(qint64 time, qint64 raw);
+
+    /* i = 0 is the oldest sample */
+    qint64 timeAt(int i) const;
+    qint64 rawAt(int i) const;
+    qint64 lastTime() const;
+    qint64 lastRaw() const;
+
+    /**
+     * @brief last Copy the newest n samples, oldest first
+     * @param n
+     * @param times may be nullptr
+     * @param raws may be nullptr
+     * @return Number of samples copied
+     */
+    int last(int n, QVector<qint64>* times, QVector<qint64>* raws) const;
+    /**
+     * @brief since Copy all samples with time >= time, oldest first
+     * @return Number of samples copied
+     */
+    int since(qint64 time, QVector<qint64>* times, QVector<qint64>* raws) const;
+    /**
+     * @brief indexOf Binary search
+     * @param time
+     * @return Index of the first sample with time >= time, count()
+     * if there is none
+     */
+    int indexOf(qint64 time) const;
+
+private:
+    QVector<qint64> m_times;
+    QVector<qint64> m_raws;
+    /* next write position */
+    int m_head;
+    int m_count;
+
+private:
+    inline int physical(int i) const;
+    inline int copy(int from, QVector<qint64>* times, QVector<qint64>* raws) const;
+};
@@ -0,0 +1,461 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <algorithm>
+#include <csvescheduler.h>
+
+/* weight of the newest interval in the moving average */
+static const double EMA_WEIGHT = 0.2;
+
+CSVeScheduler::CSVeScheduler(QObject* parent)
+    : QObject(parent)
+    , m_clock()
+    , m_registers()
+    , m_staleFactor(3.0)
+    , m_inflight()
+    , m_window(DEFAULT_WINDOW)
+    , m_unsupported()
+    , m_streams()
+{
+    m_clock.start();
+}
+
+void CSVeScheduler::addPollRegister(quint16 regid, qint64 interval)
+{
+    TRegisterStats& rs = entry(regid);
+    if (interval <= 0) {
+        interval = DEFAULT_POLL_INTERVAL;
+    }
+    rs.m_interval = interval;
+    rs.m_lastPoll = -rs.m_interval; /* due immediately */
+}
+
+void CSVeScheduler::removePollRegister(quint16 regid)
+{
+    if (m_registers.contains(regid)) {
+        m_registers[regid].m_interval = 0;
+    }
+}
+
+void CSVeScheduler::setStaleFactor(double factor)
+{
+    m_staleFactor = (factor < 1.0 ? 1.0 : factor);
+}
+
+double CSVeScheduler::staleFactor() const
+{
+    return m_staleFactor;
+}
+
+void CSVeScheduler::noteBroadcast(quint16 regid)
+{
+    const qint64 now = elapsed();
+    TRegisterStats& rs = entry(regid);
+
+    if (rs.m_broadcasts == 0) {
+        rs.m_firstBroadcast = now;
+    }
+    else {
+        const double interval = now - rs.m_lastBroadcast;
+        if (rs.m_broadcasts == 1) {
+            rs.m_avgInterval = interval;
+        }
+        else {
+            rs.m_avgInterval += EMA_WEIGHT * (interval - rs.m_avgInterval);
+        }
+    }
+
+    rs.m_lastBroadcast = now;
+    rs.m_broadcasts++;
+}
+
+void CSVeScheduler::noteResponse(quint16 regid)
+{
+    entry(regid).m_lastResponse = elapsed();
+}
+
+bool CSVeScheduler::isBroadcastFresh(quint16 regid) const
+{
+    if (!m_registers.contains(regid)) {
+        return false;
+    }
+
+    const TRegisterStats& rs = m_registers[regid];
+    if (rs.m_broadcasts == 0) {
+        return false;
+    }
+
+    return (elapsed() - rs.m_lastBroadcast) <= freshWindow(rs);
+}
+
+double CSVeScheduler::broadcastRate(quint16 regid) const
+{
+    if (!m_registers.contains(regid)) {
+        return 0.0;
+    }
+
+    const TRegisterStats& rs = m_registers[regid];
+    if (rs.m_broadcasts < 2 || rs.m_avgInterval <= 0.0) {
+        return 0.0;
+    }
+
+    return 1000.0 / rs.m_avgInterval;
+}
+
+QList<quint16> CSVeScheduler::duePolls()
+{
+    const qint64 now = elapsed();
+    QList<quint16> due;
+
+    QHash<quint16, TRegisterStats>::iterator it;
+    for (it = m_registers.begin(); it != m_registers.end(); it++) {
+        TRegisterStats& rs = it.value();
+        if (rs.m_interval <= 0 || (now - rs.m_lastPoll) < rs.m_interval) {
+            continue;
+        }
+        if (m_unsupported.contains(rs.m_regid)) {
+            continue;
+        }
+
+        rs.m_lastPoll = now;
+
+        /* device pushes this one by itself, don't waste link time */
+        if (rs.m_broadcasts && (now - rs.m_lastBroadcast) <= freshWindow(rs)) {
+            rs.m_suppressed++;
+            continue;
+        }
+
+        rs.m_polls++;
+        due.append(rs.m_regid);
+    }
+
+    return due;
+}
+
+QList<CSVeScheduler::TRegisterStats> CSVeScheduler::statistics() const
+{
+    return m_registers.values();
+}
+
+QStringList CSVeScheduler::report() const
+{
+    QStringList lines;
+
+    QList<quint16> regids = m_registers.keys();
+    std::sort(regids.begin(), regids.end());
+
+    foreach (quint16 regid, regids) {
+        const TRegisterStats& rs = m_registers[regid];
+        const quint32 cycles = rs.m_polls + rs.m_suppressed;
+        const double savings = (cycles ? (100.0 * rs.m_suppressed) / cycles : 0.0);
+        lines << tr("0x%1 async=%2 rate=%3/s polls=%4 suppressed=%5 savings=%6%")
+                    .arg(regid, 4, 16, QChar('0'))
+                    .arg(rs.m_broadcasts)
+                    .arg(broadcastRate(regid), 0, 'f', 2)
+                    .arg(rs.m_polls)
+                    .arg(rs.m_suppressed)
+                    .arg(savings, 0, 'f', 0);
+    }
+
+    return lines;
+}
+
+void CSVeScheduler::reset()
+{
+    QHash<quint16, TRegisterStats>::iterator it;
+    for (it = m_registers.begin(); it != m_registers.end(); it++) {
+        TRegisterStats& rs = it.value();
+        rs.m_lastPoll = -rs.m_interval;
+        rs.m_lastResponse = 0;
+        rs.m_polls = 0;
+        rs.m_suppressed = 0;
+        rs.m_broadcasts = 0;
+        rs.m_firstBroadcast = 0;
+        rs.m_lastBroadcast = 0;
+        rs.m_avgInterval = 0.0;
+    }
+}
+
+qint64 CSVeScheduler::elapsed() const
+{
+    return m_clock.elapsed();
+}
+
+void CSVeScheduler::enqueue(const CSVEDirect::ved_t& ved, TPriority prio)
+{
+    if (prio < PrioBackground || prio >= PrioLevels) {
+        prio = PrioNormal;
+    }
+    m_queues[prio].append(ved);
+}
+
+bool CSVeScheduler::takeNext(CSVEDirect::ved_t* ved, TPriority* prio)
+{
+    expireInflight();
+
+    /* reserved slot for urgent commands */
+    int window = m_window;
+    if (!m_queues[PrioUrgent].isEmpty()) {
+        window++;
+    }
+    if (m_inflight.count() >= window) {
+        return false;
+    }
+
+    for (int level = PrioUrgent; level >= PrioBackground; level--) {
+        /* setpoint streams right after urgent commands */
+        if (level == PrioHigh) {
+            QHash<quint16, TStream>::iterator it;
+            for (it = m_streams.begin(); it != m_streams.end(); it++) {
+                TStream& st = it.value();
+                if (!st.m_pending || isInflight(VED_CMD_SET, st.m_regid)) {
+                    continue;
+                }
+                (*ved) = st.m_ved;
+                st.m_pending = false;
+                release(ved);
+                st.m_sent = m_inflight.last().m_sent;
+                if (prio) {
+                    (*prio) = PrioHigh;
+                }
+                return true;
+            }
+        }
+        if (m_queues[level].isEmpty()) {
+            continue;
+        }
+        /* background only on idle link */
+        if (level == PrioBackground && !m_inflight.isEmpty()) {
+            return false;
+        }
+
+        (*ved) = m_queues[level].takeFirst();
+        release(ved);
+        if (prio) {
+            (*prio) = (TPriority) level;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void CSVeScheduler::noteAnswer(quint8 command, quint16 regid)
+{
+    for (int i = 0; i < m_inflight.count(); i++) {
+        const TInflight& tf = m_inflight.at(i);
+        bool match = false;
+        switch (command) {
+            case VED_RESP_GET:
+            case VED_RESP_SET: {
+                match = (tf.m_command == command && tf.m_regid == regid);
+                break;
+            }
+            case VED_RESP_PING: {
+                match = (tf.m_command == VED_CMD_PING);
+                break;
+            }
+            case VED_RESP_DONE: {
+                match = (tf.m_command == VED_CMD_GET_APPVER || tf.m_command == VED_CMD_GET_PRODUCT_ID);
+                break;
+            }
+            /* no id in unknown/error response, oldest one */
+            case VED_RESP_UNKNOWN:
+            case VED_RESP_ERROR: {
+                match = true;
+                break;
+            }
+        }
+        if (match) {
+            if (tf.m_command == VED_CMD_SET && command == VED_RESP_SET && m_streams.contains(regid)) {
+                TStream& st = m_streams[regid];
+                if (st.m_sent == tf.m_sent) {
+                    st.m_lastLatency = elapsed() - st.m_sent;
+                    st.m_maxLatency = qMax(st.m_maxLatency, st.m_lastLatency);
+                    if (st.m_acks == 0) {
+                        st.m_avgLatency = st.m_lastLatency;
+                    }
+                    else {
+                        st.m_avgLatency += EMA_WEIGHT * (st.m_lastLatency - st.m_avgLatency);
+                    }
+                    st.m_acks++;
+                    m_inflight.removeAt(i);
+                    emit streamAcknowledged(regid, st.m_lastLatency);
+                    return;
+                }
+            }
+            m_inflight.removeAt(i);
+            return;
+        }
+    }
+}
+
+int CSVeScheduler::expireInflight()
+{
+    const qint64 now = elapsed();
+    int expired = 0;
+    while (!m_inflight.isEmpty() && (now - m_inflight.first().m_sent) > RESPONSE_TIMEOUT) {
+        m_inflight.removeFirst();
+        expired++;
+    }
+    return expired;
+}
+
+bool CSVeScheduler::isQueued(quint8 command, quint16 regid) const
+{
+    for (int prio = PrioBackground; prio < PrioLevels; prio++) {
+        for (int i = 0; i < m_queues[prio].count(); i++) {
+            CSVEDirect::ved_t ved = m_queues[prio].at(i);
+            if (CSVEDirect::getCommand(&ved) == command && CSVEDirect::getId(&ved) == regid) {
+                return true;
+            }
+        }
+    }
+    if (command == VED_CMD_SET && m_streams.contains(regid) && m_streams[regid].m_pending) {
+        return true;
+    }
+    return isInflight(command, regid);
+}
+
+int CSVeScheduler::queuedCount(TPriority prio) const
+{
+    if (prio < PrioBackground || prio >= PrioLevels) {
+        return 0;
+    }
+    return m_queues[prio].count();
+}
+
+int CSVeScheduler::inflightCount() const
+{
+    return m_inflight.count();
+}
+
+void CSVeScheduler::clearQueue()
+{
+    for (int prio = PrioBackground; prio < PrioLevels; prio++) {
+        m_queues[prio].clear();
+    }
+    QHash<quint16, TStream>::iterator it;
+    for (it = m_streams.begin(); it != m_streams.end(); it++) {
+        it.value().m_pending = false;
+    }
+    m_inflight.clear();
+}
+
+void CSVeScheduler::setWindow(int window)
+{
+    m_window = (window < 1 ? 1 : window);
+}
+
+int CSVeScheduler::window() const
+{
+    return m_window;
+}
+
+void CSVeScheduler::stream(const CSVEDirect::ved_t& ved)
+{
+    CSVEDirect::ved_t in = ved;
+    const quint16 regid = CSVEDirect::getId(&in);
+
+    if (!m_streams.contains(regid)) {
+        TStream st = {};
+        st.m_regid = regid;
+        m_streams[regid] = st;
+    }
+
+    TStream& st = m_streams[regid];
+    if (st.m_pending) {
+        st.m_coalesced++;
+    }
+    st.m_ved = ved;
+    st.m_pending = true;
+    st.m_updates++;
+}
+
+void CSVeScheduler::closeStream(quint16 regid)
+{
+    m_streams.remove(regid);
+}
+
+QList<CSVeScheduler::TStream> CSVeScheduler::streamStatistics() const
+{
+    return m_streams.values();
+}
+
+QStringList CSVeScheduler::streamReport() const
+{
+    QStringList lines;
+
+    QList<quint16> regids = m_streams.keys();
+    std::sort(regids.begin(), regids.end());
+
+    foreach (quint16 regid, regids) {
+        const TStream& st = m_streams[regid];
+        lines << tr("0x%1 updates=%2 coalesced=%3 acks=%4 latency=%5ms avg=%6ms max=%7ms")
+                    .arg(regid, 4, 16, QChar('0'))
+                    .arg(st.m_updates)
+                    .arg(st.m_coalesced)
+                    .arg(st.m_acks)
+                    .arg(st.m_lastLatency)
+                    .arg(st.m_avgLatency, 0, 'f', 1)
+                    .arg(st.m_maxLatency);
+    }
+
+    return lines;
+}
+
+void CSVeScheduler::setUnsupported(const QSet<quint16>& regids)
+{
+    m_unsupported = regids;
+}
+
+bool CSVeScheduler::isSupported(quint16 regid) const
+{
+    return !m_unsupported.contains(regid);
+}
+
+inline CSVeScheduler::TRegisterStats& CSVeScheduler::entry(quint16 regid)
+{
+    if (!m_registers.contains(regid)) {
+        TRegisterStats rs = {};
+        rs.m_regid = regid;
+        m_registers[regid] = rs;
+    }
+    return m_registers[regid];
+}
+
+inline bool CSVeScheduler::isInflight(quint8 command, quint16 regid) const
+{
+    for (int i = 0; i < m_inflight.count(); i++) {
+        if (m_inflight.at(i).m_command == command && m_inflight.at(i).m_regid == regid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void CSVeScheduler::release(CSVEDirect::ved_t* ved)
+{
+    const quint8 command = CSVEDirect::getCommand(ved);
+    m_inflight.append({command, (command == VED_CMD_GET || command == VED_CMD_SET ? CSVEDirect::getId(ved) : (quint16) 0), elapsed()});
+}
+
+/* A learned broadcast may jitter up to m_staleFactor of its
+ * average interval before it is considered stale. Until the
+ * interval is learned the poll interval is used, the default
+ * interval if not polled. */
+inline qint64 CSVeScheduler::freshWindow(const TRegisterStats& rs) const
+{
+    if (rs.m_broadcasts >= 2 && rs.m_avgInterval > 0.0) {
+        return static_cast<qint64>(rs.m_avgInterval * m_staleFactor);
+    }
+    qint64 interval = rs.m_interval;
+    if (interval <= 0) {
+        interval = DEFAULT_POLL_INTERVAL;
+    }
+    return interval;
+}
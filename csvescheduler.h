@@ -0,0 +1,265 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <csvedirect.h>
+
+/**
+ * @brief Register poll scheduler
+ *
+ * Learns which registers the device broadcasts by itself
+ * (VED_CMD_ASYNC) and how often. Cyclic GET polls of those
+ * registers are suppressed as long as the broadcast value is
+ * fresh. Polling resumes as soon as a broadcast goes stale.
+ *
+ * Outgoing VE.HEX commands are queued by priority and released
+ * pipelined: up to window() commands may wait for their response
+ * at the same time. Background commands are released only if no
+ * other command is pending. Urgent commands (deadline bound link
+ * writes) have one reserved slot above the window, so a full
+ * pipeline of polls never delays them.
+ *
+ * Setpoint streams keep only the newest value of a register. It
+ * is released as soon as a pipeline slot is free and the previous
+ * value of the same register is acknowledged.
+ */
+class CSVeScheduler: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* default poll interval in milliseconds */
+    static const qint64 DEFAULT_POLL_INTERVAL = 5000;
+    /* response timeout of a released command in milliseconds */
+    static const qint64 RESPONSE_TIMEOUT = 1000;
+    /* default number of commands waiting for response */
+    static const int DEFAULT_WINDOW = 4;
+
+    typedef enum {
+        PrioBackground = 0,
+        PrioNormal,
+        PrioHigh,
+        PrioUrgent,
+        PrioLevels,
+    } TPriority;
+
+    typedef struct {
+        quint8 m_command;
+        quint16 m_regid;
+        qint64 m_sent;
+    } TInflight;
+
+    typedef struct {
+        quint16 m_regid;
+        /* poll interval in ms, 0 = not polled */
+        qint64 m_interval;
+        qint64 m_lastPoll;
+        qint64 m_lastResponse;
+        quint32 m_polls;
+        quint32 m_suppressed;
+        /* ASYNC broadcast statistics */
+        quint32 m_broadcasts;
+        qint64 m_firstBroadcast;
+        qint64 m_lastBroadcast;
+        double m_avgInterval;
+    } TRegisterStats;
+
+    typedef struct {
+        quint16 m_regid;
+        CSVEDirect::ved_t m_ved;
+        bool m_pending;
+        qint64 m_sent;
+        quint32 m_updates;
+        quint32 m_coalesced;
+        quint32 m_acks;
+        qint64 m_lastLatency;
+        qint64 m_maxLatency;
+        double m_avgLatency;
+    } TStream;
+
+    /**
+     * @brief CSVeScheduler
+     * @param parent
+     */
+    explicit CSVeScheduler(QObject* parent = nullptr);
+
+    /**
+     * @brief addPollRegister Poll register cyclic
+     * @param regid
+     * @param interval Poll interval in ms
+     */
+    void addPollRegister(quint16 regid, qint64 interval = DEFAULT_POLL_INTERVAL);
+    /**
+     * @brief removePollRegister Stop cyclic poll of register
+     * @param regid
+     */
+    void removePollRegister(quint16 regid);
+    /**
+     * @brief setStaleFactor Number of learned broadcast intervals
+     * a broadcast may be late before polling falls back to GET.
+     * @param factor
+     */
+    void setStaleFactor(double factor);
+    double staleFactor() const;
+    /**
+     * @brief noteBroadcast Register received as VED_CMD_ASYNC
+     * @param regid
+     */
+    void noteBroadcast(quint16 regid);
+    /**
+     * @brief noteResponse Register received as GET response
+     * @param regid
+     */
+    void noteResponse(quint16 regid);
+    /**
+     * @brief isBroadcastFresh
+     * @param regid
+     * @return true if a broadcast value is younger than the
+     * freshness window of the register.
+     */
+    bool isBroadcastFresh(quint16 regid) const;
+    /**
+     * @brief broadcastRate
+     * @param regid
+     * @return Learned broadcast rate in frames per second
+     */
+    double broadcastRate(quint16 regid) const;
+    /**
+     * @brief duePolls Collect registers to poll now. Registers
+     * with a fresh broadcast are counted as suppressed.
+     * @return List of register ids
+     */
+    QList<quint16> duePolls();
+    /**
+     * @brief statistics
+     * @return Per register broadcast and poll statistics
+     */
+    QList<TRegisterStats> statistics() const;
+    /**
+     * @brief report Human readable broadcast rate and poll
+     * savings per register.
+     * @return
+     */
+    QStringList report() const;
+    /**
+     * @brief reset Clear learned broadcasts and counters,
+     * keeps the poll registrations.
+     */
+    void reset();
+    /**
+     * @brief elapsed Monotonic scheduler time in ms
+     * @return
+     */
+    qint64 elapsed() const;
+
+    /* ------------------------------------------------------
+     * Command queue
+     * ------------------------------------------------------ */
+
+    /**
+     * @brief enqueue Queue VE.HEX command (not framed)
+     * @param ved
+     * @param prio
+     */
+    void enqueue(const CSVEDirect::ved_t& ved, TPriority prio = PrioNormal);
+    /**
+     * @brief takeNext Take next command to release if the
+     * pipeline window allows it.
+     * @param ved
+     * @param prio Priority of the taken command, optional
+     * @return false if nothing to send now
+     */
+    bool takeNext(CSVEDirect::ved_t* ved, TPriority* prio = nullptr);
+    /**
+     * @brief noteAnswer Response received from device, frees
+     * the pipeline slot of the matching command.
+     * @param command Response command code
+     * @param regid
+     */
+    void noteAnswer(quint8 command, quint16 regid);
+    /**
+     * @brief expireInflight Free pipeline slots of commands
+     * without response.
+     * @return Number of expired commands
+     */
+    int expireInflight();
+    /**
+     * @brief isQueued
+     * @param command
+     * @param regid
+     * @return true if command is queued or waiting for response
+     */
+    bool isQueued(quint8 command, quint16 regid) const;
+    int queuedCount(TPriority prio) const;
+    int inflightCount() const;
+    void clearQueue();
+    /**
+     * @brief setWindow Max. commands waiting for response
+     * @param window
+     */
+    void setWindow(int window);
+    int window() const;
+
+    /* ------------------------------------------------------
+     * Setpoint streams
+     * ------------------------------------------------------ */
+
+    /**
+     * @brief stream Latest value wins SET command. Replaces a
+     * not yet released value of the same register.
+     * @param ved
+     */
+    void stream(const CSVEDirect::ved_t& ved);
+    /**
+     * @brief closeStream Drop pending value and statistics
+     * @param regid
+     */
+    void closeStream(quint16 regid);
+    QList<TStream> streamStatistics() const;
+    /**
+     * @brief streamReport Human readable send to acknowledge
+     * latency per stream.
+     * @return
+     */
+    QStringList streamReport() const;
+
+    /* ------------------------------------------------------
+     * Device capabilities
+     * ------------------------------------------------------ */
+
+    /**
+     * @brief setUnsupported Registers the device doesn't have.
+     * Those are never polled or queued for GET.
+     * @param regids
+     */
+    void setUnsupported(const QSet<quint16>& regids);
+    bool isSupported(quint16 regid) const;
+
+signals:
+    void streamAcknowledged(quint16 regid, qint64 latency);
+
+private:
+    QElapsedTimer m_clock;
+    QHash<quint16, TRegisterStats> m_registers;
+    double m_staleFactor;
+    QList<CSVEDirect::ved_t> m_queues[PrioLevels];
+    QList<TInflight> m_inflight;
+    int m_window;
+    QSet<quint16> m_unsupported;
+    QHash<quint16, TStream> m_streams;
+
+private:
+    inline TRegisterStats& entry(quint16 regid);
+    inline qint64 freshWindow(const TRegisterStats& rs) const;
+    inline bool isInflight(quint8 command, quint16 regid) const;
+    inline void release(CSVEDirect::ved_t* ved);
+};
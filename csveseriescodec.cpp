@@ -0,0 +1,336 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QtEndian>
+#include <csveregisterstore.h>
+#include <csveseriescodec.h>
+
+static inline quint64 zigzag(qint64 v)
+{
+    return ((quint64) v << 1) ^ (quint64) (v >> 63);
+}
+
+static inline qint64 unzigzag(quint64 v)
+{
+    return (qint64) (v >> 1) ^ -(qint64) (v & 1);
+}
+
+/* MSB first bit reader, refilled a byte at a time */
+typedef struct {
+    const uchar* m_p;
+    const uchar* m_end;
+    quint64 m_acc;
+    int m_bits;
+} TBitReader;
+
+static inline bool readBits(TBitReader* r, int n, quint64* value)
+{
+    while (r->m_bits <= 56 && r->m_p < r->m_end) {
+        r->m_acc |= (quint64) *r->m_p++ << (56 - r->m_bits);
+        r->m_bits += 8;
+    }
+    if (r->m_bits < n) {
+        return false;
+    }
+    *value = r->m_acc >> (64 - n);
+    r->m_acc <<= n;
+    r->m_bits -= n;
+    return true;
+}
+
+/* prefix of up to four 1 bits selects the width */
+static inline bool readBucket(TBitReader* r, const int* widths, quint64* value)
+{
+    quint64 bit;
+    int i = 0;
+    for (; i < 4; i++) {
+        if (!readBits(r, 1, &bit)) {
+            return false;
+        }
+        if (!bit) {
+            break;
+        }
+    }
+    if (widths[i] == 0) {
+        *value = 0;
+        return true;
+    }
+    return readBits(r, widths[i], value);
+}
+
+/* bucket widths by prefix '0', '10', '110', '1110', '1111' */
+static const int TIME_WIDTHS[] = {0, 7, 9, 12, 40};
+static const int VALUE_WIDTHS[] = {0, 6, 13, 20, 40};
+
+qint64 CSVeSeriesCodec::extend(quint8 type, quint32 bits)
+{
+    switch (type) {
+        case CSVeRegisterStore::TypeS16:
+        case CSVeRegisterStore::TypeS32:
+        case CSVeRegisterStore::TypeInt: {
+            return (qint32) bits;
+        }
+        default: {
+            return bits;
+        }
+    }
+}
+
+void CSVeSeriesCodec::writeInfo(const TBlockInfo& info, uchar* p)
+{
+    qToLittleEndian<quint16>(info.m_device, p);
+    qToLittleEndian<quint16>(info.m_regid, p + 2);
+    p[4] = info.m_type;
+    p[5] = (uchar) info.m_exponent;
+    qToLittleEndian<quint16>(0, p + 6);
+    qToLittleEndian<quint32>(info.m_count, p + 8);
+    qToLittleEndian<quint32>(info.m_size, p + 12);
+    qToLittleEndian<qint64>(info.m_first, p + 16);
+    qToLittleEndian<qint64>(info.m_last, p + 24);
+    qToLittleEndian<quint32>((quint32) info.m_value, p + 32);
+    qToLittleEndian<quint32>((quint32) info.m_min, p + 36);
+    qToLittleEndian<quint32>((quint32) info.m_max, p + 40);
+}
+
+void CSVeSeriesCodec::readInfo(const uchar* p, TBlockInfo* info)
+{
+    info->m_device = qFromLittleEndian<quint16>(p);
+    info->m_regid = qFromLittleEndian<quint16>(p + 2);
+    info->m_type = p[4];
+    info->m_exponent = (qint8) p[5];
+    info->m_count = qFromLittleEndian<quint32>(p + 8);
+    info->m_size = qFromLittleEndian<quint32>(p + 12);
+    info->m_first = qFromLittleEndian<qint64>(p + 16);
+    info->m_last = qFromLittleEndian<qint64>(p + 24);
+    info->m_value = extend(info->m_type, qFromLittleEndian<quint32>(p + 32));
+    info->m_min = extend(info->m_type, qFromLittleEndian<quint32>(p + 36));
+    info->m_max = extend(info->m_type, qFromLittleEndian<quint32>(p + 40));
+}
+
+bool CSVeSeriesCodec::parse(const uchar* payload, quint32 size, TBatch* batch)
+{
+    batch->m_blocks.clear();
+    batch->m_data.clear();
+    if (size < 4) {
+        return false;
+    }
+
+    const quint32 count = qFromLittleEndian<quint32>(payload);
+    if ((quint64) count * BLOCK_INFO_SIZE > size - 4) {
+        return false;
+    }
+
+    batch->m_blocks.resize(count);
+    batch->m_data.resize(count);
+
+    const uchar* data = payload + 4 + count * BLOCK_INFO_SIZE;
+    const uchar* end = payload + size;
+    for (quint32 i = 0; i < count; i++) {
+        readInfo(payload + 4 + i * BLOCK_INFO_SIZE, &batch->m_blocks[i]);
+        if (batch->m_blocks[i].m_size > (quint64) (end - data)) {
+            return false;
+        }
+        batch->m_data[i] = data;
+        data += batch->m_blocks[i].m_size;
+    }
+    return true;
+}
+
+int CSVeSeriesCodec::decode(const TBlockInfo& info, const uchar* data, qint64* times, qint64* raws)
+{
+    if (info.m_count == 0) {
+        return 0;
+    }
+
+    TBitReader r = {data, data + info.m_size, 0, 0};
+    qint64 time = info.m_first;
+    qint64 delta = 0;
+    qint64 raw = info.m_value;
+    times[0] = time;
+    raws[0] = raw;
+
+    for (quint32 i = 1; i < info.m_count; i++) {
+        quint64 dod;
+        quint64 diff;
+        if (!readBucket(&r, TIME_WIDTHS, &dod) || !readBucket(&r, VALUE_WIDTHS, &diff)) {
+            return (int) i;
+        }
+        delta += unzigzag(dod);
+        time += delta;
+        raw += unzigzag(diff);
+        times[i] = time;
+        raws[i] = raw;
+    }
+    return (int) info.m_count;
+}
+
+CSVeSeriesEncoder::CSVeSeriesEncoder(quint16 device, quint16 regid, quint8 type, qint8 exponent)
+    : m_info()
+    , m_prevTime(0)
+    , m_prevDelta(0)
+    , m_prevRaw(0)
+    , m_bits()
+    , m_acc(0)
+    , m_accBits(0)
+{
+    m_info.m_device = device;
+    m_info.m_regid = regid;
+    m_info.m_type = type;
+    m_info.m_exponent = exponent;
+}
+
+void CSVeSeriesEncoder::append(qint64 time, qint64 raw)
+{
+    if (m_info.m_count == 0) {
+        m_info.m_first = time;
+        m_info.m_value = raw;
+        m_info.m_min = raw;
+        m_info.m_max = raw;
+    }
+    else {
+        const qint64 delta = time - m_prevTime;
+        const quint64 dod = zigzag(delta - m_prevDelta);
+        if (dod == 0) {
+            writeBits(0, 1);
+        }
+        else if (dod < (1ULL << 7)) {
+            writeBits(0x2, 2);
+            writeBits(dod, 7);
+        }
+        else if (dod < (1ULL << 9)) {
+            writeBits(0x6, 3);
+            writeBits(dod, 9);
+        }
+        else if (dod < (1ULL << 12)) {
+            writeBits(0xE, 4);
+            writeBits(dod, 12);
+        }
+        else {
+            writeBits(0xF, 4);
+            writeBits(dod, 40);
+        }
+        m_prevDelta = delta;
+
+        const quint64 diff = zigzag(raw - m_prevRaw);
+        if (diff == 0) {
+            writeBits(0, 1);
+        }
+        else if (diff < (1ULL << 6)) {
+            writeBits(0x2, 2);
+            writeBits(diff, 6);
+        }
+        else if (diff < (1ULL << 13)) {
+            writeBits(0x6, 3);
+            writeBits(diff, 13);
+        }
+        else if (diff < (1ULL << 20)) {
+            writeBits(0xE, 4);
+            writeBits(diff, 20);
+        }
+        else {
+            writeBits(0xF, 4);
+            writeBits(diff, 40);
+        }
+        m_info.m_min = qMin(m_info.m_min, raw);
+        m_info.m_max = qMax(m_info.m_max, raw);
+    }
+
+    m_prevTime = time;
+    m_prevRaw = raw;
+    m_info.m_last = time;
+    m_info.m_count++;
+}
+
+int CSVeSeriesEncoder::count() const
+{
+    return m_info.m_count;
+}
+
+bool CSVeSeriesEncoder::isEmpty() const
+{
+    return (m_info.m_count == 0);
+}
+
+int CSVeSeriesEncoder::size() const
+{
+    return m_bits.size() + (m_accBits ? 1 : 0);
+}
+
+quint8 CSVeSeriesEncoder::type() const
+{
+    return m_info.m_type;
+}
+
+qint8 CSVeSeriesEncoder::exponent() const
+{
+    return m_info.m_exponent;
+}
+
+qint64 CSVeSeriesEncoder::first() const
+{
+    return m_info.m_first;
+}
+
+QByteArray CSVeSeriesEncoder::finish(CSVeSeriesCodec::TBlockInfo* info) const
+{
+    QByteArray bits = m_bits;
+    if (m_accBits) {
+        bits.append((char) (m_acc << (8 - m_accBits)));
+    }
+
+    *info = m_info;
+    info->m_size = bits.size();
+    return bits;
+}
+
+void CSVeSeriesEncoder::reset()
+{
+    m_info.m_count = 0;
+    m_info.m_size = 0;
+    m_prevTime = 0;
+    m_prevDelta = 0;
+    m_prevRaw = 0;
+    m_bits.resize(0);
+    m_acc = 0;
+    m_accBits = 0;
+}
+
+QByteArray CSVeSeriesEncoder::encodeBatch(const QList<CSVeSeriesEncoder*>& encoders)
+{
+    QList<QByteArray> streams;
+    QList<CSVeSeriesCodec::TBlockInfo> infos;
+    foreach (const CSVeSeriesEncoder* encoder, encoders) {
+        if (encoder->isEmpty()) {
+            continue;
+        }
+        CSVeSeriesCodec::TBlockInfo info;
+        streams.append(encoder->finish(&info));
+        infos.append(info);
+    }
+
+    QByteArray payload(4 + infos.count() * CSVeSeriesCodec::BLOCK_INFO_SIZE, '\0');
+    uchar* p = (uchar*) payload.data();
+    qToLittleEndian<quint32>(infos.count(), p);
+    for (int i = 0; i < infos.count(); i++) {
+        CSVeSeriesCodec::writeInfo(infos[i], p + 4 + i * CSVeSeriesCodec::BLOCK_INFO_SIZE);
+    }
+    foreach (const QByteArray& stream, streams) {
+        payload.append(stream);
+    }
+    return payload;
+}
+
+/* at most 40 value bits, the accumulator keeps less than 8 */
+inline void CSVeSeriesEncoder::writeBits(quint64 value, int bits)
+{
+    m_acc = (m_acc << bits) | (value & ((1ULL << bits) - 1));
+    m_accBits += bits;
+    while (m_accBits >= 8) {
+        m_accBits -= 8;
+        m_bits.append((char) (m_acc >> m_accBits));
+    }
+    m_acc &= (1ULL << m_accBits) - 1;
+}
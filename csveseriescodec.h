@@ -0,0 +1,134 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+
+/**
+ * @brief Gorilla style compression of register series
+ *
+ * A block holds the samples of one register of one device over a
+ * time window. Timestamps are stored as delta-of-delta and values
+ * as zigzag integer delta of the raw register value, both with
+ * prefix coded bit widths:
+ *
+ *   time   '0' same interval, '10' + 7 bits, '110' + 9 bits,
+ *          '1110' + 12 bits, '1111' + 40 bits
+ *   value  '0' unchanged, '10' + 6 bits, '110' + 13 bits,
+ *          '1110' + 20 bits, '1111' + 40 bits
+ *
+ * The first time and value are in the block info, so a sampled
+ * register with a steady interval and a slowly moving value
+ * needs 3 to 10 bits per sample instead of 18 bytes.
+ *
+ * A batch starts with the infos of all its blocks (u32 count,
+ * count * BLOCK_INFO_SIZE) followed by the bit streams, so a
+ * reader can pick blocks by device, register, time range and
+ * min/max without decoding the others.
+ */
+class CSVeSeriesCodec
+{
+public:
+    /* little endian on disk: u16 device, u16 regid, u8 type,
+     * i8 exponent, u16 reserved, u32 count, u32 size, i64 first,
+     * i64 last time, i32 first value, i32 min, i32 max */
+    static const int BLOCK_INFO_SIZE = 44;
+
+    typedef struct {
+        quint16 m_device;
+        quint16 m_regid;
+        quint8 m_type;
+        qint8 m_exponent;
+        quint32 m_count;
+        /* bit stream bytes */
+        quint32 m_size;
+        qint64 m_first;
+        qint64 m_last;
+        qint64 m_value;
+        qint64 m_min;
+        qint64 m_max;
+    } TBlockInfo;
+
+    /* parsed batch, pointers into the payload */
+    typedef struct {
+        QVector<TBlockInfo> m_blocks;
+        QVector<const uchar*> m_data;
+    } TBatch;
+
+    /**
+     * @brief extend Raw value of its 32 bit image on disk, signed
+     * register types sign extended
+     */
+    static qint64 extend(quint8 type, quint32 bits);
+    static void writeInfo(const TBlockInfo& info, uchar* p);
+    static void readInfo(const uchar* p, TBlockInfo* info);
+
+    /**
+     * @brief parse Block infos and streams of a batch payload
+     * @return false if the payload is inconsistent
+     */
+    static bool parse(const uchar* payload, quint32 size, TBatch* batch);
+    /**
+     * @brief decode All samples of a block
+     * @param info
+     * @param data Bit stream
+     * @param times count entries
+     * @param raws count entries
+     * @return Samples decoded, less than count if damaged
+     */
+    static int decode(const TBlockInfo& info, const uchar* data, qint64* times, qint64* raws);
+};
+
+/**
+ * @brief Streaming encoder of one register series block
+ *
+ * Samples are appended as they arrive, only the bit stream is
+ * kept.
+ */
+class CSVeSeriesEncoder
+{
+public:
+    CSVeSeriesEncoder(quint16 device, quint16 regid, quint8 type, qint8 exponent);
+
+    void append(qint64 time, qint64 raw);
+    int count() const;
+    bool isEmpty() const;
+    /* bytes of the bit stream so far */
+    int size() const;
+    quint8 type() const;
+    qint8 exponent() const;
+    qint64 first() const;
+
+    /**
+     * @brief finish Info and bit stream of the block
+     * @param info
+     * @return Bit stream, padded to full bytes
+     */
+    QByteArray finish(CSVeSeriesCodec::TBlockInfo* info) const;
+    void reset();
+
+    /**
+     * @brief encodeBatch Batch payload of finished blocks
+     * @param encoders Empty ones are skipped
+     * @return Payload
+     */
+    static QByteArray encodeBatch(const QList<CSVeSeriesEncoder*>& encoders);
+
+private:
+    CSVeSeriesCodec::TBlockInfo m_info;
+    qint64 m_prevTime;
+    qint64 m_prevDelta;
+    qint64 m_prevRaw;
+    QByteArray m_bits;
+    /* pending bits, MSB first */
+    quint64 m_acc;
+    int m_accBits;
+
+private:
+    inline void writeBits(quint64 value, int bits);
+};
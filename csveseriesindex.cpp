@@ -0,0 +1,468 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+#include <csverecordreader.h>
+#include <csveseriescodec.h>
+#include <csveseriesindex.h>
+
+static inline quint32 seriesKey(quint16 device, quint16 regid)
+{
+    return ((quint32) device << 16) | regid;
+}
+
+static inline quint64 rollupKey(quint16 device, quint16 regid, quint8 level)
+{
+    return ((quint64) device << 24) | ((quint64) regid << 8) | level;
+}
+
+CSVeSeriesIndex::CSVeSeriesIndex()
+    : m_devices()
+    , m_wallBase(0)
+    , m_segmentSize(0)
+    , m_first(0)
+    , m_last(0)
+    , m_entries()
+    , m_series()
+    , m_rollupStarts()
+    , m_rollups()
+    , m_rollupSeries()
+{
+}
+
+QString CSVeSeriesIndex::indexName(const QString& segment)
+{
+    const QFileInfo info(segment);
+    return info.dir().filePath(info.completeBaseName() + ".vidx");
+}
+
+bool CSVeSeriesIndex::build(CSVeRecordReader* reader)
+{
+    clear();
+    reader->rewind();
+    m_wallBase = reader->wallBase();
+    m_segmentSize = reader->size();
+
+    CSVeRecordReader::TBatch batch;
+    CSVeSeriesCodec::TBatch blocks;
+    while (reader->readBatch(&batch)) {
+        if (batch.m_kind == CSVeRecorder::KindRollups && (quint64) batch.m_count * CSVeRollup::ENTRY_SIZE == batch.m_size) {
+            /* one entry per series and level of the batch */
+            QHash<quint64, int> series;
+            CSVeRollup::TBucket bucket;
+            for (quint32 i = 0; i < batch.m_count; i++) {
+                CSVeRollup::readEntry(batch.m_payload + i * CSVeRollup::ENTRY_SIZE, &bucket);
+                const quint64 rkey = rollupKey(bucket.m_device, bucket.m_regid, bucket.m_level);
+                QHash<quint64, int>::const_iterator rit = series.constFind(rkey);
+                if (rit == series.constEnd()) {
+                    series.insert(rkey, m_rollups.count());
+                    TRollupEntry e = {bucket.m_device, bucket.m_regid, bucket.m_level, batch.m_offset, 1, bucket.m_start, bucket.m_start};
+                    m_rollups.append(e);
+                }
+                else {
+                    TRollupEntry& e = m_rollups[rit.value()];
+                    e.m_count++;
+                    e.m_first = qMin(e.m_first, bucket.m_start);
+                    e.m_last = qMax(e.m_last, bucket.m_start);
+                }
+
+                const quint32 key = ((quint32) bucket.m_level << 16) | bucket.m_regid;
+                QHash<quint32, qint64>::iterator it = m_rollupStarts.find(key);
+                if (it == m_rollupStarts.end()) {
+                    m_rollupStarts.insert(key, bucket.m_start);
+                }
+                else {
+                    it.value() = qMin(it.value(), bucket.m_start);
+                }
+            }
+            continue;
+        }
+        if (batch.m_kind != CSVeRecorder::KindRecords) {
+            continue;
+        }
+        if (batch.m_codec == CSVeRecorder::CodecPlain && (quint64) batch.m_count * CSVeRecorder::RECORD_SIZE == batch.m_size) {
+            addPlain(batch.m_offset, batch.m_payload, batch.m_count);
+        }
+        else if (batch.m_codec == CSVeRecorder::CodecGorilla && CSVeSeriesCodec::parse(batch.m_payload, batch.m_size, &blocks)) {
+            for (int i = 0; i < blocks.m_blocks.count(); i++) {
+                const CSVeSeriesCodec::TBlockInfo& info = blocks.m_blocks.at(i);
+                m_entries.append({
+                   info.m_device,
+                   info.m_regid,
+                   CSVeRecorder::CodecGorilla,
+                   info.m_type,
+                   info.m_exponent,
+                   batch.m_offset,
+                   (quint32) i,
+                   info.m_count,
+                   info.m_first,
+                   info.m_last,
+                   info.m_min,
+                   info.m_max,
+                });
+            }
+        }
+    }
+
+    const bool intact = !reader->isTorn();
+    m_devices = reader->devices();
+    reader->rewind();
+    finish();
+    return intact;
+}
+
+bool CSVeSeriesIndex::load(const QString& fileName, qint64 segmentSize)
+{
+    clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    const uchar* p = (const uchar*) data.constData();
+    if (data.size() < HEADER_SIZE || qFromLittleEndian<quint32>(p) != INDEX_MAGIC || //
+        qFromLittleEndian<quint16>(p + 4) != INDEX_VERSION) {
+        return false;
+    }
+
+    const quint16 headerSize = qFromLittleEndian<quint16>(p + 6);
+    if (headerSize < HEADER_SIZE || headerSize > data.size() || //
+        CSVeRecorder::crc32(data.constData() + headerSize, data.size() - headerSize) != qFromLittleEndian<quint32>(p + 8) || //
+        qFromLittleEndian<qint64>(p + 12) != segmentSize) {
+        return false;
+    }
+
+    m_segmentSize = segmentSize;
+    m_wallBase = qFromLittleEndian<qint64>(p + 20);
+    const quint32 devices = qFromLittleEndian<quint32>(p + 28);
+    const quint32 entries = qFromLittleEndian<quint32>(p + 32);
+    const quint32 rollups = qFromLittleEndian<quint32>(p + 36);
+    const quint32 rollupEntries = qFromLittleEndian<quint32>(p + 40);
+
+    const uchar* end = p + data.size();
+    p += headerSize;
+    for (quint32 i = 0; i < devices; i++) {
+        if (end - p < 2 || end - p - 2 < qFromLittleEndian<quint16>(p)) {
+            clear();
+            return false;
+        }
+        const quint16 length = qFromLittleEndian<quint16>(p);
+        m_devices.append(QString::fromUtf8((const char*) p + 2, length));
+        p += 2 + length;
+    }
+
+    if ((quint64) (end - p) != (quint64) entries * ENTRY_SIZE + (quint64) rollups * 12 + (quint64) rollupEntries * ROLLUP_ENTRY_SIZE) {
+        clear();
+        return false;
+    }
+    m_entries.resize(entries);
+    for (quint32 i = 0; i < entries; i++, p += ENTRY_SIZE) {
+        TEntry& e = m_entries[i];
+        e.m_device = qFromLittleEndian<quint16>(p);
+        e.m_regid = qFromLittleEndian<quint16>(p + 2);
+        e.m_codec = p[4];
+        e.m_type = p[5];
+        e.m_exponent = (qint8) p[6];
+        e.m_offset = qFromLittleEndian<qint64>(p + 8);
+        e.m_block = qFromLittleEndian<quint32>(p + 16);
+        e.m_count = qFromLittleEndian<quint32>(p + 20);
+        e.m_first = qFromLittleEndian<qint64>(p + 24);
+        e.m_last = qFromLittleEndian<qint64>(p + 32);
+        e.m_min = CSVeSeriesCodec::extend(e.m_type, qFromLittleEndian<quint32>(p + 40));
+        e.m_max = CSVeSeriesCodec::extend(e.m_type, qFromLittleEndian<quint32>(p + 44));
+    }
+    for (quint32 i = 0; i < rollups; i++, p += 12) {
+        m_rollupStarts.insert(qFromLittleEndian<quint32>(p), qFromLittleEndian<qint64>(p + 4));
+    }
+    m_rollups.resize(rollupEntries);
+    for (quint32 i = 0; i < rollupEntries; i++, p += ROLLUP_ENTRY_SIZE) {
+        TRollupEntry& e = m_rollups[i];
+        e.m_device = qFromLittleEndian<quint16>(p);
+        e.m_regid = qFromLittleEndian<quint16>(p + 2);
+        e.m_level = p[4];
+        e.m_offset = qFromLittleEndian<qint64>(p + 8);
+        e.m_count = qFromLittleEndian<quint32>(p + 16);
+        e.m_first = qFromLittleEndian<qint64>(p + 20);
+        e.m_last = qFromLittleEndian<qint64>(p + 28);
+    }
+
+    finish();
+    return true;
+}
+
+bool CSVeSeriesIndex::save(const QString& fileName) const
+{
+    QByteArray body;
+    foreach (const QString& device, m_devices) {
+        const QByteArray id = device.toUtf8();
+        uchar length[2];
+        qToLittleEndian<quint16>(id.size(), length);
+        body.append((const char*) length, sizeof(length));
+        body.append(id);
+    }
+
+    const int offset = body.size();
+    body.resize(offset + m_entries.count() * ENTRY_SIZE);
+    uchar* p = (uchar*) body.data() + offset;
+    foreach (const TEntry& e, m_entries) {
+        qToLittleEndian<quint16>(e.m_device, p);
+        qToLittleEndian<quint16>(e.m_regid, p + 2);
+        p[4] = e.m_codec;
+        p[5] = e.m_type;
+        p[6] = (uchar) e.m_exponent;
+        p[7] = 0;
+        qToLittleEndian<qint64>(e.m_offset, p + 8);
+        qToLittleEndian<quint32>(e.m_block, p + 16);
+        qToLittleEndian<quint32>(e.m_count, p + 20);
+        qToLittleEndian<qint64>(e.m_first, p + 24);
+        qToLittleEndian<qint64>(e.m_last, p + 32);
+        qToLittleEndian<quint32>((quint32) e.m_min, p + 40);
+        qToLittleEndian<quint32>((quint32) e.m_max, p + 44);
+        p += ENTRY_SIZE;
+    }
+    for (QHash<quint32, qint64>::const_iterator it = m_rollupStarts.constBegin(); it != m_rollupStarts.constEnd(); ++it) {
+        uchar item[12];
+        qToLittleEndian<quint32>(it.key(), item);
+        qToLittleEndian<qint64>(it.value(), item + 4);
+        body.append((const char*) item, sizeof(item));
+    }
+    foreach (const TRollupEntry& e, m_rollups) {
+        uchar item[ROLLUP_ENTRY_SIZE] = {};
+        qToLittleEndian<quint16>(e.m_device, item);
+        qToLittleEndian<quint16>(e.m_regid, item + 2);
+        item[4] = e.m_level;
+        qToLittleEndian<qint64>(e.m_offset, item + 8);
+        qToLittleEndian<quint32>(e.m_count, item + 16);
+        qToLittleEndian<qint64>(e.m_first, item + 20);
+        qToLittleEndian<qint64>(e.m_last, item + 28);
+        body.append((const char*) item, sizeof(item));
+    }
+
+    uchar header[HEADER_SIZE] = {};
+    qToLittleEndian<quint32>(INDEX_MAGIC, header);
+    qToLittleEndian<quint16>(INDEX_VERSION, header + 4);
+    qToLittleEndian<quint16>(HEADER_SIZE, header + 6);
+    qToLittleEndian<quint32>(CSVeRecorder::crc32(body.constData(), body.size()), header + 8);
+    qToLittleEndian<qint64>(m_segmentSize, header + 12);
+    qToLittleEndian<qint64>(m_wallBase, header + 20);
+    qToLittleEndian<quint32>(m_devices.count(), header + 28);
+    qToLittleEndian<quint32>(m_entries.count(), header + 32);
+    qToLittleEndian<quint32>(m_rollupStarts.count(), header + 36);
+    qToLittleEndian<quint32>(m_rollups.count(), header + 40);
+
+    /* readers never see a half written index */
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write((const char*) header, HEADER_SIZE);
+    file.write(body);
+    return file.commit();
+}
+
+void CSVeSeriesIndex::clear()
+{
+    m_devices.clear();
+    m_wallBase = 0;
+    m_segmentSize = 0;
+    m_first = 0;
+    m_last = 0;
+    m_entries.clear();
+    m_series.clear();
+    m_rollupStarts.clear();
+    m_rollups.clear();
+    m_rollupSeries.clear();
+}
+
+const QStringList& CSVeSeriesIndex::devices() const
+{
+    return m_devices;
+}
+
+qint64 CSVeSeriesIndex::wallBase() const
+{
+    return m_wallBase;
+}
+
+qint64 CSVeSeriesIndex::segmentSize() const
+{
+    return m_segmentSize;
+}
+
+int CSVeSeriesIndex::count() const
+{
+    return m_entries.count();
+}
+
+const QVector<CSVeSeriesIndex::TEntry>& CSVeSeriesIndex::entries() const
+{
+    return m_entries;
+}
+
+qint64 CSVeSeriesIndex::first() const
+{
+    return m_first;
+}
+
+qint64 CSVeSeriesIndex::last() const
+{
+    return m_last;
+}
+
+const QHash<quint32, qint64>& CSVeSeriesIndex::rollupStarts() const
+{
+    return m_rollupStarts;
+}
+
+int CSVeSeriesIndex::find(quint16 device, quint16 regid, qint64 from, qint64 to, QVector<TEntry>* entries) const
+{
+    QHash<quint32, QPair<int, int>>::const_iterator it = m_series.constFind(seriesKey(device, regid));
+    if (it == m_series.constEnd() || to <= m_first || from > m_last) {
+        return 0;
+    }
+
+    /* ordered by first time, stop at the first entry behind to */
+    int found = 0;
+    for (int i = it.value().first; i < it.value().second; i++) {
+        const TEntry& e = m_entries.at(i);
+        if (e.m_first >= to) {
+            break;
+        }
+        if (e.m_last >= from) {
+            entries->append(e);
+            found++;
+        }
+    }
+    return found;
+}
+
+int CSVeSeriesIndex::findRollups(quint16 device, quint16 regid, quint8 level, qint64 from, qint64 to, QVector<TRollupEntry>* entries) const
+{
+    QHash<quint64, QPair<int, int>>::const_iterator it = m_rollupSeries.constFind(rollupKey(device, regid, level));
+    if (it == m_rollupSeries.constEnd()) {
+        return 0;
+    }
+
+    /* ordered by first start, partials of late data overlap */
+    int found = 0;
+    for (int i = it.value().first; i < it.value().second; i++) {
+        const TRollupEntry& e = m_rollups.at(i);
+        if (e.m_first >= to) {
+            break;
+        }
+        if (e.m_last >= from) {
+            entries->append(e);
+            found++;
+        }
+    }
+    return found;
+}
+
+bool CSVeSeriesIndex::lastRollup(quint16 device, quint16 regid, quint8 level, qint64 before, TRollupEntry* entry) const
+{
+    QHash<quint64, QPair<int, int>>::const_iterator it = m_rollupSeries.constFind(rollupKey(device, regid, level));
+    if (it == m_rollupSeries.constEnd()) {
+        return false;
+    }
+
+    bool found = false;
+    for (int i = it.value().first; i < it.value().second && m_rollups.at(i).m_first < before; i++) {
+        if (!found || m_rollups.at(i).m_first > entry->m_first) {
+            *entry = m_rollups.at(i);
+            found = true;
+        }
+    }
+    return found;
+}
+
+/* sort and build the series ranges */
+inline void CSVeSeriesIndex::finish()
+{
+    std::sort(m_entries.begin(), m_entries.end(), [](const TEntry& a, const TEntry& b) {
+        if (a.m_device != b.m_device) {
+            return a.m_device < b.m_device;
+        }
+        if (a.m_regid != b.m_regid) {
+            return a.m_regid < b.m_regid;
+        }
+        return a.m_first < b.m_first;
+    });
+
+    m_series.clear();
+    m_first = 0;
+    m_last = 0;
+    for (int i = 0; i < m_entries.count(); i++) {
+        const TEntry& e = m_entries.at(i);
+        const quint32 key = seriesKey(e.m_device, e.m_regid);
+        QHash<quint32, QPair<int, int>>::iterator it = m_series.find(key);
+        if (it == m_series.end()) {
+            m_series.insert(key, qMakePair(i, i + 1));
+        }
+        else {
+            it.value().second = i + 1;
+        }
+        m_first = (i ? qMin(m_first, e.m_first) : e.m_first);
+        m_last = (i ? qMax(m_last, e.m_last) : e.m_last);
+    }
+
+    std::sort(m_rollups.begin(), m_rollups.end(), [](const TRollupEntry& a, const TRollupEntry& b) {
+        if (a.m_device != b.m_device) {
+            return a.m_device < b.m_device;
+        }
+        if (a.m_regid != b.m_regid) {
+            return a.m_regid < b.m_regid;
+        }
+        if (a.m_level != b.m_level) {
+            return a.m_level < b.m_level;
+        }
+        return a.m_first < b.m_first;
+    });
+
+    m_rollupSeries.clear();
+    for (int i = 0; i < m_rollups.count(); i++) {
+        const TRollupEntry& e = m_rollups.at(i);
+        const quint64 key = rollupKey(e.m_device, e.m_regid, e.m_level);
+        QHash<quint64, QPair<int, int>>::iterator it = m_rollupSeries.find(key);
+        if (it == m_rollupSeries.end()) {
+            m_rollupSeries.insert(key, qMakePair(i, i + 1));
+        }
+        else {
+            it.value().second = i + 1;
+        }
+    }
+}
+
+/* one entry per run of a series with the same type and
+ * exponent, from its first record on */
+inline void CSVeSeriesIndex::addPlain(qint64 offset, const uchar* payload, quint32 count)
+{
+    QHash<quint32, int> series;
+    CSVeRecordReader::TRecord r;
+    for (quint32 i = 0; i < count; i++, payload += CSVeRecorder::RECORD_SIZE) {
+        CSVeRecordReader::decode(payload, &r);
+        const quint32 key = seriesKey(r.m_device, r.m_regid);
+        QHash<quint32, int>::const_iterator it = series.constFind(key);
+        if (it == series.constEnd() || m_entries.at(it.value()).m_type != r.m_type || //
+            m_entries.at(it.value()).m_exponent != r.m_exponent) {
+            series.insert(key, m_entries.count());
+            m_entries.append({r.m_device, r.m_regid, CSVeRecorder::CodecPlain, r.m_type, r.m_exponent, offset, i, 1, r.m_time, r.m_time, r.m_raw, r.m_raw});
+            continue;
+        }
+
+        TEntry& e = m_entries[it.value()];
+        e.m_count++;
+        e.m_first = qMin(e.m_first, r.m_time);
+        e.m_last = qMax(e.m_last, r.m_time);
+        e.m_min = qMin(e.m_min, r.m_raw);
+        e.m_max = qMax(e.m_max, r.m_raw);
+    }
+}
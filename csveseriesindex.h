@@ -0,0 +1,166 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QHash>
+#include <QPair>
+#include <QStringList>
+#include <QVector>
+
+class CSVeRecordReader;
+
+/**
+ * @brief Sparse block index of a recorder segment
+ *
+ * One entry per device register and record batch: batch offset,
+ * block number, sample count, first and last time and min/max of
+ * the raw values. CodecGorilla batches give these from their block
+ * directory, plain batches are scanned once into one entry per
+ * run of a register with the same type and exponent. Rollup batches
+ * get one entry per device register and level with the range of
+ * bucket starts, so a rollup query reads only the batches of its
+ * series, and the oldest bucket start per level and register is
+ * kept for retention.
+ *
+ * The index is kept next to its segment ("00000001.vidx") and is
+ * only used while the segment has the size it was built from, a
+ * growing segment is indexed again.
+ *
+ * Sidecar layout, little endian: u32 magic "VIDX", u16 version,
+ * u16 header size, u32 CRC-32 of the rest, i64 segment size, i64
+ * wall base, u32 devices, u32 entries, u32 rollup starts, u32
+ * rollup entries; devices as u16 size + UTF-8 id; entries of
+ * ENTRY_SIZE; rollup starts as u32 key + i64 start; rollup entries
+ * of ROLLUP_ENTRY_SIZE.
+ */
+class CSVeSeriesIndex
+{
+public:
+    static const quint32 INDEX_MAGIC = 0x58444956; // VIDX
+    static const quint16 INDEX_VERSION = 4;
+    static const int HEADER_SIZE = 44;
+    /* u16 device, u16 regid, u8 codec, u8 type, i8 exponent,
+     * u8 reserved, i64 batch offset, u32 block, u32 count,
+     * i64 first, i64 last, i32 min, i32 max */
+    static const int ENTRY_SIZE = 48;
+    /* u16 device, u16 regid, u8 level, u8 reserved[3], i64 batch
+     * offset, u32 count, i64 first start, i64 last start */
+    static const int ROLLUP_ENTRY_SIZE = 36;
+
+    typedef struct {
+        quint16 m_device;
+        quint16 m_regid;
+        quint8 m_codec;
+        quint8 m_type;
+        qint8 m_exponent;
+        qint64 m_offset;
+        /* CodecGorilla block, CodecPlain first record of the run */
+        quint32 m_block;
+        quint32 m_count;
+        /* monotonic ms of the segment */
+        qint64 m_first;
+        qint64 m_last;
+        qint64 m_min;
+        qint64 m_max;
+    } TEntry;
+
+    typedef struct {
+        quint16 m_device;
+        quint16 m_regid;
+        quint8 m_level;
+        qint64 m_offset;
+        quint32 m_count;
+        /* bucket starts, wall clock ms */
+        qint64 m_first;
+        qint64 m_last;
+    } TRollupEntry;
+
+    CSVeSeriesIndex();
+
+    static QString indexName(const QString& segment);
+
+    /**
+     * @brief build Index an open segment
+     * @param reader Rewound afterwards
+     * @return false if the segment has a torn tail, the index
+     * covers the intact part
+     */
+    bool build(CSVeRecordReader* reader);
+    /**
+     * @brief load Read a sidecar
+     * @param fileName
+     * @param segmentSize Current size of the segment
+     * @return false if missing, damaged or built from another size
+     */
+    bool load(const QString& fileName, qint64 segmentSize);
+    bool save(const QString& fileName) const;
+    void clear();
+
+    const QStringList& devices() const;
+    qint64 wallBase() const;
+    qint64 segmentSize() const;
+    int count() const;
+    /* ordered by device, regid and first time */
+    const QVector<TEntry>& entries() const;
+    /* time range of all entries, monotonic ms */
+    qint64 first() const;
+    qint64 last() const;
+    /**
+     * @brief rollupStarts Oldest rollup bucket start, wall clock ms,
+     * by level << 16 | regid
+     */
+    const QHash<quint32, qint64>& rollupStarts() const;
+
+    /**
+     * @brief find Entries of a device register overlapping a time
+     * range, ordered by first time
+     * @param device Device index of this segment
+     * @param regid
+     * @param from Monotonic ms, inclusive
+     * @param to Monotonic ms, exclusive
+     * @param entries Appended to
+     * @return Number of entries found
+     */
+    int find(quint16 device, quint16 regid, qint64 from, qint64 to, QVector<TEntry>* entries) const;
+    /**
+     * @brief findRollups Rollup batches of a device register and
+     * level with bucket starts in a range, ordered by first start
+     * @param device Device index of this segment
+     * @param regid
+     * @param level
+     * @param from Wall clock ms, inclusive
+     * @param to Wall clock ms, exclusive
+     * @param entries Appended to
+     * @return Number of entries found
+     */
+    int findRollups(quint16 device, quint16 regid, quint8 level, qint64 from, qint64 to, QVector<TRollupEntry>* entries) const;
+    /**
+     * @brief lastRollup Newest rollup batch of a device register and
+     * level with a bucket start before a time
+     * @return false if none
+     */
+    bool lastRollup(quint16 device, quint16 regid, quint8 level, qint64 before, TRollupEntry* entry) const;
+
+private:
+    QStringList m_devices;
+    qint64 m_wallBase;
+    qint64 m_segmentSize;
+    qint64 m_first;
+    qint64 m_last;
+    /* ordered by device, regid and first time */
+    QVector<TEntry> m_entries;
+    /* entry range by device << 16 | regid */
+    QHash<quint32, QPair<int, int>> m_series;
+    QHash<quint32, qint64> m_rollupStarts;
+    /* ordered by device, regid, level and first start */
+    QVector<TRollupEntry> m_rollups;
+    /* rollup entry range by device << 24 | regid << 8 | level */
+    QHash<quint64, QPair<int, int>> m_rollupSeries;
+
+private:
+    inline void finish();
+    inline void addPlain(qint64 offset, const uchar* payload, quint32 count);
+};
@@ -0,0 +1,393 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <csvedirectacdccharger.h>
+#include <csvesettingsbackup.h>
+
+/* settings snapshot file header */
+static const quint32 BACKUP_MAGIC = 0x5645424B; // VEBK
+static const quint16 BACKUP_VERSION = 1;
+
+/* written first and one by one, other settings depend on them */
+static const quint16 ORDERED_REGISTERS[] = {
+   0xEDEA, /* VE_REG_BAT_VOLTAGE */
+   0xEDF1, /* VE_REG_BAT_TYPE (charge preset) */
+};
+
+CSVeSettingsBackup::CSVeSettingsBackup(CSVeDirectAcDcCharger* charger, QObject* parent)
+    : QObject(parent)
+    , m_charger(charger)
+    , m_state(StIdle)
+    , m_fileName()
+    , m_timer(this)
+    , m_payloads()
+    , m_ordered()
+    , m_index()
+    , m_results()
+    , m_verify()
+{
+    m_timer.setSingleShot(true);
+    m_timer.setInterval(PROGRESS_TIMEOUT);
+
+    connect(&m_timer, &QTimer::timeout, this, [this]() {
+        for (int i = 0; i < m_results.count(); i++) {
+            if (m_results[i].m_result == ResPending) {
+                setResult(m_results[i].m_regid, ResTimeout);
+            }
+        }
+        done();
+    });
+    connect(m_charger, &CSVeDirectAcDcCharger::hexFrameReceived, this, &CSVeSettingsBackup::onHexFrame);
+}
+
+bool CSVeSettingsBackup::backup(const QString& fileName)
+{
+    if (isBusy()) {
+        return false;
+    }
+
+    m_fileName = fileName;
+    m_payloads.clear();
+    m_ordered.clear();
+    m_index.clear();
+    m_results.clear();
+    m_verify.clear();
+    m_state = StBackup;
+
+    foreach (quint16 regid, CSVeDirectAcDcCharger::settingsRegisters()) {
+        m_index[regid] = m_results.count();
+        m_results.append({regid, ResPending, 0, QByteArray()});
+        if (!m_charger->scheduler()->isSupported(regid)) {
+            setResult(regid, ResSkipped);
+            continue;
+        }
+        sendGet(regid);
+    }
+
+    m_timer.start();
+    checkDone();
+    return true;
+}
+
+bool CSVeSettingsBackup::restore(const QString& fileName, bool force)
+{
+    if (isBusy()) {
+        return false;
+    }
+
+    QString pid;
+    QMap<quint16, QByteArray> payloads;
+    if (!readFile(fileName, &pid, &payloads)) {
+        qWarning("[VE.CHR] RESTORE invalid settings file: %s", qPrintable(fileName));
+        return false;
+    }
+
+    const QString devicePid = m_charger->store().text(0x0001);
+    if (!force && !devicePid.isEmpty() && pid != devicePid) {
+        qWarning("[VE.CHR] RESTORE product id mismatch: file=%s device=%s", //
+                 qPrintable(pid),
+                 qPrintable(devicePid));
+        return false;
+    }
+
+    m_fileName = fileName;
+    m_payloads = payloads;
+    m_ordered.clear();
+    m_index.clear();
+    m_results.clear();
+    m_verify.clear();
+
+    QMap<quint16, QByteArray>::const_iterator it;
+    for (it = m_payloads.constBegin(); it != m_payloads.constEnd(); it++) {
+        m_index[it.key()] = m_results.count();
+        m_results.append({it.key(), ResPending, 0, it.value()});
+    }
+    for (uint i = 0; i < sizeof(ORDERED_REGISTERS) / sizeof(quint16); i++) {
+        if (m_payloads.contains(ORDERED_REGISTERS[i])) {
+            m_ordered.append(ORDERED_REGISTERS[i]);
+        }
+    }
+
+    m_state = StRestoreOrdered;
+    m_timer.start();
+    restoreNextOrdered();
+    return true;
+}
+
+void CSVeSettingsBackup::abort()
+{
+    if (!isBusy()) {
+        return;
+    }
+    for (int i = 0; i < m_results.count(); i++) {
+        if (m_results[i].m_result == ResPending) {
+            m_results[i].m_result = ResSkipped;
+        }
+    }
+    done();
+}
+
+bool CSVeSettingsBackup::isBusy() const
+{
+    return m_state != StIdle;
+}
+
+const QList<CSVeSettingsBackup::TResult>& CSVeSettingsBackup::results() const
+{
+    return m_results;
+}
+
+QString CSVeSettingsBackup::resultText(quint8 result)
+{
+    switch (result) {
+        case ResPending:
+            return tr("pending");
+        case ResOk:
+            return tr("ok");
+        case ResRejected:
+            return tr("rejected");
+        case ResMismatch:
+            return tr("read-back mismatch");
+        case ResTimeout:
+            return tr("timeout");
+        case ResSkipped:
+            return tr("skipped");
+    }
+    return tr("unknown");
+}
+
+void CSVeSettingsBackup::onHexFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    if (m_state == StIdle || !m_index.contains(frame.regid)) {
+        return;
+    }
+    if (m_results[m_index[frame.regid]].m_result != ResPending) {
+        return;
+    }
+
+    const CSVEDirect::ved_t* ved = &frame.ve_in;
+    const QByteArray payload((const char*) ved->data + 4, (ved->size > 4 ? ved->size - 4 : 0));
+
+    m_timer.start();
+
+    switch (m_state) {
+        case StBackup: {
+            if (frame.command != VED_CMD_GET) {
+                return;
+            }
+            if (frame.flags & (VED_FLAG_UNK_ID | VED_FLAG_NOT_SUPPORTED)) {
+                setResult(frame.regid, ResSkipped, frame.flags);
+            }
+            else if (frame.flags) {
+                setResult(frame.regid, ResRejected, frame.flags);
+            }
+            else {
+                m_payloads[frame.regid] = payload;
+                m_results[m_index[frame.regid]].m_payload = payload;
+                setResult(frame.regid, ResOk);
+            }
+            break;
+        }
+        case StRestoreOrdered:
+        case StRestore: {
+            /* write acknowledge, verify by read-back */
+            if (frame.command == VED_CMD_SET && !m_verify.contains(frame.regid)) {
+                if (frame.flags) {
+                    setResult(frame.regid, ResRejected, frame.flags);
+                }
+                else {
+                    m_verify.insert(frame.regid);
+                    sendGet(frame.regid);
+                }
+            }
+            /* read-back */
+            else if (frame.command == VED_CMD_GET && m_verify.contains(frame.regid)) {
+                m_verify.remove(frame.regid);
+                if (frame.flags) {
+                    setResult(frame.regid, ResRejected, frame.flags);
+                }
+                else if (payload != m_payloads.value(frame.regid)) {
+                    setResult(frame.regid, ResMismatch);
+                }
+                else {
+                    setResult(frame.regid, ResOk);
+                }
+            }
+            else {
+                return;
+            }
+            if (m_state == StRestoreOrdered && m_results[m_index[frame.regid]].m_result != ResPending) {
+                restoreNextOrdered();
+                return;
+            }
+            break;
+        }
+        default: {
+            return;
+        }
+    }
+
+    checkDone();
+}
+
+inline void CSVeSettingsBackup::sendGet(quint16 regid)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_GET);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, 0);
+    m_charger->sendFrame(ved, CSVeScheduler::PrioHigh);
+}
+
+inline void CSVeSettingsBackup::sendSet(quint16 regid, const QByteArray& payload)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, VED_CMD_SET);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, 0);
+    for (int i = 0; i < payload.count(); i++) {
+        CSVEDirect::addU8(&ved, (quint8) payload.at(i));
+    }
+    m_charger->sendFrame(ved, CSVeScheduler::PrioHigh);
+}
+
+inline void CSVeSettingsBackup::setResult(quint16 regid, quint8 result, quint8 flags)
+{
+    if (!m_index.contains(regid)) {
+        return;
+    }
+
+    TResult& r = m_results[m_index[regid]];
+    r.m_result = result;
+    r.m_flags = flags;
+
+    qDebug("[VE.CHR] %s regid: 0x%04X %s", //
+           (m_state == StBackup ? "BACKUP" : "RESTORE"),
+           regid,
+           qPrintable(resultText(result)));
+
+    emit registerResult(regid, result);
+}
+
+/* dependency registers one by one, then all others pipelined */
+inline void CSVeSettingsBackup::restoreNextOrdered()
+{
+    if (!m_ordered.isEmpty()) {
+        quint16 regid = m_ordered.takeFirst();
+        sendSet(regid, m_payloads[regid]);
+        return;
+    }
+
+    m_state = StRestore;
+
+    QMap<quint16, QByteArray>::const_iterator it;
+    for (it = m_payloads.constBegin(); it != m_payloads.constEnd(); it++) {
+        if (m_results[m_index[it.key()]].m_result == ResPending) {
+            sendSet(it.key(), it.value());
+        }
+    }
+
+    checkDone();
+}
+
+inline void CSVeSettingsBackup::checkDone()
+{
+    if (m_state == StIdle) {
+        return;
+    }
+    foreach (const TResult& r, m_results) {
+        if (r.m_result == ResPending) {
+            return;
+        }
+    }
+    done();
+}
+
+inline void CSVeSettingsBackup::done()
+{
+    const TState state = m_state;
+    m_timer.stop();
+    m_state = StIdle;
+
+    bool success = true;
+    foreach (const TResult& r, m_results) {
+        if (r.m_result != ResOk && r.m_result != ResSkipped) {
+            success = false;
+        }
+    }
+
+    if (state == StBackup && !m_payloads.isEmpty()) {
+        if (!writeFile()) {
+            qWarning("[VE.CHR] BACKUP unable to write: %s", qPrintable(m_fileName));
+            success = false;
+        }
+    }
+
+    emit finished(success);
+}
+
+inline bool CSVeSettingsBackup::writeFile() const
+{
+    const CSVeRegisterStore& store = m_charger->store();
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+    ds << BACKUP_MAGIC << BACKUP_VERSION;
+    ds << store.text(0x0001);
+    ds << store.text(0x0002);
+    ds << store.text(0x0003);
+    ds << QDateTime::currentMSecsSinceEpoch();
+    ds << (quint32) m_payloads.count();
+
+    QMap<quint16, QByteArray>::const_iterator it;
+    for (it = m_payloads.constBegin(); it != m_payloads.constEnd(); it++) {
+        ds << it.key() << it.value();
+    }
+
+    return file.commit();
+}
+
+inline bool CSVeSettingsBackup::readFile(const QString& fileName, QString* pid, QMap<quint16, QByteArray>* payloads) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    QString firmware, serial;
+    qint64 created = 0;
+    quint32 count = 0;
+
+    ds >> magic >> version;
+    if (magic != BACKUP_MAGIC || version != BACKUP_VERSION) {
+        return false;
+    }
+
+    ds >> (*pid) >> firmware >> serial >> created >> count;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        quint16 regid = 0;
+        QByteArray payload;
+        ds >> regid >> payload;
+        (*payloads)[regid] = payload;
+    }
+
+    return (ds.status() == QDataStream::Ok);
+}
@@ -0,0 +1,114 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+#include <csvedirect.h>
+
+class CSVeDirectAcDcCharger;
+
+/**
+ * @brief Bulk settings backup and restore
+ *
+ * Backup reads all settings registers of a charger in one
+ * pipelined batch and writes the raw register payloads into a
+ * versioned snapshot file. Restore writes them back pipelined,
+ * dependency registers (battery voltage, charge preset) first,
+ * and verifies every register by reading it back.
+ */
+class CSVeSettingsBackup: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* no progress timeout in milliseconds */
+    static const int PROGRESS_TIMEOUT = 3000;
+
+    typedef enum {
+        StIdle = 0,
+        StBackup,
+        StRestoreOrdered,
+        StRestore,
+    } TState;
+
+    typedef enum {
+        ResPending = 0,
+        ResOk,
+        ResRejected,
+        ResMismatch,
+        ResTimeout,
+        ResSkipped,
+    } TResultCode;
+
+    typedef struct {
+        quint16 m_regid;
+        quint8 m_result;
+        quint8 m_flags;
+        QByteArray m_payload;
+    } TResult;
+
+    /**
+     * @brief CSVeSettingsBackup
+     * @param charger
+     * @param parent
+     */
+    explicit CSVeSettingsBackup(CSVeDirectAcDcCharger* charger, QObject* parent = nullptr);
+
+    /**
+     * @brief backup Read all settings into snapshot file
+     * @param fileName
+     * @return false if busy
+     */
+    bool backup(const QString& fileName);
+    /**
+     * @brief restore Write settings of snapshot file
+     * @param fileName
+     * @param force Allow restore to a different product id
+     * @return false if busy or file invalid
+     */
+    bool restore(const QString& fileName, bool force = false);
+    /**
+     * @brief abort Cancel running operation
+     */
+    void abort();
+
+    bool isBusy() const;
+    const QList<TResult>& results() const;
+    static QString resultText(quint8 result);
+
+signals:
+    void registerResult(quint16 regid, quint8 result);
+    void finished(bool success);
+
+private slots:
+    void onHexFrame(const CSVeParser::TVeHexFrame& frame);
+
+private:
+    CSVeDirectAcDcCharger* m_charger;
+    TState m_state;
+    QString m_fileName;
+    QTimer m_timer;
+    QMap<quint16, QByteArray> m_payloads;
+    QList<quint16> m_ordered;
+    QMap<quint16, int> m_index;
+    QList<TResult> m_results;
+    QSet<quint16> m_verify;
+
+private:
+    inline void sendGet(quint16 regid);
+    inline void sendSet(quint16 regid, const QByteArray& payload);
+    inline void setResult(quint16 regid, quint8 result, quint8 flags = 0);
+    inline void restoreNextOrdered();
+    inline void checkDone();
+    inline void done();
+    inline bool writeFile() const;
+    inline bool readFile(const QString& fileName, QString* pid, QMap<quint16, QByteArray>* payloads) const;
+};
@@ -0,0 +1,177 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <climits>
+#include <csvesnapshot.h>
+
+/* snapshot file header */
+static const quint32 SNAPSHOT_MAGIC = 0x5645534E; // VESN
+static const quint16 SNAPSHOT_VERSION = 1;
+
+/* value type tags */
+#define SNAP_TYPE_DOUBLE 0
+#define SNAP_TYPE_INT    1
+#define SNAP_TYPE_UINT   2
+#define SNAP_TYPE_STRING 3
+#define SNAP_TYPE_BYTES  4
+
+QString CSVeSnapshot::location()
+{
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    return QDir(path).filePath("snapshots");
+}
+
+QString CSVeSnapshot::fileName(const QString& serial)
+{
+    static const QRegularExpression invalid("[^A-Za-z0-9]");
+
+    QString name = serial;
+    return QDir(location()).filePath(name.remove(invalid) + ".snap");
+}
+
+bool CSVeSnapshot::save(const QString& serial, const TValues& values)
+{
+    if (serial.isEmpty() || !QDir().mkpath(location())) {
+        return false;
+    }
+
+    QSaveFile file(fileName(serial));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+    ds << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << (quint32) values.count();
+
+    TValues::const_iterator it;
+    for (it = values.constBegin(); it != values.constEnd(); it++) {
+        const QVariant& value = it.value().second;
+        ds << it.key() << it.value().first;
+        switch (value.type()) {
+            case QVariant::Int:
+            case QVariant::LongLong: {
+                ds << (quint8) SNAP_TYPE_INT << (qint64) value.toLongLong();
+                break;
+            }
+            case QVariant::UInt:
+            case QVariant::ULongLong: {
+                ds << (quint8) SNAP_TYPE_UINT << (quint64) value.toULongLong();
+                break;
+            }
+            case QVariant::String: {
+                ds << (quint8) SNAP_TYPE_STRING << value.toString().toUtf8();
+                break;
+            }
+            case QVariant::ByteArray: {
+                ds << (quint8) SNAP_TYPE_BYTES << value.toByteArray();
+                break;
+            }
+            default: {
+                ds << (quint8) SNAP_TYPE_DOUBLE << value.toDouble();
+                break;
+            }
+        }
+    }
+
+    return file.commit();
+}
+
+bool CSVeSnapshot::load(const QString& serial, TValues* values)
+{
+    if (serial.isEmpty() || !values) {
+        return false;
+    }
+
+    QFile file(fileName(serial));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream ds(&file);
+    ds.setByteOrder(QDataStream::LittleEndian);
+
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 count = 0;
+    ds >> magic >> version >> count;
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    TValues result;
+    for (quint32 i = 0; i < count && ds.status() == QDataStream::Ok; i++) {
+        quint16 regid = 0;
+        float scale = 1.0f;
+        quint8 type = 0;
+        ds >> regid >> scale >> type;
+
+        QVariant value;
+        switch (type) {
+            case SNAP_TYPE_INT: {
+                qint64 v = 0;
+                ds >> v;
+                value = (v >= INT_MIN && v <= INT_MAX ? QVariant((int) v) : QVariant(v));
+                break;
+            }
+            case SNAP_TYPE_UINT: {
+                quint64 v = 0;
+                ds >> v;
+                value = (v <= UINT_MAX ? QVariant((uint) v) : QVariant(v));
+                break;
+            }
+            case SNAP_TYPE_STRING: {
+                QByteArray v;
+                ds >> v;
+                value = QString::fromUtf8(v);
+                break;
+            }
+            case SNAP_TYPE_BYTES: {
+                QByteArray v;
+                ds >> v;
+                value = v;
+                break;
+            }
+            default: {
+                double v = 0.0;
+                ds >> v;
+                value = v;
+                break;
+            }
+        }
+        result[regid] = QPair<float, QVariant>(scale, value);
+    }
+
+    if (ds.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    (*values) = result;
+    return true;
+}
+
+QString CSVeSnapshot::lastSerial(const QString& portName)
+{
+    QSettings settings(QDir(location()).filePath("ports.ini"), QSettings::IniFormat);
+    return settings.value("ports/" + QString(portName).replace('/', '_')).toString();
+}
+
+void CSVeSnapshot::setLastSerial(const QString& portName, const QString& serial)
+{
+    if (!QDir().mkpath(location())) {
+        return;
+    }
+
+    QSettings settings(QDir(location()).filePath("ports.ini"), QSettings::IniFormat);
+    settings.setValue("ports/" + QString(portName).replace('/', '_'), serial);
+}
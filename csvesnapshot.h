@@ -0,0 +1,56 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QVariant>
+
+/**
+ * @brief Persisted register snapshot of a device
+ *
+ * Last known register values stored per device serial number
+ * (VE.Text SER#) in a compact binary file. Used to fill the
+ * register table immediately after connect (warm start).
+ */
+class CSVeSnapshot
+{
+public:
+    typedef QMap<quint16, QPair<float, QVariant>> TValues;
+
+    /**
+     * @brief fileName
+     * @param serial Device serial number
+     * @return Snapshot file of the device
+     */
+    static QString fileName(const QString& serial);
+    /**
+     * @brief save Write register values of device
+     * @param serial
+     * @param values
+     * @return
+     */
+    static bool save(const QString& serial, const TValues& values);
+    /**
+     * @brief load Read register values of device
+     * @param serial
+     * @param values
+     * @return false if no valid snapshot exists
+     */
+    static bool load(const QString& serial, TValues* values);
+    /**
+     * @brief lastSerial Serial number of the device seen last
+     * on the serial port.
+     * @param portName
+     * @return
+     */
+    static QString lastSerial(const QString& portName);
+    static void setLastSerial(const QString& portName, const QString& serial);
+
+private:
+    static QString location();
+};
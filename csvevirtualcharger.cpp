@@ -0,0 +1,481 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QDebug>
+#include <csvevirtualcharger.h>
+
+/* VE_REG_DEVICE_STATE, worst first: fault, off, low power,
+ * bulk, absorption, recondition, float, storage, supply */
+static const quint8 STATE_RANK[] = {2, 0, 1, 3, 4, 7, 5, 6, 11};
+
+CSVeVirtualCharger::CSVeVirtualCharger(QObject* parent)
+    : QObject(parent)
+    , m_port(this)
+    , m_parser(this)
+    , m_timer(this)
+    , m_serial()
+    , m_members()
+    , m_sumCurrent(0)
+    , m_sumVoltage(0)
+    , m_voltages(0)
+    , m_states()
+    , m_errors()
+    , m_sets()
+    , m_setSerial(0)
+{
+    m_timer.setInterval(TEXT_INTERVAL);
+    connect(&m_timer, &QTimer::timeout, this, &CSVeVirtualCharger::sendTextBlock);
+    connect(&m_parser, &CSVeParser::vedHexFrame, this, &CSVeVirtualCharger::onCerboFrame);
+    connect(&m_port, &QSerialPort::readyRead, this, [this]() {
+        const QByteArray data = m_port.readAll();
+        for (int i = 0; i < data.count(); i++) {
+            m_parser.handle(data.at(i));
+        }
+    });
+}
+
+void CSVeVirtualCharger::addCharger(CSVeDirectAcDcCharger* charger)
+{
+    if (indexOf(charger) >= 0) {
+        return;
+    }
+
+    TMember m = {};
+    m.m_charger = charger;
+    m.m_connections << connect(charger, &CSVeDirectAcDcCharger::dataChanged, this, [this, charger](uint regid, const QPair<float, QVariant>& value) {
+        onDataChanged(charger, regid, value);
+    });
+    m.m_connections << connect(charger, &CSVeDirectAcDcCharger::hexFrameReceived, this, [this, charger](const CSVeParser::TVeHexFrame& frame) {
+        onMemberFrame(charger, frame);
+    });
+    m.m_connections << connect(charger, &QObject::destroyed, this, &CSVeVirtualCharger::removeCharger);
+
+    /* off until the first state update */
+    addMember(m, 1);
+    m_members.append(m);
+
+    /* current values */
+    foreach (const CSVeRegisterStore::TSlot& slot, charger->store().view()) {
+        if (slot.m_type != CSVeRegisterStore::TypeNone) {
+            onDataChanged(charger, slot.m_regid, CSVeRegisterStore::toPair(slot));
+        }
+    }
+}
+
+void CSVeVirtualCharger::removeCharger(QObject* charger)
+{
+    const int i = indexOf(charger);
+    if (i < 0) {
+        return;
+    }
+
+    foreach (const QMetaObject::Connection& c, m_members[i].m_connections) {
+        disconnect(c);
+    }
+    addMember(m_members[i], -1);
+    m_members.removeAt(i);
+
+    /* gone before it answered, the SET did not apply */
+    for (int k = m_sets.count() - 1; k >= 0; k--) {
+        if (m_sets[k].m_waiting.removeAll((CSVeDirectAcDcCharger*) charger)) {
+            m_sets[k].m_flags |= VED_FLAG_PARAM_ERROR;
+            if (m_sets[k].m_waiting.isEmpty()) {
+                finishSet(k, 0);
+            }
+        }
+    }
+}
+
+int CSVeVirtualCharger::chargerCount() const
+{
+    return m_members.count();
+}
+
+bool CSVeVirtualCharger::open(const CSVeDirectAcDcCharger::TVedConfig& config)
+{
+    if (m_port.isOpen()) {
+        return true;
+    }
+
+    m_port.setPortName(config.m_portName);
+    m_port.setBaudRate(config.m_baudRate);
+    m_port.setDataBits(config.m_dataBits);
+    m_port.setStopBits(config.m_stopBits);
+    m_port.setFlowControl(config.m_flow);
+    m_port.setParity(config.m_parity);
+
+    if (!m_port.open(QSerialPort::ReadWrite)) {
+        return false;
+    }
+
+    m_timer.start();
+    return true;
+}
+
+void CSVeVirtualCharger::close()
+{
+    m_timer.stop();
+    if (m_port.isOpen()) {
+        m_port.close();
+    }
+}
+
+bool CSVeVirtualCharger::isOpen() const
+{
+    return m_port.isOpen();
+}
+
+void CSVeVirtualCharger::setSerial(const QString& serial)
+{
+    m_serial = serial;
+}
+
+qint64 CSVeVirtualCharger::current() const
+{
+    return m_sumCurrent;
+}
+
+qint64 CSVeVirtualCharger::voltage() const
+{
+    return (m_voltages ? m_sumVoltage / m_voltages : 0);
+}
+
+quint8 CSVeVirtualCharger::state() const
+{
+    for (uint i = 0; i < sizeof(STATE_RANK); i++) {
+        if (m_states[STATE_RANK[i]] > 0) {
+            return STATE_RANK[i];
+        }
+    }
+    /* other states, lowest code */
+    for (int i = 0; i < 256; i++) {
+        if (m_states[i] > 0) {
+            return (quint8) i;
+        }
+    }
+    return 0;
+}
+
+quint8 CSVeVirtualCharger::error() const
+{
+    for (int i = 1; i < 256; i++) {
+        if (m_errors[i] > 0) {
+            return (quint8) i;
+        }
+    }
+    return 0;
+}
+
+/* replace the old contribution of the charger, constant work */
+void CSVeVirtualCharger::onDataChanged(CSVeDirectAcDcCharger* charger, uint regid, const QPair<float, QVariant>& value)
+{
+    const int i = indexOf(charger);
+    if (i < 0 || !value.second.isValid()) {
+        return;
+    }
+
+    TMember& m = m_members[i];
+    const double physical = value.second.toDouble() * value.first;
+
+    switch (regid) {
+        /* current, 0.1A */
+        case 0xED8F: {
+            const qint64 current = qRound64(physical * 1000.0);
+            m_sumCurrent += current - m.m_current;
+            m.m_current = current;
+            break;
+        }
+        /* voltage, 0.01V */
+        case 0xED8D: {
+            const qint64 voltage = qRound64(physical * 1000.0);
+            if (!m.m_hasVoltage) {
+                m.m_hasVoltage = true;
+                m_voltages++;
+                m.m_voltage = 0;
+            }
+            m_sumVoltage += voltage - m.m_voltage;
+            m.m_voltage = voltage;
+            break;
+        }
+        case 0x0201: {
+            const quint8 state = (quint8) value.second.toUInt();
+            m_states[m.m_state]--;
+            m_states[state]++;
+            m.m_state = state;
+            break;
+        }
+        /* VE.Text ERR or link error code */
+        case 0x2009: {
+            const quint8 error = (quint8) value.second.toUInt();
+            m_errors[m.m_error]--;
+            m_errors[error]++;
+            m.m_error = error;
+            break;
+        }
+    }
+}
+
+void CSVeVirtualCharger::onCerboFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    CSVeDirectAcDcCharger* chr = primary();
+    CSVEDirect::ved_t ved = frame.ve_out;
+
+    switch (frame.command) {
+        case VED_CMD_PING: {
+            QByteArray response;
+            if (chr && chr->proxyCache()->lookup(VED_CMD_PING, 0, &response)) {
+                m_port.write(response);
+                return;
+            }
+            if (chr) {
+                chr->sendPing();
+            }
+            return;
+        }
+        case VED_CMD_GET: {
+            if (answerAggregate(frame.regid, &ved)) {
+                sendResponse(&ved);
+                return;
+            }
+            /* not aggregated, from the primary charger */
+            QByteArray response;
+            if (chr && chr->proxyCache()->lookup(VED_CMD_GET, frame.regid, &response)) {
+                m_port.write(response);
+                return;
+            }
+            if (!chr || !chr->scheduler()->isSupported(frame.regid)) {
+                CSVEDirect::setCommand(&ved, VED_RESP_GET);
+                CSVEDirect::setId(&ved, frame.regid);
+                CSVEDirect::setFlags(&ved, VED_FLAG_UNK_ID);
+                sendResponse(&ved);
+                return;
+            }
+            /* refresh for the next request, answer with the last
+             * known value or let the Cerbo GX retry */
+            chr->sendGetRegister(frame.regid, CSVeScheduler::PrioHigh);
+            if (!answerStored(chr, frame.regid, &ved)) {
+                CSVEDirect::setFlags(&ved, VED_FLAG_PARAM_ERROR);
+            }
+            sendResponse(&ved);
+            return;
+        }
+        /* settings apply to all chargers of the bank, answered in
+         * onMemberFrame() or after SET_TIMEOUT */
+        case VED_CMD_SET: {
+            TPendingSet set = {};
+            set.m_serial = ++m_setSerial;
+            set.m_regid = frame.regid;
+            set.m_request = frame.ve_in;
+            foreach (const TMember& m, m_members) {
+                m.m_charger->sendFrame(frame.ve_in, CSVeScheduler::PrioHigh);
+                set.m_waiting.append(m.m_charger);
+            }
+            m_sets.append(set);
+            if (set.m_waiting.isEmpty()) {
+                finishSet(m_sets.count() - 1, VED_FLAG_UNK_ID);
+                return;
+            }
+
+            const quint32 serial = set.m_serial;
+            QTimer::singleShot(SET_TIMEOUT, this, [this, serial]() {
+                for (int i = 0; i < m_sets.count(); i++) {
+                    if (m_sets[i].m_serial == serial) {
+                        /* a charger that did not answer counts as failed */
+                        qWarning("[VE.VRT] SET 0x%04X: %d charger(s) did not answer", //
+                                 m_sets[i].m_regid,
+                                 m_sets[i].m_waiting.count());
+                        finishSet(i, VED_FLAG_PARAM_ERROR);
+                        return;
+                    }
+                }
+            });
+            return;
+        }
+        default: {
+            m_parser.setUnknownCmd(&ved, frame.command);
+            sendResponse(&ved);
+            return;
+        }
+    }
+}
+
+void CSVeVirtualCharger::onMemberFrame(CSVeDirectAcDcCharger* charger, const CSVeParser::TVeHexFrame& frame)
+{
+    if (frame.command != VED_RESP_SET) {
+        return;
+    }
+
+    /* a charger answers its SETs in order, the oldest waiting one */
+    for (int i = 0; i < m_sets.count(); i++) {
+        TPendingSet& set = m_sets[i];
+        if (set.m_regid != frame.regid || !set.m_waiting.contains(charger)) {
+            continue;
+        }
+        set.m_waiting.removeOne(charger);
+        set.m_flags |= frame.flags;
+        if (set.m_waiting.isEmpty()) {
+            finishSet(i, 0);
+        }
+        return;
+    }
+}
+
+void CSVeVirtualCharger::sendTextBlock()
+{
+    if (!m_port.isOpen()) {
+        return;
+    }
+
+    CSVeDirectAcDcCharger* chr = primary();
+    QByteArray pid = "0xA330";
+    QByteArray fwe;
+    QByteArray serial = m_serial.toLatin1();
+    if (chr) {
+        pid = chr->store().bytes(0x0001);
+        fwe = chr->store().bytes(0x0002);
+        if (serial.isEmpty()) {
+            serial = chr->store().bytes(0x0003);
+        }
+    }
+
+    QByteArray block;
+    block += textField("PID", pid);
+    block += textField("FWE", fwe);
+    block += textField("SER#", serial);
+    block += textField("V", QByteArray::number(voltage()));
+    block += textField("I", QByteArray::number(current()));
+    block += textField("ERR", QByteArray::number(error()));
+    block += textField("CS", QByteArray::number(state()));
+    block += "\r\nChecksum\t";
+
+    /* all bytes of the block sum up to 0 */
+    quint8 sum = 0;
+    for (int i = 0; i < block.count(); i++) {
+        sum += (quint8) block.at(i);
+    }
+    block.append((char) (quint8) (256 - sum));
+
+    m_port.write(block);
+}
+
+inline int CSVeVirtualCharger::indexOf(QObject* charger) const
+{
+    for (int i = 0; i < m_members.count(); i++) {
+        if (m_members[i].m_charger == charger) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline void CSVeVirtualCharger::addMember(TMember& m, int sign)
+{
+    m_sumCurrent += sign * m.m_current;
+    if (m.m_hasVoltage) {
+        m_sumVoltage += sign * m.m_voltage;
+        m_voltages += sign;
+    }
+    m_states[m.m_state] += sign;
+    m_errors[m.m_error] += sign;
+}
+
+inline QByteArray CSVeVirtualCharger::textField(const QByteArray& label, const QByteArray& value) const
+{
+    return "\r\n" + label + "\t" + value;
+}
+
+inline void CSVeVirtualCharger::sendResponse(CSVEDirect::ved_t* ved)
+{
+    if (CSVEDirect::enframe(ved) && ved->size) {
+        m_port.write("\n" + QByteArray((char*) ved->data, ved->size));
+    }
+}
+
+/* summed / worst-case values, VE.HEX units */
+inline bool CSVeVirtualCharger::answerAggregate(quint16 regid, CSVEDirect::ved_t* ved) const
+{
+    CSVEDirect::setCommand(ved, VED_RESP_GET);
+    CSVEDirect::setId(ved, regid);
+    CSVEDirect::setFlags(ved, 0);
+
+    switch (regid) {
+        /* 0.01V */
+        case 0xED8D:
+        case 0xEDD5: {
+            CSVEDirect::setU16(ved, (quint16) (voltage() / 10));
+            return true;
+        }
+        /* 0.1A */
+        case 0xED8F:
+        case 0xEDD7: {
+            CSVEDirect::setU16(ved, (quint16) (current() / 100));
+            return true;
+        }
+        case 0x0201: {
+            CSVEDirect::setU8(ved, state());
+            return true;
+        }
+        case 0xEDDA: {
+            CSVEDirect::setU8(ved, error());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* last value of the primary charger in its wire type */
+inline bool CSVeVirtualCharger::answerStored(CSVeDirectAcDcCharger* charger, quint16 regid, CSVEDirect::ved_t* ved) const
+{
+    CSVEDirect::setCommand(ved, VED_RESP_GET);
+    CSVEDirect::setId(ved, regid);
+    CSVEDirect::setFlags(ved, 0);
+
+    const CSVeRegisterStore::TSlot* slot = charger->store().find(regid);
+    if (!slot) {
+        return false;
+    }
+
+    switch (slot->m_type) {
+        case CSVeRegisterStore::TypeU8: {
+            CSVEDirect::setU8(ved, (quint8) slot->m_raw);
+            return true;
+        }
+        case CSVeRegisterStore::TypeU16:
+        case CSVeRegisterStore::TypeS16: {
+            CSVEDirect::setU16(ved, (quint16) slot->m_raw);
+            return true;
+        }
+        case CSVeRegisterStore::TypeU32:
+        case CSVeRegisterStore::TypeS32: {
+            CSVEDirect::setU32(ved, (quint32) slot->m_raw);
+            return true;
+        }
+        case CSVeRegisterStore::TypeString: {
+            CSVEDirect::setString(ved, slot->m_bytes.constData(), slot->m_bytes.size());
+            return true;
+        }
+    }
+
+    /* VE.Text only or record, no wire form */
+    return false;
+}
+
+/* worst flags of all chargers to the Cerbo GX */
+inline void CSVeVirtualCharger::finishSet(int index, quint8 flags)
+{
+    const TPendingSet set = m_sets.takeAt(index);
+
+    CSVEDirect::ved_t ved = set.m_request;
+    CSVEDirect::setFlags(&ved, set.m_flags | flags);
+    ved.size = set.m_request.size;
+    sendResponse(&ved);
+}
+
+inline CSVeDirectAcDcCharger* CSVeVirtualCharger::primary() const
+{
+    return (m_members.isEmpty() ? nullptr : m_members.first().m_charger);
+}
@@ -0,0 +1,126 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSerialPort>
+#include <QTimer>
+#include <QVariant>
+#include <csvedirect.h>
+#include <csvedirectacdccharger.h>
+
+/**
+ * @brief One virtual charger made of several physical ones
+ *
+ * Presents the chargers of one battery bank as a single
+ * VE.Direct device on the Cerbo GX port: summed current, common
+ * (mean) voltage, worst-case charge state and error. VE.Text
+ * blocks are synthesized once per second, VE.HEX requests are
+ * answered from memory. A SET goes to all chargers, the Cerbo GX
+ * gets the worst flags of their responses.
+ *
+ * Aggregation is incremental: an update of one charger only
+ * replaces its old contribution in the sums and state / error
+ * histograms, the cost does not grow with the number of chargers.
+ */
+class CSVeVirtualCharger: public QObject
+{
+    Q_OBJECT
+
+public:
+    /* VE.Text block interval in milliseconds */
+    static const int TEXT_INTERVAL = 1000;
+    /* wait for the SET responses of the chargers, milliseconds */
+    static const int SET_TIMEOUT = 1000;
+
+    /**
+     * @brief CSVeVirtualCharger
+     * @param parent
+     */
+    explicit CSVeVirtualCharger(QObject* parent = nullptr);
+
+    /**
+     * @brief addCharger Add physical charger, the first one is
+     * the primary: product id, firmware and all not aggregated
+     * registers come from it.
+     * @param charger
+     */
+    void addCharger(CSVeDirectAcDcCharger* charger);
+    void removeCharger(QObject* charger);
+    int chargerCount() const;
+
+    /**
+     * @brief open Start serving the Cerbo GX port
+     * @param config
+     * @return false if port can't be opened
+     */
+    bool open(const CSVeDirectAcDcCharger::TVedConfig& config);
+    void close();
+    bool isOpen() const;
+
+    void setSerial(const QString& serial);
+
+    /* aggregated values */
+    qint64 current() const;
+    qint64 voltage() const;
+    quint8 state() const;
+    quint8 error() const;
+
+private slots:
+    void onDataChanged(CSVeDirectAcDcCharger* charger, uint regid, const QPair<float, QVariant>& value);
+    void onCerboFrame(const CSVeParser::TVeHexFrame& frame);
+    void onMemberFrame(CSVeDirectAcDcCharger* charger, const CSVeParser::TVeHexFrame& frame);
+    void sendTextBlock();
+
+private:
+    typedef struct {
+        CSVeDirectAcDcCharger* m_charger;
+        /* contribution in mA / mV, voltage only if valid */
+        qint64 m_current;
+        qint64 m_voltage;
+        bool m_hasVoltage;
+        quint8 m_state;
+        quint8 m_error;
+        QList<QMetaObject::Connection> m_connections;
+    } TMember;
+
+    /* SET forwarded to the chargers, answered when all responded */
+    typedef struct {
+        quint32 m_serial;
+        quint16 m_regid;
+        quint8 m_flags;
+        CSVEDirect::ved_t m_request;
+        QList<CSVeDirectAcDcCharger*> m_waiting;
+    } TPendingSet;
+
+    QSerialPort m_port;
+    CSVeParser m_parser;
+    QTimer m_timer;
+    QString m_serial;
+    QList<TMember> m_members;
+    /* incremental aggregates */
+    qint64 m_sumCurrent;
+    qint64 m_sumVoltage;
+    int m_voltages;
+    int m_states[256];
+    int m_errors[256];
+    /* in order of the requests */
+    QList<TPendingSet> m_sets;
+    quint32 m_setSerial;
+
+private:
+    inline int indexOf(QObject* charger) const;
+    inline void addMember(TMember& m, int sign);
+    inline QByteArray textField(const QByteArray& label, const QByteArray& value) const;
+    inline void sendResponse(CSVEDirect::ved_t* ved);
+    inline bool answerAggregate(quint16 regid, CSVEDirect::ved_t* ved) const;
+    inline bool answerStored(CSVeDirectAcDcCharger* charger, quint16 regid, CSVEDirect::ved_t* ved) const;
+    inline void finishSet(int index, quint8 flags);
+    inline CSVeDirectAcDcCharger* primary() const;
+};
@@ -1,11 +1,21 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    QCommandLineParser cmdline;
+    cmdline.addHelpOption();
+    cmdline.addOption({"capture", "Capture the raw serial bytes to a file.", "file"});
+    cmdline.addOption({"mux", "Share the charger port on TCP 2101 and the local socket vedirect."});
+    cmdline.process(a);
+
     MainWindow w;
+    w.setCaptureFile(cmdline.value("capture"));
+    w.setMuxEnabled(cmdline.isSet("mux"));
     w.show();
     return a.exec();
 }
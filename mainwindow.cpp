@@ -25,8 +25,18 @@ Q_DECLARE_METATYPE(QSerialPortInfo)
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , m_chr(this)
+    , m_devices(this)
+    , m_chr(m_devices.addDevice(QStringLiteral("charger")))
     , m_config()
+    , m_model()
+    , m_backup(m_chr, this)
+    , m_history(m_chr, this)
+    , m_keepalive(this)
+    , m_mux(m_chr, this)
+    , m_muxEnabled(false)
+    , m_recorder(this)
+    , m_compactor(this)
+    , m_capture(this)
 {
     ui->setupUi(this);
 
@@ -51,6 +61,20 @@ MainWindow::~MainWindow()
     delete ui;
 }
 
+void MainWindow::setCaptureFile(const QString& fileName)
+{
+    /* once per run, reopening would replace what was captured */
+    m_capture.close();
+    if (!fileName.isEmpty()) {
+        m_capture.open(fileName);
+    }
+}
+
+void MainWindow::setMuxEnabled(bool enabled)
+{
+    m_muxEnabled = enabled;
+}
+
 void MainWindow::onDataChanged(uint regid, const QPair<float, QVariant>& kv)
 {
     m_model.beginUpdate();
@@ -58,6 +82,13 @@ void MainWindow::onDataChanged(uint regid, const QPair<float, QVariant>& kv)
     m_model.endUpdate();
 }
 
+void MainWindow::onStaleChanged(uint regid, bool stale)
+{
+    m_model.beginUpdate();
+    m_model.setStale(regid, stale);
+    m_model.endUpdate();
+}
+
 void MainWindow::on_tableView_doubleClicked(const QModelIndex& index)
 {
     quint16 regid = m_model.toRegId(index);
@@ -72,46 +103,110 @@ void MainWindow::on_tableView_doubleClicked(const QModelIndex& index)
 
 void MainWindow::on_btnOpen_clicked()
 {
-    m_chr.setConfigIn(m_config);
-    m_chr.startVEDirect();
+    m_chr->setConfigIn(m_config);
+    /* raw bytes for replay, see tools/vereplay */
+    if (m_capture.isOpen()) {
+        m_chr->setCapture(&m_capture);
+    }
+    m_chr->startVEDirect();
+
+    /* share the charger with local tools */
+    if (m_muxEnabled) {
+        m_mux.listen();
+        m_mux.listenLocal();
+    }
+
+    /* register history for fault analysis */
+    m_recorder.attach(&m_devices);
+    m_recorder.open();
+    /* retention and compaction of the closed segments */
+    m_compactor.start(m_recorder.directory());
 }
 
 void MainWindow::on_btnClose_clicked()
 {
-    m_chr.stopVEDirect();
+    m_keepalive.removeCharger(m_chr);
+    m_mux.close();
+    m_chr->stopVEDirect();
+    m_compactor.stop();
+    m_recorder.close();
+    m_chr->setCapture(nullptr);
+    m_capture.flush();
 }
 
 void MainWindow::on_btnWriteReg_clicked()
 {
     if (ui->edValue->value() > 65535) {
-        m_chr.sendSetRegister(ui->edRegister->value(), (quint32) ui->edValue->value());
+        m_chr->sendSetRegister(ui->edRegister->value(), (quint32) ui->edValue->value());
     }
     else if (ui->edValue->value() > 255) {
-        m_chr.sendSetRegister(ui->edRegister->value(), (quint16) ui->edValue->value());
+        m_chr->sendSetRegister(ui->edRegister->value(), (quint16) ui->edValue->value());
     }
     else {
-        m_chr.sendSetRegister(ui->edRegister->value(), (quint8) ui->edValue->value());
+        m_chr->sendSetRegister(ui->edRegister->value(), (quint8) ui->edValue->value());
     }
 }
 
+void MainWindow::on_btnBackup_clicked()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Backup Settings"), QDir::homePath(), tr("Charger Settings (*.vebk)"));
+    if (fileName.isEmpty()) {
+        return;
+    }
+    if (!fileName.endsWith(".vebk")) {
+        fileName += ".vebk";
+    }
+    if (m_backup.backup(fileName)) {
+        ui->btnBackup->setEnabled(false);
+        ui->btnRestore->setEnabled(false);
+    }
+}
+
+void MainWindow::on_btnRestore_clicked()
+{
+    const QString fileName = QFileDialog::getOpenFileName(this, tr("Restore Settings"), QDir::homePath(), tr("Charger Settings (*.vebk)"));
+    if (fileName.isEmpty()) {
+        return;
+    }
+    if (!m_backup.restore(fileName)) {
+        QMessageBox::warning(this, tr("Restore Settings"), tr("Unable to restore settings of file %1").arg(fileName));
+        return;
+    }
+    ui->btnBackup->setEnabled(false);
+    ui->btnRestore->setEnabled(false);
+}
+
 inline void MainWindow::setupDefaults()
 {
-    m_config = m_chr.configIn();
+    m_config = m_chr->configIn();
 
     /* device queries */
-    m_chr.sendPing();
-    m_chr.sendGetRegister(0x0104);
-    m_chr.sendGetRegister(0xEDDE);
-    m_chr.sendGetRegister(0x0140);
-    m_chr.sendGetRegister(0x0143);
-    m_chr.sendGetRegister(0x200F);
-    m_chr.sendGetRegister(0x010C);
-    m_chr.sendGetRegister(0x1070);
-    m_chr.sendGetRegister(0x2001);
+    m_chr->sendPing();
+    m_chr->sendGetRegister(0x0104);
+    m_chr->sendGetRegister(0xEDDE);
+    m_chr->sendGetRegister(0x0140);
+    m_chr->sendGetRegister(0x0143);
+    m_chr->sendGetRegister(0x200F);
+    m_chr->sendGetRegister(0x010C);
+    m_chr->sendGetRegister(0x2001);
+
+    /* live values, polled only if the charger doesn't broadcast them */
+    m_chr->scheduler()->addPollRegister(0x0201, 5000);
+    m_chr->scheduler()->addPollRegister(0x0207, 10000);
+    m_chr->scheduler()->addPollRegister(0x200F, 10000);
+    m_chr->scheduler()->addPollRegister(0xED8D, 2000);
+    m_chr->scheduler()->addPollRegister(0xED8F, 2000);
+    m_chr->scheduler()->addPollRegister(0xEDD5, 2000);
+    m_chr->scheduler()->addPollRegister(0xEDD7, 2000);
+    m_chr->scheduler()->addPollRegister(0xEDDB, 10000);
+
+    /* charge cycle history, downloads changed records only */
+    m_chr->scheduler()->addPollRegister(0x1099, 60000);
+    m_history.sync();
 
     /* charge LiFePo battery */
-    m_chr.setBatteryCharger();
-    m_chr.sendSetRegister(0xEDF1, (quint8) 4);
+    m_chr->setBatteryCharger();
+    m_chr->sendSetRegister(0xEDF1, (quint8) 4);
 }
 
 inline void MainWindow::initializeUI()
@@ -256,5 +351,33 @@ inline void MainWindow::initializeUI()
         m_config.m_flow = ui->cbxFlowCtrl->itemData(index).value<QSerialPort::FlowControl>();
     });
 
-    connect(&m_chr, &CSVeDirectAcDcCharger::dataChanged, this, &MainWindow::onDataChanged);
+    connect(m_chr, &CSVeDirectAcDcCharger::dataChanged, this, &MainWindow::onDataChanged);
+    connect(m_chr, &CSVeDirectAcDcCharger::staleChanged, this, &MainWindow::onStaleChanged);
+
+    connect(&m_keepalive, &CSVeKeepalive::deadlineMissed, this, [this](CSVeDirectAcDcCharger*, quint16 regid, qint64 late) {
+        ui->statusbar->showMessage(tr("Link register 0x%1 not refreshed in time (%2 ms late), charger fell back") //
+                                      .arg(regid, 4, 16, QChar('0'))
+                                      .arg(late));
+    });
+
+    connect(&m_mux, &CSVeMuxServer::clientCountChanged, this, [this](int count) {
+        ui->statusbar->showMessage(tr("%1 VE.Direct client(s) connected").arg(count));
+    });
+
+    connect(&m_backup, &CSVeSettingsBackup::finished, this, [this](bool success) {
+        QStringList lines;
+        foreach (const CSVeSettingsBackup::TResult& r, m_backup.results()) {
+            lines << tr("0x%1: %2") //
+                        .arg(r.m_regid, 4, 16, QChar('0'))
+                        .arg(CSVeSettingsBackup::resultText(r.m_result));
+        }
+        ui->btnBackup->setEnabled(true);
+        ui->btnRestore->setEnabled(true);
+        if (success) {
+            QMessageBox::information(this, tr("Charger Settings"), lines.join("\n"));
+        }
+        else {
+            QMessageBox::warning(this, tr("Charger Settings"), lines.join("\n"));
+        }
+    });
 }
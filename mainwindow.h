@@ -6,8 +6,16 @@
 #include <QSerialPortInfo>
 #include <QTimer>
 #include <cschargerdatamodel.h>
+#include <csvecapture.h>
 #include <csvedirect.h>
+#include <csvecompactor.h>
+#include <csvedevicemanager.h>
 #include <csvedirectacdccharger.h>
+#include <csvehistorysync.h>
+#include <csvekeepalive.h>
+#include <csvemuxserver.h>
+#include <csverecorder.h>
+#include <csvesettingsbackup.h>
 
 QT_BEGIN_NAMESPACE
 
@@ -25,20 +33,44 @@ public:
     MainWindow(QWidget* parent = nullptr);
     ~MainWindow();
 
+    /**
+     * @brief setCaptureFile Capture the raw bytes of the ports to
+     * this file while open, empty = off. The file is created once,
+     * all open / close cycles of the ports go into it.
+     */
+    void setCaptureFile(const QString& fileName);
+    /**
+     * @brief setMuxEnabled Share the charger port with local tools
+     * on TCP 2101 and the local socket "vedirect" while open
+     */
+    void setMuxEnabled(bool enabled);
+
 private slots:
     void onDataChanged(uint regid, const QPair<float, QVariant>&);
+    void onStaleChanged(uint regid, bool stale);
     void on_btnOpen_clicked();
     void on_btnClose_clicked();
     void on_tableView_doubleClicked(const QModelIndex& index);
 
     void on_btnWriteReg_clicked();
+    void on_btnBackup_clicked();
+    void on_btnRestore_clicked();
 
 private:
     Ui::MainWindow* ui;
 
-    CSVeDirectAcDcCharger m_chr;
+    CSVeDeviceManager m_devices;
+    CSVeDirectAcDcCharger* m_chr;
     CSVeDirectAcDcCharger::TVedConfig m_config;
     CSChargerDataModel m_model;
+    CSVeSettingsBackup m_backup;
+    CSVeHistorySync m_history;
+    CSVeKeepalive m_keepalive;
+    CSVeMuxServer m_mux;
+    bool m_muxEnabled;
+    CSVeRecorder m_recorder;
+    CSVeCompactor m_compactor;
+    CSVeCapture m_capture;
     QList<CSVEDirect::ved_t> m_queue;
 
 private:
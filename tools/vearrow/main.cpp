@@ -0,0 +1,117 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <csvearrowexport.h>
+#include <csverecorder.h>
+#include <limits>
+
+/**
+ * Arrow IPC stream export of a recording or the cycle history.
+ *
+ * Writes the records of --dir (default the recording of the
+ * vedirect app) in the time range --from .. --to (ISO 8601, UTC if
+ * no offset is given), optionally of one --device and some
+ * --regid, or with --cycles the cached 0x1070 cycle records of the
+ * serial numbers given as arguments. Output goes to --output or
+ * stdout.
+ *
+ *   vearrow --from 2026-10-01 --regid 0xED8D,0xED8F -o week.arrows
+ *   vearrow --cycles HQ2204ABCDE HQ2204FGHIJ > cycles.arrows
+ *
+ *   python3 -c "import pyarrow.ipc as ipc; \
+ *       print(ipc.open_stream('week.arrows').read_all())"
+ */
+
+static bool parseTime(const QString& text, qint64* time)
+{
+    QDateTime dt = QDateTime::fromString(text, Qt::ISODateWithMs);
+    if (!dt.isValid()) {
+        return false;
+    }
+    if (dt.timeSpec() == Qt::LocalTime) {
+        dt.setTimeSpec(Qt::UTC);
+    }
+    *time = dt.toMSecsSinceEpoch();
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    /* the recording and history cache of the app */
+    QCoreApplication::setApplicationName("vedirect");
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct recording export as Arrow IPC stream");
+    cmdline.addHelpOption();
+    cmdline.addOption({"dir", "Recording directory.", "path", CSVeRecorder::defaultDirectory()});
+    cmdline.addOption({"from", "First time, ISO 8601.", "time"});
+    cmdline.addOption({"to", "End time, exclusive, ISO 8601.", "time"});
+    cmdline.addOption({"device", "Device id.", "id"});
+    cmdline.addOption({"regid", "Register ids, comma separated.", "list"});
+    cmdline.addOption({"rows", "Rows per record batch.", "n", QString::number(CSVeArrowExport::DEFAULT_BATCH_ROWS)});
+    cmdline.addOption({{"o", "output"}, "Output file, default stdout.", "file"});
+    cmdline.addOption({"cycles", "Export the cycle history of the serial numbers given."});
+    cmdline.addPositionalArgument("serial", "Device serial numbers, with --cycles.", "[serial...]");
+    cmdline.process(app);
+
+    CSVeArrowExport exporter;
+    exporter.setBatchRows(cmdline.value("rows").toInt());
+    exporter.setDevice(cmdline.value("device"));
+
+    qint64 from = std::numeric_limits<qint64>::min();
+    qint64 to = std::numeric_limits<qint64>::max();
+    if ((cmdline.isSet("from") && !parseTime(cmdline.value("from"), &from)) || //
+        (cmdline.isSet("to") && !parseTime(cmdline.value("to"), &to))) {
+        fprintf(stderr, "invalid time, expected ISO 8601\n");
+        return 1;
+    }
+    exporter.setRange(from, to);
+
+    QList<quint16> regids;
+    foreach (const QString& text, cmdline.value("regid").split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        const uint regid = text.trimmed().toUInt(&ok, 0);
+        if (!ok || regid > 0xFFFF) {
+            fprintf(stderr, "invalid register id %s\n", qPrintable(text));
+            return 1;
+        }
+        regids.append((quint16) regid);
+    }
+    exporter.setRegisters(regids);
+
+    QFile out(cmdline.value("output"));
+    const bool opened = (out.fileName().isEmpty() ? out.open(stdout, QIODevice::WriteOnly) : out.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    if (!opened) {
+        fprintf(stderr, "unable to write %s\n", qPrintable(out.fileName()));
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = (cmdline.isSet("cycles") ? exporter.exportCycles(cmdline.positionalArguments(), &out) : exporter.exportRecords(cmdline.value("dir"), &out));
+    out.close();
+    if (!ok) {
+        fprintf(stderr, "write error\n");
+        return 1;
+    }
+
+    const CSVeArrowExport::TStats& st = exporter.statistics();
+    fprintf(stderr,
+            "rows=%llu batches=%u bytes=%llu segments=%u skipped=%u in %.1fs\n",
+            (unsigned long long) st.m_rows,
+            st.m_batches,
+            (unsigned long long) st.m_bytes,
+            st.m_segments,
+            st.m_segmentsSkipped,
+            timer.elapsed() / 1000.0);
+    return 0;
+}
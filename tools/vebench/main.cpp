@@ -0,0 +1,252 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QList>
+#include <QLoggingCategory>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <csvedevicemanager.h>
+#include <csvefleetengine.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * Device manager benchmark.
+ *
+ * Opens N pseudo terminals, each one a simulated charger sending
+ * VE.Text blocks and answering every VE.HEX GET, and drives all
+ * of them through one CSVeDeviceManager on the main thread, or
+ * through a CSVeFleetEngine with --shards. At the end the CPU
+ * time per device / shard, the register update throughput and
+ * the process CPU are printed:
+ *
+ *   vebench --devices 64 --rate 1 --seconds 60
+ *   vebench --devices 500 --rate 10 --shards 4
+ *
+ * Each device needs two file descriptors, raise "ulimit -n" for
+ * large runs.
+ */
+
+typedef struct {
+    int m_master;
+    QSocketNotifier* m_notifier;
+    QByteArray m_rx;
+    quint32 m_tick;
+} TSimulator;
+
+static void writeMaster(int fd, const QByteArray& data)
+{
+    /* non blocking, a full pty drops the rest like a busy UART */
+    if (::write(fd, data.constData(), data.length()) < 0) {
+        return;
+    }
+}
+
+static QByteArray textBlock(int device, quint32 tick)
+{
+    QByteArray block;
+    block += "\r\nPID\t0xA339";
+    block += "\r\nFWE\t0141FF";
+    block += "\r\nSER#\tHQBENCH" + QByteArray::number(device).rightJustified(4, '0');
+    block += "\r\nV\t" + QByteArray::number(27600 + (int) (tick % 7) * 10);
+    block += "\r\nI\t" + QByteArray::number(12300 + (int) (tick % 5) * 100);
+    block += "\r\nT\t---";
+    block += "\r\nERR\t0";
+    block += "\r\nCS\t3";
+    block += "\r\nChecksum\t";
+
+    quint8 sum = 0;
+    for (int k = 0; k < block.length(); k++) {
+        sum += (quint8) block.at(k);
+    }
+    block.append((char) (quint8) (256 - sum));
+    return block;
+}
+
+/* answer ":7<id><flags>" with a 16 bit zero, unknown commands ignored */
+static void answer(TSimulator* sim)
+{
+    int eol;
+    while ((eol = sim->m_rx.indexOf('\n')) >= 0) {
+        const QByteArray line = sim->m_rx.left(eol).trimmed();
+        sim->m_rx.remove(0, eol + 1);
+
+        CSVEDirect::ved_t ved = {};
+        if (line.startsWith(":1")) {
+            CSVEDirect::setCommand(&ved, VED_RESP_PING);
+            ved.data[ved.size++] = 0x41;
+            ved.data[ved.size++] = 0x41;
+        }
+        else if (line.startsWith(":7") && line.length() >= 8) {
+            const quint16 lo = line.mid(2, 2).toUShort(nullptr, 16);
+            const quint16 hi = line.mid(4, 2).toUShort(nullptr, 16);
+            CSVEDirect::setCommand(&ved, VED_RESP_GET);
+            CSVEDirect::setId(&ved, (quint16) ((hi << 8) | lo));
+            CSVEDirect::setFlags(&ved, 0);
+            CSVEDirect::setU16(&ved, 0);
+        }
+        else {
+            continue;
+        }
+        if (CSVEDirect::enframe(&ved)) {
+            writeMaster(sim->m_master, QByteArray((const char*) ved.data, ved.size));
+        }
+    }
+}
+
+static double cpuSeconds()
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru)) {
+        return 0;
+    }
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + //
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("vebench");
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct device manager benchmark");
+    cmdline.addHelpOption();
+    cmdline.addOption({"devices", "Number of simulated chargers.", "n", "64"});
+    cmdline.addOption({"rate", "VE.Text blocks per second and charger.", "n", "1"});
+    cmdline.addOption({"seconds", "Run time.", "s", "30"});
+    cmdline.addOption({"shards", "Worker threads of the fleet engine, 0 = device manager on main thread.", "n", "0"});
+    cmdline.process(app);
+
+    const int devices = qMax(1, cmdline.value("devices").toInt());
+    const int rate = qMax(1, cmdline.value("rate").toInt());
+    const int seconds = qMax(1, cmdline.value("seconds").toInt());
+    const int shards = qMax(0, cmdline.value("shards").toInt());
+
+    /* the per frame debug output would be the benchmark */
+    QLoggingCategory::setFilterRules("*.debug=false\n*.warning=false");
+
+    CSVeDeviceManager* manager = nullptr;
+    CSVeFleetEngine* engine = nullptr;
+    QList<TSimulator*> simulators;
+    quint64 events = 0;
+
+    const CSVeFleetEngine::TSetup setup = [](CSVeDirectAcDcCharger* charger) {
+        charger->scheduler()->addPollRegister(0xEDD5, 2000);
+        charger->scheduler()->addPollRegister(0xEDD7, 2000);
+    };
+    if (shards > 0) {
+        engine = new CSVeFleetEngine(shards, &app);
+        engine->setSetup(setup);
+        QObject::connect(engine, &CSVeFleetEngine::dataChanged, &app, [&events]() {
+            events++;
+        });
+    }
+    else {
+        manager = new CSVeDeviceManager(&app);
+        QObject::connect(manager, &CSVeDeviceManager::dataChanged, &app, [&events]() {
+            events++;
+        });
+    }
+
+    for (int i = 0; i < devices; i++) {
+        const int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+            qCritical("Unable to open pseudo terminal %d, check the pty limit.", i);
+            return 1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        struct termios tio;
+        if (tcgetattr(fd, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+        }
+
+        TSimulator* sim = new TSimulator {fd, nullptr, QByteArray(), 0};
+        sim->m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, &app);
+        QObject::connect(sim->m_notifier, &QSocketNotifier::activated, &app, [sim]() {
+            char buffer[256];
+            const ssize_t n = ::read(sim->m_master, buffer, sizeof(buffer));
+            if (n > 0) {
+                sim->m_rx.append(buffer, (int) n);
+                answer(sim);
+            }
+        });
+        simulators << sim;
+
+        CSVeDirectAcDcCharger::TVedConfig config;
+        config.m_portName = QString::fromLatin1(ptsname(fd));
+        const QString id = QStringLiteral("bench-%1").arg(i, 3, 10, QChar('0'));
+        if (engine) {
+            engine->addDevice(id, config);
+        }
+        else {
+            setup(manager->addDevice(id, config));
+        }
+    }
+
+    const int running = (manager ? manager->startAll() : devices);
+    printf("devices=%d running=%d rate=%d/s seconds=%d shards=%d\n", devices, running, rate, seconds, shards);
+    fflush(stdout);
+
+    /* VE.Text of all simulators, spread over the period */
+    int next = 0;
+    QTimer text;
+    text.setTimerType(Qt::PreciseTimer);
+    text.setInterval(qMax(1, 1000 / (devices * rate)));
+    QObject::connect(&text, &QTimer::timeout, &app, [&]() {
+        const int burst = qMax(1, (devices * rate * text.interval()) / 1000);
+        for (int k = 0; k < burst; k++) {
+            TSimulator* sim = simulators[next];
+            writeMaster(sim->m_master, textBlock(next, sim->m_tick++));
+            next = (next + 1) % simulators.count();
+        }
+    });
+
+    QElapsedTimer wall;
+    const double cpuStart = cpuSeconds();
+    if (manager) {
+        manager->sample();
+    }
+    wall.start();
+    text.start();
+
+    QTimer::singleShot(seconds * 1000, &app, &QCoreApplication::quit);
+    app.exec();
+
+    const double elapsed = wall.elapsed() / 1000.0;
+    const double cpu = cpuSeconds() - cpuStart;
+
+    if (manager) {
+        manager->sample();
+    }
+    foreach (const QString& line, (manager ? manager->report() : engine->report())) {
+        printf("%s\n", qPrintable(line));
+    }
+    printf("updates=%llu updates/s=%.0f\n", (unsigned long long) events, events / elapsed);
+    printf("process cpu=%.3fs wall=%.3fs load=%.2f%% per-device=%.4f%% (incl. simulators)\n",
+           cpu,
+           elapsed,
+           100.0 * cpu / elapsed,
+           100.0 * cpu / elapsed / devices);
+
+    if (manager) {
+        manager->stopAll();
+    }
+    /* shard threads stop the devices */
+    delete engine;
+    foreach (TSimulator* sim, simulators) {
+        ::close(sim->m_master);
+        delete sim;
+    }
+    return 0;
+}
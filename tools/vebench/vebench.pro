@@ -0,0 +1,44 @@
+QT = core
+QT += serialport
+
+###
+TEMPLATE = app
+TARGET = vebench
+
+###
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+	../../csvecapture.cpp \
+	../../csvedevicemanager.cpp \
+	../../csvedirect.cpp \
+	../../csvedirectacdccharger.cpp \
+	../../csvediscovery.cpp \
+	../../csvefleetengine.cpp \
+	../../csveframerouter.cpp \
+	../../csvehistorysync.cpp \
+	../../csveproxycache.cpp \
+	../../csveregisterstore.cpp \
+	../../csvesamplering.cpp \
+	../../csvescheduler.cpp \
+	../../csvesnapshot.cpp \
+	main.cpp
+
+HEADERS += \
+	../../csvecapture.h \
+	../../csvedevicemanager.h \
+	../../csvedirect.h \
+	../../csvedirectacdccharger.h \
+	../../csvediscovery.h \
+	../../csvefleetengine.h \
+	../../csveframerouter.h \
+	../../csvehistorysync.h \
+	../../csveproxycache.h \
+	../../csveregisterstore.h \
+	../../csvesamplering.h \
+	../../csvescheduler.h \
+	../../csvesnapshot.h
@@ -0,0 +1,137 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThreadPool>
+#include <csvecapturedecoder.h>
+
+/**
+ * Offline decoder of raw serial captures.
+ *
+ * Decodes a file of the bytes a charger sent (a plain dump of the
+ * tty, "cat /dev/ttyUSB0 > dump.bin") in parallel chunks and prints
+ * the throughput. --sequential decodes with one parser byte by byte
+ * instead, --verify does both and compares every signal, --print
+ * writes the signals to stdout:
+ *
+ *   vedecode dump.bin
+ *   vedecode --verify --chunk 65536 dump.bin
+ *   vedecode --print dump.bin | grep ^hex
+ */
+
+static QByteArray toLine(const CSVeCaptureDecoder* decoder, const char* kind, const QByteArray& text, quint32 sequence)
+{
+    return QByteArray(kind) + ' ' + QByteArray::number(decoder->offset()) + ' ' + QByteArray::number(sequence) + ' ' + text;
+}
+
+static void connectDecoder(CSVeCaptureDecoder* decoder, QList<QByteArray>* lines)
+{
+    QObject::connect(decoder, &CSVeCaptureDecoder::vedHexFrame, [decoder, lines](const CSVeParser::TVeHexFrame& frame) {
+        QByteArray text = frame.source + ' ' + QByteArray::number(frame.command) + ' ' + QByteArray::number(frame.regid, 16) + ' ' + QByteArray::number(frame.flags);
+        text += ' ' + QByteArray((const char*) frame.ve_out.data, frame.ve_out.size).toHex();
+        lines->append(toLine(decoder, "hex", text, frame.stamp.m_sequence));
+    });
+    QObject::connect(decoder, &CSVeCaptureDecoder::vedTextField, [decoder, lines](const QString& field, const QByteArray& value) {
+        lines->append(toLine(decoder, "text", field.toLatin1() + '\t' + value, decoder->textStamp().m_sequence));
+    });
+    QObject::connect(decoder, &CSVeCaptureDecoder::errorOccured, [decoder, lines](const QByteArray& message) {
+        lines->append(toLine(decoder, "error", message, 0));
+    });
+}
+
+static bool run(CSVeCaptureDecoder* decoder, const QString& fileName, bool sequential)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = (sequential ? decoder->decodeSequential(fileName) : decoder->decode(fileName));
+    if (!ok) {
+        fprintf(stderr, "unable to map %s\n", qPrintable(fileName));
+        return false;
+    }
+
+    const CSVeCaptureDecoder::TStats& st = decoder->statistics();
+    const double seconds = qMax((qint64) 1, timer.nsecsElapsed()) / 1e9;
+    fprintf(stderr,
+            "%s: bytes=%llu chunks=%u resumed=%u frames=%llu fields=%llu errors=%llu in %.3fs, %.1f MB/s\n",
+            (sequential ? "sequential" : "parallel"),
+            (unsigned long long) st.m_bytes,
+            st.m_chunks,
+            st.m_resumed,
+            (unsigned long long) st.m_frames,
+            (unsigned long long) st.m_fields,
+            (unsigned long long) st.m_errors,
+            seconds,
+            st.m_bytes / seconds / 1e6);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct raw capture decoder");
+    cmdline.addHelpOption();
+    cmdline.addOption({"sequential", "Decode with one parser byte by byte."});
+    cmdline.addOption({"verify", "Decode both ways and compare the signals."});
+    cmdline.addOption({"print", "Print the decoded signals."});
+    cmdline.addOption({"chunk", "Chunk size in bytes.", "bytes", QString::number(CSVeCaptureDecoder::DEFAULT_CHUNK_SIZE)});
+    cmdline.addOption({"threads", "Pool threads, 0 = one per core.", "n", "0"});
+    cmdline.addPositionalArgument("capture", "Raw capture file.");
+    cmdline.process(app);
+
+    const QStringList files = cmdline.positionalArguments();
+    if (files.count() != 1) {
+        cmdline.showHelp(1);
+    }
+    if (cmdline.value("threads").toInt() > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(cmdline.value("threads").toInt());
+    }
+
+    const bool keep = cmdline.isSet("verify") || cmdline.isSet("print");
+    QList<QByteArray> lines;
+    CSVeCaptureDecoder decoder;
+    decoder.setChunkSize(cmdline.value("chunk").toInt());
+    if (keep) {
+        connectDecoder(&decoder, &lines);
+    }
+
+    if (!run(&decoder, files.first(), cmdline.isSet("sequential"))) {
+        return 1;
+    }
+
+    if (cmdline.isSet("verify")) {
+        QList<QByteArray> reference;
+        CSVeCaptureDecoder sequential;
+        connectDecoder(&sequential, &reference);
+        if (!run(&sequential, files.first(), !cmdline.isSet("sequential"))) {
+            return 1;
+        }
+        const int count = qMin(lines.count(), reference.count());
+        for (int i = 0; i < count; i++) {
+            if (lines[i] != reference[i]) {
+                fprintf(stderr, "mismatch at signal %d:\n  %s\n  %s\n", i, lines[i].constData(), reference[i].constData());
+                return 2;
+            }
+        }
+        if (lines.count() != reference.count()) {
+            fprintf(stderr, "mismatch: %d signals, expected %d\n", lines.count(), reference.count());
+            return 2;
+        }
+        fprintf(stderr, "verified %d signals\n", count);
+    }
+
+    if (cmdline.isSet("print")) {
+        foreach (const QByteArray& line, lines) {
+            fwrite(line.constData(), 1, line.size(), stdout);
+            fputc('\n', stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+QT = core
+QT += concurrent
+
+###
+TEMPLATE = app
+TARGET = vedecode
+
+###
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+	../../csvecapturedecoder.cpp \
+	../../csvedirect.cpp \
+	main.cpp
+
+HEADERS += \
+	../../csvecapturedecoder.h \
+	../../csvedirect.h
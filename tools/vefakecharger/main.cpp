@@ -0,0 +1,248 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <csvedirect.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * Fake VE.Direct charger on a pseudo terminal.
+ *
+ * Sends a VE.Text block every second and answers VE.HEX PING,
+ * GET and SET from a register map, optionally with an ASYNC
+ * broadcast of the output voltage. The slave side of the pty is
+ * printed (or linked) and used as charger port:
+ *
+ *   vefakecharger --link /tmp/ttyVE0
+ *   socat - TCP:localhost:2101
+ */
+
+static int s_master = -1;
+static QHash<quint16, QByteArray> s_registers;
+
+static void writeMaster(const QByteArray& data)
+{
+    qint64 done = 0;
+    while (done < data.length()) {
+        const ssize_t n = ::write(s_master, data.constData() + done, data.length() - done);
+        if (n < 0) {
+            return;
+        }
+        done += n;
+    }
+}
+
+static void sendFrame(CSVEDirect::ved_t* ved)
+{
+    if (CSVEDirect::enframe(ved)) {
+        writeMaster(QByteArray((const char*) ved->data, ved->size));
+    }
+}
+
+static void sendRegister(quint8 command, quint16 regid, quint8 flags, const QByteArray& value)
+{
+    CSVEDirect::ved_t ved = {};
+    CSVEDirect::setCommand(&ved, command);
+    CSVEDirect::setId(&ved, regid);
+    CSVEDirect::setFlags(&ved, flags);
+    for (int i = 0; i < value.length(); i++) {
+        CSVEDirect::addU8(&ved, (quint8) value.at(i));
+    }
+    sendFrame(&ved);
+}
+
+static QByteArray u16(quint16 value)
+{
+    QByteArray b;
+    b.append((char) (value & 0xff));
+    b.append((char) (value >> 8));
+    return b;
+}
+
+static void sendTextBlock(quint32 tick)
+{
+    /* some ripple, 27.60V +- 20mV, 12.3A +- 0.2A */
+    const int v = 27600 + (int) (tick % 5) * 10 - 20;
+    const int i = 12300 + (int) (tick % 3) * 100 - 100;
+
+    QByteArray block;
+    block += "\r\nPID\t0xA339";
+    block += "\r\nFWE\t0141FF";
+    block += "\r\nSER#\tHQ2200FAKE0";
+    block += "\r\nV\t" + QByteArray::number(v);
+    block += "\r\nI\t" + QByteArray::number(i);
+    block += "\r\nT\t---";
+    block += "\r\nERR\t0";
+    block += "\r\nCS\t" + QByteArray::number((quint8) s_registers.value(0x0201).at(0));
+    block += "\r\nChecksum\t";
+
+    quint8 sum = 0;
+    for (int k = 0; k < block.length(); k++) {
+        sum += (quint8) block.at(k);
+    }
+    block.append((char) (quint8) (256 - sum));
+
+    writeMaster(block);
+}
+
+static void onHexFrame(const CSVeParser::TVeHexFrame& frame)
+{
+    switch (frame.command) {
+        case VED_CMD_PING: {
+            CSVEDirect::ved_t ved = {};
+            CSVEDirect::setCommand(&ved, VED_RESP_PING);
+            /* firmware 1.41 */
+            ved.data[ved.size++] = 0x41;
+            ved.data[ved.size++] = 0x41;
+            sendFrame(&ved);
+            break;
+        }
+        case VED_CMD_GET: {
+            if (!s_registers.contains(frame.regid)) {
+                sendRegister(VED_RESP_GET, frame.regid, VED_FLAG_UNK_ID, QByteArray());
+                break;
+            }
+            sendRegister(VED_RESP_GET, frame.regid, 0, s_registers[frame.regid]);
+            break;
+        }
+        case VED_CMD_SET: {
+            if (!s_registers.contains(frame.regid)) {
+                sendRegister(VED_RESP_SET, frame.regid, VED_FLAG_UNK_ID, QByteArray());
+                break;
+            }
+            const QByteArray value((const char*) frame.ve_in.data + 4, qMax(0, frame.ve_in.size - 4));
+            if (value.length() != s_registers[frame.regid].length()) {
+                sendRegister(VED_RESP_SET, frame.regid, VED_FLAG_PARAM_ERROR, QByteArray());
+                break;
+            }
+            s_registers[frame.regid] = value;
+            sendRegister(VED_RESP_SET, frame.regid, 0, value);
+            break;
+        }
+        default: {
+            /* unknown command, :3<cmd> */
+            CSVEDirect::ved_t ved = {};
+            CSVEDirect::setCommand(&ved, VED_RESP_UNKNOWN);
+            ved.data[ved.size++] = frame.command;
+            ved.data[ved.size++] = 0;
+            sendFrame(&ved);
+            break;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("vefakecharger");
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("Fake VE.Direct charger on a pseudo terminal");
+    cmdline.addHelpOption();
+    cmdline.addOption({"link", "Symlink to the slave tty.", "path"});
+    cmdline.addOption({"interval", "VE.Text block interval in ms.", "ms", "1000"});
+    cmdline.addOption({"async", "ASYNC broadcast interval of 0xED8D in ms, 0 = off.", "ms", "0"});
+    cmdline.process(app);
+
+    /* pseudo terminal, raw like the VE.Direct UART */
+    s_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (s_master < 0 || grantpt(s_master) || unlockpt(s_master)) {
+        qCritical("Unable to open pseudo terminal.");
+        return 1;
+    }
+    /* nobody reading, drop instead of blocking */
+    fcntl(s_master, F_SETFL, fcntl(s_master, F_GETFL) | O_NONBLOCK);
+    struct termios tio;
+    if (tcgetattr(s_master, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(s_master, TCSANOW, &tio);
+    }
+
+    const QByteArray slave = ptsname(s_master);
+    const QString link = cmdline.value("link");
+    if (!link.isEmpty()) {
+        QFile::remove(link);
+        if (!QFile::link(slave, link)) {
+            qCritical("Unable to link %s", qPrintable(link));
+            return 1;
+        }
+    }
+    printf("%s\n", link.isEmpty() ? slave.constData() : qPrintable(link));
+    fflush(stdout);
+
+    /* device state bulk, 27.60V / 12.30A, absorption 28.40V */
+    s_registers[0x0100] = QByteArray::fromHex("39A30000");
+    s_registers[0x0201] = QByteArray::fromHex("03");
+    s_registers[0x0207] = QByteArray::fromHex("00000000");
+    s_registers[0x200F] = QByteArray::fromHex("00");
+    s_registers[0x2001] = QByteArray::fromHex("04");
+    s_registers[0xED8D] = u16(2760);
+    s_registers[0xED8F] = u16(123);
+    s_registers[0xEDD5] = u16(2760);
+    s_registers[0xEDD7] = u16(123);
+    s_registers[0xEDDA] = QByteArray::fromHex("00");
+    s_registers[0xEDF0] = u16(300);
+    s_registers[0xEDF1] = QByteArray::fromHex("04");
+    s_registers[0xEDF7] = u16(2840);
+    s_registers[0xEDE9] = u16(2760);
+
+    CSVeParser parser;
+    QObject::connect(&parser, &CSVeParser::vedHexFrame, &app, &onHexFrame);
+    QObject::connect(&parser, &CSVeParser::errorOccured, &app, [](const QByteArray& message) {
+        if (message.contains("VE.HEX")) {
+            /* framing error */
+            writeMaster(":4AAAAFD\n");
+        }
+    });
+
+    QSocketNotifier notifier(s_master, QSocketNotifier::Read);
+    QObject::connect(&notifier, &QSocketNotifier::activated, &app, [&parser, &notifier]() {
+        char buffer[256];
+        const ssize_t n = ::read(s_master, buffer, sizeof(buffer));
+        /* EIO while no slave is open, retry later */
+        if (n <= 0) {
+            notifier.setEnabled(false);
+            QTimer::singleShot(100, &notifier, [&notifier]() {
+                notifier.setEnabled(true);
+            });
+            return;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            parser.handle(buffer[i]);
+        }
+    });
+
+    quint32 tick = 0;
+    QTimer text;
+    QObject::connect(&text, &QTimer::timeout, &app, [&tick]() {
+        sendTextBlock(tick++);
+    });
+    text.start(cmdline.value("interval").toInt());
+
+    QTimer async;
+    QObject::connect(&async, &QTimer::timeout, &app, []() {
+        sendRegister(VED_CMD_ASYNC, 0xED8D, 0, s_registers[0xED8D]);
+    });
+    if (cmdline.value("async").toInt() > 0) {
+        async.start(cmdline.value("async").toInt());
+    }
+
+    const int result = app.exec();
+    if (!link.isEmpty()) {
+        QFile::remove(link);
+    }
+    ::close(s_master);
+    return result;
+}
@@ -0,0 +1,19 @@
+QT = core
+
+###
+TEMPLATE = app
+TARGET = vefakecharger
+
+###
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+	../../csvedirect.cpp \
+	main.cpp
+
+HEADERS += \
+	../../csvedirect.h
@@ -0,0 +1,250 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QVector>
+#include <algorithm>
+#include <csvedirect.h>
+#include <csverangequery.h>
+#include <csverecorder.h>
+#include <csverecordreader.h>
+
+/**
+ * Range query latency benchmark.
+ *
+ * Records --days of simulated data (default a year) of --devices
+ * chargers with --registers registers each, one sample every
+ * --interval seconds, with the recorder, unless --dir already holds
+ * a recording. Values are a slow random walk with rare spikes, so
+ * a "value above" predicate matches few blocks.
+ *
+ * Then the segment indexes are built (cold) and loaded (warm), and
+ * every query kind runs --queries times at random positions:
+ * latency p50/p95/max, samples returned, blocks read and blocks
+ * skipped by min/max. Fleet queries run sequentially and on the
+ * global thread pool (--threads).
+ *
+ *   vequerybench
+ *   vequerybench --days 30 --interval 1 --devices 4
+ *   vequerybench --dir /media/sdcard/year --keep
+ */
+
+/* VE.Text like mix: voltage, current, temperature, state ... */
+static const quint16 REGIDS[] = {0xED8D, 0xED8F, 0xEDEC, 0xEDDB, 0xEDD5, 0xEDDA};
+static const int MAX_REGISTERS = sizeof(REGIDS) / sizeof(REGIDS[0]);
+static const qint64 DAY = 24 * 60 * 60 * 1000LL;
+/* raw spike value, exponent -2 */
+static const qint64 SPIKE = 9000;
+
+typedef struct {
+    const char* m_name;
+    bool m_fleet;
+    qint64 m_span;
+    bool m_predicate;
+    bool m_parallel;
+} TKind;
+
+static bool generate(const QString& directory, int devices, int registers, int interval, int days, CSVeRecorder::TCodec codec, int window)
+{
+    CSVeRecorder recorder;
+    recorder.setCommitInterval(0);
+    recorder.setCodec(codec);
+    recorder.setBlockWindow(window);
+    if (!recorder.open(directory)) {
+        return false;
+    }
+
+    QList<quint16> indexes;
+    for (int d = 0; d < devices; d++) {
+        indexes << recorder.deviceIndex(QStringLiteral("HQ%1").arg(2200 + d, 6, 10, QChar('0')));
+    }
+
+    CSVeRegisterStore::TSlot slot = {};
+    slot.m_type = CSVeRegisterStore::TypeU16;
+    slot.m_exponent = -2;
+
+    QVector<qint64> walk(devices * registers, 1300);
+    quint32 seed = 0x2545F491u;
+    const qint64 step = interval * 1000LL;
+    const qint64 end = CSVeParser::monotonicTime();
+    const qint64 begin = end - days * DAY;
+    qint64 nextCommit = begin + DAY;
+
+    QElapsedTimer timer;
+    timer.start();
+    quint64 n = 0;
+    for (qint64 time = begin; time < end; time += step) {
+        slot.m_time = time;
+        for (int d = 0; d < devices; d++) {
+            for (int r = 0; r < registers; r++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                qint64& value = walk[d * registers + r];
+                value = qBound(1000LL, value + (seed % 8 ? 0 : (qint64) (seed >> 8) % 5 - 2), 2000LL);
+                slot.m_regid = REGIDS[r];
+                /* about one spike per series and day at 1 min */
+                slot.m_raw = ((seed >> 4) % 1440 == 0 ? SPIKE : value);
+                recorder.record(indexes.at(d), slot);
+                n++;
+            }
+        }
+        if (time >= nextCommit) {
+            recorder.commit();
+            nextCommit += DAY;
+        }
+    }
+    recorder.close();
+
+    const CSVeRecorder::TStats& st = recorder.statistics();
+    printf("generated records=%llu segments=%u bytes=%llu in %.1fs\n",
+           (unsigned long long) n,
+           st.m_segments,
+           (unsigned long long) st.m_bytes,
+           timer.elapsed() / 1000.0);
+    return true;
+}
+
+static double percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values.at(qMin(values.count() - 1, (int) (p * values.count())));
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("vequerybench");
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct recording range query benchmark");
+    cmdline.addHelpOption();
+    cmdline.addOption({"dir", "Recording directory, default a temporary one.", "path"});
+    cmdline.addOption({"keep", "Keep the recording."});
+    cmdline.addOption({"devices", "Simulated chargers.", "n", "8"});
+    cmdline.addOption({"registers", "Registers per charger, at most 6.", "n", "6"});
+    cmdline.addOption({"interval", "Sample interval in seconds.", "s", "60"});
+    cmdline.addOption({"days", "Recorded days.", "n", "365"});
+    cmdline.addOption({"codec", "Record codec, plain or gorilla.", "name", "gorilla"});
+    cmdline.addOption({"window", "Gorilla block window in ms.", "ms", "3600000"});
+    cmdline.addOption({"queries", "Runs per query kind.", "n", "20"});
+    cmdline.addOption({"threads", "Thread pool size of the parallel scans, 0 = cores.", "n", "0"});
+    cmdline.process(app);
+
+    QTemporaryDir temp;
+    const QString directory = (cmdline.isSet("dir") ? cmdline.value("dir") : temp.path());
+    temp.setAutoRemove(!cmdline.isSet("keep"));
+
+    const int devices = qMax(1, cmdline.value("devices").toInt());
+    const int registers = qBound(1, cmdline.value("registers").toInt(), MAX_REGISTERS);
+    const int runs = qMax(1, cmdline.value("queries").toInt());
+    if (cmdline.value("threads").toInt() > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(cmdline.value("threads").toInt());
+    }
+
+    if (CSVeRecordReader::segments(directory).isEmpty()) {
+        const CSVeRecorder::TCodec codec = (cmdline.value("codec") == "plain" ? CSVeRecorder::CodecPlain : CSVeRecorder::CodecGorilla);
+        if (!generate(directory,
+                      devices,
+                      registers,
+                      qMax(1, cmdline.value("interval").toInt()),
+                      qMax(1, cmdline.value("days").toInt()),
+                      codec,
+                      qMax(1000, cmdline.value("window").toInt()))) {
+            fprintf(stderr, "unable to record into %s\n", qPrintable(directory));
+            return 1;
+        }
+    }
+
+    /* cold: no index files yet */
+    foreach (const QString& name, QDir(directory).entryList({"*.vidx"}, QDir::Files)) {
+        QFile::remove(QDir(directory).filePath(name));
+    }
+    CSVeRangeQuery engine(directory);
+    QElapsedTimer timer;
+    timer.start();
+    if (!engine.open()) {
+        fprintf(stderr, "no segments in %s\n", qPrintable(directory));
+        return 1;
+    }
+    const double cold = timer.nsecsElapsed() / 1e6;
+    timer.restart();
+    engine.open();
+    const double warm = timer.nsecsElapsed() / 1e6;
+    printf("segments=%d index build=%.1fms load=%.1fms threads=%d\n",
+           engine.segmentCount(),
+           cold,
+           warm,
+           QThreadPool::globalInstance()->maxThreadCount());
+
+    const qint64 first = engine.first();
+    const qint64 last = engine.last() + 1;
+    const QString device = QStringLiteral("HQ%1").arg(2200, 6, 10, QChar('0'));
+
+    static const TKind KINDS[] = {
+       {"device 1h", false, 60 * 60 * 1000LL, false, false},
+       {"device 1d", false, DAY, false, false},
+       {"device 30d", false, 30 * DAY, false, false},
+       {"device 365d", false, 365 * DAY, false, false},
+       {"fleet 7d", true, 7 * DAY, false, false},
+       {"fleet 7d parallel", true, 7 * DAY, false, true},
+       {"fleet 365d spikes", true, 365 * DAY, true, false},
+       {"fleet 365d spikes parallel", true, 365 * DAY, true, true},
+    };
+
+    static const int KIND_COUNT = sizeof(KINDS) / sizeof(KINDS[0]);
+
+    quint32 seed = 0x9E3779B9u;
+    for (int k = 0; k < KIND_COUNT; k++) {
+        const TKind& kind = KINDS[k];
+        const qint64 span = qMin(kind.m_span, last - first);
+        QVector<double> latencies;
+        quint64 samples = 0;
+        quint64 blocks = 0;
+        quint64 pruned = 0;
+
+        for (int i = 0; i < runs; i++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            const qint64 from = first + (last - first > span ? (qint64) (seed % (quint64) (last - first - span)) : 0);
+
+            CSVeRangeQuery::TQuery query = CSVeRangeQuery::query((kind.m_fleet ? QString() : device), REGIDS[0], from, from + span);
+            if (kind.m_predicate) {
+                query.m_min = (SPIKE - 100) / 100.0;
+            }
+
+            CSVeRangeQuery::TStats stats;
+            timer.restart();
+            const QList<CSVeRangeQuery::TSeries> result = (kind.m_parallel ? engine.runParallel(query, &stats) : engine.run(query, &stats));
+            latencies.append(timer.nsecsElapsed() / 1e6);
+
+            samples += stats.m_samples;
+            blocks += stats.m_blocks;
+            pruned += stats.m_blocksPruned;
+            Q_UNUSED(result)
+        }
+
+        printf("%-28s p50=%8.3fms p95=%8.3fms max=%8.3fms samples=%llu blocks=%llu pruned=%llu\n",
+               kind.m_name,
+               percentile(latencies, 0.50),
+               percentile(latencies, 0.95),
+               *std::max_element(latencies.constBegin(), latencies.constEnd()),
+               (unsigned long long) (samples / runs),
+               (unsigned long long) (blocks / runs),
+               (unsigned long long) (pruned / runs));
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+QT = core
+QT += serialport
+QT += concurrent
+
+###
+TEMPLATE = app
+TARGET = vequerybench
+
+###
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+	../../csvecapture.cpp \
+	../../csvedevicemanager.cpp \
+	../../csvedirect.cpp \
+	../../csvedirectacdccharger.cpp \
+	../../csvediscovery.cpp \
+	../../csveframerouter.cpp \
+	../../csvehistorysync.cpp \
+	../../csveproxycache.cpp \
+	../../csverangequery.cpp \
+	../../csverecorder.cpp \
+	../../csverecordreader.cpp \
+	../../csveregisterstore.cpp \
+	../../csverollup.cpp \
+	../../csvesamplering.cpp \
+	../../csvescheduler.cpp \
+	../../csveseriescodec.cpp \
+	../../csveseriesindex.cpp \
+	../../csvesnapshot.cpp \
+	main.cpp
+
+HEADERS += \
+	../../csvecapture.h \
+	../../csvedevicemanager.h \
+	../../csvedirect.h \
+	../../csvedirectacdccharger.h \
+	../../csvediscovery.h \
+	../../csveframerouter.h \
+	../../csvehistorysync.h \
+	../../csveproxycache.h \
+	../../csverangequery.h \
+	../../csverecorder.h \
+	../../csverecordreader.h \
+	../../csveregisterstore.h \
+	../../csverollup.h \
+	../../csvesamplering.h \
+	../../csvescheduler.h \
+	../../csveseriescodec.h \
+	../../csveseriesindex.h \
+	../../csvesnapshot.h
@@ -0,0 +1,272 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+#include <csvedirect.h>
+#include <csverecorder.h>
+#include <csverecordreader.h>
+#include <time.h>
+
+/**
+ * Recorder ingest benchmark.
+ *
+ * Every thread feeds synthetic register changes of its own devices
+ * into its own recorder and segment directory, with a group commit
+ * every --commit ms, for --seconds. Printed per thread and in
+ * total: records per second, records per CPU second (the ingest
+ * rate of one core), sync latency and write amplification, both
+ * as bytes written to the segments and, on Linux, as bytes the
+ * process sent to the block layer (/proc/self/io), each per byte
+ * of record payload. At the end all segments are read back, the
+ * records and the rollup partials.
+ *
+ * With --codec gorilla the values are a random walk, the payload
+ * is still counted as plain records, so the amplification shows
+ * the compression ratio.
+ *
+ *   verecbench --threads 1 --seconds 10
+ *   verecbench --threads 4 --commit 100 --dir /media/sdcard/bench
+ *   verecbench --codec gorilla --window 10000
+ */
+
+typedef struct {
+    int m_index;
+    QString m_directory;
+    int m_devices;
+    int m_commit;
+    CSVeRecorder::TCodec m_codec;
+    int m_window;
+    qint64 m_rate;
+    qint64 m_duration;
+    CSVeRecorder::TStats m_stats;
+    double m_wall;
+    double m_cpu;
+} TWorker;
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)) {
+        return 0;
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* bytes the process caused to be sent to storage */
+static qint64 storageWriteBytes()
+{
+    QFile file("/proc/self/io");
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    foreach (const QByteArray& line, file.readAll().split('\n')) {
+        if (line.startsWith("write_bytes:")) {
+            return line.mid(12).trimmed().toLongLong();
+        }
+    }
+    return -1;
+}
+
+static void runWorker(TWorker* w)
+{
+    CSVeRecorder recorder;
+    recorder.setCommitInterval(0);
+    recorder.setCodec(w->m_codec);
+    recorder.setBlockWindow(w->m_window);
+    if (!recorder.open(w->m_directory)) {
+        return;
+    }
+
+    /* VE.Text like mix: voltage, current, temperature, state */
+    static const quint16 REGIDS[] = {0xED8D, 0xED8F, 0x2009, 0x0201, 0xEDD7, 0x200A};
+    static const int REGISTERS = sizeof(REGIDS) / sizeof(REGIDS[0]);
+
+    QList<quint16> devices;
+    for (int d = 0; d < w->m_devices; d++) {
+        devices << recorder.deviceIndex(QStringLiteral("bench-%1-%2").arg(w->m_index).arg(d));
+    }
+
+    CSVeRegisterStore::TSlot slot = {};
+    slot.m_type = CSVeRegisterStore::TypeU16;
+    slot.m_exponent = -2;
+
+    QElapsedTimer wall;
+    const double cpu = threadCpuSeconds();
+    wall.start();
+
+    QVector<qint64> walk(REGISTERS * w->m_devices, 1200);
+    quint32 seed = 0x9E3779B9u + w->m_index;
+
+    quint64 n = 0;
+    qint64 lastCommit = 0;
+    qint64 now = 0;
+    while ((now = wall.elapsed()) < w->m_duration) {
+        /* rate limited: catch up to the schedule, then yield */
+        const quint64 due = (w->m_rate > 0 ? (quint64) (now * w->m_rate / 1000) : n + 4096);
+        const qint64 time = CSVeParser::monotonicTime();
+        for (; n < due; n++) {
+            slot.m_regid = REGIDS[n % REGISTERS];
+            slot.m_time = time;
+            const int device = (int) ((n / REGISTERS) % devices.count());
+            if (w->m_codec == CSVeRecorder::CodecPlain) {
+                slot.m_raw = 1200 + (qint64) (n % 97);
+            }
+            else {
+                /* xorshift, mostly unchanged, small steps otherwise */
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                qint64& value = walk[device * REGISTERS + (int) (n % REGISTERS)];
+                value = qBound(0LL, value + (seed % 4 ? 0 : (qint64) (seed >> 8) % 9 - 4), 65535LL);
+                slot.m_raw = value;
+            }
+            recorder.record(devices[device], slot);
+        }
+        if (now - lastCommit >= w->m_commit) {
+            recorder.commit();
+            lastCommit = now;
+        }
+        if (w->m_rate > 0) {
+            QThread::usleep(200);
+        }
+    }
+    recorder.close();
+
+    w->m_wall = wall.elapsed() / 1000.0;
+    w->m_cpu = threadCpuSeconds() - cpu;
+    w->m_stats = recorder.statistics();
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("verecbench");
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct recorder ingest benchmark");
+    cmdline.addHelpOption();
+    cmdline.addOption({"threads", "Recorder threads, one recorder each.", "n", "1"});
+    cmdline.addOption({"devices", "Devices per thread.", "n", "16"});
+    cmdline.addOption({"rate", "Records per second and thread, 0 = as fast as possible.", "n", "0"});
+    cmdline.addOption({"commit", "Group commit interval in ms.", "ms", "1000"});
+    cmdline.addOption({"codec", "Record codec, plain or gorilla.", "name", "plain"});
+    cmdline.addOption({"window", "Gorilla block window in ms.", "ms", "60000"});
+    cmdline.addOption({"seconds", "Run time.", "s", "10"});
+    cmdline.addOption({"dir", "Segment directory, default a temporary one.", "path"});
+    cmdline.addOption({"keep", "Keep the segments."});
+    cmdline.process(app);
+
+    const int threads = qMax(1, cmdline.value("threads").toInt());
+    const CSVeRecorder::TCodec codec = (cmdline.value("codec") == "gorilla" ? CSVeRecorder::CodecGorilla : CSVeRecorder::CodecPlain);
+    QTemporaryDir temp;
+    const QString base = (cmdline.isSet("dir") ? cmdline.value("dir") : temp.path());
+    temp.setAutoRemove(!cmdline.isSet("keep"));
+
+    QList<TWorker*> workers;
+    QList<QThread*> pool;
+    for (int i = 0; i < threads; i++) {
+        TWorker* w = new TWorker {
+           i,
+           QDir(base).filePath(QStringLiteral("thread-%1").arg(i)),
+           qMax(1, cmdline.value("devices").toInt()),
+           qMax(1, cmdline.value("commit").toInt()),
+           codec,
+           qMax(1, cmdline.value("window").toInt()),
+           qMax(0LL, cmdline.value("rate").toLongLong()),
+           qMax(1, cmdline.value("seconds").toInt()) * 1000LL,
+           {},
+           0,
+           0,
+        };
+        workers << w;
+        pool << QThread::create(runWorker, w);
+    }
+
+    printf("threads=%d codec=%s dir=%s\n", threads, (codec == CSVeRecorder::CodecGorilla ? "gorilla" : "plain"), qPrintable(base));
+    fflush(stdout);
+
+    const qint64 ioStart = storageWriteBytes();
+    foreach (QThread* t, pool) {
+        t->start();
+    }
+    foreach (QThread* t, pool) {
+        t->wait();
+        delete t;
+    }
+    const qint64 ioEnd = storageWriteBytes();
+
+    double rate = 0;
+    quint64 records = 0;
+    quint64 rollups = 0;
+    quint64 payload = 0;
+    quint64 bytes = 0;
+    foreach (const TWorker* w, workers) {
+        const CSVeRecorder::TStats& st = w->m_stats;
+        printf("thread=%d records=%llu rec/s=%.0f rec/cpu-s=%.0f commits=%llu sync avg=%.3fms max=%.3fms\n",
+               w->m_index,
+               (unsigned long long) st.m_records,
+               st.m_records / qMax(0.001, w->m_wall),
+               st.m_records / qMax(0.001, w->m_cpu),
+               (unsigned long long) st.m_commits,
+               (st.m_commits ? st.m_syncNs / 1e6 / st.m_commits : 0),
+               st.m_maxSyncNs / 1e6);
+        rate += st.m_records / qMax(0.001, w->m_wall);
+        records += st.m_records;
+        rollups += st.m_rollups;
+        payload += st.m_payload;
+        bytes += st.m_bytes;
+    }
+
+    printf("total records=%llu rec/s=%.0f payload=%llu written=%llu file-amplification=%.3f\n",
+           (unsigned long long) records,
+           rate,
+           (unsigned long long) payload,
+           (unsigned long long) bytes,
+           (payload ? (double) bytes / payload : 0));
+    if (ioStart >= 0 && ioEnd >= 0 && payload) {
+        printf("storage write_bytes=%lld storage-amplification=%.3f\n", //
+               (long long) (ioEnd - ioStart),
+               (double) (ioEnd - ioStart) / payload);
+    }
+
+    /* read back through the mmap reader */
+    quint64 read = 0;
+    quint64 readRollups = 0;
+    bool intact = true;
+    foreach (const TWorker* w, workers) {
+        foreach (const QString& segment, CSVeRecordReader::segments(w->m_directory)) {
+            CSVeRecordReader reader;
+            if (!reader.open(segment)) {
+                intact = false;
+                continue;
+            }
+            CSVeRecordReader::TRecord r;
+            while (reader.next(&r)) {
+                read++;
+            }
+            intact = intact && !reader.isTorn();
+
+            reader.rewind();
+            CSVeRollup::TBucket b;
+            while (reader.nextRollup(&b)) {
+                readRollups++;
+            }
+        }
+    }
+    const bool ok = (read == records && readRollups == rollups && intact);
+    printf("verify read=%llu rollups=%llu %s\n", (unsigned long long) read, (unsigned long long) readRollups, (ok ? "ok" : "MISMATCH"));
+
+    qDeleteAll(workers);
+    return (ok ? 0 : 1);
+}
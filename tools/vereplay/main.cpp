@@ -0,0 +1,355 @@
+/*********************************************************************
+ * Copyright EoF Software Labs. All Rights Reserved.
+ * Copyright EoF Software Labs Authors.
+ * Written by B. Eschrich (bjoern.eschrich@gmail.com)
+ * SPDX-License-Identifier: MIT License
+ **********************************************************************/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <csvecapturereader.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * Replay of a raw serial capture (CSVeCapture, "vedirect --capture")
+ * through pseudo terminals.
+ *
+ * Opens one pty pair per port of the capture and writes the bytes
+ * the port delivered at the time they were read, scaled by --speed,
+ * or as fast as the ptys take them with --max. The app or a
+ * benchmark opens the slave names printed at start, or the links
+ * created in --link by the port names of the capture:
+ *
+ *   vereplay --link /tmp/ve --delay 3000 field.vcap
+ *   vedirect (ports /tmp/ve/ttysVECHR and /tmp/ve/ttysVECGX)
+ *
+ *   vereplay --speed 10 --loop 5 field.vcap
+ *   vereplay --max field.vcap
+ *
+ * Bytes written by the app are read and counted, not checked. At
+ * the end the replay rate and how late the chunks were written
+ * against their schedule are printed.
+ *
+ * --extract writes the bytes read from one port as a plain dump,
+ * the input of tools/vedecode:
+ *
+ *   vereplay --extract ttysVECHR -o charger.bin field.vcap
+ */
+
+typedef struct {
+    QString m_name;
+    int m_master;
+    /* held open, the master reads EIO without an open slave */
+    int m_slave;
+    QString m_slaveName;
+    QString m_link;
+    quint64 m_chunks;
+    quint64 m_bytes;
+    quint64 m_received;
+} TPty;
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void onSignal(int)
+{
+    s_stop = 1;
+}
+
+static bool openPty(TPty* pty)
+{
+    pty->m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty->m_master < 0 || grantpt(pty->m_master) || unlockpt(pty->m_master)) {
+        return false;
+    }
+    fcntl(pty->m_master, F_SETFL, fcntl(pty->m_master, F_GETFL) | O_NONBLOCK);
+
+    pty->m_slaveName = QString::fromLatin1(ptsname(pty->m_master));
+    pty->m_slave = ::open(ptsname(pty->m_master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (pty->m_slave < 0) {
+        return false;
+    }
+
+    /* no echo, no line editing, until the app sets its own mode */
+    struct termios tio;
+    if (tcgetattr(pty->m_slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(pty->m_slave, TCSANOW, &tio);
+    }
+    return true;
+}
+
+static void closePty(TPty* pty)
+{
+    if (!pty->m_link.isEmpty()) {
+        QFile::remove(pty->m_link);
+    }
+    if (pty->m_slave >= 0) {
+        ::close(pty->m_slave);
+    }
+    if (pty->m_master >= 0) {
+        ::close(pty->m_master);
+    }
+}
+
+/**
+ * Waits until the monotonic time deadline (ns of timer, -1 = only
+ * poll) or until one of the masters can take data (writable >= 0),
+ * and counts what the app wrote meanwhile.
+ */
+static bool waitPtys(QList<TPty>* ptys, const QElapsedTimer& timer, qint64 deadline, int writable)
+{
+    struct pollfd fds[CSVeCapture::MAX_PORTS];
+    char buffer[4096];
+
+    do {
+        for (int i = 0; i < ptys->count(); i++) {
+            /* member order of pollfd is not specified */
+            fds[i].fd = (*ptys)[i].m_master;
+            fds[i].events = (short) (POLLIN | (i == writable ? POLLOUT : 0));
+            fds[i].revents = 0;
+        }
+
+        const qint64 left = (deadline < 0 ? 0 : deadline - timer.nsecsElapsed());
+        if (deadline >= 0 && left <= 0 && writable < 0) {
+            return true;
+        }
+        /* ms rounded up, the deadline is not woken up early */
+        const int timeout = (writable >= 0 ? -1 : (int) qMin((qMax((qint64) 0, left) + 999999) / 1000000, (qint64) INT_MAX));
+        const int n = ::poll(fds, ptys->count(), timeout);
+        if (n < 0) {
+            if (errno == EINTR && !s_stop) {
+                continue;
+            }
+            return false;
+        }
+
+        for (int i = 0; i < ptys->count(); i++) {
+            if (fds[i].revents & POLLIN) {
+                const ssize_t size = ::read(fds[i].fd, buffer, sizeof(buffer));
+                if (size > 0) {
+                    (*ptys)[i].m_received += size;
+                }
+            }
+        }
+        if (writable >= 0 && (fds[writable].revents & POLLOUT)) {
+            return true;
+        }
+    } while (!s_stop && (writable >= 0 || deadline > timer.nsecsElapsed()));
+    return !s_stop;
+}
+
+static bool writePty(QList<TPty>* ptys, int index, const char* data, int size, const QElapsedTimer& timer)
+{
+    TPty& pty = (*ptys)[index];
+    while (size > 0) {
+        const ssize_t written = ::write(pty.m_master, data, size);
+        if (written > 0) {
+            data += written;
+            size -= written;
+            continue;
+        }
+        if (written < 0 && errno != EAGAIN && errno != EINTR) {
+            return false;
+        }
+        /* pty buffer full, the app reads too slow */
+        if (!waitPtys(ptys, timer, -1, index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int extract(CSVeCaptureReader* reader, const QString& port, const QString& fileName)
+{
+    QFile out(fileName);
+    const bool opened = (fileName.isEmpty() ? out.open(stdout, QIODevice::WriteOnly) : out.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    if (!opened) {
+        fprintf(stderr, "unable to write %s\n", qPrintable(fileName));
+        return 1;
+    }
+
+    quint64 bytes = 0;
+    CSVeCaptureReader::TChunk chunk;
+    while (reader->next(&chunk)) {
+        if (chunk.m_direction != CSVeCapture::DirRead || reader->ports()[chunk.m_port] != port) {
+            continue;
+        }
+        if (out.write(chunk.m_data, chunk.m_size) != chunk.m_size) {
+            fprintf(stderr, "write error\n");
+            return 1;
+        }
+        bytes += chunk.m_size;
+    }
+    if (!reader->ports().contains(port)) {
+        fprintf(stderr, "no port %s in the capture, ports: %s\n", qPrintable(port), qPrintable(reader->ports().join(", ")));
+        return 1;
+    }
+    fprintf(stderr, "%s: %llu bytes\n", qPrintable(port), (unsigned long long) bytes);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser cmdline;
+    cmdline.setApplicationDescription("VE.Direct raw capture replay through pseudo terminals");
+    cmdline.addHelpOption();
+    cmdline.addOption({"speed", "Time scale, 2 = twice as fast.", "factor", "1"});
+    cmdline.addOption({"max", "Replay as fast as the ptys take the data."});
+    cmdline.addOption({"loop", "Number of replays.", "n", "1"});
+    cmdline.addOption({"delay", "Wait before the replay, ms.", "ms", "0"});
+    cmdline.addOption({"linger", "Keep the ptys open after the replay, ms.", "ms", "1000"});
+    cmdline.addOption({"link", "Directory of links by port name to the pty slaves.", "dir"});
+    cmdline.addOption({"extract", "Write the bytes read from a port as plain dump.", "port"});
+    cmdline.addOption({{"o", "output"}, "Output file of --extract, default stdout.", "file"});
+    cmdline.addPositionalArgument("capture", "Capture file.");
+    cmdline.process(app);
+
+    if (cmdline.positionalArguments().count() != 1) {
+        cmdline.showHelp(1);
+    }
+
+    CSVeCaptureReader reader;
+    if (!reader.open(cmdline.positionalArguments().first())) {
+        fprintf(stderr, "unable to read capture %s\n", qPrintable(cmdline.positionalArguments().first()));
+        return 1;
+    }
+    if (cmdline.isSet("extract")) {
+        return extract(&reader, cmdline.value("extract"), cmdline.value("output"));
+    }
+
+    const double speed = cmdline.value("speed").toDouble();
+    const bool max = cmdline.isSet("max");
+    if (!max && !(speed > 0)) {
+        fprintf(stderr, "invalid speed %s\n", qPrintable(cmdline.value("speed")));
+        return 1;
+    }
+    const int loops = qMax(1, cmdline.value("loop").toInt());
+
+    /* all ports of the capture, declared on the way */
+    CSVeCaptureReader::TChunk chunk;
+    qint64 duration = 0;
+    quint64 chunks = 0;
+    while (reader.next(&chunk)) {
+        duration = chunk.m_time;
+        chunks += (chunk.m_direction == CSVeCapture::DirRead);
+    }
+    const QStringList ports = reader.ports();
+    if (ports.isEmpty()) {
+        fprintf(stderr, "no ports in the capture\n");
+        return 1;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    QList<TPty> ptys;
+    int rc = 0;
+    foreach (const QString& name, ports) {
+        ptys.append({name, -1, -1, QString(), QString(), 0, 0, 0});
+        if (!openPty(&ptys.last())) {
+            fprintf(stderr, "unable to open a pseudo terminal for %s\n", qPrintable(name));
+            rc = 1;
+            break;
+        }
+        if (cmdline.isSet("link")) {
+            const QDir dir(cmdline.value("link"));
+            dir.mkpath(".");
+            ptys.last().m_link = dir.filePath(QFileInfo(name).fileName());
+            QFile::remove(ptys.last().m_link);
+            if (!QFile::link(ptys.last().m_slaveName, ptys.last().m_link)) {
+                fprintf(stderr, "unable to link %s\n", qPrintable(ptys.last().m_link));
+                ptys.last().m_link.clear();
+            }
+        }
+        fprintf(stderr,
+                "%s -> %s%s%s\n",
+                qPrintable(name),
+                qPrintable(ptys.last().m_slaveName),
+                (ptys.last().m_link.isEmpty() ? "" : " "),
+                qPrintable(ptys.last().m_link));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 lagSum = 0;
+    qint64 lagMax = 0;
+    quint64 written = 0;
+    quint64 bytes = 0;
+    qint64 start = 0;
+    qint64 end = 0;
+
+    if (rc == 0 && waitPtys(&ptys, timer, cmdline.value("delay").toLongLong() * 1000000, -1)) {
+        fprintf(stderr, "replay of %llu chunks, %.1fs, %s\n", (unsigned long long) chunks, duration / 1e6, (max ? "max speed" : qPrintable(QString::number(speed) + "x")));
+
+        start = timer.nsecsElapsed();
+        for (int loop = 0; loop < loops && !s_stop && rc == 0; loop++) {
+            const qint64 base = timer.nsecsElapsed();
+            reader.rewind();
+            while (!s_stop && reader.next(&chunk)) {
+                if (chunk.m_direction != CSVeCapture::DirRead) {
+                    continue;
+                }
+                const qint64 due = base + (max ? 0 : (qint64) (chunk.m_time * 1000 / speed));
+                if (!max && !waitPtys(&ptys, timer, due, -1)) {
+                    break;
+                }
+
+                const qint64 lag = qMax((qint64) 0, timer.nsecsElapsed() - due);
+                if (!writePty(&ptys, chunk.m_port, chunk.m_data, chunk.m_size, timer)) {
+                    fprintf(stderr, "write error on %s\n", qPrintable(ptys[chunk.m_port].m_name));
+                    rc = 1;
+                    break;
+                }
+                if (!max) {
+                    lagSum += lag;
+                    lagMax = qMax(lagMax, lag);
+                }
+                ptys[chunk.m_port].m_chunks++;
+                ptys[chunk.m_port].m_bytes += chunk.m_size;
+                written++;
+                bytes += chunk.m_size;
+            }
+        }
+        end = timer.nsecsElapsed();
+
+        /* the app reads the tail meanwhile */
+        waitPtys(&ptys, timer, end + cmdline.value("linger").toLongLong() * 1000000, -1);
+    }
+
+    const double seconds = qMax((qint64) 1, end - start) / 1e9;
+    foreach (const TPty& pty, ptys) {
+        fprintf(stderr,
+                "%s: chunks=%llu bytes=%llu received=%llu\n",
+                qPrintable(pty.m_name),
+                (unsigned long long) pty.m_chunks,
+                (unsigned long long) pty.m_bytes,
+                (unsigned long long) pty.m_received);
+    }
+    fprintf(stderr,
+            "chunks=%llu bytes=%llu in %.3fs, %.2f MB/s, %.1fx, lag avg=%.0fus max=%.0fus\n",
+            (unsigned long long) written,
+            (unsigned long long) bytes,
+            seconds,
+            bytes / seconds / 1e6,
+            (duration * loops / 1e6) / seconds,
+            (written ? lagSum / 1000.0 / written : 0.0),
+            lagMax / 1000.0);
+
+    for (int i = 0; i < ptys.count(); i++) {
+        closePty(&ptys[i]);
+    }
+    return rc;
+}
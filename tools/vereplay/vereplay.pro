@@ -0,0 +1,23 @@
+QT = core
+
+###
+TEMPLATE = app
+TARGET = vereplay
+
+###
+CONFIG += c++17
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+	../../csvecapture.cpp \
+	../../csvecapturereader.cpp \
+	../../csvedirect.cpp \
+	main.cpp
+
+HEADERS += \
+	../../csvecapture.h \
+	../../csvecapturereader.h \
+	../../csvedirect.h
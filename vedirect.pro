@@ -33,13 +33,67 @@ SOURCES += \
 	cschargerdatamodel.cpp \
 	csvedirectacdccharger.cpp \
 	main.cpp \
+	csvearrowexport.cpp \
+	csvearrowwriter.cpp \
+	csvecapture.cpp \
+	csvecapturedecoder.cpp \
+	csvecapturereader.cpp \
+	csvecompactor.cpp \
+	csvedevicemanager.cpp \
 	csvedirect.cpp \
+	csvediscovery.cpp \
+	csvefleetengine.cpp \
+	csveframerouter.cpp \
+	csvehistorysync.cpp \
+	csvekeepalive.cpp \
+	csvemuxserver.cpp \
+	csvenetworkmaster.cpp \
+	csveproxycache.cpp \
+	csverangequery.cpp \
+	csverecorder.cpp \
+	csverecordreader.cpp \
+	csveregisterstore.cpp \
+	csverollup.cpp \
+	csvesamplering.cpp \
+	csvescheduler.cpp \
+	csveseriescodec.cpp \
+	csveseriesindex.cpp \
+	csvesettingsbackup.cpp \
+	csvesnapshot.cpp \
+	csvevirtualcharger.cpp \
 	mainwindow.cpp
 
 HEADERS += \
 	cschargerdatamodel.h \
+	csvearrowexport.h \
+	csvearrowwriter.h \
+	csvecapture.h \
+	csvecapturedecoder.h \
+	csvecapturereader.h \
+	csvecompactor.h \
+	csvedevicemanager.h \
 	csvedirect.h \
 	csvedirectacdccharger.h \
+	csvediscovery.h \
+	csvefleetengine.h \
+	csveframerouter.h \
+	csvehistorysync.h \
+	csvekeepalive.h \
+	csvemuxserver.h \
+	csvenetworkmaster.h \
+	csveproxycache.h \
+	csverangequery.h \
+	csverecorder.h \
+	csverecordreader.h \
+	csveregisterstore.h \
+	csverollup.h \
+	csvesamplering.h \
+	csvescheduler.h \
+	csveseriescodec.h \
+	csveseriesindex.h \
+	csvesettingsbackup.h \
+	csvesnapshot.h \
+	csvevirtualcharger.h \
 	mainwindow.h
 
 FORMS += \